@@ -0,0 +1,234 @@
+#include "acpi.h"
+#include "mm/vmm.h"
+#include "libc/string.h"
+#include "libc/stdio.h"
+
+// Root system description pointer (version 2 layout; version 1 stops at 'length')
+typedef struct {
+    char signature[8];     // "RSD PTR "
+    uint8_t checksum;
+    char oem[6];
+    uint8_t revision;      // 0 for ACPI 1.0, 2 for 2.0+
+    uint32_t rsdt;
+    uint32_t length;
+    uint64_t xsdt;
+    uint8_t ext_checksum;
+    uint8_t reserved[3];
+} __attribute__((packed)) acpi_rsdp_t;
+
+#define ACPI_RSDP_V1_SIZE 20
+
+// Common header of every system description table
+typedef struct {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem[6];
+    char oem_table[8];
+    uint32_t oem_revision;
+    uint32_t creator;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_sdt_t;
+
+typedef struct {
+    acpi_sdt_t header;
+    uint32_t lapic_base;
+    uint32_t flags;
+    uint8_t entries[];     // Variable-length records: type, length, body
+} __attribute__((packed)) acpi_madt_t;
+
+// MADT record types
+#define MADT_LAPIC          0
+#define MADT_IOAPIC         1
+#define MADT_LAPIC_OVERRIDE 5
+#define MADT_X2APIC         9
+
+#define MADT_CPU_ENABLED        0x1
+#define MADT_CPU_ONLINE_CAPABLE 0x2  // Disabled now, but may be started
+
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+    uint8_t acpi_id;
+    uint8_t apic_id;
+    uint32_t flags;
+} __attribute__((packed)) madt_lapic_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+    uint8_t id;
+    uint8_t reserved;
+    uint32_t address;
+    uint32_t gsi_base;
+} __attribute__((packed)) madt_ioapic_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+    uint16_t reserved;
+    uint64_t address;
+} __attribute__((packed)) madt_lapic_override_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+    uint16_t reserved;
+    uint32_t x2apic_id;
+    uint32_t flags;
+    uint32_t acpi_uid;
+} __attribute__((packed)) madt_x2apic_t;
+
+static acpi_madt_info_t madt_info;
+static int madt_found = 0;
+
+// Firmware tables live in reserved memory that the boot identity map may
+// not cover. Map them read-only where needed; the identity map above the
+// boot window is built from 2MB pages, so most of the time this is a no-op.
+static void* acpi_map(uint64_t phys, uint64_t length) {
+    uint64_t page = phys & ~(VMM_PAGE_SIZE - 1);
+    for (; page < phys + length; page += VMM_PAGE_SIZE) {
+        if (!vmm_translate(vmm_kernel_space(), page) &&
+            !vmm_map(page, page, VMM_NO_EXEC)) {
+            return NULL;
+        }
+    }
+    return (void*)(uintptr_t)phys;
+}
+
+static int checksum_ok(const void* data, uint32_t length) {
+    const uint8_t* bytes = data;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        sum += bytes[i];
+    }
+    return sum == 0;
+}
+
+// Map a whole table: the header first, to learn its length
+static acpi_sdt_t* map_table(uint64_t phys) {
+    acpi_sdt_t* table = acpi_map(phys, sizeof(acpi_sdt_t));
+    if (!table || !acpi_map(phys, table->length) || !checksum_ok(table, table->length)) {
+        return NULL;
+    }
+    return table;
+}
+
+// The RSDP sits on a 16-byte boundary in the first KB of the EBDA or in
+// the BIOS area between 0xE0000 and 0xFFFFF
+static acpi_rsdp_t* scan_rsdp(uint64_t start, uint64_t end) {
+    for (uint64_t addr = start; addr + ACPI_RSDP_V1_SIZE <= end; addr += 16) {
+        acpi_rsdp_t* rsdp = (acpi_rsdp_t*)(uintptr_t)addr;
+        if (memcmp(rsdp->signature, "RSD PTR ", 8) == 0 &&
+            checksum_ok(rsdp, ACPI_RSDP_V1_SIZE)) {
+            return rsdp;
+        }
+    }
+    return NULL;
+}
+
+static acpi_rsdp_t* find_rsdp(void) {
+    // The BIOS data area keeps the EBDA segment at 0x40E. The barrier stops
+    // GCC treating the low constant address as a null-pointer offset.
+    uintptr_t bda_ebda = 0x40E;
+    __asm__ ("" : "+r"(bda_ebda));
+    uint64_t ebda = (uint64_t)*(volatile uint16_t*)bda_ebda << 4;
+    acpi_rsdp_t* rsdp = ebda ? scan_rsdp(ebda, ebda + 1024) : NULL;
+    return rsdp ? rsdp : scan_rsdp(0xE0000, 0x100000);
+}
+
+// Look a table up by signature through the XSDT (64-bit entries) when the
+// firmware has one, else through the RSDT
+static acpi_sdt_t* find_table(acpi_rsdp_t* rsdp, const char* signature) {
+    int wide = rsdp->revision >= 2 && rsdp->xsdt;
+    acpi_sdt_t* root = map_table(wide ? rsdp->xsdt : rsdp->rsdt);
+    if (!root) {
+        printf("acpi: Bad %s\n", wide ? "XSDT" : "RSDT");
+        return NULL;
+    }
+
+    uint32_t entry_size = wide ? 8 : 4;
+    uint32_t count = (root->length - sizeof(acpi_sdt_t)) / entry_size;
+    uint8_t* entries = (uint8_t*)(root + 1);
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t phys = wide ? *(uint64_t*)(entries + i * 8) : *(uint32_t*)(entries + i * 4);
+        acpi_sdt_t* table = acpi_map(phys, sizeof(acpi_sdt_t));
+        if (table && memcmp(table->signature, signature, 4) == 0) {
+            return map_table(phys);
+        }
+    }
+    return NULL;
+}
+
+static void add_cpu(uint32_t apic_id, uint32_t flags) {
+    if (!(flags & (MADT_CPU_ENABLED | MADT_CPU_ONLINE_CAPABLE))) {
+        return;
+    }
+    if (madt_info.cpu_count < ACPI_MAX_CPUS) {
+        madt_info.apic_ids[madt_info.cpu_count++] = apic_id;
+    }
+}
+
+static void parse_madt(acpi_madt_t* madt) {
+    memset(&madt_info, 0, sizeof(madt_info));
+    madt_info.lapic_base = madt->lapic_base;
+
+    uint8_t* end = (uint8_t*)madt + madt->header.length;
+    for (uint8_t* entry = madt->entries; entry + 2 <= end && entry[1] >= 2; entry += entry[1]) {
+        switch (entry[0]) {
+        case MADT_LAPIC: {
+            madt_lapic_t* lapic = (madt_lapic_t*)entry;
+            add_cpu(lapic->apic_id, lapic->flags);
+            break;
+        }
+        case MADT_X2APIC: {
+            madt_x2apic_t* x2apic = (madt_x2apic_t*)entry;
+            add_cpu(x2apic->x2apic_id, x2apic->flags);
+            break;
+        }
+        case MADT_IOAPIC: {
+            madt_ioapic_t* ioapic = (madt_ioapic_t*)entry;
+            if (madt_info.ioapic_count++ == 0) {
+                madt_info.ioapic_base = ioapic->address;
+                madt_info.ioapic_gsi_base = ioapic->gsi_base;
+            }
+            break;
+        }
+        case MADT_LAPIC_OVERRIDE:
+            madt_info.lapic_base = ((madt_lapic_override_t*)entry)->address;
+            break;
+        }
+    }
+}
+
+// Find the MADT, starting from the RSDP the bootloader passed (a copy in
+// the multiboot information) or one found in the BIOS areas. Returns 1 when
+// the processor list is known.
+int acpi_init(uint64_t rsdp_addr) {
+    acpi_rsdp_t* rsdp = rsdp_addr ? (acpi_rsdp_t*)(uintptr_t)rsdp_addr : find_rsdp();
+    if (!rsdp || !checksum_ok(rsdp, ACPI_RSDP_V1_SIZE)) {
+        printf("acpi: No RSDP\n");
+        return 0;
+    }
+
+    acpi_madt_t* madt = (acpi_madt_t*)find_table(rsdp, "APIC");
+    if (!madt) {
+        printf("acpi: No MADT\n");
+        return 0;
+    }
+
+    parse_madt(madt);
+    madt_found = 1;
+    printf("ACPI: %u CPUs, local APIC at 0x%x, %u I/O APICs\n", madt_info.cpu_count,
+           (uint32_t)madt_info.lapic_base, madt_info.ioapic_count);
+    return 1;
+}
+
+int acpi_get_madt(acpi_madt_info_t* info) {
+    if (!madt_found || !info) {
+        return 0;
+    }
+    *info = madt_info;
+    return 1;
+}
@@ -0,0 +1,22 @@
+#ifndef _ACPI_H
+#define _ACPI_H
+
+#include <stdint.h>
+
+#define ACPI_MAX_CPUS 32
+
+// What the MADT ("APIC" table) says about the interrupt controllers
+typedef struct {
+    uint64_t lapic_base;                 // Physical address of the local APICs
+    uint32_t cpu_count;                  // Usable processors, boot CPU included
+    uint32_t apic_ids[ACPI_MAX_CPUS];    // Their local APIC IDs, in table order
+    uint32_t ioapic_count;
+    uint64_t ioapic_base;                // First I/O APIC
+    uint32_t ioapic_gsi_base;
+} acpi_madt_info_t;
+
+// Function declarations
+int acpi_init(uint64_t rsdp_addr);  // 0: search the BIOS areas for the RSDP
+int acpi_get_madt(acpi_madt_info_t* info);
+
+#endif // _ACPI_H
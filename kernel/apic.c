@@ -0,0 +1,122 @@
+#include "apic.h"
+#include "idt.h"
+#include "gdt.h"
+#include "timer.h"
+#include "process.h"
+#include "softirq.h"
+#include "cpu.h"
+#include "mm/vmm.h"
+#include "libc/stdio.h"
+
+// Local APIC registers (byte offsets into the 4KB register page)
+#define LAPIC_ID          0x020
+#define LAPIC_TPR         0x080
+#define LAPIC_EOI         0x0B0
+#define LAPIC_SVR         0x0F0
+#define LAPIC_ICR_LOW     0x300
+#define LAPIC_ICR_HIGH    0x310
+#define LAPIC_LVT_TIMER   0x320
+#define LAPIC_TIMER_INIT  0x380
+#define LAPIC_TIMER_COUNT 0x390
+#define LAPIC_TIMER_DIV   0x3E0
+
+#define LAPIC_SVR_ENABLE     0x100
+#define LAPIC_ICR_PENDING    0x1000
+#define LAPIC_LVT_MASKED     (1U << 16)
+#define LAPIC_LVT_PERIODIC   (1U << 17)
+#define LAPIC_TIMER_DIV_16   0x3
+
+#define LAPIC_CALIBRATE_US 10000
+
+extern void lapic_timer_stub(void);
+extern void apic_spurious_stub(void);
+
+static volatile uint32_t* lapic = NULL;
+static uint32_t timer_per_ms = 0;  // LAPIC timer counts per millisecond (divider 16)
+
+static inline uint32_t lapic_read(uint32_t reg) {
+    return lapic[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value) {
+    lapic[reg / 4] = value;
+    (void)lapic[LAPIC_ID / 4];  // Read back so the write has landed
+}
+
+// Map the register page uncached and enable the boot CPU's APIC. Every
+// CPU's APIC answers at the same address, so one mapping serves them all.
+int lapic_init(uint64_t base) {
+    if (!vmm_map(base, base, VMM_WRITE | VMM_NO_CACHE | VMM_NO_EXEC)) {
+        printf("lapic_init: Cannot map the local APIC at 0x%x\n", (uint32_t)base);
+        return 0;
+    }
+    lapic = (volatile uint32_t*)(uintptr_t)base;
+
+    idt_set_gate(APIC_VECTOR_TIMER, (uint64_t)lapic_timer_stub, GDT_KERNEL_CODE, 0x8E);
+    idt_set_gate(APIC_VECTOR_SPURIOUS, (uint64_t)apic_spurious_stub, GDT_KERNEL_CODE, 0x8E);
+    lapic_enable();
+    return 1;
+}
+
+// Software-enable this CPU's APIC and accept every priority
+void lapic_enable(void) {
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | APIC_VECTOR_SPURIOUS);
+}
+
+uint32_t lapic_id(void) {
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+void lapic_eoi(void) {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+// Send an interrupt command to one CPU and wait until it is delivered
+void lapic_send_ipi(uint32_t apic_id, uint32_t command) {
+    lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, command);
+    while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING) {
+        cpu_pause();
+    }
+}
+
+// Count how fast the APIC timer runs against the PIT. Done once on the
+// boot CPU; the APs share the same bus clock.
+void lapic_timer_calibrate(void) {
+    lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+    timer_udelay(LAPIC_CALIBRATE_US);
+    uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_COUNT);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+
+    timer_per_ms = elapsed / (LAPIC_CALIBRATE_US / 1000);
+    printf("Local APIC timer: %u counts per ms\n", timer_per_ms);
+}
+
+// Periodic tick on this CPU at 'hz' interrupts a second
+void lapic_timer_start(uint32_t hz) {
+    uint32_t count = hz ? timer_per_ms * 1000 / hz : 0;
+    if (count == 0) {
+        printf("lapic_timer_start: Timer not calibrated\n");
+        return;
+    }
+    lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_PERIODIC | APIC_VECTOR_TIMER);
+    lapic_write(LAPIC_TIMER_INIT, count);
+}
+
+// Stop this CPU's tick; lapic_timer_start resumes it
+void lapic_timer_stop(void) {
+    lapic_write(LAPIC_TIMER_INIT, 0);
+}
+
+// APIC timer interrupt: the APs' equivalent of IRQ0. Acknowledged first,
+// for the same reason as irq0_handler.
+void lapic_timer_handler(void) {
+    uint64_t start = rdtsc();
+    lapic_eoi();
+    irq_exit(start);
+    process_tick(start);
+}
@@ -0,0 +1,29 @@
+#ifndef _APIC_H
+#define _APIC_H
+
+#include <stdint.h>
+
+// Vectors raised by the local APICs (the PIC's IRQs use 32..47)
+#define APIC_VECTOR_TIMER    0xF0  // Per-CPU scheduler tick on the APs
+#define APIC_VECTOR_TLB      0xF1  // TLB shootdown (see smp.c)
+#define APIC_VECTOR_RESCHED  0xF2  // Wakes a halted CPU that has work queued
+#define APIC_VECTOR_SPURIOUS 0xFF
+
+// Interrupt command register: delivery modes and flags
+#define APIC_ICR_FIXED   0x00000
+#define APIC_ICR_INIT    0x00500
+#define APIC_ICR_STARTUP 0x00600
+#define APIC_ICR_ASSERT  0x04000
+
+// Function declarations
+int lapic_init(uint64_t base);
+void lapic_enable(void);
+uint32_t lapic_id(void);
+void lapic_eoi(void);
+void lapic_send_ipi(uint32_t apic_id, uint32_t command);
+void lapic_timer_calibrate(void);
+void lapic_timer_start(uint32_t hz);
+void lapic_timer_stop(void);
+void lapic_timer_handler(void);
+
+#endif // _APIC_H
@@ -26,6 +26,9 @@ multiboot_start:
     dd 6    ; memory map
     dd 8    ; framebuffer info
 
+    ; Tags must start on an 8-byte boundary
+    align 8
+
     ; End tag
     dw 0    ; type
     dw 0    ; flags  
@@ -48,9 +51,9 @@ _start:
     mov esp, stack_top
     mov ebp, esp
 
-    ; Save multiboot info
-    push ebx  ; Multiboot info structure
-    push eax  ; Magic number
+    ; Save multiboot info (the stack is reset before entering long mode)
+    mov [multiboot_magic], eax
+    mov [multiboot_info], ebx
 
     ; Check if we have long mode support
     call check_multiboot
@@ -183,8 +186,8 @@ long_mode_start:
     mov rsp, stack_top
 
     ; Call kernel main
-    pop rdi  ; Magic number
-    pop rsi  ; Multiboot info
+    mov edi, [multiboot_magic]  ; Magic number
+    mov esi, [multiboot_info]   ; Multiboot info
     call kernel_main
 
     ; Halt
@@ -215,7 +218,14 @@ p3_table:
 p2_table:
     resb 4096
 
+; Multiboot handoff values
+multiboot_magic:
+    resd 1
+multiboot_info:
+    resd 1
+
 ; Stack
+align 16
 stack_bottom:
     resb 64 * 1024 ; 64 KB
 stack_top:
@@ -229,11 +239,22 @@ idt_load:
     lidt [rdi]
     ret
 
+; Interrupts from ring 3 arrive with the user's GS base: swap in the
+; per-CPU one (kernel/smp.h) on the way in and back on the way out. The
+; argument is where the saved CS sits above RSP.
+%macro SWAPGS_IF_USER 1
+    test byte [rsp + %1], 3
+    jz %%kernel
+    swapgs
+%%kernel:
+%endmacro
+
 ; IRQ stubs macro
 %macro IRQ 1
 global irq%1_stub
 extern irq%1_handler
 irq%1_stub:
+    SWAPGS_IF_USER 8
     push rbp
     mov rbp, rsp
     push rax
@@ -269,6 +290,7 @@ irq%1_stub:
     pop rcx
     pop rax
     pop rbp
+    SWAPGS_IF_USER 8
     iretq
 %endmacro
 
@@ -279,4 +301,117 @@ irq%1_stub:
 %assign i i+1
 %endrep
 
+; Local APIC vectors (kernel/apic.c, kernel/smp.c): same frame as the
+; IRQ stubs, calling <name>_handler
+%macro APIC_ISR 1
+global %1_stub
+extern %1_handler
+%1_stub:
+    SWAPGS_IF_USER 8
+    push rbp
+    mov rbp, rsp
+    push rax
+    push rcx
+    push rdx
+    push rbx
+    push rsi
+    push rdi
+    push r8
+    push r9
+    push r10
+    push r11
+    push r12
+    push r13
+    push r14
+    push r15
+
+    call %1_handler
+
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rdi
+    pop rsi
+    pop rbx
+    pop rdx
+    pop rcx
+    pop rax
+    pop rbp
+    SWAPGS_IF_USER 8
+    iretq
+%endmacro
+
+APIC_ISR lapic_timer
+APIC_ISR smp_tlb
+APIC_ISR smp_resched
+
+; Spurious APIC interrupts need no EOI
+global apic_spurious_stub
+apic_spurious_stub:
+    iretq
+
+; Page fault (#PF, vector 14). The CPU pushes an error code; the handler
+; gets it and the faulting RIP, and returns once the page is mapped.
+global page_fault_stub
+extern page_fault_handler
+page_fault_stub:
+    SWAPGS_IF_USER 16
+    push rbp
+    mov rbp, rsp
+    push rax
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push r8
+    push r9
+    push r10
+    push r11
+
+    mov rdi, [rbp + 8]     ; error code
+    mov rsi, [rbp + 16]    ; faulting RIP
+    call page_fault_handler
+
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rax
+    pop rbp
+    add rsp, 8             ; drop the error code
+    SWAPGS_IF_USER 8
+    iretq
+
+; Other CPU exceptions (kernel/idt.c): <vector>, <1 if the CPU pushes an
+; error code>. exception_handler gets the vector, error code, RIP and CS,
+; and never returns: it ends the user process or stops the kernel.
+extern exception_handler
+%macro EXCEPTION 2
+global exception%1_stub
+exception%1_stub:
+%if %2 == 0
+    push 0                 ; same frame as with an error code
+%endif
+    SWAPGS_IF_USER 16
+    mov rdi, %1
+    mov rsi, [rsp]
+    mov rdx, [rsp + 8]
+    mov rcx, [rsp + 16]
+    call exception_handler
+%endmacro
+
+EXCEPTION 0, 0             ; #DE divide error
+EXCEPTION 6, 0             ; #UD invalid opcode
+EXCEPTION 12, 1            ; #SS stack fault
+EXCEPTION 13, 1            ; #GP general protection
+
 section .note.GNU-stack noalloc noexec nowrite progbits
@@ -0,0 +1,96 @@
+; ============================================================================
+; trampoline.s - Application processor start-up code
+; ============================================================================
+;
+; kernel/smp.c copies everything between smp_trampoline_start and
+; smp_trampoline_end to SMP_TRAMPOLINE_ADDR and points each AP's startup
+; IPI at it. The AP arrives in real mode at that address and climbs through
+; protected mode into long mode on the boot CPU's page tables, then calls
+; the C entry point with its per-CPU structure. The parameter block at the
+; end is filled in by smp.c before every start.
+
+TRAMPOLINE_ADDR equ 0x8000     ; SMP_TRAMPOLINE_ADDR in kernel/smp.h
+
+; Address of a trampoline label once copied into place
+%define T(label) (TRAMPOLINE_ADDR + (label) - smp_trampoline_start)
+
+section .rodata
+global smp_trampoline_start
+global smp_trampoline_end
+global smp_trampoline_params
+
+bits 16
+smp_trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+
+    ; Protected mode with the flat segments below
+    lgdt [T(tramp_gdt_ptr)]
+    mov eax, cr0
+    or eax, 1                  ; PE
+    mov cr0, eax
+    jmp dword 0x08:T(tramp_protected)
+
+bits 32
+tramp_protected:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+
+    ; PAE, then the boot CPU's page tables
+    mov eax, cr4
+    or eax, 1 << 5
+    mov cr4, eax
+    mov eax, [T(tramp_cr3)]
+    mov cr3, eax
+
+    ; Same EFER as the boot CPU: long mode, plus NX when it is in use
+    mov ecx, 0xC0000080
+    mov eax, [T(tramp_efer)]
+    mov edx, [T(tramp_efer) + 4]
+    wrmsr
+
+    ; Paging on activates long mode
+    mov eax, cr0
+    or eax, 1 << 31
+    mov cr0, eax
+    jmp 0x18:T(tramp_long)
+
+bits 64
+tramp_long:
+    mov rsp, [T(tramp_stack)]
+    mov rdi, [T(tramp_cpu)]
+    mov rax, [T(tramp_entry)]
+    call rax
+
+    ; The entry point never returns
+    cli
+.hang:
+    hlt
+    jmp .hang
+
+; Null, 32-bit code, 32-bit data, 64-bit code
+align 8
+tramp_gdt:
+    dq 0
+    dq 0x00CF9A000000FFFF
+    dq 0x00CF92000000FFFF
+    dq 0x00AF9A000000FFFF
+tramp_gdt_ptr:
+    dw tramp_gdt_ptr - tramp_gdt - 1
+    dd T(tramp_gdt)
+
+; Parameter block (trampoline_params_t in kernel/smp.c)
+align 8
+smp_trampoline_params:
+tramp_cr3:   dq 0
+tramp_efer:  dq 0
+tramp_stack: dq 0
+tramp_entry: dq 0
+tramp_cpu:   dq 0
+smp_trampoline_end:
+
+section .note.GNU-stack noalloc noexec nowrite progbits
@@ -0,0 +1,358 @@
+; ============================================================================
+; user.s - Ring 3 entry and exit, and the user programs
+; ============================================================================
+;
+; syscall_entry is where SYSCALL lands (MSR_LSTAR, kernel/user.c) and
+; user_enter is how a user process first drops to ring 3. The programs at
+; the end run in ring 3: process_create_user copies one into a fresh
+; address space, so they must be position-independent and keep their data
+; on the stack.
+
+; Per-CPU fields reached through GS (CPU_KERNEL_RSP, CPU_USER_RSP in kernel/smp.h)
+CPU_KERNEL_RSP equ 8
+CPU_USER_RSP   equ 16
+
+; Selectors with RPL 3 (GDT_USER_DATA, GDT_USER_CODE in kernel/gdt.h)
+USER_DATA_SEL  equ 0x20 | 3
+USER_CODE_SEL  equ 0x28 | 3
+
+; System call numbers (kernel/user.h)
+SYS_EXIT       equ 0
+SYS_GETPID     equ 2
+SYS_SEND       equ 5
+SYS_RECEIVE    equ 6
+SYS_CLOCK      equ 7
+SYS_RING_SETUP equ 8
+SYS_RING_ENTER equ 9
+
+; Kernel data page (VDSO_USER_BASE and the vdso_data_t layout in kernel/vdso.h)
+VDSO_USER_BASE   equ 0x8000100000
+VDSO_SEQ         equ 0
+VDSO_BASE_TSC    equ 8
+VDSO_BASE_NS     equ 16
+VDSO_MULT        equ 24
+VDSO_CLOCK_SHIFT equ 32
+
+; Submission/completion rings (uring_shared_t and uring_sqe_t in kernel/uring.h)
+URING_ENTRIES    equ 64
+URING_SQ_TAIL    equ 4
+URING_CQ_HEAD    equ 8
+URING_CQ_TAIL    equ 12
+URING_SQ         equ 32
+URING_SQE_SHIFT  equ 5     ; 32-byte requests
+SQE_OPCODE       equ 0     ; Byte, then flags and reserved: written as one dword
+SQE_FD           equ 4
+SQE_ADDR         equ 8
+SQE_LEN          equ 16
+SQE_ARG          equ 20
+SQE_USER_DATA    equ 24
+URING_OP_SEND    equ 4
+URING_OP_RECEIVE equ 5
+
+section .text
+
+; SYSCALL: RCX holds the user RIP, R11 the user RFLAGS, and interrupts are
+; off. Switch to the process's kernel stack, save a syscall_frame_t and
+; call syscall_dispatch with interrupts on. The frame is on the process's
+; own stack, so it may block or be preempted in between. Returns with
+; SYSRET to the RIP the CPU saved, which is always canonical.
+global syscall_entry
+extern syscall_dispatch
+syscall_entry:
+    swapgs
+    mov [gs:CPU_USER_RSP], rsp
+    mov rsp, [gs:CPU_KERNEL_RSP]
+    push qword [gs:CPU_USER_RSP]
+    push r11
+    push rcx
+    push rax
+    push r9
+    push r8
+    push r10
+    push rdx
+    push rsi
+    push rdi
+
+    mov rdi, rsp
+    sti
+    call syscall_dispatch
+    cli
+
+    pop rdi
+    pop rsi
+    pop rdx
+    pop r10
+    pop r8
+    pop r9
+    add rsp, 8             ; the number; RAX holds the result
+    pop rcx
+    pop r11
+    pop rsp
+    swapgs
+    o64 sysret
+
+; user_enter(rip, rsp): start the running process in ring 3 (interrupts
+; off, never returns). No kernel value is left in a register.
+global user_enter
+user_enter:
+    push USER_DATA_SEL     ; SS
+    push rsi               ; RSP
+    push 0x202             ; RFLAGS: IF
+    push USER_CODE_SEL     ; CS
+    push rdi               ; RIP
+    xor eax, eax
+    xor ebx, ebx
+    xor ecx, ecx
+    xor edx, edx
+    xor esi, esi
+    xor edi, edi
+    xor ebp, ebp
+    xor r8d, r8d
+    xor r9d, r9d
+    xor r10d, r10d
+    xor r11d, r11d
+    xor r12d, r12d
+    xor r13d, r13d
+    xor r14d, r14d
+    xor r15d, r15d
+    swapgs
+    iretq
+
+section .rodata
+
+; Null system call benchmark. Waits for a message whose data starts with
+; an iteration count, makes that many SYS_GETPID calls, then replies to the
+; sender with the TSC cycles they took and exits.
+global user_syscall_bench_start
+global user_syscall_bench_end
+user_syscall_bench_start:
+    sub rsp, 64            ; message_t
+    mov rdi, rsp
+    mov eax, SYS_RECEIVE
+    syscall
+    mov r12d, [rsp]        ; sender
+    mov rbx, [rsp + 8]     ; iterations
+    test rbx, rbx
+    jz .exit
+
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    mov r13, rax
+.loop:
+    mov eax, SYS_GETPID
+    syscall
+    dec rbx
+    jnz .loop
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    sub rax, r13
+
+    mov [rsp + 8], rax
+    mov edi, r12d          ; pid
+    xor esi, esi           ; type
+    lea rdx, [rsp + 8]     ; data
+    mov r10d, 8            ; size
+    mov eax, SYS_SEND
+    syscall
+.exit:
+    xor edi, edi
+    mov eax, SYS_EXIT
+    syscall
+user_syscall_bench_end:
+
+; Clock benchmark. Waits for an iteration count like the one above, reads
+; the clock that many times from the kernel data page (vdso_clock_ns) and
+; that many times with SYS_CLOCK, then replies with the TSC cycles of each
+; run and exits.
+global user_clock_bench_start
+global user_clock_bench_end
+user_clock_bench_start:
+    sub rsp, 64            ; message_t
+    mov rdi, rsp
+    mov eax, SYS_RECEIVE
+    syscall
+    mov r12d, [rsp]        ; sender
+    mov r15, [rsp + 8]     ; iterations
+    test r15, r15
+    jz .exit
+    mov r14, VDSO_USER_BASE
+
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    mov r13, rax
+    mov rbx, r15
+.vdso_loop:
+    mov ecx, [r14 + VDSO_SEQ]
+    test ecx, 1
+    jnz .vdso_busy
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    sub rax, [r14 + VDSO_BASE_TSC]
+    mul qword [r14 + VDSO_MULT]
+    shrd rax, rdx, VDSO_CLOCK_SHIFT
+    add rax, [r14 + VDSO_BASE_NS]
+    cmp ecx, [r14 + VDSO_SEQ]
+    jne .vdso_loop         ; The kernel refreshed the page: read again
+    dec rbx
+    jnz .vdso_loop
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    sub rax, r13
+    mov [rsp + 8], rax
+
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    mov r13, rax
+    mov rbx, r15
+.syscall_loop:
+    mov eax, SYS_CLOCK
+    syscall
+    dec rbx
+    jnz .syscall_loop
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    sub rax, r13
+    mov [rsp + 16], rax
+
+    mov edi, r12d          ; pid
+    xor esi, esi           ; type
+    lea rdx, [rsp + 8]     ; data: both cycle counts
+    mov r10d, 16           ; size
+    mov eax, SYS_SEND
+    syscall
+.exit:
+    xor edi, edi
+    mov eax, SYS_EXIT
+    syscall
+.vdso_busy:
+    pause
+    jmp .vdso_loop
+user_clock_bench_end:
+
+; Ring benchmark. Waits for an iteration count like the ones above, then
+; bounces that many messages off its own mailbox twice: first with a
+; SYS_SEND and a SYS_RECEIVE each, then in batches of RING_BENCH_BATCH
+; send/receive pairs queued on the rings, one SYS_RING_ENTER per batch.
+; Replies with the TSC cycles of each run and exits.
+RING_BENCH_BATCH equ 16    ; Pairs per batch; their requests fit URING_ENTRIES
+
+global user_ring_bench_start
+global user_ring_bench_end
+user_ring_bench_start:
+    sub rsp, 96            ; message_t, then the payload and the two results
+    mov rdi, rsp
+    mov eax, SYS_RECEIVE
+    syscall
+    mov r12d, [rsp]        ; sender
+    mov r15, [rsp + 8]     ; iterations
+    test r15, r15
+    jz .exit
+    mov eax, SYS_GETPID
+    syscall
+    mov ebp, eax           ; messages go to ourselves
+    mov qword [rsp + 64], 0
+
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    mov r13, rax
+    mov rbx, r15
+.sync_loop:
+    mov edi, ebp           ; pid
+    xor esi, esi           ; type
+    lea rdx, [rsp + 64]    ; data
+    mov r10d, 8            ; size
+    mov eax, SYS_SEND
+    syscall
+    mov rdi, rsp
+    mov eax, SYS_RECEIVE
+    syscall
+    dec rbx
+    jnz .sync_loop
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    sub rax, r13
+    mov [rsp + 72], rax
+
+    mov eax, SYS_RING_SETUP
+    syscall
+    cmp rax, -1
+    je .exit
+    mov r14, rax           ; uring_shared_t
+
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    mov r13, rax
+    mov rbx, r15           ; pairs left
+.batch:
+    mov ecx, RING_BENCH_BATCH
+    cmp rbx, rcx
+    cmovb rcx, rbx
+    sub rbx, rcx
+    lea r8d, [rcx + rcx]   ; requests in this batch
+    mov r10d, [r14 + URING_SQ_TAIL]
+.fill:
+    mov eax, r10d
+    and eax, URING_ENTRIES - 1
+    shl eax, URING_SQE_SHIFT
+    lea rdi, [r14 + URING_SQ + rax]
+    mov dword [rdi + SQE_OPCODE], URING_OP_SEND
+    mov [rdi + SQE_FD], ebp
+    lea rax, [rsp + 64]
+    mov [rdi + SQE_ADDR], rax
+    mov dword [rdi + SQE_LEN], 8
+    mov dword [rdi + SQE_ARG], 0
+    mov [rdi + SQE_USER_DATA], r10
+    inc r10d
+
+    mov eax, r10d
+    and eax, URING_ENTRIES - 1
+    shl eax, URING_SQE_SHIFT
+    lea rdi, [r14 + URING_SQ + rax]
+    mov dword [rdi + SQE_OPCODE], URING_OP_RECEIVE
+    mov dword [rdi + SQE_FD], 0
+    mov [rdi + SQE_ADDR], rsp
+    mov dword [rdi + SQE_LEN], 0
+    mov dword [rdi + SQE_ARG], 0
+    mov [rdi + SQE_USER_DATA], r10
+    inc r10d
+    dec ecx
+    jnz .fill
+
+    mov [r14 + URING_SQ_TAIL], r10d  ; Stores stay in order: the requests are visible first
+    mov edi, r8d           ; to_submit
+    mov esi, r8d           ; min_complete
+    mov eax, SYS_RING_ENTER
+    syscall
+    mov eax, [r14 + URING_CQ_TAIL]   ; Reap the whole batch at once
+    mov [r14 + URING_CQ_HEAD], eax
+    test rbx, rbx
+    jnz .batch
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    sub rax, r13
+    mov [rsp + 80], rax
+
+    mov edi, r12d          ; pid
+    xor esi, esi           ; type
+    lea rdx, [rsp + 72]    ; data: both cycle counts
+    mov r10d, 16           ; size
+    mov eax, SYS_SEND
+    syscall
+.exit:
+    xor edi, edi
+    mov eax, SYS_EXIT
+    syscall
+user_ring_bench_end:
+
+section .note.GNU-stack noalloc noexec nowrite progbits
@@ -0,0 +1,393 @@
+#include "bench.h"
+#include "process.h"
+#include "cpu.h"
+#include "smp.h"
+#include "timer.h"
+#include "ipc.h"
+#include "user.h"
+#include "mm/mm.h"
+#include "libc/string.h"
+#include "libc/stdio.h"
+
+static volatile int bench_stop = 0;
+static volatile uint64_t bench_work = 0;
+
+static void bench_worker(void) {
+    while (!bench_stop) {
+        process_yield();
+    }
+}
+
+// Average cycles per context switch with 'nprocs' runnable processes (the
+// caller and nprocs - 1 workers) yielding to each other. They run at the
+// top priority so nothing else joins the rotation. The workers share the
+// caller's CPU; the run queue is O(1), so the result should not grow with
+// nprocs.
+uint32_t bench_switch(uint32_t nprocs, uint32_t rounds) {
+    if (nprocs < 2 || rounds == 0) {
+        return 0;
+    }
+
+    uint32_t old_priority = process_set_priority(PROCESS_PRIORITIES - 1);
+    cpu_t* cpu = this_cpu();
+    uint32_t created = 0;
+    bench_stop = 0;
+    for (uint32_t i = 1; i < nprocs; i++) {
+        if (!process_create_on(bench_worker, PROCESS_PRIORITIES - 1, cpu->id)) {
+            break;
+        }
+        created++;
+    }
+
+    uint32_t result = 0;
+    if (created == 0) {
+        printf("bench_switch: Could not create workers\n");
+    } else {
+        // One yield from here runs every worker once before coming back
+        process_yield();
+
+        uint32_t before = cpu->stats.switches;
+        uint64_t start = rdtsc();
+        for (uint32_t i = 0; i < rounds; i++) {
+            process_yield();
+        }
+        uint64_t cycles = rdtsc() - start;
+
+        uint32_t switches = cpu->stats.switches - before;
+        result = switches ? (uint32_t)(cycles / switches) : 0;
+    }
+
+    // Let the workers see the flag and exit
+    bench_stop = 1;
+    process_yield();
+    process_set_priority(old_priority);
+    return result;
+}
+
+// Raw switch cost, without the scheduler: this process ping-pongs with a
+// coroutine on a private stack. The full-frame switch the scheduler used
+// to do (every GPR and RFLAGS) is replicated here as a reference.
+__attribute__((naked)) static void context_switch_full(uint64_t* old_rsp, uint64_t new_rsp) {
+    (void)old_rsp; (void)new_rsp; // Suppress unused parameter warnings
+    __asm__ __volatile__ (
+        "pushfq                  \n"
+        "pushq %rax              \n"
+        "pushq %rbx              \n"
+        "pushq %rcx              \n"
+        "pushq %rdx              \n"
+        "pushq %rsi              \n"
+        "pushq %rdi              \n"
+        "pushq %rbp              \n"
+        "pushq %r8               \n"
+        "pushq %r9               \n"
+        "pushq %r10              \n"
+        "pushq %r11              \n"
+        "pushq %r12              \n"
+        "pushq %r13              \n"
+        "pushq %r14              \n"
+        "pushq %r15              \n"
+        "movq %rsp, (%rdi)       \n"
+        "movq %rsi, %rsp         \n"
+        "popq %r15               \n"
+        "popq %r14               \n"
+        "popq %r13               \n"
+        "popq %r12               \n"
+        "popq %r11               \n"
+        "popq %r10               \n"
+        "popq %r9                \n"
+        "popq %r8                \n"
+        "popq %rbp               \n"
+        "popq %rdi               \n"
+        "popq %rsi               \n"
+        "popq %rdx               \n"
+        "popq %rcx               \n"
+        "popq %rbx               \n"
+        "popq %rax               \n"
+        "popfq                   \n"
+        "retq                    \n"
+    );
+}
+
+static void (*bench_switch_fn)(uint64_t* old_rsp, uint64_t new_rsp);
+static uint64_t bench_main_rsp = 0;
+static uint64_t bench_coroutine_rsp = 0;
+
+static void bench_coroutine(void) {
+    for (;;) {
+        bench_switch_fn(&bench_coroutine_rsp, bench_main_rsp);
+    }
+}
+
+// Cycles per switch through 'fn', whose frames hold 'words' saved words
+// below the return address
+static uint32_t bench_raw_switch(void (*fn)(uint64_t*, uint64_t), uint32_t words, uint32_t rounds) {
+    uint8_t* stack = kmalloc(BENCH_COROUTINE_STACK);
+    if (!stack) {
+        printf("bench_context_switch: Out of memory\n");
+        return 0;
+    }
+
+    // The coroutine's first frame "returns" into it as if it was called
+    uint64_t* top = (uint64_t*)(stack + BENCH_COROUTINE_STACK);
+    *--top = 0;
+    *--top = (uint64_t)bench_coroutine;
+    for (uint32_t i = 0; i < words; i++) {
+        *--top = 0x002;  // Zero registers; RFLAGS with interrupts off for the full frame
+    }
+    bench_switch_fn = fn;
+    bench_coroutine_rsp = (uint64_t)top;
+
+    // Nothing may switch this process out while the coroutine holds its RSP
+    uint64_t flags = irq_save();
+    fn(&bench_main_rsp, bench_coroutine_rsp);  // Starts the coroutine and warms up
+    uint64_t start = rdtsc();
+    for (uint32_t i = 0; i < rounds; i++) {
+        fn(&bench_main_rsp, bench_coroutine_rsp);
+    }
+    uint64_t cycles = rdtsc() - start;
+    irq_restore(flags);
+
+    kfree(stack);
+    return (uint32_t)(cycles / (2 * (uint64_t)rounds));  // There and back each round
+}
+
+// Cycles per bare context_switch, and in 'full_cycles' (optional) the
+// same for the old full-frame switch
+uint32_t bench_context_switch(uint32_t rounds, uint32_t* full_cycles) {
+    if (rounds == 0) {
+        return 0;
+    }
+    uint32_t slim = bench_raw_switch(context_switch, sizeof(switch_frame_t) / 8 - 1, rounds);
+    if (full_cycles) {
+        *full_cycles = bench_raw_switch(context_switch_full, 16, rounds);
+    }
+    return slim;
+}
+
+// CPU-bound worker: burns a fixed chunk of work between yields
+static void bench_busy_worker(void) {
+    while (!bench_stop) {
+        for (volatile uint32_t i = 0; i < BENCH_WORK_UNIT; i++) {
+        }
+        __atomic_fetch_add(&bench_work, 1, __ATOMIC_RELAXED);
+        process_yield();
+    }
+}
+
+// Scheduling throughput: work units per second completed by 'nprocs'
+// CPU-bound processes over 'ms' milliseconds. New processes are spread
+// over the CPUs, so this should scale with the CPUs online until nprocs
+// exceeds them.
+uint32_t bench_throughput(uint32_t nprocs, uint32_t ms) {
+    if (nprocs == 0 || ms == 0) {
+        return 0;
+    }
+
+    uint32_t created = 0;
+    bench_stop = 0;
+    for (uint32_t i = 0; i < nprocs; i++) {
+        if (!process_create(bench_busy_worker, PROCESS_PRIORITY_DEFAULT)) {
+            break;
+        }
+        created++;
+    }
+    if (created == 0) {
+        printf("bench_throughput: Could not create workers\n");
+        return 0;
+    }
+
+    // The caller only waits, yielding whenever it gets the CPU
+    uint64_t start = timer_uptime_ms();
+    uint64_t before = bench_work;
+    while (timer_uptime_ms() - start < ms) {
+        process_yield();
+    }
+    uint64_t done = bench_work - before;
+    uint64_t elapsed = timer_uptime_ms() - start;
+
+    bench_stop = 1;
+    process_yield();
+    return elapsed ? (uint32_t)(done * 1000 / elapsed) : 0;
+}
+
+static volatile uint32_t bench_remaining = 0;
+
+// CPU-bound worker with a fixed amount of work; never yields, so only
+// preemption and the load balancer move it around
+static void bench_batch_worker(void) {
+    for (uint32_t unit = 0; unit < BENCH_BATCH_UNITS; unit++) {
+        for (volatile uint32_t i = 0; i < BENCH_WORK_UNIT; i++) {
+        }
+    }
+    __atomic_fetch_sub(&bench_remaining, 1, __ATOMIC_RELEASE);
+}
+
+// Completion time in milliseconds of 'nprocs' CPU-bound processes started
+// with process_create, each doing BENCH_BATCH_UNITS of work. Run under
+// 'make run SMP=1', 2 and 4 to see how it scales. '*steals' receives the
+// processes the balancer moved meanwhile.
+uint32_t bench_batch(uint32_t nprocs, uint32_t* steals) {
+    sched_stats_t before, after;
+    process_get_sched_stats(&before);
+    uint64_t start = timer_uptime_ms();
+
+    bench_remaining = nprocs;
+    for (uint32_t i = 0; i < nprocs; i++) {
+        if (!process_create(bench_batch_worker, PROCESS_PRIORITY_DEFAULT)) {
+            printf("bench_batch: Could not create worker %u\n", i);
+            __atomic_fetch_sub(&bench_remaining, nprocs - i, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    while (__atomic_load_n(&bench_remaining, __ATOMIC_ACQUIRE)) {
+        process_yield();
+    }
+
+    uint32_t elapsed = (uint32_t)(timer_uptime_ms() - start);
+    process_get_sched_stats(&after);
+    if (steals) {
+        *steals = after.steals - before.steals;
+    }
+    return elapsed;
+}
+
+// Message passing: producers flood one consumer, which drains its mailbox
+// in batches
+#define BENCH_IPC_DATA 1
+#define BENCH_IPC_STOP 2
+
+static volatile uint32_t bench_consumer = 0;
+static volatile uint64_t bench_received = 0;
+
+static void bench_ipc_consumer(void) {
+    message_t batch[IPC_BATCH_MAX];
+    for (;;) {
+        uint32_t count = ipc_receive_batch(batch, IPC_BATCH_MAX);
+        for (uint32_t i = 0; i < count; i++) {
+            if (batch[i].type == BENCH_IPC_STOP) {
+                return;
+            }
+        }
+        __atomic_fetch_add(&bench_received, count, __ATOMIC_RELAXED);
+    }
+}
+
+static void bench_ipc_producer(void) {
+    uint64_t payload = 0;
+    while (!bench_stop) {
+        if (ipc_send(bench_consumer, BENCH_IPC_DATA, &payload, sizeof(payload))) {
+            payload++;
+        } else {
+            process_yield();  // Mailbox full: let the consumer catch up
+        }
+    }
+}
+
+// Messages per second delivered to one consumer by 'nproducers' senders
+// over 'ms' milliseconds
+uint32_t bench_ipc(uint32_t nproducers, uint32_t ms) {
+    if (nproducers == 0 || ms == 0) {
+        return 0;
+    }
+
+    bench_stop = 0;
+    bench_consumer = process_create(bench_ipc_consumer, PROCESS_PRIORITY_DEFAULT);
+    if (!bench_consumer) {
+        printf("bench_ipc: Could not create the consumer\n");
+        return 0;
+    }
+    for (uint32_t i = 0; i < nproducers; i++) {
+        if (!process_create(bench_ipc_producer, PROCESS_PRIORITY_DEFAULT)) {
+            break;
+        }
+    }
+
+    uint64_t start = timer_uptime_ms();
+    uint64_t before = bench_received;
+    process_sleep(ms);
+    uint64_t done = bench_received - before;
+    uint64_t elapsed = timer_uptime_ms() - start;
+
+    bench_stop = 1;
+    while (!ipc_send(bench_consumer, BENCH_IPC_STOP, NULL, 0)) {
+        process_yield();
+    }
+    return elapsed ? (uint32_t)(done * 1000 / elapsed) : 0;
+}
+
+// Start the ring 3 program in [start, end), send it an iteration count
+// and wait for its reply: 'size' bytes copied to 'result'. Polls, so a
+// user process that dies instead cannot hang the caller. Returns 0 on
+// failure.
+static int bench_user(const char* name, const uint8_t* start, const uint8_t* end,
+                      uint64_t count, void* result, uint32_t size) {
+    uint32_t pid = process_create_user(start, end - start, PROCESS_PRIORITY_DEFAULT);
+    if (!pid) {
+        printf("%s: Could not start the user process\n", name);
+        return 0;
+    }
+    if (!ipc_send(pid, 0, &count, sizeof(count))) {
+        return 0;
+    }
+
+    uint64_t deadline = timer_uptime_ms() + BENCH_SYSCALL_TIMEOUT_MS;
+    message_t reply;
+    while (timer_uptime_ms() < deadline) {
+        if (!ipc_poll(&reply)) {
+            process_sleep(10);
+        } else if (reply.sender == pid) {
+            memcpy(result, reply.data, size);
+            return 1;
+        }
+    }
+    printf("%s: No answer from process %u\n", name, pid);
+    return 0;
+}
+
+// Null system call round trip: a user process makes 'calls' SYS_GETPID
+// calls back to back and reports the TSC cycles they took. Returns cycles
+// per call, or 0 if it never reported back.
+uint32_t bench_syscall(uint32_t calls) {
+    uint64_t cycles;
+    if (calls == 0 || !bench_user("bench_syscall", user_syscall_bench_start,
+                                  user_syscall_bench_end, calls, &cycles, sizeof(cycles))) {
+        return 0;
+    }
+    return (uint32_t)(cycles / calls);
+}
+
+// Clock read from ring 3: a user process reads the clock 'reads' times
+// from the kernel data page, then as often through SYS_CLOCK. Returns
+// cycles per read from the page and sets '*syscall_cycles' to cycles per
+// system call; 0 if it never reported back.
+uint32_t bench_clock(uint32_t reads, uint32_t* syscall_cycles) {
+    uint64_t cycles[2];
+    *syscall_cycles = 0;
+    if (reads == 0 || !bench_user("bench_clock", user_clock_bench_start,
+                                  user_clock_bench_end, reads, cycles, sizeof(cycles))) {
+        return 0;
+    }
+    *syscall_cycles = (uint32_t)(cycles[1] / reads);
+    return (uint32_t)(cycles[0] / reads);
+}
+
+static uint32_t ops_per_second(uint64_t ops, uint64_t cycles) {
+    return cycles ? (uint32_t)(ops * timer_tsc_khz() * 1000 / cycles) : 0;
+}
+
+// Batched against one-at-a-time kernel requests: a user process sends
+// itself 'pairs' messages and receives them, first with a system call
+// for each, then batched through its submission/completion rings.
+// Returns operations (sends and receives) per second through the rings
+// and sets '*syscall_ops' to the rate with system calls; 0 if it never
+// reported back.
+uint32_t bench_ring(uint32_t pairs, uint32_t* syscall_ops) {
+    uint64_t cycles[2];
+    *syscall_ops = 0;
+    if (pairs == 0 || !bench_user("bench_ring", user_ring_bench_start,
+                                  user_ring_bench_end, pairs, cycles, sizeof(cycles))) {
+        return 0;
+    }
+    *syscall_ops = ops_per_second(2ULL * pairs, cycles[0]);
+    return ops_per_second(2ULL * pairs, cycles[1]);
+}
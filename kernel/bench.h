@@ -0,0 +1,45 @@
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <stdint.h>
+
+// Scheduler switch benchmark: process counts tried by the 'bench' command
+#define BENCH_SWITCH_MAX_PROCS 64
+#define BENCH_SWITCH_ROUNDS    200   // Trips around the run queue per measurement
+
+// Raw context switch benchmark
+#define BENCH_RAW_SWITCH_ROUNDS 100000
+#define BENCH_COROUTINE_STACK   (8 * 1024)
+
+// Scheduling throughput benchmark
+#define BENCH_WORK_UNIT        100000  // Loop iterations per unit of work
+#define BENCH_THROUGHPUT_MS    1000    // Measuring window per process count
+
+// Batch completion benchmark (exercises the work-stealing balancer)
+#define BENCH_BATCH_PROCS      16
+#define BENCH_BATCH_UNITS      200     // Units of work per process
+
+// Message passing benchmark
+#define BENCH_IPC_MS           1000    // Measuring window per producer count
+
+// System call benchmark (a ring 3 process, see arch/x86_64/user.s)
+#define BENCH_SYSCALL_CALLS      100000
+#define BENCH_SYSCALL_TIMEOUT_MS 5000
+
+// Clock read benchmark: the kernel data page against SYS_CLOCK
+#define BENCH_CLOCK_READS        100000
+
+// Submission/completion ring benchmark: send/receive pairs to self
+#define BENCH_RING_PAIRS         50000
+
+// Function declarations
+uint32_t bench_switch(uint32_t nprocs, uint32_t rounds);
+uint32_t bench_context_switch(uint32_t rounds, uint32_t* full_cycles);
+uint32_t bench_throughput(uint32_t nprocs, uint32_t ms);
+uint32_t bench_batch(uint32_t nprocs, uint32_t* steals);
+uint32_t bench_ipc(uint32_t nproducers, uint32_t ms);
+uint32_t bench_syscall(uint32_t calls);
+uint32_t bench_clock(uint32_t reads, uint32_t* syscall_cycles);
+uint32_t bench_ring(uint32_t pairs, uint32_t* syscall_ops);
+
+#endif // _BENCH_H
@@ -0,0 +1,66 @@
+#ifndef _DEQUE_H
+#define _DEQUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Chase-Lev work-stealing deque over a fixed power-of-two buffer. Items go
+// in at the bottom and come out at the top. Taking is lock-free and safe
+// from any CPU at once: a compare-and-swap on 'top' decides who gets an
+// item. Pushing writes 'bottom', so only one CPU may push at a time (the
+// owner in the classic form; the scheduler serializes pushers with a lock).
+// The owner taking from the top rather than popping the bottom keeps every
+// deque FIFO, which round-robin needs.
+typedef struct {
+    volatile int64_t top;     // Next item to take
+    volatile int64_t bottom;  // Next free slot
+    void** buffer;
+    uint32_t mask;            // Capacity - 1
+} deque_t;
+
+static inline void deque_init(deque_t* dq, void** buffer, uint32_t capacity) {
+    dq->top = 0;
+    dq->bottom = 0;
+    dq->buffer = buffer;
+    dq->mask = capacity - 1;
+}
+
+// Items in the deque; only a snapshot while other CPUs take
+static inline uint32_t deque_size(deque_t* dq) {
+    int64_t b = __atomic_load_n(&dq->bottom, __ATOMIC_SEQ_CST);
+    int64_t t = __atomic_load_n(&dq->top, __ATOMIC_SEQ_CST);
+    return b > t ? (uint32_t)(b - t) : 0;
+}
+
+// Append an item; 0 when the deque is full. One pusher at a time.
+static inline int deque_push(deque_t* dq, void* item) {
+    int64_t b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED);
+    int64_t t = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+    if (b - t > (int64_t)dq->mask) {
+        return 0;
+    }
+    __atomic_store_n(&dq->buffer[b & dq->mask], item, __ATOMIC_RELAXED);
+    // The item must be visible before the new bottom that publishes it
+    __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+// Take the oldest item, or NULL when the deque is empty. A CAS lost to
+// another taker just means trying the next item.
+static inline void* deque_steal(deque_t* dq) {
+    for (;;) {
+        int64_t t = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        int64_t b = __atomic_load_n(&dq->bottom, __ATOMIC_ACQUIRE);
+        if (t >= b) {
+            return NULL;
+        }
+        void* item = __atomic_load_n(&dq->buffer[t & dq->mask], __ATOMIC_RELAXED);
+        if (__atomic_compare_exchange_n(&dq->top, &t, t + 1, 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            return item;
+        }
+    }
+}
+
+#endif // _DEQUE_H
@@ -5,6 +5,9 @@
 #include "mouse.h"
 #include "keyboard.h"
 #include "text.h"
+#include "process.h"
+#include "sync.h"
+#include "mm/arena.h"
 #include <string.h>
 
 #define MAX_NOTEPADS 4
@@ -45,6 +48,9 @@ int desktop_height = VGA_HEIGHT;
 int taskbar_height = 16; // Smaller taskbar for VGA 200px height
 int desktop_theme = 0; // 0 = Light, 1 = Dark
 
+// Desktop state is shared by the main loop and the input task
+static mutex_t desktop_mutex;
+
 // VGA color indices for desktop
 #define COLOR_BLACK     0x00
 #define COLOR_BLUE      0x01
@@ -70,6 +76,26 @@ desktop_icon_t desktop_icons[NUM_ICONS] = {
     {280, 60, 32, 32, "Settings", 3}
 };
 
+void desktop_lock(void) {
+    mutex_lock(&desktop_mutex);
+}
+
+void desktop_unlock(void) {
+    mutex_unlock(&desktop_mutex);
+}
+
+// Keyboard consumer: sleeps until a key arrives instead of polling the
+// buffer every frame
+static void desktop_input_task(void) {
+    process_set_name("input");
+    for (;;) {
+        char key = keyboard_wait_char();
+        desktop_lock();
+        desktop_handle_keyboard_input(key);
+        desktop_unlock();
+    }
+}
+
 void desktop_init(uint32_t *fb, int width, int height) {
     (void)width;  // Unused parameter
     (void)height; // Unused parameter
@@ -82,6 +108,8 @@ void desktop_init(uint32_t *fb, int width, int height) {
     window_init();
     mouse_init(fb, VGA_WIDTH, VGA_HEIGHT);
     keyboard_init();
+    mutex_init(&desktop_mutex);
+    process_create(desktop_input_task, PROCESS_PRIORITY_DEFAULT);
     
     // Create some demo windows (smaller to fit VGA resolution)
     window_create(20, 20, 180, 100, "Welcome", COLOR_LGRAY);
@@ -172,7 +200,7 @@ void desktop_draw_taskbar(void) {
     // Draw window buttons in taskbar (simplified for VGA)
     int button_x = 55;
     for (int i = 0; i < window_count; i++) {
-        if (windows[i].active) {
+        if (windows[i]->active) {
             uint8_t btn_color = (i == active_window) ? COLOR_LGRAY : COLOR_DGRAY; // Light gray or dark gray
             
             // Draw button background
@@ -185,8 +213,8 @@ void desktop_draw_taskbar(void) {
             // Draw window title (truncate if needed)
             char short_title[8];
             int j = 0;
-            while (windows[i].title[j] && j < 7) {
-                short_title[j] = windows[i].title[j];
+            while (windows[i]->title[j] && j < 7) {
+                short_title[j] = windows[i]->title[j];
                 j++;
             }
             short_title[j] = '\0';
@@ -205,9 +233,7 @@ static char calc_op = 0;
 static int calc_new_input = 1;
 
 void draw_calculator(int wx, int wy) {
-    char buf[32];
-    snprintf(buf, sizeof(buf), "%d", calc_value);
-    draw_string(buf, wx + 20, wy + 30, COLOR_BLACK);
+    draw_string(arena_printf(frame_arena, "%d", calc_value), wx + 20, wy + 30, COLOR_BLACK);
     // Draw buttons (4x5 grid)
     const char *labels[5][4] = {
         {"7", "8", "9", "/"},
@@ -238,33 +264,33 @@ void desktop_draw(void) {
     desktop_draw_taskbar();
     mouse_draw(desktop_framebuffer, desktop_width);
     for (int i = 0; i < window_count; i++) {
-        if (windows[i].active) {
-            if (strcmp(windows[i].title, "AI Assistant") == 0) {
-                draw_string("How can I help you?", windows[i].x + 20, windows[i].y + 40, COLOR_BLACK);
-            } else if (strcmp(windows[i].title, "About") == 0) {
-                draw_string("MyOS v0.1", windows[i].x + 20, windows[i].y + 40, COLOR_BLACK);
-                draw_string("Created by Vinay", windows[i].x + 20, windows[i].y + 60, COLOR_BLACK);
-            } else if (strcmp(windows[i].title, "File Explorer") == 0) {
-                draw_string("Files:", windows[i].x + 20, windows[i].y + 40, COLOR_BLACK);
-                draw_string("- readme.txt", windows[i].x + 40, windows[i].y + 60, COLOR_DGRAY);
-                draw_string("- notes.txt", windows[i].x + 40, windows[i].y + 80, COLOR_DGRAY);
-            } else if (strncmp(windows[i].title, "Notepad:", 8) == 0) {
+        if (windows[i]->active) {
+            if (strcmp(windows[i]->title, "AI Assistant") == 0) {
+                draw_string("How can I help you?", windows[i]->x + 20, windows[i]->y + 40, COLOR_BLACK);
+            } else if (strcmp(windows[i]->title, "About") == 0) {
+                draw_string("MyOS v0.1", windows[i]->x + 20, windows[i]->y + 40, COLOR_BLACK);
+                draw_string("Created by Vinay", windows[i]->x + 20, windows[i]->y + 60, COLOR_BLACK);
+            } else if (strcmp(windows[i]->title, "File Explorer") == 0) {
+                draw_string("Files:", windows[i]->x + 20, windows[i]->y + 40, COLOR_BLACK);
+                draw_string("- readme.txt", windows[i]->x + 40, windows[i]->y + 60, COLOR_DGRAY);
+                draw_string("- notes.txt", windows[i]->x + 40, windows[i]->y + 80, COLOR_DGRAY);
+            } else if (strncmp(windows[i]->title, "Notepad:", 8) == 0) {
                 notepad_t* np = find_notepad(i);
                 if (np) {
-                    draw_string(np->filename, windows[i].x + 20, windows[i].y + 30, COLOR_BLACK);
-                    draw_string(np->buffer, windows[i].x + 20, windows[i].y + 50, COLOR_BLACK);
+                    draw_string(np->filename, windows[i]->x + 20, windows[i]->y + 30, COLOR_BLACK);
+                    draw_string(np->buffer, windows[i]->x + 20, windows[i]->y + 50, COLOR_BLACK);
                 } else {
-                    draw_string("(Notepad stub)", windows[i].x + 20, windows[i].y + 40, COLOR_BLACK);
+                    draw_string("(Notepad stub)", windows[i]->x + 20, windows[i]->y + 40, COLOR_BLACK);
                 }
-            } else if (strcmp(windows[i].title, "Calculator") == 0) {
-                draw_calculator(windows[i].x, windows[i].y);
-            } else if (strcmp(windows[i].title, "Settings") == 0) {
-                draw_string("Settings", windows[i].x + 20, windows[i].y + 40, COLOR_BLACK);
+            } else if (strcmp(windows[i]->title, "Calculator") == 0) {
+                draw_calculator(windows[i]->x, windows[i]->y);
+            } else if (strcmp(windows[i]->title, "Settings") == 0) {
+                draw_string("Settings", windows[i]->x + 20, windows[i]->y + 40, COLOR_BLACK);
                 draw_string(desktop_theme == 0 ? "Theme: Light" : "Theme: Dark", 
-                          windows[i].x + 20, windows[i].y + 60, COLOR_DGRAY);
-                draw_string("Version: 0.1", windows[i].x + 20, windows[i].y + 80, COLOR_DGRAY);
+                          windows[i]->x + 20, windows[i]->y + 60, COLOR_DGRAY);
+                draw_string("Version: 0.1", windows[i]->x + 20, windows[i]->y + 80, COLOR_DGRAY);
                 // Draw toggle button
-                int btn_x = windows[i].x + 20, btn_y = windows[i].y + 100;
+                int btn_x = windows[i]->x + 20, btn_y = windows[i]->y + 100;
                 uint8_t* vga_buffer = (uint8_t*)desktop_framebuffer;
                 for (int y = 0; y < 24; y++) {
                     for (int x = 0; x < 80; x++) {
@@ -405,8 +431,8 @@ void desktop_handle_mouse_click(int x, int y, int button) {
             } else if (x >= 90) {
                 int window_index = (x - 90) / 110;
                 if (window_index < window_count) {
-                    if (windows[window_index].minimized) {
-                        windows[window_index].minimized = 0;
+                    if (windows[window_index]->minimized) {
+                        windows[window_index]->minimized = 0;
                     }
                     window_bring_to_front(window_index);
                 }
@@ -416,7 +442,7 @@ void desktop_handle_mouse_click(int x, int y, int button) {
         // Check if clicking on a window control button
         int win_id = window_at_position(x, y);
         if (win_id >= 0) {
-            window_t *win = &windows[win_id];
+            window_t *win = windows[win_id];
             int wx = win->maximized ? 0 : win->x;
             int wy = win->maximized ? 0 : win->y;
             int wwidth = win->maximized ? desktop_width : win->width;
@@ -448,9 +474,9 @@ void desktop_handle_mouse_click(int x, int y, int button) {
         }
         // Check if clicking on a file in File Explorer
         for (int i = 0; i < window_count; i++) {
-            if (windows[i].active && strcmp(windows[i].title, "File Explorer") == 0) {
-                int wx = windows[i].maximized ? 0 : windows[i].x;
-                int wy = windows[i].maximized ? 0 : windows[i].y;
+            if (windows[i]->active && strcmp(windows[i]->title, "File Explorer") == 0) {
+                int wx = windows[i]->maximized ? 0 : windows[i]->x;
+                int wy = windows[i]->maximized ? 0 : windows[i]->y;
                 if (x >= wx + 40 && x < wx + 200 && y >= wy + 60 && y < wy + 76) {
                     int win_id = window_create(wx + 100, wy + 40, 180, 80, "Notepad: readme.txt", 0x0E); // Yellow
                     create_notepad(win_id, "readme.txt");
@@ -465,9 +491,9 @@ void desktop_handle_mouse_click(int x, int y, int button) {
         }
         // Calculator button clicks
         for (int i = 0; i < window_count; i++) {
-            if (windows[i].active && strcmp(windows[i].title, "Calculator") == 0) {
-                int wx = windows[i].maximized ? 0 : windows[i].x;
-                int wy = windows[i].maximized ? 0 : windows[i].y;
+            if (windows[i]->active && strcmp(windows[i]->title, "Calculator") == 0) {
+                int wx = windows[i]->maximized ? 0 : windows[i]->x;
+                int wy = windows[i]->maximized ? 0 : windows[i]->y;
                 if (x >= wx + 20 && x < wx + 20 + 4 * 40 && y >= wy + 60 && y < wy + 60 + 4 * 28) {
                     handle_calculator_click(wx, wy, x, y);
                     return;
@@ -476,8 +502,8 @@ void desktop_handle_mouse_click(int x, int y, int button) {
         }
         // Settings toggle theme button
         for (int i = 0; i < window_count; i++) {
-            if (windows[i].active && strcmp(windows[i].title, "Settings") == 0) {
-                int btn_x = windows[i].x + 20, btn_y = windows[i].y + 100;
+            if (windows[i]->active && strcmp(windows[i]->title, "Settings") == 0) {
+                int btn_x = windows[i]->x + 20, btn_y = windows[i]->y + 100;
                 if (x >= btn_x && x < btn_x + 80 && y >= btn_y && y < btn_y + 24) {
                     desktop_theme = !desktop_theme;
                     return;
@@ -497,7 +523,7 @@ void desktop_handle_mouse_move(int x, int y) {
 
 void desktop_handle_keyboard_input(char key) {
     if (key == 0) return;
-    if (active_window >= 0 && strncmp(windows[active_window].title, "Notepad:", 8) == 0) {
+    if (active_window >= 0 && strncmp(windows[active_window]->title, "Notepad:", 8) == 0) {
         notepad_t* np = find_notepad(active_window);
         if (np) {
             if (key == '\b') {
@@ -512,7 +538,7 @@ void desktop_handle_keyboard_input(char key) {
         }
         return;
     }
-    if (active_window >= 0 && strcmp(windows[active_window].title, "Calculator") == 0) {
+    if (active_window >= 0 && strcmp(windows[active_window]->title, "Calculator") == 0) {
         handle_calculator_key(key);
         return;
     }
@@ -530,7 +556,7 @@ void desktop_handle_keyboard_input(char key) {
             break;
         default:
             // Handle regular text input
-            if (active_window >= 0 && strncmp(windows[active_window].title, "Notepad:", 8) == 0) {
+            if (active_window >= 0 && strncmp(windows[active_window]->title, "Notepad:", 8) == 0) {
                 notepad_t* np = find_notepad(active_window);
                 if (np) {
                     if (key >= 32 && key <= 126 && np->len < NOTEPAD_BUF_SIZE - 1) {
@@ -546,13 +572,8 @@ void desktop_handle_keyboard_input(char key) {
     }
 }
 
+// Per-frame input work; keys are handled by the input task (desktop_lock held)
 void desktop_handle_input(void) {
-    // Handle keyboard input
-    while (keyboard_has_data()) {
-        char key = keyboard_get_char();
-        desktop_handle_keyboard_input(key);
-    }
-    
     // Handle mouse input (simplified - in real implementation you'd read from PS/2)
     // For now, we'll just update the mouse position based on some simulation
     
@@ -15,6 +15,8 @@ typedef struct {
 
 // Function declarations
 void desktop_init(uint32_t *fb, int width, int height);
+void desktop_lock(void);
+void desktop_unlock(void);
 void desktop_draw(void);
 void desktop_draw_background(void);
 void desktop_draw_icons(void);
@@ -1,20 +1,28 @@
 #include "fs.h"
 #include "mm/mm.h"
+#include "mm/slab.h"
 #include "string.h"
 #include "stdio.h"
 
 // The root of the filesystem
 fs_node_t *fs_root = NULL;
 
-// Temporary storage for our initial filesystem
-#define MAX_NODES 64
-static fs_node_t nodes[MAX_NODES];
+// Nodes come from a slab cache and are chained for the fallback name lookup
+typedef struct fs_node_entry {
+    fs_node_t node;               // Must be first: entries are used as fs_node_t
+    struct fs_node_entry *next;
+} fs_node_entry_t;
+
+static kmem_cache_t *node_cache = NULL;
+static fs_node_entry_t *node_list = NULL;
+static fs_node_entry_t *node_list_tail = NULL;
 static uint32_t num_nodes = 0;
 
 // Initialize the filesystem
 void fs_init(void) {
-    // Clear the nodes array
-    memset(nodes, 0, sizeof(nodes));
+    node_cache = kmem_cache_create("fs_node", sizeof(fs_node_entry_t), 0, NULL);
+    node_list = NULL;
+    node_list_tail = NULL;
     num_nodes = 0;
     
     // Create the root directory
@@ -35,12 +43,22 @@ void fs_init(void) {
 
 // Create a new filesystem node
 fs_node_t *make_fs_node(char *name, uint32_t flags, uint32_t mask) {
-    if (num_nodes >= MAX_NODES) {
-        printf("make_fs_node: Maximum number of nodes reached\n");
+    fs_node_entry_t *entry = kmem_cache_alloc(node_cache);
+    if (!entry) {
+        printf("make_fs_node: Out of memory\n");
         return NULL;
     }
+    // Append so lookups keep finding the oldest node of a given name first
+    entry->next = NULL;
+    if (node_list_tail) {
+        node_list_tail->next = entry;
+    } else {
+        node_list = entry;
+    }
+    node_list_tail = entry;
+    num_nodes++;
     
-    fs_node_t *node = &nodes[num_nodes++];
+    fs_node_t *node = &entry->node;
     
     strncpy(node->name, name, 127);
     node->name[127] = '\0';
@@ -166,6 +184,16 @@ struct dirent *readdir_fs(fs_node_t *node, uint32_t index) {
     return NULL;
 }
 
+// Find a node by inode number; NULL if there is none
+fs_node_t *fs_find_inode(uint32_t inode) {
+    for (fs_node_entry_t *entry = node_list; entry; entry = entry->next) {
+        if (entry->node.inode == inode) {
+            return &entry->node;
+        }
+    }
+    return NULL;
+}
+
 // Find a file in a directory
 fs_node_t *finddir_fs(fs_node_t *node, char *name) {
     if (!node || !name) return NULL;
@@ -181,9 +209,9 @@ fs_node_t *finddir_fs(fs_node_t *node, char *name) {
     }
     
     // Simple linear search for now
-    for (uint32_t i = 0; i < num_nodes; i++) {
-        if (strcmp(nodes[i].name, name) == 0) {
-            return &nodes[i];
+    for (fs_node_entry_t *entry = node_list; entry; entry = entry->next) {
+        if (strcmp(entry->node.name, name) == 0) {
+            return &entry->node;
         }
     }
     
@@ -68,6 +68,9 @@ struct dirent *readdir_fs(fs_node_t *node, uint32_t index);
 // Find a file in a directory
 fs_node_t *finddir_fs(fs_node_t *node, char *name);
 
+// Find a node by inode number
+fs_node_t *fs_find_inode(uint32_t inode);
+
 // Initialize the filesystem
 void fs_init(void);
 
@@ -0,0 +1,97 @@
+#include "gdt.h"
+#include "smp.h"
+#include "libc/string.h"
+
+// Descriptor bits
+#define GDT_ACCESSED   (1ULL << 40)
+#define GDT_WRITABLE   (1ULL << 41)
+#define GDT_EXECUTABLE (1ULL << 43)
+#define GDT_SEGMENT    (1ULL << 44)
+#define GDT_PRESENT    (1ULL << 47)
+#define GDT_USER       (3ULL << 45)  // DPL 3
+#define GDT_LONG_MODE  (1ULL << 53)
+
+#define GDT_TSS_AVAILABLE 0x9ULL  // 64-bit TSS, not busy
+
+// Null, kernel code and data, the user segments, then one 16-byte TSS
+// descriptor per CPU
+#define GDT_ENTRIES (GDT_TSS / 8 + 2 * SMP_MAX_CPUS)
+
+static uint64_t gdt[GDT_ENTRIES];
+static tss_t tss[SMP_MAX_CPUS];
+static uint8_t fault_stack[FAULT_STACK_SIZE] __attribute__((aligned(16)));  // Boot CPU's
+
+struct gdt_ptr {
+    uint16_t limit;
+    uint64_t base;
+} __attribute__((packed));
+
+// Fill in a CPU's TSS and its descriptor
+static void tss_setup(uint32_t cpu, uint8_t* ist_stack) {
+    memset(&tss[cpu], 0, sizeof(tss_t));
+    tss[cpu].ist[IST_FAULT - 1] = (uint64_t)(uintptr_t)(ist_stack + FAULT_STACK_SIZE);
+    tss[cpu].iomap_base = sizeof(tss_t);  // No I/O permission bitmap
+
+    uint64_t base = (uint64_t)(uintptr_t)&tss[cpu];
+    uint64_t limit = sizeof(tss_t) - 1;
+    uint32_t index = GDT_TSS_SELECTOR(cpu) / 8;
+    gdt[index] = (limit & 0xFFFF) | ((base & 0xFFFFFF) << 16) |
+                 (GDT_TSS_AVAILABLE << 40) | GDT_PRESENT |
+                 (((limit >> 16) & 0xF) << 48) | (((base >> 24) & 0xFF) << 56);
+    gdt[index + 1] = base >> 32;
+}
+
+// Load the shared GDT on this CPU and its own TSS
+static void gdt_load(uint16_t tss_selector) {
+    struct gdt_ptr ptr = { sizeof(gdt) - 1, (uint64_t)(uintptr_t)gdt };
+    __asm__ volatile (
+        "lgdt %0\n"
+        // Reload CS with a far return, then the data segments
+        "pushq %1\n"
+        "leaq 1f(%%rip), %%rax\n"
+        "pushq %%rax\n"
+        "lretq\n"
+        "1:\n"
+        "movw %2, %%ax\n"
+        "movw %%ax, %%ds\n"
+        "movw %%ax, %%es\n"
+        "movw %%ax, %%ss\n"
+        "movw %%ax, %%fs\n"
+        "movw %%ax, %%gs\n"
+        "ltr %w3\n"
+        :
+        : "m"(ptr), "i"((uint64_t)GDT_KERNEL_CODE), "i"(GDT_KERNEL_DATA), "r"(tss_selector)
+        : "rax", "memory"
+    );
+}
+
+// Replace the boot GDT with one that also carries the user segments and a
+// TSS, so faults can be taken on a known-good stack (IST) even when the
+// current stack is not
+void gdt_init(void) {
+    gdt[0] = 0;
+    gdt[GDT_KERNEL_CODE / 8] = GDT_SEGMENT | GDT_PRESENT | GDT_WRITABLE |
+                               GDT_EXECUTABLE | GDT_LONG_MODE;
+    gdt[GDT_KERNEL_DATA / 8] = GDT_SEGMENT | GDT_PRESENT | GDT_WRITABLE;
+    gdt[GDT_USER_BASE / 8] = 0;
+    gdt[GDT_USER_DATA / 8] = GDT_SEGMENT | GDT_PRESENT | GDT_WRITABLE | GDT_USER;
+    gdt[GDT_USER_CODE / 8] = GDT_SEGMENT | GDT_PRESENT | GDT_WRITABLE |
+                             GDT_EXECUTABLE | GDT_LONG_MODE | GDT_USER;
+
+    tss_setup(0, fault_stack);
+    gdt_load(GDT_TSS_SELECTOR(0));
+}
+
+// Application processor 'cpu' joins with its own TSS. 'ist_stack' is
+// FAULT_STACK_SIZE bytes that must already be mapped. Loading GS here
+// clears the GS base, so per-CPU data is set up after this.
+void gdt_init_ap(uint32_t cpu, void* ist_stack) {
+    tss_setup(cpu, ist_stack);
+    gdt_load(GDT_TSS_SELECTOR(cpu));
+}
+
+// Stack the CPU switches to when an interrupt arrives in ring 3: the top
+// of the kernel stack of the user process about to run there
+void gdt_set_kernel_stack(uint32_t cpu, uint64_t rsp) {
+    tss[cpu].rsp[0] = rsp;
+}
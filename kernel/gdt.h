@@ -0,0 +1,37 @@
+#ifndef _GDT_H
+#define _GDT_H
+
+#include <stdint.h>
+
+// Segment selectors (the kernel ones match the boot GDT). SYSRET takes
+// the user selectors from GDT_USER_BASE: data at +8, code at +16, so the
+// order is fixed. The user ones are used with RPL 3 (GDT_USER_DATA | 3).
+#define GDT_KERNEL_CODE 0x08
+#define GDT_KERNEL_DATA 0x10
+#define GDT_USER_BASE   0x18  // 32-bit user code for SYSRET; left null
+#define GDT_USER_DATA   0x20
+#define GDT_USER_CODE   0x28
+#define GDT_TSS         0x30  // First TSS; each CPU has its own after it
+#define GDT_TSS_SELECTOR(cpu) (GDT_TSS + 16 * (cpu))
+
+// Interrupt stack table slots
+#define IST_FAULT        1            // Faults that may arrive on a bad stack (#PF)
+#define FAULT_STACK_SIZE (16 * 1024)
+
+// 64-bit task state segment
+typedef struct {
+    uint32_t reserved0;
+    uint64_t rsp[3];      // Stack pointers for privilege changes
+    uint64_t reserved1;
+    uint64_t ist[7];      // Interrupt stack table (IST1..IST7)
+    uint64_t reserved2;
+    uint16_t reserved3;
+    uint16_t iomap_base;
+} __attribute__((packed)) tss_t;
+
+// Function declarations
+void gdt_init(void);
+void gdt_init_ap(uint32_t cpu, void* ist_stack);
+void gdt_set_kernel_stack(uint32_t cpu, uint64_t rsp);
+
+#endif // _GDT_H
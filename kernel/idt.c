@@ -1,6 +1,12 @@
 #include <stdint.h>
 #include "idt.h"
 #include "io.h"
+#include "gdt.h"
+#include "cpu.h"
+#include "softirq.h"
+#include "serial.h"
+#include "user.h"
+#include "libc/stdio.h"
 
 // Forward declarations for IRQ stubs
 extern void irq0_stub(void);
@@ -19,6 +25,11 @@ extern void irq12_stub(void);
 extern void irq13_stub(void);
 extern void irq14_stub(void);
 extern void irq15_stub(void);
+extern void page_fault_stub(void);
+extern void exception0_stub(void);
+extern void exception6_stub(void);
+extern void exception12_stub(void);
+extern void exception13_stub(void);
 
 #define PIC1            0x20
 #define PIC2            0xA0
@@ -49,6 +60,11 @@ void idt_set_gate(int n, uint64_t handler, uint16_t sel, uint8_t flags) {
     idt[n].reserved = 0;
 }
 
+// Run a vector on an interrupt stack table entry (0 = current stack)
+void idt_set_ist(int n, uint8_t ist) {
+    idt[n].ist = ist;
+}
+
 void idt_init(void) {
     idtp.limit = (sizeof(struct idt_entry) * IDT_ENTRIES) - 1;
     idtp.base = (uint64_t)&idt;
@@ -58,6 +74,14 @@ void idt_init(void) {
         idt_set_gate(i, 0, 0, 0);
     }
     
+    // Exceptions
+    idt_set_gate(14, (uint64_t)&page_fault_stub, 0x08, 0x8E);  // Page fault (kernel/mm/vmm.c)
+    idt_set_ist(14, IST_FAULT);  // Stack guard and lazy stack faults arrive on a bad stack
+    idt_set_gate(0, (uint64_t)&exception0_stub, 0x08, 0x8E);    // Divide error
+    idt_set_gate(6, (uint64_t)&exception6_stub, 0x08, 0x8E);    // Invalid opcode
+    idt_set_gate(12, (uint64_t)&exception12_stub, 0x08, 0x8E);  // Stack fault
+    idt_set_gate(13, (uint64_t)&exception13_stub, 0x08, 0x8E);  // General protection
+
     // Set up IRQ handlers for all 16 IRQs
     idt_set_gate(32, (uint64_t)&irq0_stub, 0x08, 0x8E);  // Timer
     idt_set_gate(33, (uint64_t)&irq1_stub, 0x08, 0x8E);  // Keyboard
@@ -83,6 +107,30 @@ void idt_init(void) {
     pic_remap();
 }
 
+// Application processors share the boot CPU's table
+void idt_init_ap(void) {
+    idt_load((uint64_t)&idtp);
+}
+
+// CPU exceptions other than #PF (boot_fixed.s). From ring 3 they end the
+// process; in the kernel there is nothing to go back to.
+void exception_handler(uint64_t vector, uint64_t error_code, uint64_t rip, uint64_t cs) {
+    const char* name = vector == 0 ? "Divide error" :
+                       vector == 6 ? "Invalid opcode" :
+                       vector == 12 ? "Stack fault" : "General protection fault";
+    if ((cs & 3) == 3) {
+        user_fault(name, rip, error_code);
+    }
+
+    serial_printf("%s in the kernel at ", name);
+    serial_write_hex(rip);
+    serial_printf(" error 0x%x\n", (uint32_t)error_code);
+    printf("%s at 0x%x (error 0x%x)\n", name, (uint32_t)rip, (uint32_t)error_code);
+    for (;;) {
+        __asm__ volatile ("cli; hlt");
+    }
+}
+
 void pic_remap(void) {
     uint8_t a1, a2;
     a1 = inb(PIC1_DATA);
@@ -104,88 +152,134 @@ void pic_send_eoi(unsigned char irq) {
     outb(PIC1_COMMAND, 0x20);
 }
 
+// Let the PIC deliver (or hold back) one IRQ line
+void irq_unmask(int irq) {
+    uint16_t port = irq < 8 ? PIC1_DATA : PIC2_DATA;
+    outb(port, inb(port) & ~(1 << (irq & 7)));
+    if (irq >= 8) {
+        outb(PIC1_DATA, inb(PIC1_DATA) & ~(1 << 2));  // Cascade
+    }
+}
+
+void irq_mask(int irq) {
+    uint16_t port = irq < 8 ? PIC1_DATA : PIC2_DATA;
+    outb(port, inb(port) | (1 << (irq & 7)));
+}
+
 void irq_install_handler(int irq, void (*handler)(void)) {
     if (irq < 16) irq_handlers[irq] = handler;
 }
 
 __attribute__((weak)) void irq0_handler(void) {
+    uint64_t start = rdtsc();
     if (irq_handlers[0]) irq_handlers[0]();
     pic_send_eoi(0);
+    irq_exit(start);
 }
 
 __attribute__((weak)) void irq1_handler(void) {
+    uint64_t start = rdtsc();
     if (irq_handlers[1]) irq_handlers[1]();
     pic_send_eoi(1);
+    irq_exit(start);
 }
 
 __attribute__((weak)) void irq2_handler(void) {
+    uint64_t start = rdtsc();
     if (irq_handlers[2]) irq_handlers[2]();
     pic_send_eoi(2);
+    irq_exit(start);
 }
 
 __attribute__((weak)) void irq3_handler(void) {
+    uint64_t start = rdtsc();
     if (irq_handlers[3]) irq_handlers[3]();
     pic_send_eoi(3);
+    irq_exit(start);
 }
 
 __attribute__((weak)) void irq4_handler(void) {
+    uint64_t start = rdtsc();
     if (irq_handlers[4]) irq_handlers[4]();
     pic_send_eoi(4);
+    irq_exit(start);
 }
 
 __attribute__((weak)) void irq5_handler(void) {
+    uint64_t start = rdtsc();
     if (irq_handlers[5]) irq_handlers[5]();
     pic_send_eoi(5);
+    irq_exit(start);
 }
 
 __attribute__((weak)) void irq6_handler(void) {
+    uint64_t start = rdtsc();
     if (irq_handlers[6]) irq_handlers[6]();
     pic_send_eoi(6);
+    irq_exit(start);
 }
 
 __attribute__((weak)) void irq7_handler(void) {
+    uint64_t start = rdtsc();
     if (irq_handlers[7]) irq_handlers[7]();
     pic_send_eoi(7);
+    irq_exit(start);
 }
 
 __attribute__((weak)) void irq8_handler(void) {
+    uint64_t start = rdtsc();
     if (irq_handlers[8]) irq_handlers[8]();
     pic_send_eoi(8);
+    irq_exit(start);
 }
 
 __attribute__((weak)) void irq9_handler(void) {
+    uint64_t start = rdtsc();
     if (irq_handlers[9]) irq_handlers[9]();
     pic_send_eoi(9);
+    irq_exit(start);
 }
 
 __attribute__((weak)) void irq10_handler(void) {
+    uint64_t start = rdtsc();
     if (irq_handlers[10]) irq_handlers[10]();
     pic_send_eoi(10);
+    irq_exit(start);
 }
 
 __attribute__((weak)) void irq11_handler(void) {
+    uint64_t start = rdtsc();
     if (irq_handlers[11]) irq_handlers[11]();
     pic_send_eoi(11);
+    irq_exit(start);
 }
 
 __attribute__((weak)) void irq12_handler(void) {
+    uint64_t start = rdtsc();
     if (irq_handlers[12]) irq_handlers[12]();
     pic_send_eoi(12);
+    irq_exit(start);
 }
 
 __attribute__((weak)) void irq13_handler(void) {
+    uint64_t start = rdtsc();
     if (irq_handlers[13]) irq_handlers[13]();
     pic_send_eoi(13);
+    irq_exit(start);
 }
 
 __attribute__((weak)) void irq14_handler(void) {
+    uint64_t start = rdtsc();
     if (irq_handlers[14]) irq_handlers[14]();
     pic_send_eoi(14);
+    irq_exit(start);
 }
 
 __attribute__((weak)) void irq15_handler(void) {
+    uint64_t start = rdtsc();
     if (irq_handlers[15]) irq_handlers[15]();
     pic_send_eoi(15);
+    irq_exit(start);
 }
 
 // I/O port functions are now in io.h
@@ -22,13 +22,18 @@ struct idt_ptr {
 
 // Initialize IDT
 void idt_init(void);
+void idt_init_ap(void);
 
 // Set an IDT gate
 void idt_set_gate(int n, uint64_t handler, uint16_t sel, uint8_t flags);
+void idt_set_ist(int n, uint8_t ist);
+void exception_handler(uint64_t vector, uint64_t error_code, uint64_t rip, uint64_t cs) __attribute__((noreturn));
 
 // PIC remapping and control
 void pic_remap(void);
 void pic_send_eoi(unsigned char irq);
+void irq_unmask(int irq);
+void irq_mask(int irq);
 
 // IRQ handler management
 typedef void (*irq_handler_t)(void);
@@ -0,0 +1,188 @@
+#include "ipc.h"
+#include "process.h"
+#include "smp.h"
+#include "mm/mm.h"
+#include "libc/string.h"
+#include "libc/stdio.h"
+
+// Mailbox rings are bounded multi-producer, single-consumer queues in the
+// style of Vyukov's: producers claim a position with a CAS on 'tail', fill
+// the slot, then hand it over by advancing its sequence number. The owner
+// is the only consumer, so 'head' needs no atomics at all.
+
+// Indexed by pid % PROCESS_MAX; a slot's mailbox is created by its first
+// process and then kept for the ones after it
+static mailbox_t* mailboxes[PROCESS_MAX];
+
+static void mailbox_reset(mailbox_t* mailbox) {
+    mailbox->tail = 0;
+    mailbox->head = 0;
+    mailbox->sent = 0;
+    mailbox->dropped = 0;
+    for (uint32_t i = 0; i < IPC_RING_SLOTS; i++) {
+        mailbox->slots[i].seq = i;
+    }
+}
+
+// Give process 'pid' the empty mailbox of its PID slot (from process
+// creation: process.c makes sure no other live process has the slot).
+// Returns NULL if the slot has none and it cannot be allocated.
+mailbox_t* ipc_mailbox_open(uint32_t pid) {
+    mailbox_t** slot = &mailboxes[pid & (PROCESS_MAX - 1)];
+    mailbox_t* mailbox = *slot;
+    if (!mailbox) {
+        mailbox = kmalloc(sizeof(mailbox_t));
+        if (!mailbox) {
+            printf("ipc: Failed to allocate a mailbox\n");
+            return NULL;
+        }
+        mailbox->owner = IPC_NO_OWNER;
+        mailbox->senders = 0;
+        wait_queue_init(&mailbox->readers);
+        mailbox_reset(mailbox);
+        __atomic_store_n(slot, mailbox, __ATOMIC_RELEASE);
+    } else {
+        // A send that saw the previous owner may still be pushing
+        while (__atomic_load_n(&mailbox->senders, __ATOMIC_SEQ_CST)) {
+            process_yield();
+        }
+        mailbox_reset(mailbox);
+    }
+    // Senders that see the new owner see the reset ring too
+    __atomic_store_n(&mailbox->owner, pid, __ATOMIC_RELEASE);
+    return mailbox;
+}
+
+// The owner is exiting: refuse further sends. Messages still queued are
+// dropped when the slot's next process opens the mailbox.
+void ipc_mailbox_close(mailbox_t* mailbox) {
+    if (mailbox) {
+        __atomic_store_n(&mailbox->owner, IPC_NO_OWNER, __ATOMIC_SEQ_CST);
+    }
+}
+
+// Claim a slot, fill it and publish it; 0 when the ring is full
+static int ring_push(mailbox_t* mailbox, uint32_t sender, uint32_t type,
+                     const void* data, uint32_t size) {
+    uint64_t pos = __atomic_load_n(&mailbox->tail, __ATOMIC_RELAXED);
+    ipc_slot_t* slot;
+    for (;;) {
+        slot = &mailbox->slots[pos & (IPC_RING_SLOTS - 1)];
+        int64_t diff = (int64_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0) {
+            // Free for this position: try to claim it
+            if (__atomic_compare_exchange_n(&mailbox->tail, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return 0;  // Still holds the message from one lap ago
+        } else {
+            pos = __atomic_load_n(&mailbox->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->message.sender = sender;
+    slot->message.type = type;
+    if (size) {
+        memcpy(slot->message.data, data, size);
+    }
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+// Take the oldest message (owner only); 0 when the ring is empty
+static int ring_pop(mailbox_t* mailbox, message_t* message) {
+    ipc_slot_t* slot = &mailbox->slots[mailbox->head & (IPC_RING_SLOTS - 1)];
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != mailbox->head + 1) {
+        return 0;
+    }
+    *message = slot->message;
+    // Free the slot for the producer one lap ahead
+    __atomic_store_n(&slot->seq, mailbox->head + IPC_RING_SLOTS, __ATOMIC_RELEASE);
+    mailbox->head++;
+    return 1;
+}
+
+static int ring_empty(mailbox_t* mailbox) {
+    ipc_slot_t* slot = &mailbox->slots[mailbox->head & (IPC_RING_SLOTS - 1)];
+    return __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != mailbox->head + 1;
+}
+
+// Send a message of up to IPC_DATA_SIZE bytes to process 'pid'. Never
+// blocks: returns 1 once queued, 0 if there is no such process, its
+// mailbox is full or the message is too big. Safe from any CPU.
+int ipc_send(uint32_t pid, uint32_t type, const void* data, uint32_t size) {
+    if (size > IPC_DATA_SIZE) {
+        printf("ipc_send: %u bytes is over the message size\n", size);
+        return 0;
+    }
+    uint32_t sender = process_current()->pid;
+
+    mailbox_t* mailbox = __atomic_load_n(&mailboxes[pid & (PROCESS_MAX - 1)], __ATOMIC_ACQUIRE);
+    if (!mailbox) {
+        return 0;
+    }
+
+    // Counting ourselves in before checking the owner keeps the mailbox
+    // from being reset under us for the slot's next process
+    __atomic_fetch_add(&mailbox->senders, 1, __ATOMIC_SEQ_CST);
+    int sent = 0;
+    if (__atomic_load_n(&mailbox->owner, __ATOMIC_SEQ_CST) == pid) {
+        sent = ring_push(mailbox, sender, type, data, size);
+        if (sent) {
+            __atomic_fetch_add(&mailbox->sent, 1, __ATOMIC_RELAXED);
+
+            // Only pay for the wakeup when the owner is waiting
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (wait_queue_active(&mailbox->readers)) {
+                wake_up(&mailbox->readers);
+            }
+        } else {
+            __atomic_fetch_add(&mailbox->dropped, 1, __ATOMIC_RELAXED);
+        }
+    }
+    __atomic_fetch_sub(&mailbox->senders, 1, __ATOMIC_RELEASE);
+    return sent;
+}
+
+// Receive the oldest message, blocking until one arrives. Returns 0 only
+// for processes without a mailbox (the idle tasks).
+int ipc_receive(message_t* message) {
+    return ipc_receive_batch(message, 1) == 1;
+}
+
+// Receive up to 'max' messages, blocking until there is at least one; a
+// busy mailbox is drained with a single wakeup. Returns the number taken.
+uint32_t ipc_receive_batch(message_t* messages, uint32_t max) {
+    mailbox_t* mailbox = process_current()->mailbox;
+    if (!mailbox || max == 0) {
+        return 0;
+    }
+    wait_event(&mailbox->readers, !ring_empty(mailbox));
+
+    uint32_t count = 0;
+    while (count < max && ring_pop(mailbox, &messages[count])) {
+        count++;
+    }
+    return count;
+}
+
+// Receive without blocking; 0 when the mailbox is empty
+int ipc_poll(message_t* message) {
+    mailbox_t* mailbox = process_current()->mailbox;
+    return mailbox && ring_pop(mailbox, message);
+}
+
+// The queue the running process waits on for messages, for callers that
+// wait on something else at the same time; NULL without a mailbox
+wait_queue_t* ipc_wait_queue(void) {
+    mailbox_t* mailbox = process_current()->mailbox;
+    return mailbox ? &mailbox->readers : NULL;
+}
+
+// Whether a message is waiting
+int ipc_pending(void) {
+    mailbox_t* mailbox = process_current()->mailbox;
+    return mailbox && !ring_empty(mailbox);
+}
@@ -0,0 +1,55 @@
+#ifndef _IPC_H
+#define _IPC_H
+
+#include <stdint.h>
+#include "sync.h"
+
+// Message passing. Every process has a mailbox: a ring of fixed-size
+// message slots that any process may send to without locks and only the
+// owner receives from, blocking while it is empty. Mailboxes are never
+// freed: each belongs to a PID slot (pid % PROCESS_MAX, which process.c
+// keeps unique among live processes) and passes to the slot's next
+// process, so a sender finds one without looking the process up.
+#define IPC_MESSAGE_SIZE 64
+#define IPC_DATA_SIZE    (IPC_MESSAGE_SIZE - 8)
+#define IPC_RING_SLOTS   64   // Per mailbox; power of two
+#define IPC_BATCH_MAX    32   // Messages taken per ipc_receive_batch in the benchmark
+
+typedef struct {
+    uint32_t sender;   // PID, filled in by ipc_send
+    uint32_t type;     // Meaning is up to the processes involved
+    uint8_t data[IPC_DATA_SIZE];
+} message_t;
+
+// One slot: 'seq' says whose turn it is. It equals the slot's position
+// when free for that position's producer, and position + 1 once the
+// message there is ready for the consumer.
+typedef struct {
+    volatile uint64_t seq;
+    message_t message;
+} ipc_slot_t;
+
+#define IPC_NO_OWNER 0xFFFFFFFF  // mailbox_t.owner while no process receives there
+
+typedef struct mailbox {
+    volatile uint32_t owner;   // PID receiving here, or IPC_NO_OWNER
+    volatile uint32_t senders; // ipc_send calls that may still touch the ring
+    volatile uint64_t tail;    // Next position to claim; producers race for it
+    uint64_t head;             // Next position to receive; owner only
+    wait_queue_t readers;      // The owner, while the ring is empty
+    ipc_slot_t slots[IPC_RING_SLOTS];
+    uint32_t sent;             // Messages accepted
+    uint32_t dropped;          // Sends refused because the ring was full
+} mailbox_t;
+
+// Function declarations
+int ipc_send(uint32_t pid, uint32_t type, const void* data, uint32_t size);
+int ipc_receive(message_t* message);
+uint32_t ipc_receive_batch(message_t* messages, uint32_t max);
+int ipc_poll(message_t* message);
+wait_queue_t* ipc_wait_queue(void);
+int ipc_pending(void);
+mailbox_t* ipc_mailbox_open(uint32_t pid);
+void ipc_mailbox_close(mailbox_t* mailbox);
+
+#endif // _IPC_H
@@ -1,14 +1,25 @@
 #include <stdint.h>
 #include "keyboard.h"
+#include "idt.h"
+#include "sync.h"
+#include "softirq.h"
 
 // PS/2 I/O ports
 #define PS2_DATA_PORT    0x60
 #define PS2_COMMAND_PORT 0x64
 
-// Keyboard state
+// Keyboard state. The buffer is filled from IRQ1's tasklet and drained by any
+// process; keyboard_lock guards it and key_waiters holds the readers
+// blocked in keyboard_wait_char.
 uint8_t keyboard_buffer[256];
 int keyboard_buffer_head = 0;
 int keyboard_buffer_tail = 0;
+static spinlock_t keyboard_lock = SPINLOCK_INIT;
+static wait_queue_t key_waiters;
+
+// Scancodes on their way from IRQ1 to the keyboard tasklet
+static irq_ring_t scancode_ring;
+static tasklet_t keyboard_tasklet;
 uint8_t keyboard_shift_pressed = 0;
 uint8_t keyboard_ctrl_pressed = 0;
 uint8_t keyboard_alt_pressed = 0;
@@ -70,8 +81,25 @@ uint8_t keyboard_read(void) {
     return inb(PS2_DATA_PORT);
 }
 
+// IRQ1 top half: one scancode per interrupt, decoded later
+static void keyboard_irq_handler(void) {
+    irq_ring_put(&scancode_ring, inb(PS2_DATA_PORT));
+    tasklet_schedule(&keyboard_tasklet);
+}
+
+// Bottom half: decode the scancodes and wake the readers
+static void keyboard_bottom_half(void* data) {
+    (void)data;
+    uint8_t scancode;
+    while (irq_ring_get(&scancode_ring, &scancode)) {
+        keyboard_process_scancode(scancode);
+    }
+}
+
 void keyboard_init(void) {
     // Clear keyboard buffer
+    wait_queue_init(&key_waiters);
+    tasklet_init(&keyboard_tasklet, keyboard_bottom_half, NULL);
     keyboard_buffer_head = 0;
     keyboard_buffer_tail = 0;
     keyboard_shift_pressed = 0;
@@ -89,6 +117,9 @@ void keyboard_init(void) {
     // Enable keyboard
     keyboard_write(0xF4);
     keyboard_read(); // ACK
+
+    irq_install_handler(1, keyboard_irq_handler);
+    irq_unmask(1);
 }
 
 void keyboard_enable(void) {
@@ -140,11 +171,14 @@ void keyboard_process_scancode(uint8_t scancode) {
     char ascii = scancode_to_ascii(scancode);
     if (ascii != 0) {
         // Add to buffer
+        uint64_t flags = spin_lock_irqsave(&keyboard_lock);
         int next_head = (keyboard_buffer_head + 1) % 256;
         if (next_head != keyboard_buffer_tail) {
             keyboard_buffer[keyboard_buffer_head] = ascii;
             keyboard_buffer_head = next_head;
         }
+        spin_unlock_irqrestore(&keyboard_lock, flags);
+        wake_up_all(&key_waiters);
     }
 }
 
@@ -162,15 +196,28 @@ char scancode_to_ascii(uint8_t scancode) {
 
 // Get next character from keyboard buffer
 char keyboard_get_char(void) {
-    if (keyboard_buffer_head == keyboard_buffer_tail) {
-        return 0; // Buffer empty
+    uint64_t flags = spin_lock_irqsave(&keyboard_lock);
+    char ch = 0; // Buffer empty
+    if (keyboard_buffer_head != keyboard_buffer_tail) {
+        ch = keyboard_buffer[keyboard_buffer_tail];
+        keyboard_buffer_tail = (keyboard_buffer_tail + 1) % 256;
     }
-    
-    char ch = keyboard_buffer[keyboard_buffer_tail];
-    keyboard_buffer_tail = (keyboard_buffer_tail + 1) % 256;
+    spin_unlock_irqrestore(&keyboard_lock, flags);
     return ch;
 }
 
+// Get the next character, blocking until there is one
+char keyboard_wait_char(void) {
+    for (;;) {
+        wait_event(&key_waiters, keyboard_has_data());
+        char ch = keyboard_get_char();
+        if (ch) {
+            return ch;
+        }
+        // Another reader got there first
+    }
+}
+
 // Check if keyboard buffer has data
 int keyboard_has_data(void) {
     return keyboard_buffer_head != keyboard_buffer_tail;
@@ -16,6 +16,7 @@ void keyboard_disable(void);
 void keyboard_process_scancode(uint8_t scancode);
 char scancode_to_ascii(uint8_t scancode);
 char keyboard_get_char(void);
+char keyboard_wait_char(void);
 int keyboard_has_data(void);
 
 #endif // _KEYBOARD_H
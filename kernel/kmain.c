@@ -10,10 +10,24 @@
 #include "window.h"
 #include "desktop.h"
 #include "idt.h"
+#include "gdt.h"
+#include "serial.h"
+#include "timer.h"
+#include "cpu.h"
 #include "mm/mm.h"
+#include "mm/pmm.h"
+#include "mm/vmm.h"
+#include "mm/arena.h"
 #include "process.h"
+#include "ipc.h"
+#include "softirq.h"
+#include "acpi.h"
+#include "smp.h"
+#include "user.h"
+#include "vdso.h"
 #include "fs.h"
 #include "ui.h"
+#include "system_monitor.h"
 
 // Forward declarations
 void init_graphics(uint32_t *framebuffer, uint32_t width, uint32_t height);
@@ -24,6 +38,22 @@ extern void irq0_stub(void);
 extern void irq1_stub(void);
 extern void irq12_stub(void);
 
+#define MULTIBOOT2_BOOTLOADER_MAGIC 0x36d76289
+
+#define MULTIBOOT_TAG_TYPE_END           0
+#define MULTIBOOT_TAG_TYPE_BASIC_MEMINFO 4
+#define MULTIBOOT_TAG_TYPE_MMAP          6
+#define MULTIBOOT_TAG_TYPE_FRAMEBUFFER   8
+#define MULTIBOOT_TAG_TYPE_ACPI_OLD      14
+#define MULTIBOOT_TAG_TYPE_ACPI_NEW      15
+
+#define MULTIBOOT_MEMORY_AVAILABLE 1
+
+struct multiboot_info {
+    uint32_t total_size;
+    uint32_t reserved;
+};
+
 struct multiboot_tag {
     uint32_t type;
     uint32_t size;
@@ -36,6 +66,21 @@ struct multiboot_tag_basic_meminfo {
     uint32_t mem_upper;
 };
 
+struct multiboot_mmap_entry {
+    uint64_t addr;
+    uint64_t len;
+    uint32_t type;
+    uint32_t zero;
+};
+
+struct multiboot_tag_mmap {
+    uint32_t type;
+    uint32_t size;
+    uint32_t entry_size;
+    uint32_t entry_version;
+    struct multiboot_mmap_entry entries[];
+};
+
 struct multiboot_tag_framebuffer {
     uint32_t type;
     uint32_t size;
@@ -48,16 +93,32 @@ struct multiboot_tag_framebuffer {
     uint16_t reserved;
 };
 
+// Mouse bytes on their way from IRQ12 to the mouse tasklet
+static irq_ring_t mouse_ring;
+static tasklet_t mouse_tasklet;
+
+// IRQ12 top half: just take the byte
 void mouse_irq_handler(void) {
+    irq_ring_put(&mouse_ring, mouse_read());
+    tasklet_schedule(&mouse_tasklet);
+}
+
+// Bottom half: assemble packets. The assembly state is only touched here,
+// and a tasklet never runs twice at once; the position it feeds is locked
+// in mouse.c.
+static void mouse_bottom_half(void* data) {
     static uint8_t packet[3];
     static int packet_index = 0;
-    uint8_t data = mouse_read();
-    packet[packet_index++] = data;
-    if (packet_index == 3) {
-        int8_t dx = packet[1];
-        int8_t dy = packet[2];
-        mouse_process_packet(dx, dy);
-        packet_index = 0;
+    (void)data;
+    uint8_t byte;
+    while (irq_ring_get(&mouse_ring, &byte)) {
+        packet[packet_index++] = byte;
+        if (packet_index == 3) {
+            int8_t dx = packet[1];
+            int8_t dy = packet[2];
+            mouse_process_packet(dx, dy);
+            packet_index = 0;
+        }
     }
 }
 
@@ -69,14 +130,73 @@ void debug_print(const char* message, uint32_t length);
 // In the kernel_main function, add this as the first line:
 debug_print("Kernel starting...\n", 18);
 
-void kernel_main(void) {
+#define MAX_BOOT_REGIONS 32
+
+// Desktop frame period: the main loop sleeps this long between frames
+#define KMAIN_FRAME_MS 16
+
+// Per-frame scratch memory (see mm/arena.h)
+arena_t* frame_arena = NULL;
+
+// Collect the usable RAM regions from the multiboot2 information structure,
+// along with the bootloader's copy of the ACPI RSDP when it passes one
+static int parse_multiboot(uint32_t magic, uint64_t mbi_addr, uint32_t *mem_upper,
+                           uint64_t *rsdp, pmm_region_t *regions, int max_regions) {
+    if (magic != MULTIBOOT2_BOOTLOADER_MAGIC || !mbi_addr) {
+        printf("No multiboot2 information (magic 0x%x)\n", magic);
+        return 0;
+    }
+
+    struct multiboot_info *mbi = (struct multiboot_info *)(uintptr_t)mbi_addr;
+    uint8_t *end = (uint8_t *)mbi + mbi->total_size;
+    int count = 0;
+
+    // Tags start after the 8-byte fixed part and are 8-byte aligned
+    for (struct multiboot_tag *tag = (struct multiboot_tag *)(mbi + 1);
+         (uint8_t *)tag < end && tag->type != MULTIBOOT_TAG_TYPE_END;
+         tag = (struct multiboot_tag *)((uint8_t *)tag + ((tag->size + 7) & ~7))) {
+        if (tag->type == MULTIBOOT_TAG_TYPE_BASIC_MEMINFO) {
+            *mem_upper = ((struct multiboot_tag_basic_meminfo *)tag)->mem_upper;
+        } else if (tag->type == MULTIBOOT_TAG_TYPE_ACPI_NEW ||
+                   (tag->type == MULTIBOOT_TAG_TYPE_ACPI_OLD && !*rsdp)) {
+            // The RSDP follows the tag header; prefer the ACPI 2.0 one
+            *rsdp = (uint64_t)(uintptr_t)(tag + 1);
+        } else if (tag->type == MULTIBOOT_TAG_TYPE_MMAP) {
+            struct multiboot_tag_mmap *mmap = (struct multiboot_tag_mmap *)tag;
+            for (uint8_t *entry = (uint8_t *)mmap->entries;
+                 entry < (uint8_t *)tag + tag->size && count < max_regions;
+                 entry += mmap->entry_size) {
+                struct multiboot_mmap_entry *e = (struct multiboot_mmap_entry *)entry;
+                if (e->type == MULTIBOOT_MEMORY_AVAILABLE) {
+                    regions[count].base = e->addr;
+                    regions[count].length = e->len;
+                    count++;
+                }
+            }
+        }
+    }
+    return count;
+}
+
+void kernel_main(uint32_t magic, uint64_t mbi_addr) {
     // Early debug output
+    serial_init();
     printf("MyOS Kernel Starting...\n");
     
-    // For now, use default values since we're in simple 32-bit mode
-    uint32_t mem_upper = 64 * 1024; // Default to 64MB
+    // Use the bootloader's memory information when we have it
+    uint32_t mem_upper = 0;
+    uint64_t rsdp = 0;
+    pmm_region_t usable[MAX_BOOT_REGIONS];
+    int usable_count = parse_multiboot(magic, mbi_addr, &mem_upper, &rsdp,
+                                       usable, MAX_BOOT_REGIONS);
     
-    printf("Initializing in 32-bit mode...\n");
+    if (usable_count == 0) {
+        // Fall back to 64MB of RAM above 1MB
+        mem_upper = 64 * 1024;
+        usable[0].base = 0x100000;
+        usable[0].length = (uint64_t)mem_upper * 1024;
+        usable_count = 1;
+    }
 
     // Set up default framebuffer for VGA mode
     framebuffer = (uint32_t *)0xA0000; // VGA memory
@@ -89,6 +209,24 @@ void kernel_main(void) {
     init_graphics(framebuffer, fb_width, fb_height);
     printf("Graphics initialized.\n");
     
+    // Initialize the physical frame allocator, keeping the multiboot info intact
+    pmm_region_t reserved[1];
+    int reserved_count = 0;
+    if (magic == MULTIBOOT2_BOOTLOADER_MAGIC && mbi_addr) {
+        reserved[0].base = mbi_addr;
+        reserved[0].length = ((struct multiboot_info *)(uintptr_t)mbi_addr)->total_size;
+        reserved_count = 1;
+    }
+    pmm_init(usable, usable_count, reserved, reserved_count);
+
+    // The heap is demand-paged, so the page fault handler must be in place
+    // before the first allocation
+    gdt_init();
+    smp_init_bsp();
+    idt_init();
+    pic_remap();
+    vmm_init();
+    
     // Initialize memory manager
     printf("Initializing memory manager...\n");
     if (mem_upper > 0) {
@@ -98,72 +236,98 @@ void kernel_main(void) {
         mm_init(64 * 1024);
     }
     printf("Memory manager initialized.\n");
+    frame_arena = arena_create(ARENA_FRAME_SIZE);
+
+    // Firmware tables, for the processor list the AP bring-up below needs
+    acpi_init(rsdp);
     
     // Initialize text system
     text_set_framebuffer(framebuffer, fb_width, fb_height);
 
-    // Initialize IDT and PIC
-    idt_init();
-    pic_remap();
+    // Bottom halves first: every interrupt handler ends in irq_exit
+    softirq_init();
+
+    // Mouse IRQ (the IDT and PIC were set up before the heap)
     idt_set_gate(32+12, (uint64_t)irq12_stub, 0x08, 0x8E); // IRQ12
+    tasklet_init(&mouse_tasklet, mouse_bottom_half, NULL);
     irq_install_handler(12, mouse_irq_handler);
 
-    // Initialize process management
+    // Initialize process management and the tick that drives preemption
     process_init();
+    timer_init(TIMER_HZ);
+    process_usage_start();
+    user_init();
+    vdso_init();
+
+    // Start the other processors; each comes up with its own run queue and
+    // idle task, ticking from its local APIC timer
+    smp_init();
+    softirq_start_threads();
     
     // Initialize filesystem
     fs_init();
     
     // Initialize UI system
     ui_init(framebuffer, fb_width, fb_height);
+    system_monitor_init();
     
     // Create a test process
     void test_process(void) {
+        message_t message;
+        process_set_name("sysmsg");
         while (1) {
             // Process system messages
-            process_sleep(100);
+            if (ipc_receive(&message)) {
+                printf("System message %u from PID %u\n", message.type, message.sender);
+            } else {
+                process_sleep(100);
+            }
         }
     }
-    process_create(test_process, 1);
+    process_create(test_process, PROCESS_PRIORITY_DEFAULT);
 
     // Initialize desktop environment
     printf("Starting desktop environment...\n");
     desktop_init(framebuffer, fb_width, fb_height);
     printf("Desktop initialized. Entering main loop...\n");
 
+    // Everything is set up; let the timer (and the other IRQs) in
+    irq_enable();
+
     // Main system loop
     // Removed unused variable
     uint32_t frame_count = 0;
     
     for(;;) {
-        // Handle input
+        // Everything drawn last frame is gone; recycle its scratch memory
+        arena_reset(frame_arena);
+
+        // Handle input and update the UI; the input task changes the same state
+        desktop_lock();
         desktop_handle_input();
-        
-        // Update UI
         ui_update();
+        desktop_unlock();
         
         // Simple frame limiter and status update
         if (frame_count++ % 30 == 0) {  // Update status every 30 frames
-            char status[128];
-            // Get memory stats from MM
-            uint32_t mem_used = 0;  // This should be replaced with actual memory usage
-            uint32_t current_pid = 0;  // This should be replaced with current process ID
+            // Get memory and CPU stats
+            system_monitor_update();
+            uint32_t mem_used = mm_get_used_memory();
+            cpu_stats_t cpu = system_monitor_get_cpu_stats();
             
-            snprintf(status, sizeof(status), "Memory: %u KB | Process: %u", 
-                    mem_used / 1024, 
-                    current_pid);
+            char* status = arena_printf(frame_arena, "Memory: %u KB | CPU: %u%% | Processes: %u", 
+                                        mem_used / 1024, 
+                                        cpu.cpu_usage_percent,
+                                        cpu.processes_total);
             
             // Draw status in top-right corner
             uint32_t status_x = fb_width - (strlen(status) * 8) - 20;
             draw_string(status, status_x, 10, 0xFFFFFF);
         }
         
-        // Simple delay to prevent excessive CPU usage
-        for (volatile int i = 0; i < 100000; i++) {
-            __asm__ volatile("nop");
-        }
-        
-        // Yield to other processes
-        process_yield();
+        // Spare time goes to background work, then sleep until the next
+        // frame so the CPU can idle (and stop its tick) in between
+        process_idle();
+        process_sleep(KMAIN_FRAME_MS);
     }
 }
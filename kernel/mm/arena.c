@@ -0,0 +1,183 @@
+#include "arena.h"
+#include "mm.h"
+#include "string.h"
+#include "stdio.h"
+#include <stdarg.h>
+#include <stdint.h>
+
+// Backing memory comes from kmalloc in blocks; allocations bump 'used'
+typedef struct arena_block {
+    struct arena_block* next;
+    size_t size;   // Usable bytes after the header
+    size_t used;
+    size_t pad;    // Keeps the data 16-byte aligned
+} arena_block_t;
+
+struct arena {
+    arena_block_t* first;
+    arena_block_t* current;
+    size_t block_size;  // Default size of new blocks
+    size_t used;        // Bytes handed out since the last reset
+    size_t peak;
+    uint32_t resets;
+};
+
+static inline size_t align_up(size_t value, size_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+static inline uint8_t* block_data(arena_block_t* block) {
+    return (uint8_t*)(block + 1);
+}
+
+static arena_block_t* block_create(size_t size) {
+    arena_block_t* block = kmalloc(sizeof(arena_block_t) + size);
+    if (!block) {
+        return NULL;
+    }
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+arena_t* arena_create(size_t size) {
+    arena_t* arena = kcalloc(1, sizeof(arena_t));
+    if (!arena) {
+        return NULL;
+    }
+
+    arena->block_size = align_up(size ? size : ARENA_FRAME_SIZE, ARENA_ALIGN);
+    arena->first = block_create(arena->block_size);
+    if (!arena->first) {
+        kfree(arena);
+        return NULL;
+    }
+    arena->current = arena->first;
+    return arena;
+}
+
+void arena_destroy(arena_t* arena) {
+    if (!arena) return;
+
+    arena_block_t* block = arena->first;
+    while (block) {
+        arena_block_t* next = block->next;
+        kfree(block);
+        block = next;
+    }
+    kfree(arena);
+}
+
+// Make sure the current block has 'size' free bytes, moving to (or
+// chaining) another block if it does not
+static int arena_reserve(arena_t* arena, size_t size) {
+    arena_block_t* block = arena->current;
+    if (block->used + size <= block->size) {
+        return 1;
+    }
+
+    if (block->next && block->next->size >= size) {
+        arena->current = block->next;
+        return 1;
+    }
+
+    arena_block_t* fresh = block_create(size > arena->block_size ? align_up(size, ARENA_ALIGN)
+                                                                 : arena->block_size);
+    if (!fresh) {
+        return 0;
+    }
+    fresh->next = block->next;
+    block->next = fresh;
+    arena->current = fresh;
+    return 1;
+}
+
+void* arena_alloc(arena_t* arena, size_t size) {
+    if (!arena) {
+        return NULL;
+    }
+
+    size = align_up(size ? size : 1, ARENA_ALIGN);
+    if (!arena_reserve(arena, size)) {
+        printf("arena_alloc: Out of memory (%u bytes)\n", (uint32_t)size);
+        return NULL;
+    }
+
+    arena_block_t* block = arena->current;
+    void* ptr = block_data(block) + block->used;
+    block->used += size;
+    arena->used += size;
+    return ptr;
+}
+
+// Release everything allocated since the last reset. If the arena had to
+// chain extra blocks, they are replaced by one block big enough for the
+// whole load so the next round is a single bump again.
+void arena_reset(arena_t* arena) {
+    if (!arena) return;
+
+    if (arena->used > arena->peak) {
+        arena->peak = arena->used;
+    }
+    arena->resets++;
+
+    if (arena->first->next) {
+        size_t total = 0;
+        for (arena_block_t* block = arena->first; block; block = block->next) {
+            total += block->size;
+        }
+        arena_block_t* merged = block_create(total);
+        if (merged) {
+            arena_block_t* block = arena->first;
+            while (block) {
+                arena_block_t* next = block->next;
+                kfree(block);
+                block = next;
+            }
+            arena->first = merged;
+            arena->block_size = total;
+        }
+    }
+
+    for (arena_block_t* block = arena->first; block; block = block->next) {
+        block->used = 0;
+    }
+    arena->current = arena->first;
+    arena->used = 0;
+}
+
+// Format a string into the arena
+char* arena_printf(arena_t* arena, const char* format, ...) {
+    static char empty[1] = "";
+    if (!arena || !arena_reserve(arena, ARENA_PRINTF_MAX)) {
+        return empty;
+    }
+
+    // Format in place, then keep only what was written
+    arena_block_t* block = arena->current;
+    char* str = (char*)block_data(block) + block->used;
+
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(str, ARENA_PRINTF_MAX, format, args);
+    va_end(args);
+
+    size_t size = align_up((size_t)length + 1, ARENA_ALIGN);
+    block->used += size;
+    arena->used += size;
+    return str;
+}
+
+void arena_get_stats(arena_t* arena, arena_stats_t* stats) {
+    if (!arena || !stats) return;
+
+    memset(stats, 0, sizeof(arena_stats_t));
+    for (arena_block_t* block = arena->first; block; block = block->next) {
+        stats->capacity += block->size;
+        stats->blocks++;
+    }
+    stats->used = arena->used;
+    stats->peak = arena->peak;
+    stats->resets = arena->resets;
+}
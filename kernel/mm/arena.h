@@ -0,0 +1,33 @@
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define ARENA_ALIGN       16
+#define ARENA_PRINTF_MAX  256          // Longest string arena_printf formats
+#define ARENA_FRAME_SIZE  (16 * 1024)  // Initial size of the per-frame arena
+
+// A bump allocator: allocations are freed all at once by arena_reset
+typedef struct arena arena_t;
+
+typedef struct {
+    size_t capacity;   // Bytes across all blocks
+    size_t used;       // Bytes handed out since the last reset
+    size_t peak;       // Largest 'used' seen at a reset
+    uint32_t blocks;
+    uint32_t resets;
+} arena_stats_t;
+
+// Scratch memory for the frame being drawn, reset by the render loop in kernel_main
+extern arena_t* frame_arena;
+
+// Function declarations
+arena_t* arena_create(size_t size);
+void arena_destroy(arena_t* arena);
+void* arena_alloc(arena_t* arena, size_t size);
+void arena_reset(arena_t* arena);
+char* arena_printf(arena_t* arena, const char* format, ...);  // Never NULL; "" on failure
+void arena_get_stats(arena_t* arena, arena_stats_t* stats);
+
+#endif // _ARENA_H
@@ -1,176 +1,880 @@
 #include "mm.h"
+#include "vmm.h"
 #include "string.h"
 #include "stdio.h"
+#include "../spinlock.h"
 #include <stdint.h>
 
-// Memory map
-#define MAX_MEMORY_ENTRIES 256
-static memory_map_entry_t memory_map[MAX_MEMORY_ENTRIES];
-static uint32_t memory_map_size = 0;
+#ifdef MM_PROFILE
+#include "../cpu.h"
+#include "../serial.h"
+#endif
+
 static uint32_t total_memory = 0;
 static uint32_t used_memory = 0;
 
+// Guards everything below: the bins, the free lists, the counters and the
+// profiler. Blocks are only touched outside it by their owner.
+static spinlock_t heap_lock = SPINLOCK_INIT;
+
+// Every block handed out by kmalloc is preceded by this header so that
+// kfree can tell small (binned) objects from large ones without a lookup
+typedef struct {
+    uint32_t magic;     // MM_BLOCK_MAGIC while the block is allocated
+    uint16_t bin;       // Size class index, or MM_BIN_LARGE
+    uint16_t owner;     // Accounting owner charged for the block (mm_owner_alloc)
+    uint32_t size;      // Small: usable bytes. Large: chunk bytes | CHUNK_* flags
+    uint32_t reserved;  // Profiler callsite index + 1 (MM_PROFILE), else 0
+} block_header_t;
+
+#define MM_BLOCK_MAGIC 0x4B4D454D  // "MEMK"
+#define MM_FREE_MAGIC  0x4B455246  // "FREK"
+#define MM_FENCE_MAGIC 0x4B434E46  // "FNCK"
+#define MM_BIN_LARGE   0xFFFF
+
+// Large chunks carry boundary tags. The header's size field holds the
+// whole chunk size (a multiple of 16) plus flag bits, and a free chunk
+// repeats its size in the last word of the chunk. The next chunk starts at
+// header + size; the previous one is found through its footer, which is
+// only consulted when CHUNK_PREV_USED is clear.
+#define CHUNK_USED      0x1
+#define CHUNK_PREV_USED 0x2
+#define CHUNK_FLAGS     0xF
+
+// A free large chunk: header, free-list links, ..., footer
+typedef struct free_chunk {
+    block_header_t header;
+    struct free_chunk* next;
+    struct free_chunk* prev;
+} free_chunk_t;
+
+#define CHUNK_MIN_SIZE 48  // Header, links and footer, rounded to 16
+
+// Largest request: nothing bigger fits the heap window, and it keeps
+// chunk sizes within their 32 bits
+#define MM_ALLOC_MAX VMM_HEAP_SIZE
+
+// Segregated free lists: list i holds free chunks of [2^i, 2^(i+1)) bytes
+#define MM_NUM_FREE_LISTS 32
+static free_chunk_t* free_lists[MM_NUM_FREE_LISTS];
+static uint32_t free_list_map = 0;  // Bit i set when free_lists[i] is non-empty
+
+// Free objects in a bin are linked through their payload
+typedef struct free_object {
+    struct free_object* next;
+} free_object_t;
+
+// Per-bin free lists and counters
+static free_object_t* bin_free_list[MM_NUM_BINS];
+static mm_bin_stats_t bin_stats[MM_NUM_BINS];
+
+static uint32_t heap_size = 0;
+static uint32_t heap_segments = 0;
+static uint8_t* heap_top = NULL;  // End of the most recently added segment
+
+// krealloc outcomes
+static uint32_t realloc_in_place = 0;
+static uint32_t realloc_moved = 0;
+
+// Whole pages kcalloc cleared through the VMM
+static uint32_t calloc_pages = 0;
+
+// Per-owner accounting: bytes each owner has allocated and not yet freed.
+// An owner's slot is only handed out again once it is released and every
+// block charged to it is gone, so leaks stay visible.
+static uint32_t owner_bytes[MM_OWNERS];
+static uint8_t owner_live[MM_OWNERS];
+static uint32_t (*owner_hook)(void) = NULL;  // Who is allocating; NULL: the kernel
+
+static int heap_grow(size_t min_size);
+
+#ifdef MM_PROFILE
+// Live bytes and counts per allocating callsite, open-addressed by caller
+static mm_profile_site_t profile_sites[MM_PROFILE_SITES];
+static uint32_t profile_untracked = 0;  // Allocations made while the table was full
+
+// Ring of the most recent heap calls, oldest overwritten first. With the
+// pointers it records, a dump can be replayed by tools/mmbench.
+#define TRACE_ALLOC   0
+#define TRACE_CALLOC  1
+#define TRACE_REALLOC 2
+#define TRACE_FREE    3
+
+static const char* const trace_names[] = { "alloc", "calloc", "realloc", "free" };
+
+typedef struct {
+    uint64_t tsc;
+    uintptr_t caller;
+    uintptr_t ptr;      // Block returned (freed, for TRACE_FREE)
+    uintptr_t old_ptr;  // Block passed to krealloc
+    uint32_t size;      // Bytes requested
+    uint32_t op;        // TRACE_*
+} mm_trace_entry_t;
+
+static mm_trace_entry_t profile_trace[MM_PROFILE_TRACE];
+static uint32_t profile_trace_next = 0;
+#endif
+
 // Initialize memory manager
 void mm_init(uint32_t mem_upper) {
-    // Initialize memory map
-    memory_map_size = 1;
-    memory_map[0].start = KERNEL_HEAP_START;
-    memory_map[0].size = KERNEL_HEAP_END - KERNEL_HEAP_START;
-    memory_map[0].type = MEMORY_FREE;
-    
+    // The heap starts empty and grows through the VMM's heap window on demand
+    memset(free_lists, 0, sizeof(free_lists));
+    free_list_map = 0;
+    heap_size = 0;
+    heap_segments = 0;
+    heap_top = NULL;
+
     total_memory = mem_upper * 1024;  // Convert KB to bytes
     used_memory = 0;
-    
+    realloc_in_place = 0;
+    realloc_moved = 0;
+    calloc_pages = 0;
+    memset(owner_bytes, 0, sizeof(owner_bytes));
+    memset(owner_live, 0, sizeof(owner_live));
+
+    // Initialize size classes
+    for (uint32_t i = 0; i < MM_NUM_BINS; i++) {
+        bin_free_list[i] = NULL;
+        memset(&bin_stats[i], 0, sizeof(mm_bin_stats_t));
+        bin_stats[i].object_size = MM_MIN_BIN_SIZE << i;
+    }
+
+    heap_grow(MM_HEAP_GROW_SIZE);
+
     printf("Memory manager initialized. Total memory: %u KB\n", mem_upper);
 }
 
-// Find a free memory block of at least 'size' bytes
-static memory_map_entry_t* find_free_block(size_t size) {
-    for (uint32_t i = 0; i < memory_map_size; i++) {
-        if (memory_map[i].type == MEMORY_FREE && memory_map[i].size >= size) {
-            return &memory_map[i];
+static inline uint32_t chunk_size(block_header_t* chunk) {
+    return chunk->size & ~CHUNK_FLAGS;
+}
+
+static inline block_header_t* chunk_next(block_header_t* chunk) {
+    return (block_header_t*)((uint8_t*)chunk + chunk_size(chunk));
+}
+
+// Only valid when the previous chunk is free (CHUNK_PREV_USED clear)
+static inline block_header_t* chunk_prev(block_header_t* chunk) {
+    uint32_t prev_size = *((uint32_t*)chunk - 1);
+    return (block_header_t*)((uint8_t*)chunk - prev_size);
+}
+
+// Bytes a caller may use in a block
+static inline uint32_t block_usable_size(block_header_t* header) {
+    if (header->bin < MM_NUM_BINS) {
+        return header->size;
+    }
+    return chunk_size(header) - sizeof(block_header_t);
+}
+
+// Chunk size needed to hold 'size' payload bytes
+static inline uint32_t chunk_size_for(size_t size) {
+    uint32_t needed = (sizeof(block_header_t) + size + 15) & ~15;
+    return needed < CHUNK_MIN_SIZE ? CHUNK_MIN_SIZE : needed;
+}
+
+static inline uint32_t free_list_index(uint32_t size) {
+    return 31 - __builtin_clz(size);
+}
+
+static void free_list_insert(block_header_t* header) {
+    free_chunk_t* chunk = (free_chunk_t*)header;
+    uint32_t index = free_list_index(chunk_size(header));
+
+    chunk->prev = NULL;
+    chunk->next = free_lists[index];
+    if (free_lists[index]) {
+        free_lists[index]->prev = chunk;
+    }
+    free_lists[index] = chunk;
+    free_list_map |= 1U << index;
+}
+
+static void free_list_remove(block_header_t* header) {
+    free_chunk_t* chunk = (free_chunk_t*)header;
+    uint32_t index = free_list_index(chunk_size(header));
+
+    if (chunk->prev) {
+        chunk->prev->next = chunk->next;
+    } else {
+        free_lists[index] = chunk->next;
+    }
+    if (chunk->next) {
+        chunk->next->prev = chunk->prev;
+    }
+    if (!free_lists[index]) {
+        free_list_map &= ~(1U << index);
+    }
+}
+
+// Turn an in-use chunk into a free one, merging with free neighbours
+static void chunk_release(block_header_t* chunk) {
+    uint32_t size = chunk_size(chunk);
+    uint32_t prev_used = chunk->size & CHUNK_PREV_USED;
+
+    block_header_t* next = chunk_next(chunk);
+    if (!(next->size & CHUNK_USED)) {
+        free_list_remove(next);
+        size += chunk_size(next);
+    }
+
+    if (!prev_used) {
+        block_header_t* prev = chunk_prev(chunk);
+        free_list_remove(prev);
+        size += chunk_size(prev);
+        prev_used = prev->size & CHUNK_PREV_USED;
+        chunk = prev;
+    }
+
+    chunk->magic = MM_FREE_MAGIC;
+    chunk->bin = MM_BIN_LARGE;
+    chunk->size = size | prev_used;
+    *(uint32_t*)((uint8_t*)chunk + size - sizeof(uint32_t)) = size;
+
+    chunk_next(chunk)->size &= ~CHUNK_PREV_USED;
+    free_list_insert(chunk);
+}
+
+// Trim an in-use chunk to 'size' bytes, freeing the tail if it is big enough
+static void chunk_split(block_header_t* chunk, uint32_t size) {
+    uint32_t excess = chunk_size(chunk) - size;
+    if (excess < CHUNK_MIN_SIZE) {
+        return;
+    }
+
+    block_header_t* tail = (block_header_t*)((uint8_t*)chunk + size);
+    tail->size = excess | CHUNK_USED | CHUNK_PREV_USED;
+    chunk->size = size | (chunk->size & CHUNK_FLAGS);
+    chunk_release(tail);
+}
+
+// Mark a chunk taken off a free list as in use
+static void chunk_claim(block_header_t* chunk) {
+    free_list_remove(chunk);
+    chunk->size |= CHUNK_USED;
+    chunk_next(chunk)->size |= CHUNK_PREV_USED;
+}
+
+// Hand an address range to the heap. The segment ends in a fencepost (a
+// permanently used, header-only chunk) so coalescing never runs off its
+// end. A segment that directly follows the previous one absorbs that
+// segment's fencepost instead.
+static void heap_add_segment(uint8_t* base, uint32_t size) {
+    block_header_t* chunk;
+    uint32_t chunk_bytes = size - sizeof(block_header_t);
+    uint32_t prev_used = CHUNK_PREV_USED;
+
+    if (heap_top && base == heap_top) {
+        chunk = (block_header_t*)base - 1;
+        prev_used = chunk->size & CHUNK_PREV_USED;
+        chunk_bytes = size;
+    } else {
+        chunk = (block_header_t*)base;
+        heap_segments++;
+    }
+
+    block_header_t* fence = (block_header_t*)(base + size) - 1;
+    fence->magic = MM_FENCE_MAGIC;
+    fence->bin = MM_BIN_LARGE;
+    fence->size = sizeof(block_header_t) | CHUNK_USED | CHUNK_PREV_USED;
+    fence->reserved = 0;
+
+    chunk->size = chunk_bytes | CHUNK_USED | prev_used;
+    chunk_release(chunk);
+
+    heap_top = base + size;
+    heap_size += size;
+}
+
+// Extend the heap by at least 'min_size' bytes of address space. The VMM
+// hands out the window contiguously, so each step merges with the last.
+static int heap_grow(size_t min_size) {
+    // Leave room for the segment's fencepost
+    min_size += sizeof(block_header_t);
+    if (min_size < MM_HEAP_GROW_SIZE) {
+        min_size = MM_HEAP_GROW_SIZE;
+    }
+    min_size = (min_size + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+
+    void* segment = vmm_heap_grow(min_size);
+    if (!segment) {
+        return 0;
+    }
+
+    heap_add_segment(segment, (uint32_t)min_size);
+    return 1;
+}
+
+// Map a request size to its size class in constant time
+static inline uint32_t size_to_bin(size_t size) {
+    if (size <= MM_MIN_BIN_SIZE) {
+        return 0;
+    }
+    // Index of the smallest power of two >= size, relative to MM_MIN_BIN_SIZE
+    return (32 - __builtin_clz((uint32_t)size - 1)) - MM_MIN_BIN_SHIFT;
+}
+
+// Find a free chunk of at least 'size' bytes
+static block_header_t* find_free_chunk(uint32_t size) {
+    // First fit within the chunk's own list...
+    uint32_t index = free_list_index(size);
+    for (free_chunk_t* chunk = free_lists[index]; chunk; chunk = chunk->next) {
+        if (chunk_size(&chunk->header) >= size) {
+            return &chunk->header;
         }
     }
-    return NULL;
+
+    // ...otherwise the head of any larger list fits
+    uint32_t larger = index + 1 < MM_NUM_FREE_LISTS ? free_list_map >> (index + 1) : 0;
+    if (!larger) {
+        return NULL;
+    }
+    index += 1 + __builtin_ctz(larger);
+    return &free_lists[index]->header;
 }
 
-// Allocate memory block
-void* kmalloc(size_t size) {
-    // Align size to 4 bytes
-    size = (size + 3) & ~3;
-    
-    memory_map_entry_t* block = find_free_block(size);
-    if (!block) {
-        printf("kmalloc: Out of memory!\n");
+// Allocate a chunk holding 'size' payload bytes
+static block_header_t* large_alloc(size_t size) {
+    uint32_t needed = chunk_size_for(size);
+
+    block_header_t* chunk = find_free_chunk(needed);
+    if (!chunk) {
+        if (!heap_grow(needed)) {
+            return NULL;
+        }
+        chunk = find_free_chunk(needed);
+        if (!chunk) {
+            return NULL;
+        }
+    }
+
+    chunk_claim(chunk);
+    chunk_split(chunk, needed);
+    chunk->bin = MM_BIN_LARGE;
+    chunk->reserved = 0;
+    return chunk;
+}
+
+// Return a chunk to the free lists, coalescing with free neighbours
+static int large_free(block_header_t* chunk) {
+    if (!(chunk->size & CHUNK_USED)) {
+        return 0;
+    }
+    chunk_release(chunk);
+    return 1;
+}
+
+// Resize a large chunk without moving it, growing into a free successor
+static int large_resize(block_header_t* chunk, size_t size) {
+    uint32_t needed = chunk_size_for(size);
+    uint32_t current = chunk_size(chunk);
+
+    if (current < needed) {
+        block_header_t* next = chunk_next(chunk);
+        if ((next->size & CHUNK_USED) || current + chunk_size(next) < needed) {
+            return 0;
+        }
+        chunk_claim(next);
+        chunk->size += chunk_size(next);
+    }
+
+    chunk_split(chunk, needed);
+    return 1;
+}
+
+#ifdef MM_PROFILE
+// Find or claim the table slot for a callsite
+static uint32_t profile_site_index(uintptr_t caller) {
+    uint32_t hash = (uint32_t)(caller >> 2) * 2654435761U;
+    for (uint32_t probe = 0; probe < MM_PROFILE_SITES; probe++) {
+        uint32_t i = (hash + probe) & (MM_PROFILE_SITES - 1);
+        if (profile_sites[i].caller == caller) {
+            return i;
+        }
+        if (profile_sites[i].caller == 0) {
+            profile_sites[i].caller = caller;
+            return i;
+        }
+    }
+    return MM_PROFILE_SITES;
+}
+
+static void profile_alloc(block_header_t* header, uintptr_t caller) {
+    uint32_t size = block_usable_size(header);
+    uint64_t now = rdtsc();
+
+    uint32_t index = profile_site_index(caller);
+    if (index == MM_PROFILE_SITES) {
+        profile_untracked++;
+        header->reserved = 0;
+        return;
+    }
+
+    mm_profile_site_t* site = &profile_sites[index];
+    site->live_bytes += size;
+    site->live_count++;
+    site->allocations++;
+    site->total_bytes += size;
+    site->last_tsc = now;
+    header->reserved = index + 1;
+}
+
+// Adjust a live block's site after it changed size in place
+static void profile_resize(block_header_t* header, uint32_t old_size) {
+    if (header->reserved) {
+        profile_sites[header->reserved - 1].live_bytes += block_usable_size(header) - old_size;
+    }
+}
+
+static void profile_record(uint32_t op, uintptr_t caller, size_t size, void* ptr, void* old_ptr) {
+    mm_trace_entry_t* entry = &profile_trace[profile_trace_next++ & (MM_PROFILE_TRACE - 1)];
+    entry->tsc = rdtsc();
+    entry->caller = caller;
+    entry->ptr = (uintptr_t)ptr;
+    entry->old_ptr = (uintptr_t)old_ptr;
+    entry->size = (uint32_t)size;
+    entry->op = op;
+}
+
+static void profile_free(block_header_t* header) {
+    if (!header->reserved) {
+        return;
+    }
+    mm_profile_site_t* site = &profile_sites[header->reserved - 1];
+    site->live_bytes -= block_usable_size(header);
+    site->live_count--;
+    header->reserved = 0;
+}
+#endif
+
+// Carve a fresh run from the large path into objects for an empty bin
+static int bin_refill(uint32_t bin) {
+    uint32_t stride = sizeof(block_header_t) + bin_stats[bin].object_size;
+    uint32_t run_size = MM_BIN_RUN_SIZE;
+    if (run_size < stride * MM_BIN_MIN_OBJECTS) {
+        run_size = stride * MM_BIN_MIN_OBJECTS;
+    }
+
+    block_header_t* run_chunk = large_alloc(run_size);
+    if (!run_chunk) {
+        return 0;
+    }
+    run_chunk->magic = 0;
+    uint8_t* run = (uint8_t*)(run_chunk + 1);
+
+    // Runs stay owned by their bin; push every slot onto the free list
+    for (uint32_t offset = 0; offset + stride <= run_size; offset += stride) {
+        block_header_t* header = (block_header_t*)(run + offset);
+        header->magic = 0;
+        header->bin = bin;
+        header->size = bin_stats[bin].object_size;
+        header->reserved = 0;
+
+        free_object_t* obj = (free_object_t*)(header + 1);
+        obj->next = bin_free_list[bin];
+        bin_free_list[bin] = obj;
+        bin_stats[bin].free_objects++;
+    }
+
+    bin_stats[bin].runs++;
+    return 1;
+}
+
+// Allocate a block on behalf of 'caller' (recorded by the profiler)
+static void* heap_alloc(size_t size, uintptr_t caller) {
+    if (size == 0) {
+        size = 1;
+    }
+    if (size > MM_ALLOC_MAX) {
+        printf("kmalloc: Request larger than the heap\n");
         return NULL;
     }
-    
-    // If the block is larger than needed, split it
-    if (block->size > size + sizeof(memory_map_entry_t)) {
-        // Create a new free block after the allocated one
-        memory_map_entry_t* new_block = (memory_map_entry_t*)((uint8_t*)block + size + sizeof(memory_map_entry_t));
-        new_block->start = block->start + size + sizeof(memory_map_entry_t);
-        new_block->size = block->size - size - sizeof(memory_map_entry_t);
-        new_block->type = MEMORY_FREE;
-        
-        // Update the current block
-        block->size = size;
-        
-        // Insert the new block into the memory map
-        if (memory_map_size < MAX_MEMORY_ENTRIES - 1) {
-            // Shift existing entries to make room
-            for (uint32_t i = memory_map_size; i > 0; i--) {
-                if (memory_map[i-1].start < new_block->start) {
-                    memory_map[i] = *new_block;
-                    break;
-                }
-                memory_map[i] = memory_map[i-1];
+
+    block_header_t* header;
+
+    if (size <= MM_MAX_BIN_SIZE) {
+        // Small object: pop from the size-class free list
+        uint32_t bin = size_to_bin(size);
+        if (bin_free_list[bin]) {
+            bin_stats[bin].hits++;
+        } else {
+            bin_stats[bin].misses++;
+            if (!bin_refill(bin)) {
+                printf("kmalloc: Out of memory!\n");
+                return NULL;
             }
-            memory_map_size++;
         }
+
+        free_object_t* obj = bin_free_list[bin];
+        bin_free_list[bin] = obj->next;
+        bin_stats[bin].free_objects--;
+
+        header = (block_header_t*)obj - 1;
+    } else {
+        // Large object: a boundary-tagged chunk from the free lists
+        header = large_alloc(size);
+        if (!header) {
+            printf("kmalloc: Out of memory!\n");
+            return NULL;
+        }
+    }
+
+    header->magic = MM_BLOCK_MAGIC;
+    header->owner = owner_hook ? owner_hook() : MM_OWNER_KERNEL;
+    used_memory += block_usable_size(header);
+    owner_bytes[header->owner] += block_usable_size(header);
+
+#ifdef MM_PROFILE
+    profile_alloc(header, caller);
+#else
+    (void)caller;
+#endif
+
+    return header + 1;
+}
+
+// Allocate memory block
+void* kmalloc(size_t size) {
+    uint64_t flags = spin_lock_irqsave(&heap_lock);
+    void* ptr = heap_alloc(size, MM_CALLER());
+#ifdef MM_PROFILE
+    profile_record(TRACE_ALLOC, MM_CALLER(), size, ptr, NULL);
+#endif
+    spin_unlock_irqrestore(&heap_lock, flags);
+    return ptr;
+}
+
+// Return a block to its bin or to the large free lists
+static void heap_free(void* ptr) {
+    if (!ptr) return;
+
+    block_header_t* header = (block_header_t*)ptr - 1;
+    if (header->magic != MM_BLOCK_MAGIC) {
+        printf("kfree: Invalid pointer %p\n", ptr);
+        return;
+    }
+
+#ifdef MM_PROFILE
+    profile_free(header);
+#endif
+
+    header->magic = 0;
+    used_memory -= block_usable_size(header);
+    owner_bytes[header->owner] -= block_usable_size(header);
+
+    if (header->bin < MM_NUM_BINS) {
+        // Small object: push back onto its size-class free list
+        free_object_t* obj = (free_object_t*)ptr;
+        obj->next = bin_free_list[header->bin];
+        bin_free_list[header->bin] = obj;
+        bin_stats[header->bin].free_objects++;
+        return;
+    }
+
+    if (!large_free(header)) {
+        printf("kfree: Invalid pointer %p\n", ptr);
     }
-    
-    block->type = MEMORY_USED;
-    used_memory += block->size;
-    
-    return (void*)(uintptr_t)(block->start);
 }
 
 // Free allocated memory
 void kfree(void* ptr) {
     if (!ptr) return;
-    
-    // Find the memory block
-    for (uint32_t i = 0; i < memory_map_size; i++) {
-        if (memory_map[i].start == (uint32_t)(uintptr_t)ptr) {
-            memory_map[i].type = MEMORY_FREE;
-            used_memory -= memory_map[i].size;
-            
-            // Try to merge with next block if it's free
-            if (i < memory_map_size - 1 && memory_map[i+1].type == MEMORY_FREE) {
-                memory_map[i].size += memory_map[i+1].size + sizeof(memory_map_entry_t);
-                // Remove the next block from the memory map
-                for (uint32_t j = i+1; j < memory_map_size-1; j++) {
-                    memory_map[j] = memory_map[j+1];
-                }
-                memory_map_size--;
-            }
-            
-            // Try to merge with previous block if it's free
-            if (i > 0 && memory_map[i-1].type == MEMORY_FREE) {
-                memory_map[i-1].size += memory_map[i].size + sizeof(memory_map_entry_t);
-                // Remove the current block from the memory map
-                for (uint32_t j = i; j < memory_map_size-1; j++) {
-                    memory_map[j] = memory_map[j+1];
-                }
-                memory_map_size--;
-            }
-            
-            return;
-        }
-    }
-    
-    printf("kfree: Invalid pointer %p\n", ptr);
+
+    uint64_t flags = spin_lock_irqsave(&heap_lock);
+#ifdef MM_PROFILE
+    profile_record(TRACE_FREE, MM_CALLER(), 0, ptr, NULL);
+#endif
+    heap_free(ptr);
+    spin_unlock_irqrestore(&heap_lock, flags);
 }
 
 // Allocate and zero-initialize memory
 void* kcalloc(size_t nmemb, size_t size) {
     size_t total_size = nmemb * size;
-    void* ptr = kmalloc(total_size);
+    if (nmemb && total_size / nmemb != size) {
+        printf("kcalloc: Size overflows\n");
+        return NULL;
+    }
+    uint64_t flags = spin_lock_irqsave(&heap_lock);
+    void* ptr = heap_alloc(total_size, MM_CALLER());
+#ifdef MM_PROFILE
     if (ptr) {
+        profile_record(TRACE_CALLOC, MM_CALLER(), total_size, ptr, NULL);
+    }
+#endif
+    spin_unlock_irqrestore(&heap_lock, flags);
+    if (!ptr) {
+        return NULL;
+    }
+
+    if (total_size < MM_CLEAR_PAGES_MIN) {
         memset(ptr, 0, total_size);
+        return ptr;
     }
+
+    // Large path: only the partial pages at either end are cleared here;
+    // the whole pages in between are swapped for pre-zeroed frames
+    uintptr_t start = (uintptr_t)ptr;
+    uintptr_t end = start + total_size;
+    uintptr_t first_page = (start + PAGE_SIZE - 1) & ~(uintptr_t)(PAGE_SIZE - 1);
+    uintptr_t last_page = end & ~(uintptr_t)(PAGE_SIZE - 1);
+    memset(ptr, 0, first_page - start);
+    vmm_heap_clear((void*)first_page, last_page - first_page);
+    memset((void*)last_page, 0, end - last_page);
+    __atomic_fetch_add(&calloc_pages, (last_page - first_page) / PAGE_SIZE, __ATOMIC_RELAXED);
     return ptr;
 }
 
-// Reallocate memory block
-void* krealloc(void* ptr, size_t size) {
+// Resize a block on behalf of 'caller', moving it only when it cannot
+// change size in place
+static void* heap_realloc(void* ptr, size_t size, uintptr_t caller) {
     if (!ptr) {
-        return kmalloc(size);
+        return heap_alloc(size, caller);
     }
-    
+
     if (size == 0) {
-        kfree(ptr);
+        heap_free(ptr);
         return NULL;
     }
-    
-    // Find the memory block
-    for (uint32_t i = 0; i < memory_map_size; i++) {
-        if (memory_map[i].start == (uint32_t)(uintptr_t)ptr) {
-            if (memory_map[i].size >= size) {
-                // If the block is already large enough, return it as is
-                return ptr;
-            }
-            
-            // Allocate a new block
-            void* new_ptr = kmalloc(size);
-            if (new_ptr) {
-                // Copy the old data to the new block
-                memcpy(new_ptr, ptr, memory_map[i].size);
-                // Free the old block
-                kfree(ptr);
+    if (size > MM_ALLOC_MAX) {
+        printf("krealloc: Request larger than the heap\n");
+        return NULL;
+    }
+
+    block_header_t* header = (block_header_t*)ptr - 1;
+    if (header->magic != MM_BLOCK_MAGIC) {
+        printf("krealloc: Invalid pointer %p\n", ptr);
+        return NULL;
+    }
+
+    uint32_t old_size = block_usable_size(header);
+
+    if (header->bin < MM_NUM_BINS) {
+        // If the block is already large enough, return it as is
+        if (old_size >= size) {
+            return ptr;
+        }
+    } else if (large_resize(header, size)) {
+        // Grown into the free successor (or shrunk) without copying
+        used_memory += block_usable_size(header) - old_size;
+        owner_bytes[header->owner] += block_usable_size(header) - old_size;
+#ifdef MM_PROFILE
+        profile_resize(header, old_size);
+#endif
+        realloc_in_place++;
+        return ptr;
+    }
+
+    // Allocate a new block
+    void* new_ptr = heap_alloc(size, caller);
+    if (new_ptr) {
+        // Copy the old data to the new block
+        memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+        // Free the old block
+        heap_free(ptr);
+        realloc_moved++;
+    }
+    return new_ptr;
+}
+
+// Reallocate memory block
+void* krealloc(void* ptr, size_t size) {
+    uint64_t flags = spin_lock_irqsave(&heap_lock);
+    void* new_ptr = heap_realloc(ptr, size, MM_CALLER());
+#ifdef MM_PROFILE
+    profile_record(TRACE_REALLOC, MM_CALLER(), size, new_ptr, ptr);
+#endif
+    spin_unlock_irqrestore(&heap_lock, flags);
+    return new_ptr;
+}
+
+// Bytes currently handed out by kmalloc
+uint32_t mm_get_used_memory(void) {
+    return used_memory;
+}
+
+// Tell the heap who is allocating. The hook runs with the heap locked and
+// must return an owner below MM_OWNERS.
+void mm_set_owner_hook(uint32_t (*hook)(void)) {
+    owner_hook = hook;
+}
+
+// A fresh accounting owner, or MM_OWNER_KERNEL when all are taken
+uint32_t mm_owner_alloc(void) {
+    uint32_t owner = MM_OWNER_KERNEL;
+    uint64_t flags = spin_lock_irqsave(&heap_lock);
+    for (uint32_t i = MM_OWNER_KERNEL + 1; i < MM_OWNERS; i++) {
+        if (!owner_live[i] && owner_bytes[i] == 0) {
+            owner_live[i] = 1;
+            owner = i;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&heap_lock, flags);
+    return owner;
+}
+
+// Give an owner up. Blocks still charged to it keep its slot out of use
+// until they are freed.
+void mm_owner_release(uint32_t owner) {
+    if (owner == MM_OWNER_KERNEL || owner >= MM_OWNERS) {
+        return;
+    }
+    uint64_t flags = spin_lock_irqsave(&heap_lock);
+    owner_live[owner] = 0;
+    spin_unlock_irqrestore(&heap_lock, flags);
+}
+
+// Heap bytes an owner has allocated and not freed
+uint32_t mm_owner_bytes(uint32_t owner) {
+    return owner < MM_OWNERS ? owner_bytes[owner] : 0;
+}
+
+void mm_get_heap_stats(mm_heap_stats_t* stats) {
+    if (!stats) {
+        return;
+    }
+    memset(stats, 0, sizeof(mm_heap_stats_t));
+    uint64_t flags = spin_lock_irqsave(&heap_lock);
+    stats->heap_size = heap_size;
+    stats->used = used_memory;
+    stats->segments = heap_segments;
+    stats->realloc_in_place = realloc_in_place;
+    stats->realloc_moved = realloc_moved;
+
+    for (uint32_t i = 0; i < MM_NUM_FREE_LISTS; i++) {
+        for (free_chunk_t* chunk = free_lists[i]; chunk; chunk = chunk->next) {
+            uint32_t size = chunk_size(&chunk->header);
+            stats->free_bytes += size;
+            stats->free_chunks++;
+            if (size > stats->largest_free) {
+                stats->largest_free = size;
             }
-            return new_ptr;
         }
     }
-    
-    printf("krealloc: Invalid pointer %p\n", ptr);
-    return NULL;
+    for (uint32_t i = 0; i < MM_NUM_BINS; i++) {
+        stats->bin_free_bytes += bin_stats[i].free_objects * bin_stats[i].object_size;
+    }
+    spin_unlock_irqrestore(&heap_lock, flags);
+}
+
+// Copy out the counters for one size class
+int mm_get_bin_stats(uint32_t bin, mm_bin_stats_t* stats) {
+    if (bin >= MM_NUM_BINS || !stats) {
+        return 0;
+    }
+    uint64_t flags = spin_lock_irqsave(&heap_lock);
+    *stats = bin_stats[bin];
+    spin_unlock_irqrestore(&heap_lock, flags);
+    return 1;
 }
 
 // Print memory statistics
 void mm_print_stats(void) {
+    uint64_t flags = spin_lock_irqsave(&heap_lock);
     printf("Memory Statistics:\n");
     printf("  Total memory: %u KB\n", total_memory / 1024);
+    printf("  Heap size: %u KB\n", heap_size / 1024);
     printf("  Used memory: %u KB\n", used_memory / 1024);
     printf("  Free memory: %u KB\n", (total_memory - used_memory) / 1024);
-    
-    printf("\nMemory Map (%d entries):\n", memory_map_size);
-    for (uint32_t i = 0; i < memory_map_size; i++) {
-        printf("  0x%08x - 0x%08x: %s (%u bytes)\n",
-               memory_map[i].start,
-               memory_map[i].start + memory_map[i].size - 1,
-               memory_map[i].type == MEMORY_FREE ? "FREE" : "USED",
-               memory_map[i].size);
+
+    printf("\nSize classes:\n");
+    for (uint32_t i = 0; i < MM_NUM_BINS; i++) {
+        printf("  %u bytes: %u hits, %u misses, %u free, %u runs\n",
+               bin_stats[i].object_size,
+               bin_stats[i].hits,
+               bin_stats[i].misses,
+               bin_stats[i].free_objects,
+               bin_stats[i].runs);
+    }
+
+    printf("\nFree lists (%u segments):\n", heap_segments);
+    for (uint32_t i = 0; i < MM_NUM_FREE_LISTS; i++) {
+        if (!free_lists[i]) {
+            continue;
+        }
+        uint32_t count = 0;
+        uint32_t bytes = 0;
+        for (free_chunk_t* chunk = free_lists[i]; chunk; chunk = chunk->next) {
+            count++;
+            bytes += chunk_size(&chunk->header);
+        }
+        printf("  %u+ bytes: %u chunks, %u KB\n", 1U << i, count, bytes / 1024);
+    }
+    printf("  krealloc: %u in place, %u moved\n", realloc_in_place, realloc_moved);
+    printf("  kcalloc: %u whole pages cleared by the VMM\n", calloc_pages);
+    spin_unlock_irqrestore(&heap_lock, flags);
+}
+
+#ifdef MM_PROFILE
+// Copy out up to 'max' callsites with live allocations, largest first
+int mm_profile_top(mm_profile_site_t* sites, int max) {
+    int count = 0;
+    uint64_t flags = spin_lock_irqsave(&heap_lock);
+    for (uint32_t i = 0; i < MM_PROFILE_SITES; i++) {
+        mm_profile_site_t* site = &profile_sites[i];
+        if (!site->caller || !site->live_count) {
+            continue;
+        }
+
+        // Insertion into the sorted output, dropping the smallest when full
+        int pos = count < max ? count++ : max;
+        while (pos > 0 && sites[pos - 1].live_bytes < site->live_bytes) {
+            if (pos < max) {
+                sites[pos] = sites[pos - 1];
+            }
+            pos--;
+        }
+        if (pos < max) {
+            sites[pos] = *site;
+        }
+    }
+    spin_unlock_irqrestore(&heap_lock, flags);
+    return count;
+}
+
+// Write every callsite and the call trace to COM1 for tools/heapprof.py
+// to symbolize against kernel.elf (or tools/mmbench to replay)
+void mm_profile_dump(void) {
+    uint64_t flags = spin_lock_irqsave(&heap_lock);
+    serial_printf("mmprof begin used=%u heap=%u untracked=%u\n",
+                  used_memory, heap_size, profile_untracked);
+
+    for (uint32_t i = 0; i < MM_PROFILE_SITES; i++) {
+        mm_profile_site_t* site = &profile_sites[i];
+        if (!site->caller) {
+            continue;
+        }
+        serial_write("site ");
+        serial_write_hex(site->caller);
+        serial_printf(" %u %u %u %u\n", site->live_bytes, site->live_count,
+                      site->allocations, site->total_bytes);
+    }
+
+    uint32_t first = profile_trace_next > MM_PROFILE_TRACE ? profile_trace_next - MM_PROFILE_TRACE : 0;
+    for (uint32_t n = first; n < profile_trace_next; n++) {
+        mm_trace_entry_t* entry = &profile_trace[n & (MM_PROFILE_TRACE - 1)];
+        serial_write(trace_names[entry->op]);
+        serial_write(" ");
+        serial_write_hex(entry->tsc);
+        serial_write(" ");
+        serial_write_hex(entry->caller);
+        serial_printf(" %u ", entry->size);
+        serial_write_hex(entry->ptr);
+        serial_write(" ");
+        serial_write_hex(entry->old_ptr);
+        serial_write("\n");
     }
+
+    serial_write("mmprof end\n");
+    spin_unlock_irqrestore(&heap_lock, flags);
+}
+#else
+int mm_profile_top(mm_profile_site_t* sites, int max) {
+    (void)sites;
+    (void)max;
+    return -1;
+}
+
+void mm_profile_dump(void) {
 }
+#endif
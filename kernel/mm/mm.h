@@ -6,19 +6,63 @@
 
 // Memory management constants
 #define PAGE_SIZE 4096
-#define KERNEL_HEAP_START 0x1000000  // 16MB
-#define KERNEL_HEAP_END   0x2000000  // 32MB
+#define MM_HEAP_GROW_SIZE (1024 * 1024)  // Minimum bytes of address space added per growth step
 
-// Memory map entry types
-#define MEMORY_FREE 0
-#define MEMORY_USED 1
+// Size classes: power-of-two bins from MM_MIN_BIN_SIZE to MM_MAX_BIN_SIZE
+#define MM_MIN_BIN_SHIFT   4
+#define MM_MIN_BIN_SIZE    (1 << MM_MIN_BIN_SHIFT)   // 16 bytes
+#define MM_NUM_BINS        8
+#define MM_MAX_BIN_SIZE    (MM_MIN_BIN_SIZE << (MM_NUM_BINS - 1))  // 2KB
+#define MM_BIN_RUN_SIZE    (4 * PAGE_SIZE)  // Bytes carved per bin refill
+#define MM_BIN_MIN_OBJECTS 8                // Minimum objects per refill
 
-// Memory map entry structure
+// kcalloc clears whole pages of allocations this large with pre-zeroed frames
+#define MM_CLEAR_PAGES_MIN (4 * PAGE_SIZE)
+
+// Per size-class counters
+typedef struct {
+    uint32_t object_size;   // Usable bytes per object
+    uint32_t hits;          // Allocations served from the free list
+    uint32_t misses;        // Allocations that had to refill the bin
+    uint32_t free_objects;  // Objects currently on the free list
+    uint32_t runs;          // Runs carved from the large-object path
+} mm_bin_stats_t;
+
+// Whole-heap counters, for fragmentation measurements
+typedef struct {
+    uint32_t heap_size;         // Bytes of address space in the heap
+    uint32_t used;              // Bytes handed out
+    uint32_t segments;          // Discontiguous heap segments
+    uint32_t free_bytes;        // Bytes in free large chunks
+    uint32_t free_chunks;       // Free large chunks
+    uint32_t largest_free;      // Bytes in the largest free chunk
+    uint32_t bin_free_bytes;    // Bytes idle on the size-class free lists
+    uint32_t realloc_in_place;  // krealloc calls resized without copying
+    uint32_t realloc_moved;     // krealloc calls that copied
+} mm_heap_stats_t;
+
+// Heap accounting: every block is charged to whoever allocated it, as
+// reported by the owner hook (the process system installs one). Owner 0 is
+// the kernel itself.
+#define MM_OWNERS       1024
+#define MM_OWNER_KERNEL 0
+
+// Heap profiler, compiled in with 'make MM_PROFILE=1'
+#define MM_PROFILE_SITES 256  // Callsite table slots (power of two)
+#define MM_PROFILE_TRACE 4096 // Recent heap calls kept for the dump (power of two)
+
+// Address of the allocating call, as recorded by the profiler
+#define MM_CALLER() ((uintptr_t)__builtin_return_address(0))
+
+// Per-callsite heap usage
 typedef struct {
-    uint32_t start;
-    uint32_t size;
-    uint8_t type;
-} memory_map_entry_t;
+    uintptr_t caller;       // Return address of the kmalloc/kcalloc/krealloc call
+    uint32_t live_bytes;    // Bytes currently allocated from this site
+    uint32_t live_count;    // Blocks currently allocated from this site
+    uint32_t allocations;   // Allocations since boot
+    uint32_t total_bytes;   // Bytes allocated since boot
+    uint64_t last_tsc;      // Time-stamp counter at the latest allocation
+} mm_profile_site_t;
 
 // Function declarations
 void mm_init(uint32_t mem_upper);
@@ -27,5 +71,14 @@ void kfree(void* ptr);
 void* kcalloc(size_t nmemb, size_t size);
 void* krealloc(void* ptr, size_t size);
 void mm_print_stats(void);
+int mm_get_bin_stats(uint32_t bin, mm_bin_stats_t* stats);
+uint32_t mm_get_used_memory(void);
+void mm_set_owner_hook(uint32_t (*hook)(void));
+uint32_t mm_owner_alloc(void);
+void mm_owner_release(uint32_t owner);
+uint32_t mm_owner_bytes(uint32_t owner);
+void mm_get_heap_stats(mm_heap_stats_t* stats);
+int mm_profile_top(mm_profile_site_t* sites, int max);  // -1 when the profiler is not built in
+void mm_profile_dump(void);
 
 #endif // _MM_H
@@ -0,0 +1,420 @@
+#include "pmm.h"
+#include "string.h"
+#include "stdio.h"
+#include "../spinlock.h"
+#include <stdint.h>
+
+// Kernel image bounds (from the linker script)
+extern uint8_t _kernel_start[];
+extern uint8_t _kernel_end[];
+
+// Free blocks are linked through their first frame
+typedef struct pmm_block {
+    struct pmm_block* next;
+    struct pmm_block* prev;
+} pmm_block_t;
+
+// Per-frame state: only the head frame of a block is tagged
+#define PMM_FRAME_FREE      0x80
+#define PMM_FRAME_ALLOCATED 0x40
+#define PMM_FRAME_ORDER     0x0F
+
+#define PMM_MAX_RESERVED 16
+#define PMM_MAX_USABLE   32
+
+static pmm_block_t* free_area[PMM_NUM_ORDERS];
+static uint8_t* frame_info = NULL;
+static uint32_t frame_count = 0;
+static pmm_stats_t pmm_stats;
+static spinlock_t pmm_lock = SPINLOCK_INIT;  // Free lists, zeroed pool and counters
+
+static pmm_region_t reserved_regions[PMM_MAX_RESERVED];
+static int reserved_region_count = 0;
+
+// Usable RAM is remembered so frames above the mapped limit can be
+// released once the VMM maps them
+static pmm_region_t usable_regions[PMM_MAX_USABLE];
+static int usable_region_count = 0;
+static uint64_t memory_end = 0;               // Highest usable address
+static uint64_t mapped_limit = PMM_MAPPED_LIMIT;  // Frames below this are accessible
+
+// Frames known to be all zeroes. They are allocated as far as the buddy
+// lists are concerned and are only linked here, so the pool itself never
+// dirties them.
+static void* zero_pool[PMM_ZERO_POOL_MAX];
+
+static inline uint32_t addr_to_frame(uintptr_t addr) {
+    return (uint32_t)(addr / PMM_FRAME_SIZE);
+}
+
+static inline pmm_block_t* frame_to_block(uint32_t frame) {
+    return (pmm_block_t*)((uintptr_t)frame * PMM_FRAME_SIZE);
+}
+
+static void free_list_push(uint32_t frame, uint32_t order) {
+    pmm_block_t* block = frame_to_block(frame);
+    block->prev = NULL;
+    block->next = free_area[order];
+    if (free_area[order]) {
+        free_area[order]->prev = block;
+    }
+    free_area[order] = block;
+    frame_info[frame] = PMM_FRAME_FREE | order;
+    pmm_stats.free_blocks[order]++;
+    pmm_stats.free_frames += 1U << order;
+}
+
+static void free_list_remove(uint32_t frame, uint32_t order) {
+    pmm_block_t* block = frame_to_block(frame);
+    if (block->prev) {
+        block->prev->next = block->next;
+    } else {
+        free_area[order] = block->next;
+    }
+    if (block->next) {
+        block->next->prev = block->prev;
+    }
+    frame_info[frame] = 0;
+    pmm_stats.free_blocks[order]--;
+    pmm_stats.free_frames -= 1U << order;
+}
+
+// Free a block, merging with its buddy for as long as the buddy is free
+static void buddy_free(uint32_t frame, uint32_t order) {
+    // Merging into a lower buddy must not leave this frame tagged as allocated
+    frame_info[frame] = 0;
+    while (order < PMM_MAX_ORDER) {
+        uint32_t buddy = frame ^ (1U << order);
+        if (buddy >= frame_count || frame_info[buddy] != (PMM_FRAME_FREE | order)) {
+            break;
+        }
+        free_list_remove(buddy, order);
+        frame &= ~(1U << order);
+        order++;
+    }
+    free_list_push(frame, order);
+}
+
+// Hand the frames of [start, end) to the allocator in maximal aligned blocks
+static void release_range(uint64_t start, uint64_t end) {
+    uint32_t frame = addr_to_frame(start);
+    uint32_t last = addr_to_frame(end);
+
+    while (frame < last) {
+        uint32_t order = PMM_MAX_ORDER;
+        while (order > 0 && ((frame & ((1U << order) - 1)) || frame + (1U << order) > last)) {
+            order--;
+        }
+        pmm_stats.total_frames += 1U << order;
+        buddy_free(frame, order);
+        frame += 1U << order;
+    }
+}
+
+// Walk the parts of [start, end) not covered by reserved regions
+typedef int (*range_fn_t)(uint64_t start, uint64_t end, void* arg);
+
+static int for_each_unreserved(uint64_t start, uint64_t end, int index, range_fn_t fn, void* arg) {
+    // Only whole frames inside the identity-mapped window are usable
+    start = (start + PMM_FRAME_SIZE - 1) & ~(uint64_t)(PMM_FRAME_SIZE - 1);
+    end &= ~(uint64_t)(PMM_FRAME_SIZE - 1);
+    if (end > mapped_limit) end = mapped_limit;
+    if (start >= end) return 0;
+
+    for (; index < reserved_region_count; index++) {
+        uint64_t r_start = reserved_regions[index].base;
+        uint64_t r_end = r_start + reserved_regions[index].length;
+        if (r_end <= start || r_start >= end) {
+            continue;
+        }
+        // Split around the reserved region
+        if (for_each_unreserved(start, r_start, index + 1, fn, arg)) return 1;
+        return for_each_unreserved(r_end, end, index + 1, fn, arg);
+    }
+    return fn(start, end, arg);
+}
+
+static int place_frame_info(uint64_t start, uint64_t end, void* arg) {
+    uint64_t needed = *(uint64_t*)arg;
+    if (end - start < needed) {
+        return 0;
+    }
+    frame_info = (uint8_t*)(uintptr_t)start;
+    return 1;
+}
+
+static int release_cb(uint64_t start, uint64_t end, void* arg) {
+    (void)arg;
+    release_range(start, end);
+    return 0;
+}
+
+static void reserve(uint64_t base, uint64_t length) {
+    if (reserved_region_count >= PMM_MAX_RESERVED) {
+        printf("pmm: Too many reserved regions\n");
+        return;
+    }
+    reserved_regions[reserved_region_count].base = base;
+    reserved_regions[reserved_region_count].length = length;
+    reserved_region_count++;
+}
+
+// Initialize the frame allocator from the bootloader's usable regions
+void pmm_init(const pmm_region_t* usable, int usable_count,
+              const pmm_region_t* reserved, int reserved_count) {
+    memset(free_area, 0, sizeof(free_area));
+    memset(&pmm_stats, 0, sizeof(pmm_stats));
+    reserved_region_count = 0;
+    mapped_limit = PMM_MAPPED_LIMIT;
+
+    // Low memory (BIOS data, VGA, option ROMs) and the kernel image are never handed out
+    reserve(0, 0x100000);
+    reserve((uintptr_t)_kernel_start, (uintptr_t)_kernel_end - (uintptr_t)_kernel_start);
+    for (int i = 0; i < reserved_count; i++) {
+        reserve(reserved[i].base, reserved[i].length);
+    }
+
+    // Size the per-frame table from the highest usable address, including
+    // memory the boot identity map does not reach yet
+    uint64_t highest = 0;
+    usable_region_count = 0;
+    for (int i = 0; i < usable_count; i++) {
+        uint64_t end = usable[i].base + usable[i].length;
+        if (end > highest) highest = end;
+        if (usable_region_count < PMM_MAX_USABLE) {
+            usable_regions[usable_region_count++] = usable[i];
+        }
+    }
+    if (highest > PMM_MAX_PHYS) highest = PMM_MAX_PHYS;
+    memory_end = highest;
+    frame_count = addr_to_frame(highest);
+
+    // Carve the table out of the first usable range large enough to hold it
+    uint64_t info_size = (frame_count + PMM_FRAME_SIZE - 1) & ~(uint64_t)(PMM_FRAME_SIZE - 1);
+    frame_info = NULL;
+    for (int i = 0; i < usable_count && !frame_info; i++) {
+        for_each_unreserved(usable[i].base, usable[i].base + usable[i].length, 0,
+                            place_frame_info, &info_size);
+    }
+    if (!frame_info) {
+        printf("pmm: No room for the frame table (%u frames)\n", frame_count);
+        frame_count = 0;
+        return;
+    }
+    memset(frame_info, 0, info_size);
+    reserve((uintptr_t)frame_info, info_size);
+
+    // Release everything else into the buddy lists
+    for (int i = 0; i < usable_count; i++) {
+        for_each_unreserved(usable[i].base, usable[i].base + usable[i].length, 0,
+                            release_cb, NULL);
+    }
+
+    printf("PMM initialized: %u KB free in %u frames\n",
+           pmm_stats.free_frames * (PMM_FRAME_SIZE / 1024), pmm_stats.total_frames);
+}
+
+// Release the usable frames in [mapped limit, limit) once they are mapped
+void pmm_extend(uint64_t limit) {
+    if (limit > memory_end) limit = memory_end;
+    if (limit <= mapped_limit || !frame_info) {
+        return;
+    }
+
+    uint64_t old_limit = mapped_limit;
+    mapped_limit = limit;
+    for (int i = 0; i < usable_region_count; i++) {
+        uint64_t start = usable_regions[i].base;
+        uint64_t end = start + usable_regions[i].length;
+        if (start < old_limit) start = old_limit;
+        if (start < end) {
+            for_each_unreserved(start, end, 0, release_cb, NULL);
+        }
+    }
+
+    printf("PMM extended to %u MB: %u KB free\n", (uint32_t)(limit >> 20),
+           pmm_stats.free_frames * (PMM_FRAME_SIZE / 1024));
+}
+
+// End of usable RAM, whether or not it is mapped yet
+uint64_t pmm_memory_end(void) {
+    return memory_end;
+}
+
+// Take a block of 2^order frames off the free lists; 0 when none is left
+static void* buddy_alloc(uint32_t order) {
+    // Find the smallest order with a free block
+    uint32_t current = order;
+    while (current <= PMM_MAX_ORDER && !free_area[current]) {
+        current++;
+    }
+    if (current > PMM_MAX_ORDER) {
+        return NULL;
+    }
+
+    uint32_t frame = addr_to_frame((uintptr_t)free_area[current]);
+    free_list_remove(frame, current);
+
+    // Split down, returning the upper halves to the free lists
+    while (current > order) {
+        current--;
+        free_list_push(frame + (1U << current), current);
+    }
+
+    frame_info[frame] = PMM_FRAME_ALLOCATED | order;
+    return frame_to_block(frame);
+}
+
+// Give every pooled frame back to the buddy lists
+static void zero_pool_drain(void) {
+    while (pmm_stats.zero_pool > 0) {
+        void* page = zero_pool[--pmm_stats.zero_pool];
+        buddy_free(addr_to_frame((uintptr_t)page), 0);
+    }
+}
+
+// Allocate 2^order contiguous frames
+void* pmm_alloc_pages(uint32_t order) {
+    uint64_t flags = spin_lock_irqsave(&pmm_lock);
+    void* block = NULL;
+    if (order <= PMM_MAX_ORDER) {
+        block = buddy_alloc(order);
+        if (!block && pmm_stats.zero_pool > 0) {
+            // The pool is only a cache; memory pressure wins
+            zero_pool_drain();
+            block = buddy_alloc(order);
+        }
+    }
+    if (block) {
+        pmm_stats.allocations++;
+    } else {
+        pmm_stats.failures++;
+    }
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return block;
+}
+
+// Free a block previously returned by pmm_alloc_pages
+void pmm_free_pages(void* addr, uint32_t order) {
+    if (!addr) return;
+
+    // Checked under the lock, so two CPUs freeing the same block cannot
+    // both pass and link it into the free lists twice
+    uint32_t frame = addr_to_frame((uintptr_t)addr);
+    uint64_t flags = spin_lock_irqsave(&pmm_lock);
+    if (((uintptr_t)addr & (PMM_FRAME_SIZE - 1)) || frame >= frame_count ||
+        frame_info[frame] != (PMM_FRAME_ALLOCATED | order)) {
+        spin_unlock_irqrestore(&pmm_lock, flags);
+        printf("pmm_free_pages: Invalid block 0x%x (order %u)\n", (uint32_t)(uintptr_t)addr, order);
+        return;
+    }
+
+    pmm_stats.frees++;
+    buddy_free(frame, order);
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+// Zero 2^order frames a quadword at a time
+void pmm_clear_pages(void* addr, uint32_t order) {
+    uint64_t count = ((uint64_t)PMM_FRAME_SIZE << order) / 8;
+    __asm__ volatile ("rep stosq"
+                      : "+D"(addr), "+c"(count)
+                      : "a"(0ULL)
+                      : "memory");
+}
+
+// Take a frame from the zeroed pool; NULL when it is empty, in which case
+// the caller clears memory itself
+void* pmm_zero_pool_take(void) {
+    void* page = NULL;
+    uint64_t flags = spin_lock_irqsave(&pmm_lock);
+    if (pmm_stats.zero_pool == 0) {
+        pmm_stats.zero_misses++;
+    } else {
+        pmm_stats.zero_hits++;
+        pmm_stats.allocations++;
+        page = zero_pool[--pmm_stats.zero_pool];
+    }
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return page;
+}
+
+// Allocate 2^order zeroed frames, from the pool when possible
+void* pmm_alloc_zeroed_pages(uint32_t order) {
+    if (order == 0) {
+        void* page = pmm_zero_pool_take();
+        if (page) {
+            return page;
+        }
+    } else {
+        __atomic_fetch_add(&pmm_stats.zero_misses, 1, __ATOMIC_RELAXED);
+    }
+
+    void* block = pmm_alloc_pages(order);
+    if (block) {
+        pmm_clear_pages(block, order);
+    }
+    return block;
+}
+
+// Idle work: zero up to 'max_frames' free frames into the pool. Freed
+// single frames are taken first so large blocks are only split when
+// nothing else is left. Frames are cleared outside the lock, so other CPUs
+// keep allocating meanwhile. Returns the number of frames zeroed.
+uint32_t pmm_zero_idle(uint32_t max_frames) {
+    uint32_t zeroed = 0;
+    while (zeroed < max_frames) {
+        uint64_t flags = spin_lock_irqsave(&pmm_lock);
+        void* page = pmm_stats.zero_pool < PMM_ZERO_POOL_MAX ? buddy_alloc(0) : NULL;
+        spin_unlock_irqrestore(&pmm_lock, flags);
+        if (!page) {
+            break;
+        }
+
+        pmm_clear_pages(page, 0);
+
+        flags = spin_lock_irqsave(&pmm_lock);
+        if (pmm_stats.zero_pool < PMM_ZERO_POOL_MAX) {
+            zero_pool[pmm_stats.zero_pool++] = page;
+            pmm_stats.zero_idle++;
+            zeroed++;
+        } else {
+            buddy_free(addr_to_frame((uintptr_t)page), 0);  // Another CPU filled it
+        }
+        spin_unlock_irqrestore(&pmm_lock, flags);
+    }
+    return zeroed;
+}
+
+// Smallest order whose block holds 'size' bytes
+uint32_t pmm_order_for_size(size_t size) {
+    uint32_t order = 0;
+    while (order < PMM_MAX_ORDER && ((size_t)PMM_FRAME_SIZE << order) < size) {
+        order++;
+    }
+    return order;
+}
+
+void pmm_get_stats(pmm_stats_t* stats) {
+    if (stats) {
+        uint64_t flags = spin_lock_irqsave(&pmm_lock);
+        *stats = pmm_stats;
+        spin_unlock_irqrestore(&pmm_lock, flags);
+    }
+}
+
+void pmm_print_stats(void) {
+    printf("Physical Memory:\n");
+    printf("  Total: %u KB (%u frames)\n",
+           pmm_stats.total_frames * (PMM_FRAME_SIZE / 1024), pmm_stats.total_frames);
+    printf("  Free:  %u KB\n", pmm_stats.free_frames * (PMM_FRAME_SIZE / 1024));
+    printf("  Free blocks per order:");
+    for (uint32_t i = 0; i < PMM_NUM_ORDERS; i++) {
+        printf(" %u", pmm_stats.free_blocks[i]);
+    }
+    printf("\n");
+    printf("  Allocations: %u, frees: %u, failures: %u\n",
+           pmm_stats.allocations, pmm_stats.frees, pmm_stats.failures);
+    printf("  Zeroed pool: %u frames, %u hits, %u misses, %u zeroed while idle\n",
+           pmm_stats.zero_pool, pmm_stats.zero_hits, pmm_stats.zero_misses, pmm_stats.zero_idle);
+}
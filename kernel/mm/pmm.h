@@ -0,0 +1,56 @@
+#ifndef _PMM_H
+#define _PMM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Buddy allocator orders: order n is a block of 2^n contiguous 4KB frames
+#define PMM_FRAME_SIZE  4096
+#define PMM_MAX_ORDER   10          // 4MB blocks
+#define PMM_NUM_ORDERS  (PMM_MAX_ORDER + 1)
+
+// Physical memory reachable through the boot identity map (1GB of 2MB pages).
+// Frames above it are handed out after the VMM maps them (pmm_extend).
+#define PMM_MAPPED_LIMIT 0x40000000ULL
+#define PMM_MAX_PHYS     0x4000000000ULL  // Highest physical address tracked (256GB)
+
+// Pre-zeroed frames, refilled by the idle process (pmm_zero_idle)
+#define PMM_ZERO_POOL_MAX 512   // Frames held zeroed (2MB)
+#define PMM_ZERO_BATCH    8     // Frames zeroed per idle pass
+
+// A physical address range, as reported by the bootloader
+typedef struct {
+    uint64_t base;
+    uint64_t length;
+} pmm_region_t;
+
+// Allocator statistics
+typedef struct {
+    uint32_t total_frames;                // Frames handed to the allocator
+    uint32_t free_frames;                 // Frames currently free
+    uint32_t free_blocks[PMM_NUM_ORDERS]; // Free blocks per order
+    uint32_t allocations;
+    uint32_t frees;
+    uint32_t failures;
+    uint32_t zero_pool;                   // Zeroed frames waiting in the pool
+    uint32_t zero_hits;                   // Zeroed frames served from the pool
+    uint32_t zero_misses;                 // Zeroed frames cleared on demand
+    uint32_t zero_idle;                   // Frames zeroed by the idle process
+} pmm_stats_t;
+
+// Function declarations
+void pmm_init(const pmm_region_t* usable, int usable_count,
+              const pmm_region_t* reserved, int reserved_count);
+void* pmm_alloc_pages(uint32_t order);
+void pmm_free_pages(void* addr, uint32_t order);
+void* pmm_alloc_zeroed_pages(uint32_t order);
+void* pmm_zero_pool_take(void);
+void pmm_clear_pages(void* addr, uint32_t order);
+uint32_t pmm_zero_idle(uint32_t max_frames);
+uint32_t pmm_order_for_size(size_t size);
+void pmm_extend(uint64_t limit);
+uint64_t pmm_memory_end(void);
+void pmm_get_stats(pmm_stats_t* stats);
+void pmm_print_stats(void);
+
+#endif // _PMM_H
@@ -0,0 +1,259 @@
+#include "slab.h"
+#include "mm.h"
+#include "pmm.h"
+#include "string.h"
+#include "stdio.h"
+#include "../spinlock.h"
+#include <stdint.h>
+
+// A slab is one buddy block: this header followed by the objects.
+// Buddy blocks are aligned to their size, so an object's slab is found
+// by masking its address.
+typedef struct slab {
+    struct slab* next;
+    struct slab* prev;
+    kmem_cache_t* cache;
+    void* free_list;      // Free objects, linked through their first word
+    uint32_t in_use;
+    uint32_t capacity;
+} slab_t;
+
+typedef struct slab_list {
+    slab_t* head;
+    uint32_t count;
+} slab_list_t;
+
+struct kmem_cache {
+    char name[SLAB_NAME_LEN];
+    uint32_t object_size;   // Stride between objects
+    uint32_t first_offset;  // Offset of the first object within a slab
+    uint32_t slab_order;    // Buddy order of each slab
+    uint32_t capacity;      // Objects per slab
+    void (*ctor)(void*);
+    slab_list_t partial;
+    slab_list_t full;
+    slab_list_t empty;
+    uint32_t allocations;
+    uint32_t frees;
+    spinlock_t lock;        // Guards the slab lists and counters
+    struct kmem_cache* next;
+};
+
+// All caches, for statistics
+static kmem_cache_t* cache_list = NULL;
+static spinlock_t cache_list_lock = SPINLOCK_INIT;
+
+static inline size_t align_up(size_t value, size_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+static void slab_list_add(slab_list_t* list, slab_t* slab) {
+    slab->prev = NULL;
+    slab->next = list->head;
+    if (list->head) {
+        list->head->prev = slab;
+    }
+    list->head = slab;
+    list->count++;
+}
+
+static void slab_list_remove(slab_list_t* list, slab_t* slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        list->head = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    list->count--;
+}
+
+// Objects that fit in a slab of the given order
+static uint32_t slab_capacity(kmem_cache_t* cache, uint32_t order) {
+    uint32_t slab_bytes = PMM_FRAME_SIZE << order;
+    if (slab_bytes <= cache->first_offset) {
+        return 0;
+    }
+    return (slab_bytes - cache->first_offset) / cache->object_size;
+}
+
+kmem_cache_t* kmem_cache_create(const char* name, size_t size, size_t align, void (*ctor)(void*)) {
+    if (size == 0) {
+        return NULL;
+    }
+
+    // Alignment must be a power of two; default to a cache line
+    if (align < SLAB_CACHE_LINE) {
+        align = SLAB_CACHE_LINE;
+    }
+    if (align & (align - 1)) {
+        printf("kmem_cache_create: Bad alignment %u for %s\n", (uint32_t)align, name);
+        return NULL;
+    }
+
+    kmem_cache_t* cache = kcalloc(1, sizeof(kmem_cache_t));
+    if (!cache) {
+        return NULL;
+    }
+
+    strncpy(cache->name, name, SLAB_NAME_LEN - 1);
+    cache->name[SLAB_NAME_LEN - 1] = '\0';
+    cache->object_size = align_up(size < sizeof(void*) ? sizeof(void*) : size, align);
+    cache->first_offset = align_up(sizeof(slab_t), align);
+    cache->ctor = ctor;
+
+    // Pick the smallest slab that holds SLAB_MIN_OBJECTS objects
+    uint32_t order = 0;
+    while (order < PMM_MAX_ORDER && slab_capacity(cache, order) < SLAB_MIN_OBJECTS) {
+        order++;
+    }
+    cache->slab_order = order;
+    cache->capacity = slab_capacity(cache, order);
+    if (cache->capacity == 0) {
+        printf("kmem_cache_create: Object size %u too large for %s\n", (uint32_t)size, name);
+        kfree(cache);
+        return NULL;
+    }
+
+    spin_init(&cache->lock);
+    uint64_t flags = spin_lock_irqsave(&cache_list_lock);
+    cache->next = cache_list;
+    cache_list = cache;
+    spin_unlock_irqrestore(&cache_list_lock, flags);
+    return cache;
+}
+
+// Get a fresh slab from the page allocator and thread its free list
+static slab_t* slab_create(kmem_cache_t* cache) {
+    uint8_t* base = pmm_alloc_pages(cache->slab_order);
+    if (!base) {
+        return NULL;
+    }
+
+    slab_t* slab = (slab_t*)base;
+    slab->cache = cache;
+    slab->in_use = 0;
+    slab->capacity = cache->capacity;
+    slab->free_list = NULL;
+
+    // Link objects so the lowest address is handed out first
+    for (uint32_t i = cache->capacity; i > 0; i--) {
+        void** obj = (void**)(base + cache->first_offset + (i - 1) * cache->object_size);
+        *obj = slab->free_list;
+        slab->free_list = obj;
+    }
+    return slab;
+}
+
+void* kmem_cache_alloc(kmem_cache_t* cache) {
+    if (!cache) {
+        return NULL;
+    }
+
+    // Prefer partially used slabs, then cached empty ones, then new pages
+    uint64_t flags = spin_lock_irqsave(&cache->lock);
+    slab_t* slab = cache->partial.head;
+    if (!slab) {
+        slab = cache->empty.head;
+        if (slab) {
+            slab_list_remove(&cache->empty, slab);
+        } else {
+            slab = slab_create(cache);
+            if (!slab) {
+                spin_unlock_irqrestore(&cache->lock, flags);
+                printf("kmem_cache_alloc: Out of memory in %s\n", cache->name);
+                return NULL;
+            }
+        }
+        slab_list_add(&cache->partial, slab);
+    }
+
+    void** obj = slab->free_list;
+    slab->free_list = *obj;
+    slab->in_use++;
+
+    if (slab->in_use == slab->capacity) {
+        slab_list_remove(&cache->partial, slab);
+        slab_list_add(&cache->full, slab);
+    }
+
+    cache->allocations++;
+    spin_unlock_irqrestore(&cache->lock, flags);
+    if (cache->ctor) {
+        cache->ctor(obj);
+    }
+    return obj;
+}
+
+void kmem_cache_free(kmem_cache_t* cache, void* obj) {
+    if (!cache || !obj) {
+        return;
+    }
+
+    uintptr_t slab_bytes = (uintptr_t)PMM_FRAME_SIZE << cache->slab_order;
+    slab_t* slab = (slab_t*)((uintptr_t)obj & ~(slab_bytes - 1));
+    if (slab->cache != cache) {
+        printf("kmem_cache_free: 0x%x does not belong to %s\n", (uint32_t)(uintptr_t)obj, cache->name);
+        return;
+    }
+
+    void* release = NULL;
+    uint64_t flags = spin_lock_irqsave(&cache->lock);
+    if (slab->in_use == slab->capacity) {
+        slab_list_remove(&cache->full, slab);
+        slab_list_add(&cache->partial, slab);
+    }
+
+    *(void**)obj = slab->free_list;
+    slab->free_list = obj;
+    slab->in_use--;
+    cache->frees++;
+
+    if (slab->in_use == 0) {
+        slab_list_remove(&cache->partial, slab);
+        if (cache->empty.count < SLAB_MAX_EMPTY) {
+            slab_list_add(&cache->empty, slab);
+        } else {
+            release = slab;
+        }
+    }
+    spin_unlock_irqrestore(&cache->lock, flags);
+
+    if (release) {
+        pmm_free_pages(release, cache->slab_order);
+    }
+}
+
+static void fill_stats(kmem_cache_t* cache, kmem_cache_stats_t* stats) {
+    uint64_t flags = spin_lock_irqsave(&cache->lock);
+    strncpy(stats->name, cache->name, SLAB_NAME_LEN);
+    stats->object_size = cache->object_size;
+    stats->objects_in_use = cache->allocations - cache->frees;
+    stats->objects_total = (cache->partial.count + cache->full.count + cache->empty.count) * cache->capacity;
+    stats->slabs_partial = cache->partial.count;
+    stats->slabs_full = cache->full.count;
+    stats->slabs_empty = cache->empty.count;
+    stats->allocations = cache->allocations;
+    stats->frees = cache->frees;
+    spin_unlock_irqrestore(&cache->lock, flags);
+}
+
+int kmem_cache_get_stats(kmem_cache_stats_t* stats, int max_caches) {
+    int count = 0;
+    for (kmem_cache_t* cache = cache_list; cache && count < max_caches; cache = cache->next) {
+        fill_stats(cache, &stats[count++]);
+    }
+    return count;
+}
+
+void kmem_cache_print_stats(void) {
+    printf("Slab caches:\n");
+    for (kmem_cache_t* cache = cache_list; cache; cache = cache->next) {
+        kmem_cache_stats_t stats;
+        fill_stats(cache, &stats);
+        printf("  %s: %u/%u objects of %u bytes, slabs %u partial %u full %u empty\n",
+               stats.name, stats.objects_in_use, stats.objects_total, stats.object_size,
+               stats.slabs_partial, stats.slabs_full, stats.slabs_empty);
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef _SLAB_H
+#define _SLAB_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SLAB_CACHE_LINE      64  // Default object alignment
+#define SLAB_MIN_OBJECTS     8   // Slabs are sized to hold at least this many objects
+#define SLAB_MAX_EMPTY       1   // Empty slabs kept per cache before returning pages
+#define SLAB_NAME_LEN        24
+
+typedef struct kmem_cache kmem_cache_t;
+
+// Per-cache counters, as shown by the terminal 'mem' command
+typedef struct {
+    char name[SLAB_NAME_LEN];
+    uint32_t object_size;     // Bytes per object (after alignment)
+    uint32_t objects_in_use;
+    uint32_t objects_total;   // Capacity of all slabs currently held
+    uint32_t slabs_partial;
+    uint32_t slabs_full;
+    uint32_t slabs_empty;
+    uint32_t allocations;
+    uint32_t frees;
+} kmem_cache_stats_t;
+
+// Create a cache of fixed-size objects; 'ctor' (optional) runs on every allocation
+kmem_cache_t* kmem_cache_create(const char* name, size_t size, size_t align, void (*ctor)(void*));
+void* kmem_cache_alloc(kmem_cache_t* cache);
+void kmem_cache_free(kmem_cache_t* cache, void* obj);
+
+// Statistics
+int kmem_cache_get_stats(kmem_cache_stats_t* stats, int max_caches);
+void kmem_cache_print_stats(void);
+
+#endif // _SLAB_H
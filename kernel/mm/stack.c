@@ -0,0 +1,177 @@
+#include "stack.h"
+#include "vmm.h"
+#include "pmm.h"
+#include "string.h"
+#include "stdio.h"
+#include "../spinlock.h"
+#include <stdint.h>
+
+#define STACK_SLOTS ((uint32_t)(VMM_STACK_SIZE / STACK_SLOT_SIZE))
+
+typedef struct {
+    uint32_t size;       // Usable bytes, 0 while the slot is free
+    uint32_t committed;  // Bytes mapped, counted down from the slot top
+    uint32_t next_free;  // Free list link: slot index + 1, 0 ends the list
+} stack_slot_t;
+
+static stack_slot_t slots[STACK_SLOTS];
+static uint32_t free_head = 0;
+static stack_stats_t stack_stats;
+
+// Guards the free list and the slot and cache counts. A slot off the free
+// list belongs to its stack's owner, so its pages are mapped and unmapped
+// without the lock (unmapping may wait on other CPUs' TLB flushes).
+static spinlock_t stack_lock = SPINLOCK_INIT;
+
+static inline uint64_t slot_top(uint32_t slot) {
+    return VMM_STACK_BASE + (uint64_t)(slot + 1) * STACK_SLOT_SIZE;
+}
+
+static inline size_t page_align(size_t size) {
+    return (size + VMM_PAGE_SIZE - 1) & ~(size_t)(VMM_PAGE_SIZE - 1);
+}
+
+// Map pages until the top 'bytes' of the slot are backed
+static int slot_commit(uint32_t slot, uint32_t bytes) {
+    uint64_t top = slot_top(slot);
+    while (slots[slot].committed < bytes) {
+        uint64_t page = top - slots[slot].committed - VMM_PAGE_SIZE;
+        void* frame = pmm_alloc_pages(0);
+        if (!frame) {
+            return 0;
+        }
+        if (!vmm_map(page, (uintptr_t)frame, VMM_WRITE | VMM_NO_EXEC)) {
+            pmm_free_pages(frame, 0);
+            return 0;
+        }
+        slots[slot].committed += VMM_PAGE_SIZE;
+        __atomic_fetch_add(&stack_stats.pages, 1, __ATOMIC_RELAXED);
+    }
+    return 1;
+}
+
+// Unmap pages until only the top 'bytes' of the slot are backed
+static void slot_decommit(uint32_t slot, uint32_t bytes) {
+    uint64_t top = slot_top(slot);
+    while (slots[slot].committed > bytes) {
+        uint64_t page = top - slots[slot].committed;
+        uint64_t frame = vmm_translate(vmm_kernel_space(), page);
+        vmm_unmap(page);
+        pmm_free_pages((void*)(uintptr_t)frame, 0);
+        slots[slot].committed -= VMM_PAGE_SIZE;
+        __atomic_fetch_sub(&stack_stats.pages, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void* stack_alloc(size_t size, size_t commit) {
+    size = page_align(size);
+    commit = page_align(commit);
+    if (size == 0 || size > STACK_MAX_SIZE) {
+        printf("stack_alloc: Bad stack size %u\n", (uint32_t)size);
+        return NULL;
+    }
+    if (commit > size) {
+        commit = size;
+    }
+
+    // Recently freed stacks come first: their pages are usually still mapped
+    uint32_t slot;
+    int reused = 0;
+    uint64_t flags = spin_lock_irqsave(&stack_lock);
+    if (free_head) {
+        slot = free_head - 1;
+        free_head = slots[slot].next_free;
+        if (slots[slot].committed) {
+            stack_stats.cached--;
+        }
+        stack_stats.reused++;
+        reused = 1;
+    } else if (stack_stats.slots < STACK_SLOTS) {
+        slot = stack_stats.slots++;
+    } else {
+        spin_unlock_irqrestore(&stack_lock, flags);
+        printf("stack_alloc: Out of stack slots\n");
+        return NULL;
+    }
+    stack_stats.in_use++;
+    spin_unlock_irqrestore(&stack_lock, flags);
+
+    // A smaller stack must not leave mapped pages where its guard goes
+    if (reused) {
+        slot_decommit(slot, size);
+    }
+
+    slots[slot].size = size;
+    if (!slot_commit(slot, commit)) {
+        printf("stack_alloc: Out of memory\n");
+        slot_decommit(slot, 0);
+        slots[slot].size = 0;
+        flags = spin_lock_irqsave(&stack_lock);
+        slots[slot].next_free = free_head;
+        free_head = slot + 1;
+        stack_stats.in_use--;
+        spin_unlock_irqrestore(&stack_lock, flags);
+        return NULL;
+    }
+
+    return (void*)(uintptr_t)(slot_top(slot) - size);
+}
+
+void stack_free(void* stack) {
+    uint64_t addr = (uintptr_t)stack;
+    if (!stack) return;
+
+    uint32_t slot = (addr - VMM_STACK_BASE) / STACK_SLOT_SIZE;
+    if (addr < VMM_STACK_BASE || slot >= STACK_SLOTS || !slots[slot].size ||
+        addr != slot_top(slot) - slots[slot].size) {
+        printf("stack_free: Invalid stack 0x%x\n", (uint32_t)addr);
+        return;
+    }
+
+    slots[slot].size = 0;
+
+    // Keep a bounded number of stacks mapped for quick reuse
+    uint64_t flags = spin_lock_irqsave(&stack_lock);
+    int keep = slots[slot].committed && stack_stats.cached < STACK_CACHE_MAX;
+    if (keep) {
+        stack_stats.cached++;
+    }
+    stack_stats.in_use--;
+    spin_unlock_irqrestore(&stack_lock, flags);
+
+    if (!keep) {
+        slot_decommit(slot, 0);
+    }
+
+    flags = spin_lock_irqsave(&stack_lock);
+    slots[slot].next_free = free_head;
+    free_head = slot + 1;
+    spin_unlock_irqrestore(&stack_lock, flags);
+}
+
+// Called for not-present faults in the stack window. Faults within a live
+// stack map every page from the faulting one up to what is already
+// committed; anything below the stack is its guard.
+int stack_handle_fault(uint64_t addr) {
+    uint32_t slot = (addr - VMM_STACK_BASE) / STACK_SLOT_SIZE;
+    if (slot >= STACK_SLOTS || !slots[slot].size) {
+        return 0;
+    }
+
+    uint64_t top = slot_top(slot);
+    if (addr < top - slots[slot].size) {
+        return 0;
+    }
+
+    if (!slot_commit(slot, top - (addr & ~(VMM_PAGE_SIZE - 1)))) {
+        return 0;
+    }
+    __atomic_fetch_add(&stack_stats.lazy_faults, 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+void stack_get_stats(stack_stats_t* stats) {
+    if (stats) {
+        *stats = stack_stats;
+    }
+}
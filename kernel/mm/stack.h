@@ -0,0 +1,36 @@
+#ifndef _STACK_H
+#define _STACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Every stack owns one slot of the stack window. The stack sits at the top
+// of its slot; everything below it, at least STACK_GUARD_SIZE, stays unmapped.
+#define STACK_GUARD_SIZE 4096
+#define STACK_SLOT_SIZE  (64 * 1024)
+#define STACK_MAX_SIZE   (STACK_SLOT_SIZE - STACK_GUARD_SIZE)
+#define STACK_CACHE_MAX  32  // Freed stacks kept mapped for reuse
+
+typedef struct {
+    uint32_t in_use;       // Stacks currently allocated
+    uint32_t cached;       // Freed stacks still mapped, ready for reuse
+    uint32_t slots;        // Slots carved from the window so far
+    uint32_t reused;       // Allocations served from the free list
+    uint32_t lazy_faults;  // Pages committed on first touch
+    uint32_t pages;        // Pages currently mapped for stacks
+} stack_stats_t;
+
+// Allocate a stack of 'size' bytes with its top 'commit' bytes mapped up
+// front; the rest is mapped on first touch. Committing a page takes
+// pmm_lock and vmm_lock, so a stack whose owner can run with either held
+// must be committed in full. Returns the lowest usable address, so the
+// initial stack pointer is the result + size.
+void* stack_alloc(size_t size, size_t commit);
+void stack_free(void* stack);
+
+// Page fault hook: 1 if the fault was a lazily committed page
+int stack_handle_fault(uint64_t addr);
+
+void stack_get_stats(stack_stats_t* stats);
+
+#endif // _STACK_H
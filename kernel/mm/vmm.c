@@ -0,0 +1,503 @@
+#include "vmm.h"
+#include "pmm.h"
+#include "mm.h"
+#include "stack.h"
+#include "string.h"
+#include "stdio.h"
+#include "../cpu.h"
+#include "../serial.h"
+#include "../smp.h"
+#include "../user.h"
+#include <stdint.h>
+
+// Page table layout
+#define PT_ENTRIES          512
+#define PTE_ADDR_MASK       0x000FFFFFFFFFF000ULL
+#define PTE_LARGE_ADDR_MASK 0x000FFFFFFFE00000ULL
+#define PTE_FLAGS_MASK      (0xFFFULL | VMM_NO_EXEC)
+
+#define PML4_INDEX(v) (((v) >> 39) & 0x1FF)
+#define PDPT_INDEX(v) (((v) >> 30) & 0x1FF)
+#define PD_INDEX(v)   (((v) >> 21) & 0x1FF)
+#define PT_INDEX(v)   (((v) >> 12) & 0x1FF)
+
+// Page fault error code bits
+#define PF_PRESENT 0x1
+#define PF_USER    0x4
+
+// MSRs
+#define MSR_EFER  0xC0000080
+#define EFER_NXE  (1ULL << 11)
+#define MSR_PAT   0x277
+#define PAT_WC    0x01
+
+static vmm_space_t kernel_space;
+static uint64_t nx_mask = 0;   // VMM_NO_EXEC once NX is enabled
+static uint64_t heap_end = VMM_HEAP_BASE;
+static vmm_stats_t vmm_stats;
+
+// Guards the page tables, the heap window and the counters. Other CPUs are
+// told about changed mappings only after it is dropped (smp_tlb_shootdown).
+static spinlock_t vmm_lock = SPINLOCK_INIT;
+
+static uint64_t* alloc_table(void) {
+    uint64_t* table = pmm_alloc_zeroed_pages(0);
+    if (table) {
+        vmm_stats.tables++;
+    }
+    return table;
+}
+
+// Follow the table an entry points to, creating it if asked
+static uint64_t* next_table(uint64_t* entry, int create, uint64_t flags) {
+    if (!(*entry & VMM_PRESENT)) {
+        if (!create) {
+            return NULL;
+        }
+        uint64_t* table = alloc_table();
+        if (!table) {
+            return NULL;
+        }
+        // Intermediate levels are permissive; the leaf decides
+        *entry = (uint64_t)(uintptr_t)table | VMM_PRESENT | VMM_WRITE | (flags & VMM_USER);
+        return table;
+    }
+    if (*entry & VMM_HUGE) {
+        return NULL;
+    }
+    *entry |= flags & VMM_USER;
+    return (uint64_t*)(uintptr_t)(*entry & PTE_ADDR_MASK);
+}
+
+// Page-directory entry covering 'virt'
+static uint64_t* pd_entry(vmm_space_t* space, uint64_t virt, int create, uint64_t flags) {
+    uint64_t* pdpt = next_table(&space->pml4[PML4_INDEX(virt)], create, flags);
+    if (!pdpt) {
+        return NULL;
+    }
+    uint64_t* pd = next_table(&pdpt[PDPT_INDEX(virt)], create, flags);
+    if (!pd) {
+        return NULL;
+    }
+    return &pd[PD_INDEX(virt)];
+}
+
+// Invalidate one translation. Kernel entries are shared by every space;
+// other spaces only need it while they are loaded.
+static void flush(vmm_space_t* space, uint64_t virt) {
+    if (space == &kernel_space ||
+        (read_cr3() & PTE_ADDR_MASK) == (uint64_t)(uintptr_t)space->pml4) {
+        invlpg(virt);
+    }
+}
+
+// Replace a 2MB mapping with a table of 512 equivalent 4KB mappings
+static int split_large_page(uint64_t* pde) {
+    uint64_t* pt = alloc_table();
+    if (!pt) {
+        return 0;
+    }
+
+    uint64_t phys = *pde & PTE_LARGE_ADDR_MASK;
+    uint64_t flags = *pde & PTE_FLAGS_MASK & ~VMM_HUGE;
+    for (uint32_t i = 0; i < PT_ENTRIES; i++) {
+        pt[i] = (phys + i * VMM_PAGE_SIZE) | flags;
+    }
+
+    // Same translations as before, so stale TLB entries stay correct
+    *pde = (uint64_t)(uintptr_t)pt | VMM_PRESENT | VMM_WRITE | (flags & VMM_USER);
+    vmm_stats.splits++;
+    return 1;
+}
+
+// Map one 4KB page, or one 2MB page when VMM_HUGE is set. '*replaced' is
+// set when a present mapping was overwritten.
+static int map_locked(vmm_space_t* space, uint64_t virt, uint64_t phys, uint64_t flags,
+                      int* replaced) {
+    flags = (flags | VMM_PRESENT) & ~(VMM_NO_EXEC & ~nx_mask);
+    uint64_t align = (flags & VMM_HUGE) ? VMM_LARGE_PAGE_SIZE : VMM_PAGE_SIZE;
+    if ((virt | phys) & (align - 1)) {
+        printf("vmm_map: Unaligned mapping 0x%x -> 0x%x\n", (uint32_t)virt, (uint32_t)phys);
+        return 0;
+    }
+
+    uint64_t* pde = pd_entry(space, virt, 1, flags);
+    if (!pde) {
+        printf("vmm_map: No page table for 0x%x\n", (uint32_t)virt);
+        return 0;
+    }
+
+    if (flags & VMM_HUGE) {
+        if ((*pde & VMM_PRESENT) && !(*pde & VMM_HUGE)) {
+            printf("vmm_map: 4KB pages already mapped at 0x%x\n", (uint32_t)virt);
+            return 0;
+        }
+        *replaced = (*pde & VMM_PRESENT) != 0;
+        *pde = phys | flags;
+        flush(space, virt);
+        return 1;
+    }
+
+    if ((*pde & VMM_HUGE) && !split_large_page(pde)) {
+        return 0;
+    }
+    uint64_t* pt = next_table(pde, 1, flags);
+    if (!pt) {
+        printf("vmm_map: No page table for 0x%x\n", (uint32_t)virt);
+        return 0;
+    }
+
+    *replaced = (pt[PT_INDEX(virt)] & VMM_PRESENT) != 0;
+    pt[PT_INDEX(virt)] = phys | flags;
+    flush(space, virt);
+    return 1;
+}
+
+int vmm_map_in(vmm_space_t* space, uint64_t virt, uint64_t phys, uint64_t flags) {
+    int replaced = 0;
+    uint64_t irq = spin_lock_irqsave(&vmm_lock);
+    int mapped = map_locked(space, virt, phys, flags, &replaced);
+    spin_unlock_irqrestore(&vmm_lock, irq);
+    if (replaced) {
+        smp_tlb_shootdown(virt);
+    }
+    return mapped;
+}
+
+static int unmap_locked(vmm_space_t* space, uint64_t virt) {
+    uint64_t* pde = pd_entry(space, virt, 0, 0);
+    if (!pde || !(*pde & VMM_PRESENT)) {
+        return 0;
+    }
+
+    if (*pde & VMM_HUGE) {
+        *pde = 0;
+        flush(space, virt);
+        return 1;
+    }
+
+    uint64_t* pt = (uint64_t*)(uintptr_t)(*pde & PTE_ADDR_MASK);
+    uint64_t* pte = &pt[PT_INDEX(virt)];
+    if (!(*pte & VMM_PRESENT)) {
+        return 0;
+    }
+    *pte = 0;
+    flush(space, virt);
+    return 1;
+}
+
+// Remove the page (4KB or 2MB) containing 'virt'. The frame is not freed.
+int vmm_unmap_in(vmm_space_t* space, uint64_t virt) {
+    uint64_t irq = spin_lock_irqsave(&vmm_lock);
+    int unmapped = unmap_locked(space, virt);
+    spin_unlock_irqrestore(&vmm_lock, irq);
+    if (unmapped) {
+        smp_tlb_shootdown(virt);
+    }
+    return unmapped;
+}
+
+// Map a region, using 2MB pages wherever both addresses are aligned and
+// the rest of the region covers a whole large page
+int vmm_map_range_in(vmm_space_t* space, uint64_t virt, uint64_t phys, uint64_t size, uint64_t flags) {
+    uint64_t end = (virt + size + VMM_PAGE_SIZE - 1) & ~(VMM_PAGE_SIZE - 1);
+    flags &= ~VMM_HUGE;
+
+    while (virt < end) {
+        uint64_t step = VMM_PAGE_SIZE;
+        uint64_t page_flags = flags;
+        if (!((virt | phys) & (VMM_LARGE_PAGE_SIZE - 1)) && end - virt >= VMM_LARGE_PAGE_SIZE) {
+            step = VMM_LARGE_PAGE_SIZE;
+            page_flags |= VMM_HUGE;
+        }
+        if (!vmm_map_in(space, virt, phys, page_flags)) {
+            return 0;
+        }
+        virt += step;
+        phys += step;
+    }
+    return 1;
+}
+
+uint64_t vmm_translate(vmm_space_t* space, uint64_t virt) {
+    uint64_t* pde = pd_entry(space, virt, 0, 0);
+    if (!pde || !(*pde & VMM_PRESENT)) {
+        return 0;
+    }
+    if (*pde & VMM_HUGE) {
+        return (*pde & PTE_LARGE_ADDR_MASK) | (virt & (VMM_LARGE_PAGE_SIZE - 1));
+    }
+
+    uint64_t* pt = (uint64_t*)(uintptr_t)(*pde & PTE_ADDR_MASK);
+    uint64_t pte = pt[PT_INDEX(virt)];
+    if (!(pte & VMM_PRESENT)) {
+        return 0;
+    }
+    return (pte & PTE_ADDR_MASK) | (virt & (VMM_PAGE_SIZE - 1));
+}
+
+// Whether ring 3 may read (or with 'write', write) all of [virt, virt +
+// size): it lies in the user window and every page is mapped for the user
+int vmm_user_access(vmm_space_t* space, uint64_t virt, uint64_t size, int write) {
+    if (virt < VMM_USER_BASE || size > VMM_USER_SIZE ||
+        virt - VMM_USER_BASE > VMM_USER_SIZE - size) {
+        return 0;
+    }
+    uint64_t need = VMM_PRESENT | VMM_USER | (write ? VMM_WRITE : 0);
+    uint64_t end = virt + size;
+    for (uint64_t page = virt & ~(VMM_PAGE_SIZE - 1); page < end; page += VMM_PAGE_SIZE) {
+        uint64_t* pde = pd_entry(space, page, 0, 0);
+        if (!pde || (*pde & need) != need) {
+            return 0;
+        }
+        if (*pde & VMM_HUGE) {
+            continue;
+        }
+        uint64_t* pt = (uint64_t*)(uintptr_t)(*pde & PTE_ADDR_MASK);
+        if ((pt[PT_INDEX(page)] & need) != need) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int vmm_map(uint64_t virt, uint64_t phys, uint64_t flags) {
+    return vmm_map_in(&kernel_space, virt, phys, flags);
+}
+
+int vmm_unmap(uint64_t virt) {
+    return vmm_unmap_in(&kernel_space, virt);
+}
+
+int vmm_map_range(uint64_t virt, uint64_t phys, uint64_t size, uint64_t flags) {
+    return vmm_map_range_in(&kernel_space, virt, phys, size, flags);
+}
+
+vmm_space_t* vmm_kernel_space(void) {
+    return &kernel_space;
+}
+
+// A new space starts with the kernel's top-level entries, so the identity
+// map and the heap are shared rather than copied
+vmm_space_t* vmm_create_space(void) {
+    vmm_space_t* space = kmalloc(sizeof(vmm_space_t));
+    if (!space) {
+        return NULL;
+    }
+    uint64_t irq = spin_lock_irqsave(&vmm_lock);
+    space->pml4 = alloc_table();
+    if (space->pml4) {
+        memcpy(space->pml4, kernel_space.pml4, PMM_FRAME_SIZE);
+    }
+    spin_unlock_irqrestore(&vmm_lock, irq);
+    if (!space->pml4) {
+        kfree(space);
+        return NULL;
+    }
+    return space;
+}
+
+// Free a table and every table below it (levels: 3 = PDPT, 2 = PD, 1 = PT)
+static void free_tables(uint64_t* table, int level) {
+    if (level > 1) {
+        for (uint32_t i = 0; i < PT_ENTRIES; i++) {
+            if ((table[i] & VMM_PRESENT) && !(table[i] & VMM_HUGE)) {
+                free_tables((uint64_t*)(uintptr_t)(table[i] & PTE_ADDR_MASK), level - 1);
+            }
+        }
+    }
+    pmm_free_pages(table, 0);
+    vmm_stats.tables--;
+}
+
+// Release a space's private page tables (not the frames they map)
+void vmm_destroy_space(vmm_space_t* space) {
+    if (!space || space == &kernel_space) {
+        return;
+    }
+    if ((read_cr3() & PTE_ADDR_MASK) == (uint64_t)(uintptr_t)space->pml4) {
+        vmm_switch_space(&kernel_space);
+    }
+
+    uint64_t irq = spin_lock_irqsave(&vmm_lock);
+    for (uint32_t i = 0; i < PT_ENTRIES; i++) {
+        uint64_t entry = space->pml4[i];
+        if ((entry & VMM_PRESENT) && entry != kernel_space.pml4[i]) {
+            free_tables((uint64_t*)(uintptr_t)(entry & PTE_ADDR_MASK), 3);
+        }
+    }
+    pmm_free_pages(space->pml4, 0);
+    vmm_stats.tables--;
+    spin_unlock_irqrestore(&vmm_lock, irq);
+    kfree(space);
+}
+
+void vmm_switch_space(vmm_space_t* space) {
+    write_cr3((uint64_t)(uintptr_t)space->pml4);
+}
+
+// Hand out more heap address space. Pages are backed on first touch by
+// the page fault handler, but only as much as free frames could back.
+void* vmm_heap_grow(size_t size) {
+    size = (size + VMM_PAGE_SIZE - 1) & ~(VMM_PAGE_SIZE - 1);
+    pmm_stats_t pmm;
+    pmm_get_stats(&pmm);
+    if ((uint64_t)(pmm.free_frames + pmm.zero_pool) * PMM_FRAME_SIZE < size) {
+        return NULL;
+    }
+
+    void* base = NULL;
+    uint64_t irq = spin_lock_irqsave(&vmm_lock);
+    if (heap_end + size <= VMM_HEAP_BASE + VMM_HEAP_SIZE) {
+        base = (void*)(uintptr_t)heap_end;
+        heap_end += size;
+        vmm_stats.heap_reserved += size;
+    }
+    spin_unlock_irqrestore(&vmm_lock, irq);
+    return base;
+}
+
+// Zero the whole heap pages in [addr, addr + size). Mapped pages get a
+// frame from the zeroed pool and their old frame is freed for the idle
+// process to clear; pages never touched are left alone, since the fault
+// that backs them hands out zeroed frames.
+void vmm_heap_clear(void* addr, size_t size) {
+    uint64_t page = ((uint64_t)(uintptr_t)addr + VMM_PAGE_SIZE - 1) & ~(VMM_PAGE_SIZE - 1);
+    uint64_t end = ((uint64_t)(uintptr_t)addr + size) & ~(VMM_PAGE_SIZE - 1);
+
+    for (; page < end; page += VMM_PAGE_SIZE) {
+        uint64_t old = vmm_translate(&kernel_space, page);
+        if (!old) {
+            continue;
+        }
+        void* frame = pmm_zero_pool_take();
+        if (frame && vmm_map(page, (uintptr_t)frame, VMM_WRITE | VMM_NO_EXEC)) {
+            pmm_free_pages((void*)(uintptr_t)old, 0);
+            continue;
+        }
+        if (frame) {
+            pmm_free_pages(frame, 0);
+        }
+        pmm_clear_pages((void*)(uintptr_t)page, 0);
+    }
+}
+
+// Back a faulting heap page with 'frame'. CPUs touching the same new page
+// fault together; only the first maps its frame, the others give theirs back.
+static int heap_back_page(uint64_t page, void* frame) {
+    int replaced = 0;
+    uint64_t irq = spin_lock_irqsave(&vmm_lock);
+    int raced = vmm_translate(&kernel_space, page) != 0;
+    int mapped = raced || map_locked(&kernel_space, page, (uintptr_t)frame,
+                                     VMM_WRITE | VMM_NO_EXEC, &replaced);
+    if (mapped && !raced) {
+        vmm_stats.heap_faults++;
+        vmm_stats.heap_pages++;
+    }
+    spin_unlock_irqrestore(&vmm_lock, irq);
+    if (raced) {
+        pmm_free_pages(frame, 0);
+    }
+    return mapped;
+}
+
+void page_fault_handler(uint64_t error_code, uint64_t rip) {
+    uint64_t addr = read_cr2();
+
+    // User processes get nothing on demand: a fault is the end of them
+    if (error_code & PF_USER) {
+        user_fault("Page fault", rip, addr);
+    }
+
+    // Not-present fault inside the heap window: back the page and retry
+    if (!(error_code & PF_PRESENT) && addr >= VMM_HEAP_BASE && addr < heap_end) {
+        void* frame = pmm_alloc_zeroed_pages(0);
+        if (frame && heap_back_page(addr & ~(VMM_PAGE_SIZE - 1), frame)) {
+            return;
+        }
+        serial_write("Out of memory backing the heap\n");
+    }
+
+    // Lazily committed stack page, or a hit on a guard page
+    if (!(error_code & PF_PRESENT) && addr >= VMM_STACK_BASE &&
+        addr < VMM_STACK_BASE + VMM_STACK_SIZE) {
+        if (stack_handle_fault(addr)) {
+            return;
+        }
+        serial_write("Kernel stack overflow (guard page hit)\n");
+    }
+
+    serial_write("Page fault at ");
+    serial_write_hex(addr);
+    serial_write(" rip ");
+    serial_write_hex(rip);
+    serial_printf(" error 0x%x\n", (uint32_t)error_code);
+    printf("Page fault at 0x%x (error 0x%x)\n", (uint32_t)addr, (uint32_t)error_code);
+
+    for (;;) {
+        asm volatile ("cli; hlt");
+    }
+}
+
+// Program PAT slot 1 as write-combining (see VMM_WRITE_COMBINE)
+static void pat_init(void) {
+    uint64_t pat = rdmsr(MSR_PAT);
+    pat = (pat & ~(0xFFULL << 8)) | ((uint64_t)PAT_WC << 8);
+    wbinvd();
+    wrmsr(MSR_PAT, pat);
+    wbinvd();
+}
+
+void vmm_init(void) {
+    memset(&vmm_stats, 0, sizeof(vmm_stats));
+    kernel_space.pml4 = (uint64_t*)(uintptr_t)(read_cr3() & PTE_ADDR_MASK);
+    heap_end = VMM_HEAP_BASE;
+
+    // Enable no-execute pages when the CPU has them
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0x80000001, &eax, &ebx, &ecx, &edx);
+    if (edx & (1U << 20)) {
+        wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_NXE);
+        nx_mask = VMM_NO_EXEC;
+    }
+
+    // PAT slot 1 (selected by PWT alone) becomes write-combining. Nothing
+    // is mapped with PWT yet, so no existing mapping changes type.
+    pat_init();
+
+    // Identity-map RAM above the boot window with 2MB pages, then let the
+    // PMM hand it out
+    uint64_t end = pmm_memory_end();
+    if (end > VMM_PHYS_MAP_LIMIT) end = VMM_PHYS_MAP_LIMIT;
+    end = (end + VMM_LARGE_PAGE_SIZE - 1) & ~(VMM_LARGE_PAGE_SIZE - 1);
+    if (end > PMM_MAPPED_LIMIT &&
+        vmm_map_range(PMM_MAPPED_LIMIT, PMM_MAPPED_LIMIT, end - PMM_MAPPED_LIMIT,
+                      VMM_WRITE | VMM_NO_EXEC)) {
+        pmm_extend(end);
+    }
+
+    printf("VMM initialized: %u MB identity-mapped, NX %s\n",
+           (uint32_t)((end > PMM_MAPPED_LIMIT ? end : PMM_MAPPED_LIMIT) >> 20),
+           nx_mask ? "on" : "off");
+}
+
+// Per-CPU setup on an application processor. It already runs on the
+// kernel page tables with the boot CPU's EFER (and so NX); the PAT is
+// per-CPU and must match, or write-combined mappings would differ.
+void vmm_init_ap(void) {
+    pat_init();
+}
+
+void vmm_get_stats(vmm_stats_t* stats) {
+    if (stats) {
+        *stats = vmm_stats;
+    }
+}
+
+void vmm_print_stats(void) {
+    printf("Virtual Memory:\n");
+    printf("  Page tables: %u\n", vmm_stats.tables);
+    printf("  Large pages split: %u\n", vmm_stats.splits);
+    printf("  Heap: %u KB reserved, %u pages faulted in\n",
+           (uint32_t)(vmm_stats.heap_reserved / 1024), vmm_stats.heap_faults);
+}
@@ -0,0 +1,83 @@
+#ifndef _VMM_H
+#define _VMM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Page sizes
+#define VMM_PAGE_SIZE       4096ULL
+#define VMM_LARGE_PAGE_SIZE 0x200000ULL  // 2MB
+
+// Mapping flags (x86_64 page table entry bits)
+#define VMM_PRESENT       (1ULL << 0)
+#define VMM_WRITE         (1ULL << 1)
+#define VMM_USER          (1ULL << 2)
+#define VMM_WRITE_COMBINE (1ULL << 3)   // PWT; PAT slot 1 is programmed as WC
+#define VMM_NO_CACHE      (1ULL << 4)   // PCD
+#define VMM_HUGE          (1ULL << 7)   // Map a 2MB page
+#define VMM_GLOBAL        (1ULL << 8)
+#define VMM_NO_EXEC       (1ULL << 63)  // Ignored when the CPU lacks NX
+
+// The kernel heap lives in a reserved virtual window inside PML4[0] and is
+// backed by page frames on first touch
+#define VMM_HEAP_BASE 0x0000004000000000ULL  // 256GB
+#define VMM_HEAP_SIZE 0x0000000040000000ULL  // 1GB of address space
+
+// Kernel stacks: fixed-size slots, each with an unmapped guard below it
+// (see stack.c)
+#define VMM_STACK_BASE (VMM_HEAP_BASE + VMM_HEAP_SIZE)
+#define VMM_STACK_SIZE 0x0000000010000000ULL  // 256MB of address space
+
+// Physical RAM is identity-mapped below the heap window
+#define VMM_PHYS_MAP_LIMIT VMM_HEAP_BASE
+
+// User processes own PML4 entry 1, private to each address space; the
+// kernel's entries are shared but not user-accessible
+#define VMM_USER_BASE 0x0000008000000000ULL  // 512GB
+#define VMM_USER_SIZE 0x0000008000000000ULL  // 512GB of address space
+
+// An address space: a PML4 whose kernel entries are shared with every
+// other space
+typedef struct {
+    uint64_t* pml4;
+} vmm_space_t;
+
+typedef struct {
+    uint32_t tables;        // Page-table frames allocated
+    uint32_t heap_faults;   // Heap pages backed on demand
+    uint32_t heap_pages;    // Heap pages currently mapped
+    uint32_t splits;        // 2MB pages split into 4KB pages
+    uint64_t heap_reserved; // Bytes of heap address space handed to the allocator
+} vmm_stats_t;
+
+// Function declarations
+void vmm_init(void);
+void vmm_init_ap(void);
+
+// Kernel address space
+int vmm_map(uint64_t virt, uint64_t phys, uint64_t flags);
+int vmm_unmap(uint64_t virt);
+int vmm_map_range(uint64_t virt, uint64_t phys, uint64_t size, uint64_t flags);
+
+// Any address space
+vmm_space_t* vmm_kernel_space(void);
+vmm_space_t* vmm_create_space(void);
+void vmm_destroy_space(vmm_space_t* space);
+void vmm_switch_space(vmm_space_t* space);
+int vmm_map_in(vmm_space_t* space, uint64_t virt, uint64_t phys, uint64_t flags);
+int vmm_unmap_in(vmm_space_t* space, uint64_t virt);
+int vmm_map_range_in(vmm_space_t* space, uint64_t virt, uint64_t phys, uint64_t size, uint64_t flags);
+uint64_t vmm_translate(vmm_space_t* space, uint64_t virt);  // 0 when unmapped
+int vmm_user_access(vmm_space_t* space, uint64_t virt, uint64_t size, int write);
+
+// Heap address space
+void* vmm_heap_grow(size_t size);
+void vmm_heap_clear(void* addr, size_t size);
+
+// Page fault entry (from the #PF stub)
+void page_fault_handler(uint64_t error_code, uint64_t rip);
+
+void vmm_get_stats(vmm_stats_t* stats);
+void vmm_print_stats(void);
+
+#endif // _VMM_H
@@ -1,6 +1,7 @@
 #include <stdint.h>
 #include "graphics.h"
 #include "mouse.h"
+#include "spinlock.h"
 
 // Inline assembly functions for I/O
 static inline uint8_t inb(uint16_t port) {
@@ -13,9 +14,11 @@ static inline void outb(uint16_t port, uint8_t val) {
     asm volatile ("outb %0, %1" : : "a"(val), "Nd"(port));
 }
 
-// Mouse state variables
+// Mouse state variables. The position is moved from IRQ12 and read by the
+// desktop; mouse_lock keeps the pair consistent.
 int mouse_x = 100;
 int mouse_y = 100;
+static spinlock_t mouse_lock = SPINLOCK_INIT;
 uint8_t mouse_buttons = 0;
 
 // Mouse cursor bitmap (12x12 arrow cursor)
@@ -120,32 +123,36 @@ void mouse_disable(void) {
     mouse_read(); // ACK
 }
 
-void mouse_set_position(int x, int y) {
-    mouse_x = x;
-    mouse_y = y;
-    
-    // Clamp to screen boundaries
+// Keep the cursor on screen (mouse_lock held)
+static void mouse_clamp(void) {
     if (mouse_x < 0) mouse_x = 0;
     if (mouse_y < 0) mouse_y = 0;
     if (mouse_x >= fb_width - 12) mouse_x = fb_width - 12;
     if (mouse_y >= fb_height - 12) mouse_y = fb_height - 12;
 }
 
+void mouse_set_position(int x, int y) {
+    uint64_t flags = spin_lock_irqsave(&mouse_lock);
+    mouse_x = x;
+    mouse_y = y;
+    mouse_clamp();
+    spin_unlock_irqrestore(&mouse_lock, flags);
+}
+
 void mouse_get_position(int *x, int *y) {
+    uint64_t flags = spin_lock_irqsave(&mouse_lock);
     *x = mouse_x;
     *y = mouse_y;
+    spin_unlock_irqrestore(&mouse_lock, flags);
 }
 
 void mouse_process_packet(int8_t dx, int8_t dy) {
     // Update mouse position
+    uint64_t flags = spin_lock_irqsave(&mouse_lock);
     mouse_x += dx;
     mouse_y -= dy; // Invert Y axis
-    
-    // Clamp to screen boundaries
-    if (mouse_x < 0) mouse_x = 0;
-    if (mouse_y < 0) mouse_y = 0;
-    if (mouse_x >= fb_width - 12) mouse_x = fb_width - 12;
-    if (mouse_y >= fb_height - 12) mouse_y = fb_height - 12;
+    mouse_clamp();
+    spin_unlock_irqrestore(&mouse_lock, flags);
 }
 
 void mouse_draw_at(uint32_t *fb, int width, int x, int y) {
@@ -163,5 +170,7 @@ void mouse_draw_at(uint32_t *fb, int width, int x, int y) {
 }
 
 void mouse_draw(uint32_t *fb, int width) {
-    mouse_draw_at(fb, width, mouse_x, mouse_y);
+    int x, y;
+    mouse_get_position(&x, &y);
+    mouse_draw_at(fb, width, x, y);
 }
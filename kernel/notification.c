@@ -2,6 +2,7 @@
 #include "theme.h"
 #include "text.h"
 #include "framebuffer.h"
+#include "cpu.h"
 #include "libc/string.h"
 #include "libc/stdio.h"
 
@@ -13,6 +14,11 @@ void notification_init(void) {
     notification_count = 0;
 }
 
+// Expiry timer callback (tick interrupt)
+static void notification_expire(void* arg) {
+    ((notification_t*)arg)->active = 0;
+}
+
 void notification_show(const char* title, const char* message, notification_type_t type) {
     // Find an empty slot or reuse the oldest one
     int slot = -1;
@@ -29,6 +35,7 @@ void notification_show(const char* title, const char* message, notification_type
     }
     
     notification_t* notif = &notifications[slot];
+    timer_cancel(&notif->expiry);
     
     // Copy title and message
     strncpy(notif->title, title, sizeof(notif->title) - 1);
@@ -38,7 +45,7 @@ void notification_show(const char* title, const char* message, notification_type
     notif->message[sizeof(notif->message) - 1] = '\0';
     
     notif->type = type;
-    notif->timestamp = 0; // Will be set by the caller
+    notif->timestamp = (uint32_t)timer_uptime_ms();
     notif->active = 1;
     
     // Position notifications in top-right corner
@@ -48,29 +55,39 @@ void notification_show(const char* title, const char* message, notification_type
     if (slot >= notification_count) {
         notification_count = slot + 1;
     }
+    
+    timer_add(&notif->expiry, timer_ticks() + timer_ms_to_ticks(NOTIFICATION_TIMEOUT),
+              notification_expire, notif);
 }
 
+// Expiry is done by each notification's timer; this closes the gaps it
+// leaves. 'current_time' is no longer needed.
 void notification_update(uint32_t current_time) {
-    for (int i = 0; i < notification_count; i++) {
-        if (notifications[i].active) {
-            if (current_time - notifications[i].timestamp > NOTIFICATION_TIMEOUT) {
-                notifications[i].active = 0;
-            }
-        }
-    }
+    (void)current_time;
     
-    // Compact the array
+    // Compact the array. A moved notification's timer moves with it, and
+    // the tick must not fire it halfway through.
+    uint64_t flags = irq_save();
     int write_pos = 0;
     for (int read_pos = 0; read_pos < notification_count; read_pos++) {
         if (notifications[read_pos].active) {
             if (write_pos != read_pos) {
-                notifications[write_pos] = notifications[read_pos];
-                notifications[write_pos].y = 20 + (write_pos * (NOTIFICATION_HEIGHT + 10));
+                notification_t* from = &notifications[read_pos];
+                notification_t* to = &notifications[write_pos];
+                int pending = timer_cancel(&from->expiry);
+                timer_cancel(&to->expiry);
+                *to = *from;
+                to->expiry.pprev = NULL;
+                to->y = 20 + (write_pos * (NOTIFICATION_HEIGHT + 10));
+                if (pending) {
+                    timer_add(&to->expiry, from->expiry.deadline, notification_expire, to);
+                }
             }
             write_pos++;
         }
     }
     notification_count = write_pos;
+    irq_restore(flags);
 }
 
 void notification_draw(uint32_t* framebuffer, uint32_t width, uint32_t height) {
@@ -134,6 +151,7 @@ void notification_draw(uint32_t* framebuffer, uint32_t width, uint32_t height) {
 
 void notification_clear_all(void) {
     for (int i = 0; i < MAX_NOTIFICATIONS; i++) {
+        timer_cancel(&notifications[i].expiry);
         notifications[i].active = 0;
     }
     notification_count = 0;
@@ -2,6 +2,7 @@
 #define _NOTIFICATION_H
 
 #include <stdint.h>
+#include "timer.h"
 
 #define MAX_NOTIFICATIONS 10
 #define NOTIFICATION_TIMEOUT 5000  // 5 seconds in milliseconds
@@ -22,6 +23,7 @@ typedef struct {
     uint32_t timestamp;
     int active;
     int x, y;
+    timer_t expiry;  // Clears 'active' NOTIFICATION_TIMEOUT after showing
 } notification_t;
 
 // Notification system functions
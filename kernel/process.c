@@ -1,198 +1,880 @@
 #include "process.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "ipc.h"
 #include "mm/mm.h"
+#include "mm/slab.h"
+#include "mm/stack.h"
+#include "mm/pmm.h"
+#include "timer.h"
+#include "softirq.h"
+#include "apic.h"
+#include "gdt.h"
+#include "user.h"
+#include "uring.h"
+#include "cpu.h"
 #include "string.h"
 #include "stdio.h"
 
-// Process table
-static pcb_t process_table[MAX_PROCESSES];
-static pcb_t *current_process = NULL;
-static pcb_t *ready_queue = NULL;
+// Process objects. The running process, the run queue and the scheduler
+// counters are per CPU (cpu_t in smp.h).
+static kmem_cache_t *pcb_cache = NULL;
+static pcb_t *process_list = NULL;  // Every live process, for lookups and reaping
+static uint32_t process_count = 0;  // Entries in process_list and PIDs being set up, up to PROCESS_MAX
 static uint32_t next_pid = 1;
+static pcb_t *pid_slots[PROCESS_MAX];  // By pid % PROCESS_MAX, from creation until reaped
+static spinlock_t process_lock = SPINLOCK_INIT;  // Guards the four above
 
-// Default stack size for processes (8KB for 64-bit)
-#define PROCESS_STACK_SIZE 8192
+// Process stacks: 32KB below a guard page, all mapped up front. A lazily
+// committed page could first be touched while this CPU holds pmm_lock or
+// vmm_lock, and committing it takes both.
+#define PROCESS_STACK_SIZE   (32 * 1024)
+#define PROCESS_STACK_COMMIT PROCESS_STACK_SIZE
 
-// Initialize the process system
-void process_init(void) {
-    // Clear the process table
-    memset(process_table, 0, sizeof(process_table));
-    
-    // Initialize the idle process (PID 0)
-    pcb_t *idle = &process_table[0];
+static void process_start(void (*entry)(void)) __attribute__((used));
+static void process_trampoline(void);
+static void idle_wake(cpu_t *cpu);
+static uint32_t create_process(void (*entry)(void), uint32_t priority, uint32_t cpu_id,
+                               vmm_space_t *space, uint64_t user_entry);
+
+// Multi-level feedback: slice length per priority level, in milliseconds
+static uint32_t level_slice_ms[PROCESS_PRIORITIES];
+
+// CPU usage windows, closed by a timer on the boot CPU
+static timer_t usage_timer;
+static uint64_t usage_window_start = 0;  // TSC when the current window opened
+
+static volatile uint32_t cpus_halted = 0;  // CPUs with idle_halted set
+
+static inline uint32_t clamp_priority(uint32_t priority) {
+    return priority < PROCESS_PRIORITIES ? priority : PROCESS_PRIORITIES - 1;
+}
+
+// Ticks in one time slice at a priority level and the current timer rate
+static uint32_t slice_ticks(uint32_t priority) {
+    uint32_t ticks = level_slice_ms[clamp_priority(priority)] * timer_hz() / 1000;
+    return ticks ? ticks : 1;
+}
+
+// Default slices: PROCESS_TIME_SLICE_MS at the default priority and above,
+// doubling for each level below it, up to PROCESS_MLFQ_DEPTH doublings
+static void mlfq_init(void) {
+    for (uint32_t prio = 0; prio < PROCESS_PRIORITIES; prio++) {
+        uint32_t below = prio < PROCESS_PRIORITY_DEFAULT ? PROCESS_PRIORITY_DEFAULT - prio : 0;
+        if (below > PROCESS_MLFQ_DEPTH) below = PROCESS_MLFQ_DEPTH;
+        level_slice_ms[prio] = PROCESS_TIME_SLICE_MS << below;
+    }
+}
+
+// Used its whole slice: drop a level, at most PROCESS_MLFQ_DEPTH below base
+static void mlfq_demote(cpu_t *cpu, pcb_t *proc) {
+    uint32_t floor = proc->base_priority > PROCESS_MLFQ_DEPTH ?
+                     proc->base_priority - PROCESS_MLFQ_DEPTH : 0;
+    if (proc->priority > floor) {
+        proc->priority--;
+        cpu->stats.demotions++;
+    }
+}
+
+// Gave up the CPU with most of its slice left: climb back towards base
+static void mlfq_boost(cpu_t *cpu, pcb_t *proc) {
+    if (proc->priority < proc->base_priority &&
+        proc->time_slice * 2 > slice_ticks(proc->priority)) {
+        proc->priority++;
+        cpu->stats.boosts++;
+    }
+}
+
+// Run queue: one deque per priority and a bitmap of the levels that may
+// have a ready process, so enqueue, dequeue and picking the next process
+// are all constant time. Each CPU has its own. Taking a process out is a
+// lock-free deque steal (deque.h), whether the owner dequeues or an idle
+// CPU balances load; the CPU's lock only serializes enqueues.
+
+static inline uint32_t rq_priority(pcb_t *proc) {
+    return clamp_priority(proc->priority);
+}
+
+// Give a run queue its deques: PROCESS_MAX slots per level
+static int rq_init(run_queue_t *rq) {
+    void **buffer = kmalloc(PROCESS_PRIORITIES * PROCESS_MAX * sizeof(void *));
+    if (!buffer) {
+        printf("process: Failed to allocate a run queue\n");
+        return 0;
+    }
+    memset(rq, 0, sizeof(run_queue_t));
+    for (uint32_t prio = 0; prio < PROCESS_PRIORITIES; prio++) {
+        deque_init(&rq->level[prio], buffer + prio * PROCESS_MAX, PROCESS_MAX);
+    }
+    return 1;
+}
+
+// After queueing on 'cpu': a halted CPU only notices at its next interrupt,
+// and with the tick stopped that may be a long way off. Wake 'cpu' itself
+// if it is halted, or if it is busy and the work could move, a halted CPU
+// that can steal it. Pairs with the idle_halted/count order in idle_halt.
+static void rq_kick(cpu_t *cpu) {
+    cpu_t *self = this_cpu();
+    if (!__atomic_load_n(&cpus_halted, __ATOMIC_SEQ_CST)) {
+        return;
+    }
+    if (__atomic_load_n(&cpu->idle_halted, __ATOMIC_SEQ_CST)) {
+        if (cpu != self) {
+            self->stats.kicks++;
+            smp_resched(cpu);
+        }
+        return;
+    }
+    run_queue_t *rq = &cpu->run_queue;
+    if (cpu->current == cpu->idle || rq->count <= rq->pinned) {
+        return;
+    }
+    for (uint32_t i = 0; i < smp_cpu_count(); i++) {
+        cpu_t *other = smp_cpu(i);
+        if (other != cpu && other != self && __atomic_load_n(&other->idle_halted, __ATOMIC_SEQ_CST)) {
+            self->stats.kicks++;
+            smp_resched(other);
+            return;
+        }
+    }
+}
+
+// Queue a ready process on 'cpu' (interrupts off). The counts go up before
+// the push and the bitmap bit after it, so takers never see them short.
+static void rq_enqueue(cpu_t *cpu, pcb_t *proc) {
+    run_queue_t *rq = &cpu->run_queue;
+    uint32_t prio = rq_priority(proc);
+    proc->cpu = cpu->id;
+    if (proc->pinned) {
+        __atomic_fetch_add(&rq->pinned, 1, __ATOMIC_SEQ_CST);
+    }
+    __atomic_fetch_add(&rq->count, 1, __ATOMIC_SEQ_CST);
+
+    // Never full: no more than PROCESS_MAX processes exist
+    spin_lock(&cpu->lock);
+    deque_push(&rq->level[prio], proc);
+    spin_unlock(&cpu->lock);
+
+    __atomic_fetch_or(&rq->bitmap, 1U << prio, __ATOMIC_SEQ_CST);
+    rq_kick(cpu);
+}
+
+// Highest priority that may have a ready process; -1 when the queue is empty
+static inline int rq_top_priority(run_queue_t *rq) {
+    uint32_t bitmap = __atomic_load_n(&rq->bitmap, __ATOMIC_SEQ_CST);
+    return bitmap ? 31 - __builtin_clz(bitmap) : -1;
+}
+
+// Take the oldest process of the highest level at or above 'min_prio', from
+// any CPU; NULL if there is none
+static pcb_t *rq_take(run_queue_t *rq, uint32_t min_prio) {
+    uint32_t above = ~((1U << min_prio) - 1);
+    uint32_t bitmap;
+    while ((bitmap = __atomic_load_n(&rq->bitmap, __ATOMIC_SEQ_CST) & above) != 0) {
+        uint32_t prio = 31 - __builtin_clz(bitmap);
+        pcb_t *proc = deque_steal(&rq->level[prio]);
+        if (proc) {
+            if (proc->pinned) {
+                __atomic_fetch_sub(&rq->pinned, 1, __ATOMIC_SEQ_CST);
+            }
+            __atomic_fetch_sub(&rq->count, 1, __ATOMIC_SEQ_CST);
+            return proc;
+        }
+
+        // The level ran dry: clear its bit, then set it again if a push
+        // slipped in meanwhile (its own bit may have landed before ours)
+        __atomic_fetch_and(&rq->bitmap, ~(1U << prio), __ATOMIC_SEQ_CST);
+        if (deque_size(&rq->level[prio])) {
+            __atomic_fetch_or(&rq->bitmap, 1U << prio, __ATOMIC_SEQ_CST);
+        }
+    }
+    return NULL;
+}
+
+// Work stealing, run by an idle CPU (interrupts off): take the oldest
+// process at the highest level of the CPU with the most movable ready
+// processes. The victim is never locked or interrupted. A pinned process
+// that comes out anyway goes back to the end of its own queue.
+static pcb_t *rq_steal(cpu_t *cpu) {
+    cpu_t *victim = NULL;
+    int32_t most = 0;
+    for (uint32_t i = 0; i < smp_cpu_count(); i++) {
+        cpu_t *other = smp_cpu(i);
+        run_queue_t *rq = &other->run_queue;
+        int32_t movable = (int32_t)(rq->count - rq->pinned);
+        if (other != cpu && movable > most) {
+            victim = other;
+            most = movable;
+        }
+    }
+    if (!victim) {
+        return NULL;
+    }
+
+    cpu->stats.steal_attempts++;
+    pcb_t *proc = rq_take(&victim->run_queue, 0);
+    if (proc && proc->pinned) {
+        rq_enqueue(victim, proc);
+        return NULL;
+    }
+    if (proc) {
+        cpu->stats.steals++;
+    }
+    return proc;
+}
+
+// Periodic reset against starvation: every process on this CPU returns to
+// its base priority. Queued processes are taken out in order and requeued.
+// Each CPU resets its own queue from its own tick.
+static void mlfq_reset(cpu_t *cpu) {
+    pcb_t *queued = NULL;
+    pcb_t **tail = &queued;
+    pcb_t *proc;
+    while ((proc = rq_take(&cpu->run_queue, 0)) != NULL) {
+        *tail = proc;
+        tail = &proc->next;
+    }
+    *tail = NULL;
+
+    while (queued) {
+        proc = queued;
+        queued = proc->next;
+        proc->priority = proc->base_priority;
+        rq_enqueue(cpu, proc);
+    }
+
+    cpu->current->priority = cpu->current->base_priority;
+    cpu->stats.resets++;
+}
+
+static void pcb_ctor(void *obj) {
+    memset(obj, 0, sizeof(pcb_t));
+}
+
+static void pcb_set_name(pcb_t *proc, const char *name) {
+    strncpy(proc->name, name, PROCESS_NAME_LEN - 1);
+    proc->name[PROCESS_NAME_LEN - 1] = '\0';
+}
+
+// Heap owner hook (mm.h): allocations are charged to the running process
+static uint32_t current_heap_owner(void) {
+    pcb_t *proc = this_cpu()->current;
+    return proc ? proc->heap_owner : MM_OWNER_KERNEL;
+}
+
+// Release the stacks and PCBs of exited processes once no CPU is still
+// running on them
+static void process_reap(void) {
+    pcb_t *dead = NULL;
+    uint64_t flags = spin_lock_irqsave(&process_lock);
+    pcb_t **link = &process_list;
+    while (*link) {
+        pcb_t *proc = *link;
+        if (proc->state == PROCESS_ZOMBIE && !__atomic_load_n(&proc->on_cpu, __ATOMIC_ACQUIRE)) {
+            // finish_switch may still be releasing its lock
+            spin_lock(&proc->lock);
+            spin_unlock(&proc->lock);
+            *link = proc->all_next;
+            proc->all_next = dead;
+            dead = proc;
+            pid_slots[proc->pid & (PROCESS_MAX - 1)] = NULL;
+            process_count--;
+        } else {
+            link = &proc->all_next;
+        }
+    }
+    spin_unlock_irqrestore(&process_lock, flags);
+
+    // Freeing a stack can wait on other CPUs (TLB shootdown), so not under the lock
+    while (dead) {
+        pcb_t *proc = dead;
+        dead = proc->all_next;
+        if (proc->stack) {
+            stack_free(proc->stack);
+        }
+        if (proc->ring) {
+            uring_destroy(proc->ring);
+        }
+        if (proc->space) {
+            user_space_destroy(proc->space);
+        }
+        mm_owner_release(proc->heap_owner);
+        kmem_cache_free(pcb_cache, proc);
+    }
+}
+
+// Set up the switch frame context_switch restores on a fresh stack and
+// return the stack pointer. It "returns" into process_trampoline with the
+// entry point in R12 and the stack 16-byte aligned.
+static uint64_t initial_frame(void *stack, void (*entry)(void)) {
+    uint8_t *stack_top = (uint8_t *)stack + PROCESS_STACK_SIZE;
+    switch_frame_t *frame = (switch_frame_t *)stack_top - 1;
+    memset(frame, 0, sizeof(switch_frame_t));
+    frame->r12 = (uint64_t)entry;
+    frame->rip = (uint64_t)process_trampoline;
+    return (uint64_t)frame;
+}
+
+// A CPU's idle task: PID 0 like the boot context, at the lowest priority,
+// and kept off the process list and the run queues
+static pcb_t *idle_alloc(cpu_t *cpu) {
+    pcb_t *idle = kmem_cache_alloc(pcb_cache);
+    if (!idle) {
+        printf("process: Failed to allocate the idle task for CPU %u\n", cpu->id);
+        return NULL;
+    }
     idle->pid = 0;
-    idle->state = PROCESS_RUNNING;
+    idle->state = PROCESS_READY;
     idle->priority = 0;
-    idle->time_slice = 10;
+    idle->base_priority = 0;
+    idle->time_slice = slice_ticks(0);
+    idle->cpu = cpu->id;
+    pcb_set_name(idle, "idle");
+    return idle;
+}
+
+// Initialize the process system (boot CPU, after smp_init_bsp)
+void process_init(void) {
+    cpu_t *cpu = this_cpu();
+    pcb_cache = kmem_cache_create("pcb", sizeof(pcb_t), 0, pcb_ctor);
+    process_list = NULL;
+    mm_set_owner_hook(current_heap_owner);
+    mlfq_init();
+    if (!rq_init(&cpu->run_queue)) {
+        return;
+    }
     
-    current_process = idle;
-    ready_queue = NULL;
+    // The boot context becomes PID 0 and goes on to run the desktop loop
+    pcb_t *boot = kmem_cache_alloc(pcb_cache);
+    if (!boot) {
+        printf("process_init: Failed to allocate PID 0\n");
+        return;
+    }
+    boot->pid = 0;
+    boot->state = PROCESS_RUNNING;
+    boot->priority = PROCESS_PRIORITY_DEFAULT;
+    boot->base_priority = boot->priority;
+    boot->time_slice = slice_ticks(boot->priority);
+    boot->last_run = rdtsc();
+    boot->on_cpu = 1;
+    boot->pinned = 1;  // The desktop stays on the boot CPU
+    boot->heap_owner = MM_OWNER_KERNEL;
+    pcb_set_name(boot, "kernel");
+    boot->all_next = NULL;
+    boot->mailbox = ipc_mailbox_open(0);
+    process_list = boot;
+    pid_slots[0] = boot;
+    process_count = 1;
+    cpu->current = boot;
+
+    // The boot CPU's idle task gets a stack of its own; it only runs when
+    // PID 0 cannot
+    pcb_t *idle = idle_alloc(cpu);
+    void *stack = idle ? stack_alloc(PROCESS_STACK_SIZE, PROCESS_STACK_COMMIT) : NULL;
+    if (stack) {
+        idle->stack = stack;
+        idle->rsp = initial_frame(stack, process_idle_loop);
+        cpu->idle = idle;
+    } else if (idle) {
+        kmem_cache_free(pcb_cache, idle);
+    }
     
     printf("Process system initialized\n");
 }
 
-// Create a new process
-uint32_t process_create(void (*entry)(void), uint32_t priority) {
-    // Find a free process slot
-    pcb_t *proc = NULL;
-    for (int i = 1; i < MAX_PROCESSES; i++) {
-        if (process_table[i].state == 0) {  // Unused
-            proc = &process_table[i];
-            break;
+// Join the scheduler on an application processor: the running boot
+// context becomes this CPU's idle task. Returns 0 if it cannot.
+int process_init_ap(void) {
+    cpu_t *cpu = this_cpu();
+    if (!rq_init(&cpu->run_queue)) {
+        return 0;
+    }
+    pcb_t *idle = idle_alloc(cpu);
+    if (!idle) {
+        return 0;
+    }
+    idle->state = PROCESS_RUNNING;
+    idle->last_run = rdtsc();
+    idle->on_cpu = 1;
+    cpu->idle = idle;
+    cpu->current = idle;
+    return 1;
+}
+
+// Second half of a switch, run by whatever was switched to. The process
+// switched away from has its context saved now, so it may be reaped, and
+// if still runnable it goes back in the run queue. Queued any earlier, an
+// idle CPU could steal it and resume it from a stale stack pointer.
+// A process woken while still switching out is left for this to queue
+// too; its lock makes sure exactly one of the two does.
+static void finish_switch(void) {
+    cpu_t *cpu = this_cpu();
+    pcb_t *prev = cpu->prev;
+    cpu->prev = NULL;
+    if (prev == cpu->idle) {
+        prev->on_cpu = 0;
+        return;
+    }
+
+    spin_lock(&prev->lock);
+    int requeue = prev->state == PROCESS_READY;
+    __atomic_store_n(&prev->on_cpu, 0, __ATOMIC_RELEASE);
+    spin_unlock(&prev->lock);
+    if (requeue) {
+        rq_enqueue(cpu, prev);
+    }
+}
+
+// First code a new process runs, called from process_trampoline with
+// interrupts still off
+static void process_start(void (*entry)(void)) {
+    finish_switch();
+    irq_enable();
+    entry();
+    process_exit(0);
+}
+
+// Least loaded CPU: fewest ready processes, counting a running one
+static cpu_t *least_loaded_cpu(void) {
+    cpu_t *best = smp_cpu(0);
+    uint32_t best_load = 0xFFFFFFFF;
+    for (uint32_t i = 0; i < smp_cpu_count(); i++) {
+        cpu_t *cpu = smp_cpu(i);
+        uint32_t load = cpu->run_queue.count + (cpu->current != cpu->idle);
+        if (load < best_load) {
+            best = cpu;
+            best_load = load;
         }
     }
+    return best;
+}
+
+// Create a new process on the least loaded CPU
+uint32_t process_create(void (*entry)(void), uint32_t priority) {
+    return process_create_on(entry, priority, PROCESS_CPU_ANY);
+}
+
+// Create a new process that runs on CPU 'cpu_id' and stays there, or on
+// the least loaded CPU with PROCESS_CPU_ANY
+uint32_t process_create_on(void (*entry)(void), uint32_t priority, uint32_t cpu_id) {
+    return create_process(entry, priority, cpu_id, NULL, 0);
+}
+
+// Kernel side of a user process: leave for ring 3 and never come back
+// other than through system calls and interrupts
+static void user_start(void) {
+    irq_disable();
+    user_enter(this_cpu()->current->user_entry, USER_STACK_TOP);
+}
+
+// Create a user process running a copy of 'code' (position-independent,
+// entered at its first byte) in an address space of its own
+uint32_t process_create_user(const void* code, uint32_t size, uint32_t priority) {
+    vmm_space_t *space = user_space_create(code, size);
+    if (!space) {
+        return 0;
+    }
+    return create_process(user_start, priority, PROCESS_CPU_ANY, space, USER_CODE_BASE);
+}
+
+// Common to both kinds of process. A user process gets 'space' and
+// 'user_entry'; they are freed with it, or here if creation fails.
+static uint32_t create_process(void (*entry)(void), uint32_t priority, uint32_t cpu_id,
+                               vmm_space_t *space, uint64_t user_entry) {
+    cpu_t *cpu = cpu_id == PROCESS_CPU_ANY ? least_loaded_cpu() : smp_cpu(cpu_id);
+    if (!cpu) {
+        printf("process_create: No CPU %u\n", cpu_id);
+        if (space) user_space_destroy(space);
+        return 0;
+    }
+
+    // Recycle anything left behind by exited processes
+    process_reap();
     
+    pcb_t *proc = kmem_cache_alloc(pcb_cache);
     if (!proc) {
-        printf("process_create: No free process slots\n");
-        return 0;  // No free slots
+        printf("process_create: Failed to allocate PCB\n");
+        if (space) user_space_destroy(space);
+        return 0;
     }
     
     // Allocate stack
-    void *stack = kmalloc(PROCESS_STACK_SIZE);
+    void *stack = stack_alloc(PROCESS_STACK_SIZE, PROCESS_STACK_COMMIT);
     if (!stack) {
         printf("process_create: Failed to allocate stack\n");
+        kmem_cache_free(pcb_cache, proc);
+        if (space) user_space_destroy(space);
         return 0;
     }
     
     // Initialize process control block
-    proc->pid = next_pid++;
     proc->state = PROCESS_READY;
-    proc->priority = priority;
-    proc->time_slice = 10;  // Default time slice
+    proc->priority = clamp_priority(priority);
+    proc->base_priority = proc->priority;
+    proc->time_slice = slice_ticks(proc->priority);
     proc->stack = stack;
+    proc->rsp = initial_frame(stack, entry);
     
-    // Set up the initial stack frame for x86_64
-    uint64_t *stack_top = (uint64_t *)((uint8_t *)stack + PROCESS_STACK_SIZE);
-    
-    // Make space for the interrupt frame (x86_64)
-    stack_top -= 5;  // Space for SS, RSP, RFLAGS, CS, RIP
-    
-    // Set up the initial stack frame for iretq
-    stack_top[4] = 0x10;             // SS (kernel data segment)
-    stack_top[3] = (uint64_t)stack_top + 5 * sizeof(uint64_t); // RSP after iretq
-    stack_top[2] = 0x202;            // RFLAGS (interrupts enabled)
-    stack_top[1] = 0x08;             // CS (kernel code segment)
-    stack_top[0] = (uint64_t)entry;   // RIP (entry point)
-    
-    // Set the stack pointer to the top of the stack
-    proc->rsp = (uint64_t)stack_top;
-    proc->rbp = proc->rsp;
+    proc->pinned = cpu_id != PROCESS_CPU_ANY;
+    proc->heap_owner = mm_owner_alloc();
+    proc->space = space;
+    proc->user_entry = user_entry;
+    pcb_set_name(proc, space ? "user" : "process");
     
-    // Add to ready queue
-    proc->next = ready_queue;
-    ready_queue = proc;
+    // Reserve a PID whose slot no other process holds, so the mailbox of
+    // that slot is ours; it is set up without the lock
+    uint64_t flags = spin_lock_irqsave(&process_lock);
+    if (process_count >= PROCESS_MAX) {
+        spin_unlock_irqrestore(&process_lock, flags);
+        printf("process_create: Too many processes\n");
+        goto fail;
+    }
+    while (pid_slots[next_pid & (PROCESS_MAX - 1)]) {
+        next_pid++;
+    }
+    uint32_t pid = proc->pid = next_pid++;
+    pid_slots[pid & (PROCESS_MAX - 1)] = proc;
+    process_count++;
+    spin_unlock_irqrestore(&process_lock, flags);
+
+    proc->mailbox = ipc_mailbox_open(pid);
+    flags = spin_lock_irqsave(&process_lock);
+    if (!proc->mailbox) {
+        pid_slots[pid & (PROCESS_MAX - 1)] = NULL;
+        process_count--;
+        spin_unlock_irqrestore(&process_lock, flags);
+        goto fail;
+    }
+
+    // Track the process, then add it to its CPU's ready queue
+    proc->all_next = process_list;
+    process_list = proc;
+    spin_unlock_irqrestore(&process_lock, flags);
+
+    flags = irq_save();
+    rq_enqueue(cpu, proc);
+    irq_restore(flags);
     
-    printf("Created process %u\n", proc->pid);
-    return proc->pid;
+    printf("Created process %u on CPU %u\n", pid, cpu->id);
+    return pid;
+
+fail:
+    mm_owner_release(proc->heap_owner);
+    stack_free(stack);
+    kmem_cache_free(pcb_cache, proc);
+    if (space) user_space_destroy(space);
+    return 0;
 }
 
-// Context switch (implemented in assembly)
-__attribute__((naked)) void context_switch(uint64_t *old_rsp, uint64_t *old_rbp, uint64_t new_rsp, uint64_t new_rbp) {
-    (void)old_rsp; (void)old_rbp; (void)new_rsp; (void)new_rbp; // Suppress unused parameter warnings
-    
+// Context switch: save the callee-saved registers on the old stack, store
+// its RSP in *old_rsp, and resume whatever switch frame is at 'new_rsp'
+// (switch_frame_t). It is only ever called like a function, so the
+// caller-saved registers are already dead, and always with interrupts
+// off, so RFLAGS is the same on both sides.
+__attribute__((naked)) void context_switch(uint64_t *old_rsp, uint64_t new_rsp) {
+    (void)old_rsp; (void)new_rsp; // Suppress unused parameter warnings
     __asm__ __volatile__ (
-        // Save current context
-        "pushfq                  \n"  // Save RFLAGS
-        "pushq %%rax             \n"  // Save RAX
-        "pushq %%rbx             \n"  // Save RBX
-        "pushq %%rcx             \n"  // Save RCX
-        "pushq %%rdx             \n"  // Save RDX
-        "pushq %%rsi             \n"  // Save RSI
-        "pushq %%rdi             \n"  // Save RDI
-        "pushq %%r8              \n"  // Save R8
-        "pushq %%r9              \n"  // Save R9
-        "pushq %%r10             \n"  // Save R10
-        "pushq %%r11             \n"  // Save R11
-        "pushq %%r12             \n"  // Save R12
-        "pushq %%r13             \n"  // Save R13
-        "pushq %%r14             \n"  // Save R14
-        "pushq %%r15             \n"  // Save R15
-        
-        // Save current RSP and RBP
-        "movq %%rsp, (%%rdi)     \n"  // Save RSP to *old_rsp
-        "movq %%rbp, (%%rsi)     \n"  // Save RBP to *old_rbp
-        
-        // Load new RSP and RBP
-        "movq %%rdx, %%rsp       \n"  // Load new_rsp into RSP
-        "movq %%rcx, %%rbp       \n"  // Load new_rbp into RBP
-        
-        // Restore new context
-        "popq %%r15              \n"  // Restore R15
-        "popq %%r14              \n"  // Restore R14
-        "popq %%r13              \n"  // Restore R13
-        "popq %%r12              \n"  // Restore R12
-        "popq %%r11              \n"  // Restore R11
-        "popq %%r10              \n"  // Restore R10
-        "popq %%r9               \n"  // Restore R9
-        "popq %%r8               \n"  // Restore R8
-        "popq %%rdi              \n"  // Restore RDI
-        "popq %%rsi              \n"  // Restore RSI
-        "popq %%rdx              \n"  // Restore RDX
-        "popq %%rcx              \n"  // Restore RCX
-        "popq %%rbx              \n"  // Restore RBX
-        "popq %%rax              \n"  // Restore RAX
-        "popfq                   \n"  // Restore RFLAGS
-        
-        // Return to the new context
+        "pushq %rbp              \n"
+        "pushq %rbx              \n"
+        "pushq %r12              \n"
+        "pushq %r13              \n"
+        "pushq %r14              \n"
+        "pushq %r15              \n"
+        "movq %rsp, (%rdi)       \n"  // *old_rsp = RSP
+        "movq %rsi, %rsp         \n"  // RSP = new_rsp
+        "popq %r15               \n"
+        "popq %r14               \n"
+        "popq %r13               \n"
+        "popq %r12               \n"
+        "popq %rbx               \n"
+        "popq %rbp               \n"
         "retq                    \n"
-        : // No outputs (we write through pointers)
-        : "D" (old_rsp), "S" (old_rbp), "d" (new_rsp), "c" (new_rbp)
-        : "memory"
     );
 }
 
-// Schedule the next process to run
-void process_schedule(void) {
-    if (!ready_queue) {
-        // No processes to run, just return
-        return;
+// Where a new process's switch frame returns to: pass the entry point the
+// frame left in R12 on to process_start, which never returns
+__attribute__((naked)) static void process_trampoline(void) {
+    __asm__ __volatile__ (
+        "movq %r12, %rdi         \n"
+        "call process_start      \n"
+        "ud2                     \n"
+    );
+}
+
+// Charge the tick path's cost, from the timer IRQ to the switch
+static void account_tick(cpu_t *cpu, uint64_t start) {
+    uint64_t cycles = rdtsc() - start;
+    cpu->stats.tick_cycles += cycles;
+    if (cycles > cpu->stats.tick_cycles_max) {
+        cpu->stats.tick_cycles_max = cycles;
     }
-    
-    // Save current process state
-    pcb_t *prev = current_process;
-    
-    // Get the next process from the ready queue
-    pcb_t *next = ready_queue;
-    ready_queue = ready_queue->next;
-    
-    // If the previous process is still runnable, add it to the end of the queue
-    if (prev->state == PROCESS_RUNNING) {
-        prev->state = PROCESS_READY;
-        prev->next = NULL;
-        
-        // Find the end of the queue
-        pcb_t *p = ready_queue;
-        if (p) {
-            while (p->next) p = p->next;
-            p->next = prev;
-        } else {
-            ready_queue = prev;
+}
+
+// Switch to the highest-priority ready process on this CPU; called with
+// interrupts off. A runnable caller only gives way to equal or higher
+// priorities, and with nothing ready a caller that cannot go on hands the
+// CPU to its idle task. 'start' is the TSC at the timer interrupt when a
+// tick caused the switch, else 0.
+static void switch_to_next(cpu_t *cpu, uint64_t start) {
+    pcb_t *prev = cpu->current;
+    int runnable = prev->state == PROCESS_RUNNING && prev != cpu->idle;
+
+    // Get the next process from the run queue
+    pcb_t *next = rq_take(&cpu->run_queue, runnable ? rq_priority(prev) : 0);
+    if (!next) {
+        if (runnable || prev == cpu->idle || !cpu->idle) {
+            // Nothing else to run; keep going with a fresh slice
+            prev->time_slice = slice_ticks(prev->priority);
+            if (start) account_tick(cpu, start);
+            return;
         }
+        next = cpu->idle;
+    }
+
+    if (prev == cpu->idle) {
+        idle_wake(cpu);  // Switching straight out of the halt from an interrupt
+    }
+
+    // Charge the time 'prev' ran. Both timestamps move before either
+    // state does, so a monitor reading them from another CPU is only ever
+    // off by the few cycles in between (process_runtime).
+    uint64_t now = rdtsc();
+    prev->runtime += now - prev->last_run;
+    prev->last_run = now;
+    next->last_run = now;
+
+    // A previous process that is still runnable goes to the back of its
+    // queue, but only once it is switched out (finish_switch)
+    if (runnable || prev == cpu->idle) {
+        prev->state = PROCESS_READY;
     }
     
-    // Switch to the next process
+    // A user process needs its address space loaded, and its kernel stack
+    // where ring 3 enters (the TSS for interrupts, GS for SYSCALL). Kernel
+    // processes run in the kernel's space, so a dead user space is never
+    // left loaded.
+    if (next->space != cpu->space) {
+        vmm_switch_space(next->space ? next->space : vmm_kernel_space());
+        cpu->space = next->space;
+    }
+    if (next->space) {
+        uint64_t kernel_rsp = (uint64_t)(uintptr_t)next->stack + PROCESS_STACK_SIZE;
+        cpu->kernel_rsp = kernel_rsp;
+        gdt_set_kernel_stack(cpu->id, kernel_rsp);
+    }
+
+    // Switch to the next process with a fresh time slice. 'prev' stays
+    // marked on_cpu until its registers are saved.
     next->state = PROCESS_RUNNING;
-    current_process = next;
+    next->time_slice = slice_ticks(next->priority);
+    next->switches++;
+    next->on_cpu = 1;
+    cpu->current = next;
+    cpu->prev = prev;
+    cpu->stats.switches++;
+    if (start) account_tick(cpu, start);
     
     // Perform the context switch
-    context_switch(&prev->rsp, &prev->rbp, next->rsp, next->rbp);
+    context_switch(&prev->rsp, next->rsp);
     
     // When we return here, we're running in the context of the new process
+    finish_switch();
+}
+
+// Schedule the next process to run
+void process_schedule(void) {
+    uint64_t flags = irq_save();
+    switch_to_next(this_cpu(), 0);
+    irq_restore(flags);
+}
+
+// Timer tick (IRQ0 on the boot CPU, the APIC timer on the others;
+// interrupts off): charge the running process and preempt it once its
+// time slice is used up
+void process_tick(uint64_t start) {
+    cpu_t *cpu = this_cpu();
+    cpu->stats.ticks++;
+    pcb_t *proc = cpu->current;
+    if (!proc) {
+        return;
+    }
+
+    uint32_t boost_ticks = PROCESS_MLFQ_BOOST_MS * timer_hz() / 1000;
+    if (boost_ticks && cpu->stats.ticks % boost_ticks == 0) {
+        mlfq_reset(cpu);
+    }
+
+    proc->ticks++;
+    if (softirq_active()) {
+        // Interrupted bottom halves are using this stack and this CPU's
+        // state: no switching until they are done
+        account_tick(cpu, start);
+        return;
+    }
+    if (proc == cpu->idle) {
+        // The idle task gives way as soon as anything is ready
+        if (cpu->run_queue.count) {
+            switch_to_next(cpu, start);
+        } else {
+            account_tick(cpu, start);
+        }
+        return;
+    }
+    if (proc->time_slice > 1) {
+        proc->time_slice--;
+        account_tick(cpu, start);
+        return;
+    }
+
+    // Burned the whole slice: demote, then give way to anything of at
+    // least the new priority
+    mlfq_demote(cpu, proc);
+    int top = rq_top_priority(&cpu->run_queue);
+    if (top >= 0 && (uint32_t)top >= rq_priority(proc)) {
+        proc->preemptions++;
+        cpu->stats.preemptions++;
+    }
+    switch_to_next(cpu, start);
+}
+
+// Scheduler counters summed over every CPU (the maximum for tick_cycles_max)
+void process_get_sched_stats(sched_stats_t* stats) {
+    if (!stats) {
+        return;
+    }
+    memset(stats, 0, sizeof(sched_stats_t));
+    for (uint32_t i = 0; i < smp_cpu_count(); i++) {
+        sched_stats_t *cpu = &smp_cpu(i)->stats;
+        stats->ticks += cpu->ticks;
+        stats->preemptions += cpu->preemptions;
+        stats->yields += cpu->yields;
+        stats->switches += cpu->switches;
+        stats->tick_cycles += cpu->tick_cycles;
+        if (cpu->tick_cycles_max > stats->tick_cycles_max) {
+            stats->tick_cycles_max = cpu->tick_cycles_max;
+        }
+        stats->demotions += cpu->demotions;
+        stats->boosts += cpu->boosts;
+        stats->resets += cpu->resets;
+        stats->steal_attempts += cpu->steal_attempts;
+        stats->steals += cpu->steals;
+        stats->halts += cpu->halts;
+        stats->tickless += cpu->tickless;
+        stats->kicks += cpu->kicks;
+        stats->idle_cycles += cpu->idle_cycles;
+    }
+}
+
+// Cycles a process has run, counting the stretch it may be in right now.
+// Read from another CPU a switch can land in between, so the result may
+// be a few cycles off either way; usage_close allows for that.
+static uint64_t process_runtime(pcb_t *proc, uint64_t now) {
+    uint64_t runtime = proc->runtime;
+    if (proc->state == PROCESS_RUNNING && proc->on_cpu) {
+        uint64_t last_run = proc->last_run;
+        if (now > last_run) {
+            runtime += now - last_run;
+        }
+    }
+    return runtime;
+}
+
+// Close a usage window for one process: its share of the 'window' cycles
+static void usage_close(pcb_t *proc, uint64_t now, uint64_t window) {
+    uint64_t runtime = process_runtime(proc, now);
+    uint64_t used = 0;
+    if (runtime > proc->window_runtime) {
+        used = runtime - proc->window_runtime;
+        proc->window_runtime = runtime;
+    }
+    uint64_t usage = window ? used * 100 / window : 0;
+    proc->usage = usage > 100 ? 100 : (uint32_t)usage;
+}
+
+// Timer callback ending each usage window. A CPU is busy for whatever
+// share of the window its idle task did not run.
+static void process_usage_sample(void *arg) {
+    (void)arg;
+    uint64_t now = rdtsc();
+    uint64_t window = now - usage_window_start;
+    usage_window_start = now;
+
+    uint64_t flags = spin_lock_irqsave(&process_lock);
+    for (pcb_t *proc = process_list; proc; proc = proc->all_next) {
+        usage_close(proc, now, window);
+    }
+    spin_unlock_irqrestore(&process_lock, flags);
+
+    for (uint32_t i = 0; i < smp_cpu_count(); i++) {
+        cpu_t *cpu = smp_cpu(i);
+        if (cpu->idle) {
+            usage_close(cpu->idle, now, window);
+            cpu->usage = 100 - cpu->idle->usage;
+        }
+    }
+
+    timer_add(&usage_timer, usage_timer.deadline + timer_ms_to_ticks(PROCESS_USAGE_WINDOW_MS),
+              process_usage_sample, NULL);
+}
+
+// Start measuring CPU usage (after timer_init)
+void process_usage_start(void) {
+    usage_window_start = rdtsc();
+    timer_add(&usage_timer, timer_ticks() + timer_ms_to_ticks(PROCESS_USAGE_WINDOW_MS),
+              process_usage_sample, NULL);
+}
+
+// Live processes, zombies not yet reaped included. Read without the lock,
+// so only a hint by the time the caller sees it.
+uint32_t process_total(void) {
+    return __atomic_load_n(&process_count, __ATOMIC_RELAXED);
+}
+
+// Percent of the last usage window CPU 'cpu' was busy
+uint32_t process_cpu_usage(uint32_t cpu) {
+    cpu_t *c = smp_cpu(cpu);
+    return c ? c->usage : 0;
+}
+
+// Copy out up to 'max' live processes for a monitor; returns how many
+int process_snapshot(process_snapshot_t* procs, int max) {
+    int count = 0;
+    uint64_t flags = spin_lock_irqsave(&process_lock);
+    uint64_t now = rdtsc();
+    for (pcb_t *proc = process_list; proc && count < max; proc = proc->all_next) {
+        if (proc->state == PROCESS_ZOMBIE) {
+            continue;
+        }
+        process_snapshot_t *snap = &procs[count++];
+        snap->pid = proc->pid;
+        memcpy(snap->name, proc->name, PROCESS_NAME_LEN);
+        snap->state = proc->state;
+        snap->cpu = proc->cpu;
+        snap->priority = proc->priority;
+        snap->runtime = process_runtime(proc, now);
+        snap->switches = proc->switches;
+        snap->preemptions = proc->preemptions;
+        snap->usage = proc->usage;
+        snap->heap_bytes = mm_owner_bytes(proc->heap_owner);
+    }
+    spin_unlock_irqrestore(&process_lock, flags);
+    return count;
 }
 
 // Terminate the current process
 void process_exit(int status) {
-    printf("Process %u exited with status %d\n", current_process->pid, status);
-    
-    // Free the process's stack
-    if (current_process->stack) {
-        kfree(current_process->stack);
-    }
+    printf("Process %u exited with status %d\n", process_current()->pid, status);
+    ipc_mailbox_close(process_current()->mailbox);
     
-    // Mark the process as a zombie
-    current_process->state = PROCESS_ZOMBIE;
+    // Mark the process as a zombie; its stack and PCB are reaped once no
+    // CPU is running on them any more
+    irq_disable();
+    cpu_t *cpu = this_cpu();
+    cpu->current->state = PROCESS_ZOMBIE;
     
     // Schedule the next process
-    process_schedule();
+    switch_to_next(cpu, 0);
     
     // We should never get here
     for (;;) __asm__ volatile("hlt");
@@ -200,21 +882,210 @@ void process_exit(int status) {
 
 // Yield the CPU to another process
 void process_yield(void) {
-    __asm__ volatile("int $0x20");  // Trigger a software interrupt
+    uint64_t flags = irq_save();
+    cpu_t *cpu = this_cpu();
+    cpu->stats.yields++;
+    mlfq_boost(cpu, cpu->current);
+    switch_to_next(cpu, 0);
+    irq_restore(flags);
+}
+
+// Background work done by PID 0 and the idle tasks when they have nothing
+// else to do: refill the zeroed page pool
+void process_idle(void) {
+    pcb_t *proc = process_current();
+    if (proc && proc->pid != 0) {
+        return;
+    }
+    pmm_zero_idle(PMM_ZERO_BATCH);
+}
+
+// The idle task is done halting (interrupts off): charge the halt and
+// restart the tick if it was stopped. Called after the halt, or from
+// switch_to_next when an interrupt switches away before the idle task
+// gets to run again.
+static void idle_wake(cpu_t *cpu) {
+    if (!cpu->idle_halted) {
+        return;
+    }
+    __atomic_store_n(&cpu->idle_halted, 0, __ATOMIC_SEQ_CST);
+    __atomic_fetch_sub(&cpus_halted, 1, __ATOMIC_SEQ_CST);
+    cpu->stats.idle_cycles += rdtsc() - cpu->halt_start;
+    if (cpu->tick_stopped) {
+        cpu->tick_stopped = 0;
+        if (cpu->id == 0) {
+            timer_nohz_exit();
+        } else {
+            lapic_timer_start(timer_hz());
+        }
+    }
+}
+
+// Halt until there is work (interrupts off; 'sti; hlt' only takes them
+// once the CPU is halted, so one arriving in between still wakes it).
+// idle_halted is set before the queue is checked one last time, and
+// rq_kick reads it after queueing, so a process queued from another CPU
+// either is seen here or gets this CPU an IPI. The tick stops for the
+// halt: the boot CPU, which keeps the timer wheel, programs a one-shot
+// for the next deadline; the others need no tick at all while idle.
+static void idle_halt(cpu_t *cpu) {
+    __atomic_store_n(&cpu->idle_halted, 1, __ATOMIC_SEQ_CST);
+    __atomic_fetch_add(&cpus_halted, 1, __ATOMIC_SEQ_CST);
+    cpu->halt_start = rdtsc();
+    if (__atomic_load_n(&cpu->run_queue.count, __ATOMIC_SEQ_CST)) {
+        idle_wake(cpu);
+        return;
+    }
+
+    if (cpu->id == 0) {
+        cpu->tick_stopped = timer_nohz_enter();
+    } else if (timer_hz()) {
+        lapic_timer_stop();
+        cpu->tick_stopped = 1;
+    }
+    cpu->stats.halts++;
+    if (cpu->tick_stopped) {
+        cpu->stats.tickless++;
+    }
+    __asm__ volatile ("sti; hlt; cli" : : : "memory");
+    idle_wake(cpu);
+}
+
+// Body of every CPU's idle task
+void process_idle_loop(void) {
+    for (;;) {
+        process_idle();
+        irq_disable();
+        cpu_t *cpu = this_cpu();
+        if (!cpu->run_queue.count) {
+            // Nothing of our own: pull work from the busiest other CPU
+            pcb_t *proc = rq_steal(cpu);
+            if (proc) {
+                rq_enqueue(cpu, proc);
+            }
+        }
+        if (cpu->run_queue.count) {
+            switch_to_next(cpu, 0);
+        } else {
+            idle_halt(cpu);
+        }
+        irq_enable();
+    }
+}
+
+// Change the running process's base priority, returning the old one. It
+// takes effect the next time the process is queued.
+uint32_t process_set_priority(uint32_t priority) {
+    uint64_t flags = irq_save();
+    pcb_t *proc = this_cpu()->current;
+    uint32_t old = proc->base_priority;
+    proc->base_priority = clamp_priority(priority);
+    proc->priority = proc->base_priority;
+    irq_restore(flags);
+    return old;
+}
+
+// Name the running process, for monitors
+void process_set_name(const char* name) {
+    uint64_t flags = irq_save();
+    pcb_set_name(this_cpu()->current, name);
+    irq_restore(flags);
+}
+
+// Tune the time slice of one priority level
+void process_set_level_slice(uint32_t priority, uint32_t ms) {
+    if (priority < PROCESS_PRIORITIES && ms > 0) {
+        level_slice_ms[priority] = ms;
+    }
+}
+
+uint32_t process_get_level_slice(uint32_t priority) {
+    return level_slice_ms[clamp_priority(priority)];
 }
 
 // Get the current process
 pcb_t* process_current(void) {
-    return current_process;
+    uint64_t flags = irq_save();
+    pcb_t *proc = this_cpu()->current;
+    irq_restore(flags);
+    return proc;
+}
+
+// Get the first process in the process list (follow all_next for the rest)
+pcb_t* process_first(void) {
+    return process_list;
 }
 
-// Simple sleep function (not very accurate)
+// Blocking: a process sets itself PROCESS_BLOCKED with interrupts off,
+// publishes itself where a waker will find it (a wait queue, a timer),
+// then calls process_block. A wakeup can land at any point in between.
+
+// Switch away until woken (interrupts off, state already PROCESS_BLOCKED).
+// Returns at once if a wakeup came first.
+void process_block(void) {
+    cpu_t *cpu = this_cpu();
+    pcb_t *proc = cpu->current;
+    spin_lock(&proc->lock);
+    if (proc->state != PROCESS_BLOCKED) {
+        proc->state = PROCESS_RUNNING;
+        spin_unlock(&proc->lock);
+        return;
+    }
+    spin_unlock(&proc->lock);
+    switch_to_next(cpu, 0);
+}
+
+// Back out of a block that is no longer needed (interrupts off): the
+// process keeps running, whether or not a wakeup claimed it meanwhile.
+// Nothing has queued it, since it never switched out.
+void process_unblock(void) {
+    pcb_t *proc = this_cpu()->current;
+    spin_lock(&proc->lock);
+    proc->state = PROCESS_RUNNING;
+    spin_unlock(&proc->lock);
+}
+
+// Make a blocked process ready again, on the CPU it last ran on. Safe from
+// any CPU and from interrupt handlers; waking a process that is not
+// blocked does nothing. One still switching out is queued by
+// finish_switch instead, once its registers are saved.
+void process_wake(pcb_t *proc) {
+    uint64_t flags = spin_lock_irqsave(&proc->lock);
+    int queue = 0;
+    if (proc->state == PROCESS_BLOCKED) {
+        proc->state = PROCESS_READY;
+        queue = !proc->on_cpu;
+    }
+    if (queue) {
+        cpu_t *cpu = smp_cpu(proc->cpu);
+        rq_enqueue(cpu ? cpu : this_cpu(), proc);
+    }
+    spin_unlock_irqrestore(&proc->lock, flags);
+}
+
+static void sleep_expired(void *arg) {
+    process_wake((pcb_t *)arg);
+}
+
+// Block the running process for at least 'ms' milliseconds. It leaves the
+// run queue until a timer wakes it, so sleeping costs no CPU time.
 void process_sleep(uint32_t ms) {
-    // This is a very simple implementation that just yields
-    // In a real OS, this would use a timer and block the process
-    volatile uint32_t count = ms * 1000;
-    while (count-- > 0) {
-        __asm__ volatile("pause");
+    timer_t timer = { 0 };
+    uint64_t flags = irq_save();
+    cpu_t *cpu = this_cpu();
+    pcb_t *proc = cpu->current;
+    if (proc == cpu->idle) {
+        irq_restore(flags);
+        return;
     }
-    process_yield();
+
+    // Blocked before the timer is armed, in case it fires on another CPU
+    // right away
+    proc->state = PROCESS_BLOCKED;
+    timer_add(&timer, timer_ticks() + timer_ms_to_ticks(ms) + 1, sleep_expired, proc);
+    process_block();
+
+    // Woken some other way, the timer must not outlive this frame
+    timer_cancel(&timer);
+    irq_restore(flags);
 }
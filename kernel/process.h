@@ -2,6 +2,9 @@
 #define _PROCESS_H
 
 #include <stdint.h>
+#include "deque.h"
+#include "spinlock.h"
+#include "mm/vmm.h"
 
 // Process states
 #define PROCESS_RUNNING  0
@@ -9,29 +12,145 @@
 #define PROCESS_BLOCKED  2
 #define PROCESS_ZOMBIE   3
 
-// Maximum number of processes
-#define MAX_PROCESSES 64
+// Priorities: higher values run first, equal ones share the CPU round-robin
+#define PROCESS_PRIORITIES       32
+#define PROCESS_PRIORITY_DEFAULT 16
+
+// process_create_on: let the scheduler pick the least loaded CPU
+#define PROCESS_CPU_ANY 0xFFFFFFFF
+
+// Live processes at most; also the capacity of every run queue level, so
+// an enqueue always finds room (power of two)
+#define PROCESS_MAX 256
+
+// Multi-level feedback: a process that burns its whole slice drops a level
+// (at most PROCESS_MLFQ_DEPTH below its base priority), one that yields
+// with most of its slice left climbs back, and every PROCESS_MLFQ_BOOST_MS
+// all processes return to their base priority. Slices start at
+// PROCESS_TIME_SLICE_MS and double for each level below the default;
+// process_set_level_slice tunes them.
+#define PROCESS_TIME_SLICE_MS 20
+#define PROCESS_MLFQ_DEPTH    3
+#define PROCESS_MLFQ_BOOST_MS 1000
+
+// CPU usage is the share of each PROCESS_USAGE_WINDOW_MS window a process
+// spent running, measured in TSC cycles
+#define PROCESS_USAGE_WINDOW_MS 1000
+
+#define PROCESS_NAME_LEN 16
+
+// What context_switch leaves at a switched-out process's saved RSP: the
+// registers the SysV ABI makes callee-saved, then the address to resume
+// at. New processes get one that enters process_trampoline.
+typedef struct {
+    uint64_t r15;
+    uint64_t r14;
+    uint64_t r13;
+    uint64_t r12;
+    uint64_t rbx;
+    uint64_t rbp;
+    uint64_t rip;
+} switch_frame_t;
 
 // Process control block (PCB)
 typedef struct process_control_block {
     uint32_t pid;           // Process ID
-    uint64_t rsp;           // Stack pointer (64-bit)
-    uint64_t rbp;           // Base pointer (64-bit)
-    uint64_t rip;           // Instruction pointer (64-bit)
+    uint64_t rsp;           // Saved stack pointer, at a switch_frame_t while switched out
     uint32_t state;         // Process state
-    uint32_t priority;      // Process priority
-    uint32_t time_slice;    // Time slice counter
+    uint32_t priority;      // Current priority (the run queue level)
+    uint32_t base_priority; // Priority it was created with; MLFQ moves below it
+    uint32_t time_slice;    // Timer ticks left before preemption
     void* stack;            // Process stack
-    struct process_control_block* next;  // Next process in the ready queue
+    struct process_control_block* next;  // Link in short private lists (MLFQ reset)
+    struct process_control_block* all_next;  // Next process in the process list
+    uint64_t runtime;       // TSC cycles spent running (up to the last switch)
+    uint64_t last_run;      // TSC when last switched in
+    uint32_t ticks;         // Timer ticks that arrived while running
+    uint32_t preemptions;   // Times its time slice ran out
+    uint32_t switches;      // Times switched in
+    uint32_t cpu;           // CPU whose run queue it belongs to
+    uint32_t pinned;        // Never moved by the load balancer
+    volatile uint32_t on_cpu;  // Set from switch-in until its context is saved
+    spinlock_t lock;        // Orders wakeups against switching out (process_wake)
+    struct mailbox* mailbox;  // IPC receive ring of its PID slot (ipc.c); NULL for idle tasks
+    uint32_t heap_owner;    // Heap accounting owner its allocations are charged to
+    uint64_t window_runtime;  // Runtime at the start of the current usage window
+    uint32_t usage;         // Percent of one CPU used over the last window
+    char name[PROCESS_NAME_LEN];
+    vmm_space_t* space;     // User processes: their address space; NULL for kernel ones
+    uint64_t user_entry;    // Where a user process starts in ring 3
+    struct uring* ring;     // Submission/completion rings, from uring_setup (uring.c)
 } pcb_t;
 
+// Ready processes, one FIFO deque per priority (see process.c). Each CPU
+// has its own; idle CPUs steal from the others'.
+typedef struct {
+    deque_t level[PROCESS_PRIORITIES];
+    volatile uint32_t bitmap;  // Bit p set when priority p may have a ready process
+    volatile uint32_t count;   // Ready processes
+    volatile uint32_t pinned;  // Ready processes the balancer must leave alone
+} run_queue_t;
+
+// Scheduler counters, kept per CPU (process_get_sched_stats adds them up)
+typedef struct {
+    uint64_t ticks;            // Timer ticks seen by the scheduler
+    uint32_t preemptions;      // Switches forced by an expired time slice
+    uint32_t yields;           // Voluntary switches
+    uint32_t switches;         // Context switches of any kind
+    uint64_t tick_cycles;      // TSC cycles spent in the tick path, up to the switch
+    uint64_t tick_cycles_max;  // Longest single tick
+    uint32_t demotions;        // MLFQ: levels lost by burning a whole slice
+    uint32_t boosts;           // MLFQ: levels regained by yielding early
+    uint32_t resets;           // MLFQ: periodic returns to base priority
+    uint32_t steal_attempts;   // Balancer: tries at another CPU's run queue
+    uint32_t steals;           // Balancer: processes pulled from another CPU
+    uint32_t halts;            // Idle: times the CPU halted
+    uint32_t tickless;         // Idle: halts with the tick stopped
+    uint32_t kicks;            // Idle: halted CPUs woken by an IPI to take work
+    uint64_t idle_cycles;      // Idle: TSC cycles spent halted
+} sched_stats_t;
+
+// One process as seen by process_snapshot, for monitors
+typedef struct {
+    uint32_t pid;
+    char name[PROCESS_NAME_LEN];
+    uint32_t state;
+    uint32_t cpu;
+    uint32_t priority;
+    uint64_t runtime;       // TSC cycles spent running, up to now
+    uint32_t switches;      // Times switched in
+    uint32_t preemptions;   // Times its time slice ran out
+    uint32_t usage;         // Percent of one CPU over the last usage window
+    uint32_t heap_bytes;    // Heap it allocated and has not freed
+} process_snapshot_t;
+
 // Function declarations
 void process_init(void);
+int process_init_ap(void);
 uint32_t process_create(void (*entry)(void), uint32_t priority);
+uint32_t process_create_on(void (*entry)(void), uint32_t priority, uint32_t cpu);
+uint32_t process_create_user(const void* code, uint32_t size, uint32_t priority);
 void process_schedule(void);
 void process_exit(int status);
 void process_yield(void);
+uint32_t process_set_priority(uint32_t priority);
+void process_set_level_slice(uint32_t priority, uint32_t ms);
+uint32_t process_get_level_slice(uint32_t priority);
+void process_idle(void);
+void process_idle_loop(void) __attribute__((noreturn));
 pcb_t* process_current(void);
+pcb_t* process_first(void);
 void process_sleep(uint32_t ms);
+void process_block(void);
+void process_unblock(void);
+void process_wake(pcb_t* proc);
+void process_tick(uint64_t start);
+void process_get_sched_stats(sched_stats_t* stats);
+void context_switch(uint64_t* old_rsp, uint64_t new_rsp);
+void process_set_name(const char* name);
+void process_usage_start(void);
+int process_snapshot(process_snapshot_t* procs, int max);
+uint32_t process_cpu_usage(uint32_t cpu);
+uint32_t process_total(void);
 
 #endif // _PROCESS_H
@@ -0,0 +1,64 @@
+#include "serial.h"
+#include "io.h"
+#include "libc/stdio.h"
+#include <stdarg.h>
+
+// 16550 UART registers, relative to the port base
+#define SERIAL_DATA         0
+#define SERIAL_INT_ENABLE   1
+#define SERIAL_FIFO_CTRL    2
+#define SERIAL_LINE_CTRL    3
+#define SERIAL_MODEM_CTRL   4
+#define SERIAL_LINE_STATUS  5
+
+#define SERIAL_LINE_THR_EMPTY 0x20
+
+static int serial_ready = 0;
+
+// Bring up COM1 at 115200 8N1 with FIFOs enabled
+void serial_init(void) {
+    outb(SERIAL_COM1 + SERIAL_INT_ENABLE, 0x00);   // No interrupts; we poll
+    outb(SERIAL_COM1 + SERIAL_LINE_CTRL, 0x80);    // DLAB on
+    outb(SERIAL_COM1 + SERIAL_DATA, 0x01);         // Divisor 1 = 115200 baud
+    outb(SERIAL_COM1 + SERIAL_INT_ENABLE, 0x00);
+    outb(SERIAL_COM1 + SERIAL_LINE_CTRL, 0x03);    // 8 bits, no parity, 1 stop
+    outb(SERIAL_COM1 + SERIAL_FIFO_CTRL, 0xC7);    // Enable and clear FIFOs
+    outb(SERIAL_COM1 + SERIAL_MODEM_CTRL, 0x03);   // DTR + RTS
+    serial_ready = 1;
+}
+
+void serial_putc(char c) {
+    if (!serial_ready) return;
+
+    if (c == '\n') {
+        serial_putc('\r');
+    }
+    while (!(inb(SERIAL_COM1 + SERIAL_LINE_STATUS) & SERIAL_LINE_THR_EMPTY)) {
+        // Wait for the transmit holding register
+    }
+    outb(SERIAL_COM1 + SERIAL_DATA, (uint8_t)c);
+}
+
+void serial_write(const char* str) {
+    while (*str) {
+        serial_putc(*str++);
+    }
+}
+
+// Write all 16 hex digits of a 64-bit value (the kernel printf has no %lx)
+void serial_write_hex(uint64_t value) {
+    static const char digits[] = "0123456789abcdef";
+    serial_write("0x");
+    for (int shift = 60; shift >= 0; shift -= 4) {
+        serial_putc(digits[(value >> shift) & 0xF]);
+    }
+}
+
+void serial_printf(const char* format, ...) {
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    serial_write(buffer);
+}
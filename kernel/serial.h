@@ -0,0 +1,15 @@
+#ifndef _SERIAL_H
+#define _SERIAL_H
+
+#include <stdint.h>
+
+#define SERIAL_COM1 0x3F8
+
+// Function declarations
+void serial_init(void);
+void serial_putc(char c);
+void serial_write(const char* str);
+void serial_write_hex(uint64_t value);
+void serial_printf(const char* format, ...);
+
+#endif // _SERIAL_H
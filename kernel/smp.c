@@ -0,0 +1,237 @@
+#include "smp.h"
+#include "acpi.h"
+#include "apic.h"
+#include "gdt.h"
+#include "idt.h"
+#include "timer.h"
+#include "cpu.h"
+#include "softirq.h"
+#include "user.h"
+#include "mm/vmm.h"
+#include "mm/pmm.h"
+#include "mm/stack.h"
+#include "libc/string.h"
+#include "libc/stdio.h"
+
+#define MSR_EFER    0xC0000080
+#define MSR_GS_BASE 0xC0000101
+
+// Start-up timing: INIT, a 10ms pause, then a startup IPI, repeated once
+// if the AP has not reported in shortly after
+#define SMP_INIT_DELAY_US     10000
+#define SMP_SIPI_WAIT_US      1000
+#define SMP_STARTUP_WAIT_US   100000
+#define SMP_POLL_US           100
+
+// Copied to SMP_TRAMPOLINE_ADDR (kernel/arch/x86_64/trampoline.s)
+extern uint8_t smp_trampoline_start[];
+extern uint8_t smp_trampoline_end[];
+extern uint8_t smp_trampoline_params[];
+extern void smp_tlb_stub(void);
+extern void smp_resched_stub(void);
+
+// Layout of the trampoline's parameter block
+typedef struct {
+    uint64_t cr3;
+    uint64_t efer;
+    uint64_t stack;      // Initial RSP
+    uint64_t entry;      // ap_entry
+    uint64_t cpu;        // Its argument
+} trampoline_params_t;
+
+static cpu_t cpus[SMP_MAX_CPUS];
+static volatile uint32_t cpus_online = 1;  // cpus[0 .. cpus_online) are running
+
+// Boot and fault (IST) stacks of each AP, kept if a start attempt fails
+static void* ap_stacks[SMP_MAX_CPUS];
+static void* ap_fault_stacks[SMP_MAX_CPUS];
+
+// TLB shootdown request: the page and the CPUs (one bit each) that have
+// not flushed it yet
+static spinlock_t shootdown_lock = SPINLOCK_INIT;
+static volatile uint64_t shootdown_addr;
+static volatile uint32_t shootdown_pending;
+
+static void cpu_setup(cpu_t* cpu, uint32_t id) {
+    memset(cpu, 0, sizeof(cpu_t));
+    cpu->self = cpu;
+    cpu->id = id;
+    spin_init(&cpu->lock);
+}
+
+// Make 'cpu' what this_cpu() returns on the running processor
+static void cpu_load(cpu_t* cpu) {
+    wrmsr(MSR_GS_BASE, (uint64_t)(uintptr_t)cpu);
+}
+
+// Per-CPU data for the boot CPU. Runs right after gdt_init, which clears
+// the GS base, and before anything that calls this_cpu().
+void smp_init_bsp(void) {
+    cpu_setup(&cpus[0], 0);
+    cpus[0].online = 1;
+    cpu_load(&cpus[0]);
+}
+
+uint32_t smp_cpu_count(void) {
+    return cpus_online;
+}
+
+cpu_t* smp_cpu(uint32_t id) {
+    return id < cpus_online ? &cpus[id] : NULL;
+}
+
+// First C code on an AP, on its boot stack with interrupts off. Once set
+// up, the boot context becomes the CPU's idle task.
+static void ap_entry(cpu_t* cpu) {
+    gdt_init_ap(cpu->id, ap_fault_stacks[cpu->id]);
+    idt_init_ap();
+    cpu_load(cpu);
+    vmm_init_ap();
+    user_init_ap();
+    lapic_enable();
+    if (!process_init_ap()) {
+        // Never reports in; the BSP gives up on it after its timeout
+        for (;;) __asm__ volatile("cli; hlt");
+    }
+    lapic_timer_start(timer_hz());
+
+    __atomic_store_n(&cpu->online, 1, __ATOMIC_RELEASE);
+    process_idle_loop();
+}
+
+// Bring one AP up as cpus[cpus_online]. Returns 1 once it has reported in.
+static int ap_start(uint32_t apic_id, trampoline_params_t* params) {
+    uint32_t id = cpus_online;
+    cpu_t* cpu = &cpus[id];
+    cpu_setup(cpu, id);
+    cpu->apic_id = apic_id;
+
+    if (!ap_stacks[id]) {
+        ap_stacks[id] = stack_alloc(SMP_AP_STACK_SIZE, SMP_AP_STACK_SIZE);
+        ap_fault_stacks[id] = pmm_alloc_pages(pmm_order_for_size(FAULT_STACK_SIZE));
+        if (!ap_stacks[id] || !ap_fault_stacks[id]) {
+            printf("smp: Out of memory for CPU %u's stacks\n", id);
+            return 0;
+        }
+    }
+    params->stack = (uint64_t)(uintptr_t)ap_stacks[id] + SMP_AP_STACK_SIZE;
+    params->cpu = (uint64_t)(uintptr_t)cpu;
+
+    lapic_send_ipi(apic_id, APIC_ICR_INIT | APIC_ICR_ASSERT);
+    timer_udelay(SMP_INIT_DELAY_US);
+
+    uint32_t waits[2] = { SMP_SIPI_WAIT_US, SMP_STARTUP_WAIT_US };
+    for (int attempt = 0; attempt < 2 && !cpu->online; attempt++) {
+        lapic_send_ipi(apic_id, APIC_ICR_STARTUP | (SMP_TRAMPOLINE_ADDR >> 12));
+        for (uint32_t waited = 0; waited < waits[attempt] && !cpu->online; waited += SMP_POLL_US) {
+            timer_udelay(SMP_POLL_US);
+        }
+    }
+
+    if (!cpu->online) {
+        printf("smp: CPU with APIC ID %u did not start\n", apic_id);
+        return 0;
+    }
+    cpus_online = id + 1;
+    return 1;
+}
+
+// Start every processor the MADT lists. Runs on the boot CPU after
+// process_init and timer_init; without a MADT or APIC it stays alone.
+void smp_init(void) {
+    acpi_madt_info_t madt;
+    if (!acpi_get_madt(&madt) || !lapic_init(madt.lapic_base)) {
+        printf("SMP: Running on the boot CPU only\n");
+        return;
+    }
+    cpus[0].apic_id = lapic_id();
+    idt_set_gate(APIC_VECTOR_TLB, (uint64_t)smp_tlb_stub, GDT_KERNEL_CODE, 0x8E);
+    idt_set_gate(APIC_VECTOR_RESCHED, (uint64_t)smp_resched_stub, GDT_KERNEL_CODE, 0x8E);
+    lapic_timer_calibrate();
+
+    memcpy((void*)SMP_TRAMPOLINE_ADDR, smp_trampoline_start,
+           smp_trampoline_end - smp_trampoline_start);
+    trampoline_params_t* params = (trampoline_params_t*)(uintptr_t)
+        (SMP_TRAMPOLINE_ADDR + (smp_trampoline_params - smp_trampoline_start));
+    params->cr3 = read_cr3();
+    params->efer = rdmsr(MSR_EFER);
+    params->entry = (uint64_t)(uintptr_t)ap_entry;
+
+    for (uint32_t i = 0; i < madt.cpu_count && cpus_online < SMP_MAX_CPUS; i++) {
+        if (madt.apic_ids[i] != cpus[0].apic_id) {
+            ap_start(madt.apic_ids[i], params);
+        }
+    }
+
+    printf("SMP: %u of %u CPUs online\n", cpus_online, madt.cpu_count);
+}
+
+// Answer a pending shootdown aimed at this CPU
+static void tlb_flush_pending(void) {
+    uint32_t bit = 1U << this_cpu()->id;
+    if (__atomic_load_n(&shootdown_pending, __ATOMIC_ACQUIRE) & bit) {
+        invlpg(shootdown_addr);
+        __atomic_fetch_and(&shootdown_pending, ~bit, __ATOMIC_RELEASE);
+    }
+}
+
+// Make the other CPUs drop their TLB entries for 'virt' after its mapping
+// changed; the caller has flushed its own. It waits for every CPU to
+// answer, so it must not be called holding a lock that another CPU could
+// be spinning on with interrupts off (the VMM drops its lock first).
+void smp_tlb_shootdown(uint64_t virt) {
+    if (cpus_online < 2) {
+        return;
+    }
+
+    uint64_t flags = irq_save();
+    uint32_t self = this_cpu()->id;
+
+    // Another CPU may be shooting down too, and waiting for us to answer
+    while (!spin_trylock(&shootdown_lock)) {
+        tlb_flush_pending();
+        cpu_pause();
+    }
+
+    uint32_t targets = 0;
+    for (uint32_t i = 0; i < cpus_online; i++) {
+        if (i != self) {
+            targets |= 1U << i;
+        }
+    }
+    shootdown_addr = virt;
+    __atomic_store_n(&shootdown_pending, targets, __ATOMIC_RELEASE);
+    for (uint32_t i = 0; i < cpus_online; i++) {
+        if (targets & (1U << i)) {
+            lapic_send_ipi(cpus[i].apic_id, APIC_ICR_FIXED | APIC_VECTOR_TLB);
+        }
+    }
+    while (__atomic_load_n(&shootdown_pending, __ATOMIC_ACQUIRE)) {
+        cpu_pause();
+    }
+
+    spin_unlock(&shootdown_lock);
+    irq_restore(flags);
+}
+
+// APIC_VECTOR_TLB
+void smp_tlb_handler(void) {
+    tlb_flush_pending();
+    lapic_eoi();
+}
+
+// Wake 'cpu' out of its idle halt so it looks at its run queue again
+void smp_resched(cpu_t* cpu) {
+    uint64_t flags = irq_save();
+    if (cpus_online > 1 && cpu != this_cpu()) {
+        lapic_send_ipi(cpu->apic_id, APIC_ICR_FIXED | APIC_VECTOR_RESCHED);
+    }
+    irq_restore(flags);
+}
+
+// APIC_VECTOR_RESCHED: nothing to do but leave the halt
+void smp_resched_handler(void) {
+    uint64_t start = rdtsc();
+    lapic_eoi();
+    irq_exit(start);
+}
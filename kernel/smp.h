@@ -0,0 +1,62 @@
+#ifndef _SMP_H
+#define _SMP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "process.h"
+#include "spinlock.h"
+
+#define SMP_MAX_CPUS        16
+#define SMP_TRAMPOLINE_ADDR 0x8000       // AP real-mode entry; below 1MB, never handed out by the PMM
+#define SMP_AP_STACK_SIZE   (16 * 1024)  // Boot stack, which becomes the AP's idle task stack
+
+// Fields the SYSCALL entry (arch/x86_64/user.s) reaches through GS
+#define CPU_KERNEL_RSP 8
+#define CPU_USER_RSP   16
+
+// Per-CPU state, reached through the GS base. 'self' must stay first: it
+// is what this_cpu() loads. While a user process runs in ring 3 the GS
+// base is the user's and this one waits in KERNEL_GS_BASE: every way into
+// the kernel from ring 3 starts with a swapgs.
+typedef struct cpu {
+    struct cpu* self;
+    uint64_t kernel_rsp;     // Top of the running user process's kernel stack
+    uint64_t user_rsp;       // Scratch for the user RSP on SYSCALL entry
+    uint32_t id;             // Index in the CPU table; 0 is the boot CPU
+    uint32_t apic_id;        // Local APIC ID
+    volatile uint32_t online;
+    pcb_t* current;          // Process running on this CPU
+    pcb_t* idle;             // Runs when nothing else is ready; never queued
+    pcb_t* prev;             // Process being switched away from (see process.c)
+    spinlock_t lock;         // Serializes pushes to run_queue
+    run_queue_t run_queue;   // Ready processes that run on this CPU
+    sched_stats_t stats;     // This CPU's share of the scheduler counters
+    uint32_t usage;          // Percent busy over the last usage window
+    volatile uint32_t idle_halted;  // Idle task halted or about to; wake with smp_resched
+    uint32_t tick_stopped;   // Tick stopped for the halt (see process_idle_loop)
+    uint64_t halt_start;     // TSC when the halt began
+    vmm_space_t* space;      // Address space loaded; NULL for the kernel's
+} cpu_t;
+
+_Static_assert(offsetof(cpu_t, kernel_rsp) == CPU_KERNEL_RSP, "user.s needs kernel_rsp here");
+_Static_assert(offsetof(cpu_t, user_rsp) == CPU_USER_RSP, "user.s needs user_rsp here");
+
+// The running CPU's structure. Only stable while interrupts are off, since
+// a process can be moved to another CPU whenever it is preempted.
+static inline cpu_t* this_cpu(void) {
+    cpu_t* cpu;
+    asm volatile ("mov %%gs:0, %0" : "=r"(cpu));
+    return cpu;
+}
+
+// Function declarations
+void smp_init_bsp(void);
+void smp_init(void);
+uint32_t smp_cpu_count(void);
+cpu_t* smp_cpu(uint32_t id);
+void smp_tlb_shootdown(uint64_t virt);
+void smp_tlb_handler(void);
+void smp_resched(cpu_t* cpu);
+void smp_resched_handler(void);
+
+#endif // _SMP_H
@@ -0,0 +1,209 @@
+#include "softirq.h"
+#include "smp.h"
+#include "sync.h"
+#include "process.h"
+#include "cpu.h"
+#include "libc/string.h"
+#include "libc/stdio.h"
+
+// Per-CPU bottom half state. Everything but 'pending' is only touched by
+// its own CPU, with interrupts off or from inside softirq_run.
+typedef struct {
+    volatile uint32_t pending;  // Bit n: softirq n raised
+    uint32_t active;            // softirq_run is on this CPU's stack
+    tasklet_t* tasklets;        // Scheduled here, not yet run
+    wait_queue_t wake;          // ksoftirqd, while there is nothing to do
+    irq_stats_t stats;
+} softirq_cpu_t;
+
+static softirq_cpu_t softirq_cpus[SMP_MAX_CPUS];
+static void (*softirq_handlers[SOFTIRQ_COUNT])(void);
+
+static inline softirq_cpu_t* this_softirq_cpu(void) {
+    return &softirq_cpus[this_cpu()->id];
+}
+
+void softirq_register(uint32_t nr, void (*handler)(void)) {
+    if (nr < SOFTIRQ_COUNT) {
+        softirq_handlers[nr] = handler;
+    }
+}
+
+// Run everything pending on this CPU with interrupts on (called and
+// returning with them off). Work that keeps getting raised goes to
+// ksoftirqd after SOFTIRQ_MAX_RESTART passes.
+static void softirq_run(softirq_cpu_t* sc) {
+    sc->active = 1;
+    uint64_t start = rdtsc();
+    uint32_t pending;
+    int restart = SOFTIRQ_MAX_RESTART;
+    while ((pending = __atomic_exchange_n(&sc->pending, 0, __ATOMIC_ACQ_REL)) != 0 && restart-- > 0) {
+        irq_enable();
+        for (uint32_t nr = 0; nr < SOFTIRQ_COUNT; nr++) {
+            if ((pending & (1U << nr)) && softirq_handlers[nr]) {
+                softirq_handlers[nr]();
+            }
+        }
+        irq_disable();
+    }
+    if (pending) {
+        // Taken by the last exchange but not run: put it back
+        __atomic_fetch_or(&sc->pending, pending, __ATOMIC_RELEASE);
+        sc->stats.ksoftirqd_wakeups++;
+        wake_up(&sc->wake);
+    }
+
+    uint64_t cycles = rdtsc() - start;
+    sc->stats.softirq_runs++;
+    sc->stats.softirq_cycles += cycles;
+    if (cycles > sc->stats.softirq_cycles_max) {
+        sc->stats.softirq_cycles_max = cycles;
+    }
+    sc->active = 0;
+}
+
+// Mark softirq 'nr' pending on this CPU. From an interrupt handler it
+// runs at irq_exit; from a process, ksoftirqd picks it up.
+void softirq_raise(uint32_t nr) {
+    uint64_t flags = irq_save();
+    softirq_cpu_t* sc = this_softirq_cpu();
+    __atomic_fetch_or(&sc->pending, 1U << nr, __ATOMIC_RELEASE);
+    if ((flags & (1ULL << 9)) && !sc->active) {  // Not in a handler or a bottom half
+        wake_up(&sc->wake);
+    }
+    irq_restore(flags);
+}
+
+// Whether this CPU is running bottom halves (interrupts off)
+int softirq_active(void) {
+    return this_softirq_cpu()->active;
+}
+
+// Last thing an interrupt handler does, after its EOI: account the time it
+// ran with interrupts off since 'start' (TSC), then run the bottom halves
+// unless this interrupt landed in the middle of them
+void irq_exit(uint64_t start) {
+    softirq_cpu_t* sc = this_softirq_cpu();
+    uint64_t cycles = rdtsc() - start;
+    sc->stats.irqs++;
+    sc->stats.irq_cycles += cycles;
+    if (cycles > sc->stats.irq_cycles_max) {
+        sc->stats.irq_cycles_max = cycles;
+    }
+
+    if (sc->pending && !sc->active) {
+        softirq_run(sc);
+    }
+}
+
+// Per-CPU thread for bottom halves raised too often to finish at
+// irq_exit, or raised outside an interrupt. Pinned, so its CPU is fixed.
+static void ksoftirqd(void) {
+    process_set_name("ksoftirqd");
+    uint64_t flags = irq_save();
+    softirq_cpu_t* sc = this_softirq_cpu();
+    irq_restore(flags);
+
+    for (;;) {
+        wait_event(&sc->wake, sc->pending != 0);
+        flags = irq_save();
+        if (!sc->active) {
+            softirq_run(sc);
+        }
+        irq_restore(flags);
+
+        // Work that keeps coming must not starve the other processes
+        process_yield();
+    }
+}
+
+// Tasklets
+
+void tasklet_init(tasklet_t* tasklet, void (*func)(void* data), void* data) {
+    tasklet->next = NULL;
+    tasklet->func = func;
+    tasklet->data = data;
+    tasklet->state = 0;
+}
+
+// Queue a tasklet on this CPU; safe from interrupt handlers
+void tasklet_schedule(tasklet_t* tasklet) {
+    if (__atomic_fetch_or(&tasklet->state, TASKLET_SCHEDULED, __ATOMIC_ACQ_REL) & TASKLET_SCHEDULED) {
+        return;  // Already pending
+    }
+    uint64_t flags = irq_save();
+    softirq_cpu_t* sc = this_softirq_cpu();
+    tasklet->next = sc->tasklets;
+    sc->tasklets = tasklet;
+    irq_restore(flags);
+    softirq_raise(SOFTIRQ_TASKLET);
+}
+
+// SOFTIRQ_TASKLET: run this CPU's tasklets. One still running on another
+// CPU goes back on the list for the next pass.
+static void tasklet_softirq(void) {
+    irq_disable();
+    softirq_cpu_t* sc = this_softirq_cpu();
+    tasklet_t* list = sc->tasklets;
+    sc->tasklets = NULL;
+    irq_enable();
+
+    while (list) {
+        tasklet_t* tasklet = list;
+        list = tasklet->next;
+
+        if (__atomic_fetch_or(&tasklet->state, TASKLET_RUNNING, __ATOMIC_ACQUIRE) & TASKLET_RUNNING) {
+            irq_disable();
+            tasklet->next = sc->tasklets;
+            sc->tasklets = tasklet;
+            irq_enable();
+            softirq_raise(SOFTIRQ_TASKLET);
+            continue;
+        }
+
+        // Scheduling it again from here on queues another run
+        __atomic_fetch_and(&tasklet->state, ~TASKLET_SCHEDULED, __ATOMIC_ACQ_REL);
+        tasklet->func(tasklet->data);
+        __atomic_fetch_and(&tasklet->state, ~TASKLET_RUNNING, __ATOMIC_RELEASE);
+    }
+}
+
+// Set up the bottom halves, before any interrupt can raise one
+void softirq_init(void) {
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        wait_queue_init(&softirq_cpus[i].wake);
+    }
+    softirq_register(SOFTIRQ_TASKLET, tasklet_softirq);
+}
+
+// Start a ksoftirqd on every CPU (after smp_init). Until then, bottom
+// halves only run at irq_exit.
+void softirq_start_threads(void) {
+    for (uint32_t i = 0; i < smp_cpu_count(); i++) {
+        if (!process_create_on(ksoftirqd, PROCESS_PRIORITY_DEFAULT, i)) {
+            printf("softirq: No ksoftirqd for CPU %u\n", i);
+        }
+    }
+}
+
+// Interrupt latency counters summed over every CPU (maxima for the _max fields)
+void softirq_get_stats(irq_stats_t* stats) {
+    if (!stats) {
+        return;
+    }
+    memset(stats, 0, sizeof(irq_stats_t));
+    for (uint32_t i = 0; i < smp_cpu_count(); i++) {
+        irq_stats_t* cpu = &softirq_cpus[i].stats;
+        stats->irqs += cpu->irqs;
+        stats->irq_cycles += cpu->irq_cycles;
+        if (cpu->irq_cycles_max > stats->irq_cycles_max) {
+            stats->irq_cycles_max = cpu->irq_cycles_max;
+        }
+        stats->softirq_runs += cpu->softirq_runs;
+        stats->softirq_cycles += cpu->softirq_cycles;
+        if (cpu->softirq_cycles_max > stats->softirq_cycles_max) {
+            stats->softirq_cycles_max = cpu->softirq_cycles_max;
+        }
+        stats->ksoftirqd_wakeups += cpu->ksoftirqd_wakeups;
+    }
+}
@@ -0,0 +1,90 @@
+#ifndef _SOFTIRQ_H
+#define _SOFTIRQ_H
+
+#include <stdint.h>
+
+// Deferred interrupt work. A top half (the IRQ handler proper) only
+// captures what the device hands it, typically into an irq_ring_t, and
+// schedules a bottom half; it runs with interrupts off until its EOI.
+// Bottom halves run with interrupts on: on the way out of the interrupt
+// (irq_exit), or in the CPU's ksoftirqd process when they keep coming
+// back or were raised outside an interrupt. Like top halves they must not
+// block, and the CPU does not switch processes while they run.
+
+// Softirqs, run in this order. Each CPU has its own pending set.
+#define SOFTIRQ_TIMER   0  // Timer wheel (boot CPU)
+#define SOFTIRQ_TASKLET 1  // Tasklets scheduled on this CPU
+#define SOFTIRQ_COUNT   2
+
+// Passes over the pending set at irq_exit before the rest is left to
+// ksoftirqd
+#define SOFTIRQ_MAX_RESTART 8
+
+// Tasklet: a bottom half a driver schedules from its top half. Scheduling
+// one that is already pending does nothing, and it never runs on two CPUs
+// at once.
+#define TASKLET_SCHEDULED 0x1
+#define TASKLET_RUNNING   0x2
+
+typedef struct tasklet {
+    struct tasklet* next;
+    void (*func)(void* data);
+    void* data;
+    volatile uint32_t state;  // TASKLET_*
+} tasklet_t;
+
+// Byte ring between a top half (the only producer) and its tasklet (the
+// only consumer). Full rings drop new bytes.
+#define IRQ_RING_SIZE 256  // Power of two
+
+typedef struct {
+    volatile uint32_t head;  // Next slot to write; producer only
+    volatile uint32_t tail;  // Next slot to read; consumer only
+    uint32_t dropped;        // Bytes lost to a full ring
+    uint8_t data[IRQ_RING_SIZE];
+} irq_ring_t;
+
+static inline int irq_ring_put(irq_ring_t* ring, uint8_t byte) {
+    uint32_t head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= IRQ_RING_SIZE) {
+        ring->dropped++;
+        return 0;
+    }
+    ring->data[head & (IRQ_RING_SIZE - 1)] = byte;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static inline int irq_ring_get(irq_ring_t* ring, uint8_t* byte) {
+    uint32_t tail = ring->tail;
+    if (tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    *byte = ring->data[tail & (IRQ_RING_SIZE - 1)];
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+// Interrupt latency counters, kept per CPU (softirq_get_stats adds them up)
+typedef struct {
+    uint32_t irqs;                // Interrupts that went through irq_exit
+    uint64_t irq_cycles;          // TSC cycles from handler entry to irq_exit, interrupts off
+    uint64_t irq_cycles_max;      // Longest of those
+    uint32_t softirq_runs;        // Bottom half batches run
+    uint64_t softirq_cycles;      // TSC cycles spent in bottom halves, interrupts on
+    uint64_t softirq_cycles_max;  // Longest batch
+    uint32_t ksoftirqd_wakeups;   // Batches handed to ksoftirqd
+} irq_stats_t;
+
+// Function declarations
+void softirq_init(void);
+void softirq_start_threads(void);
+void softirq_register(uint32_t nr, void (*handler)(void));
+void softirq_raise(uint32_t nr);
+int softirq_active(void);
+void irq_exit(uint64_t start);
+void tasklet_init(tasklet_t* tasklet, void (*func)(void* data), void* data);
+void tasklet_schedule(tasklet_t* tasklet);
+void softirq_get_stats(irq_stats_t* stats);
+
+#endif // _SOFTIRQ_H
@@ -0,0 +1,58 @@
+#ifndef _SPINLOCK_H
+#define _SPINLOCK_H
+
+#include <stdint.h>
+#include "cpu.h"
+
+// Test-and-test-and-set spinlock. Waiters spin on a plain read so the
+// cache line is only fought over when the lock looks free. The _irqsave
+// forms also mask interrupts on this CPU, so neither an interrupt handler
+// nor preemption can run on it while the lock is held.
+typedef struct {
+    volatile uint32_t locked;
+} spinlock_t;
+
+#define SPINLOCK_INIT { 0 }
+
+static inline void spin_init(spinlock_t* lock) {
+    lock->locked = 0;
+}
+
+static inline int spin_trylock(spinlock_t* lock) {
+    return !__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE);
+}
+
+static inline void spin_lock(spinlock_t* lock) {
+    while (__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&lock->locked, __ATOMIC_RELAXED)) {
+            cpu_pause();
+        }
+    }
+}
+
+static inline void spin_unlock(spinlock_t* lock) {
+    __atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+}
+
+// Hosted builds (tools/mmbench) run in user mode, where there are no
+// interrupts to mask
+static inline uint64_t spin_lock_irqsave(spinlock_t* lock) {
+#if __STDC_HOSTED__
+    uint64_t flags = 0;
+#else
+    uint64_t flags = irq_save();
+#endif
+    spin_lock(lock);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t* lock, uint64_t flags) {
+    spin_unlock(lock);
+#if __STDC_HOSTED__
+    (void)flags;
+#else
+    irq_restore(flags);
+#endif
+}
+
+#endif // _SPINLOCK_H
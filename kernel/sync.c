@@ -0,0 +1,128 @@
+#include "sync.h"
+#include "smp.h"
+
+// Wait queues. The queue's lock is held while a waker wakes an entry's
+// process, so a waiter cannot leave finish_wait (and its stack entry
+// cannot disappear) while a wakeup is being delivered to it.
+
+void wait_queue_init(wait_queue_t* wq) {
+    spin_init(&wq->lock);
+    wq->list.next = &wq->list;
+    wq->list.prev = &wq->list;
+    wq->list.proc = NULL;
+}
+
+static void entry_unlink(wait_entry_t* entry) {
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
+    entry->next = NULL;
+    entry->prev = NULL;
+}
+
+// Queue the running process on 'wq' (if it is not already) and mark it
+// blocked. Interrupts must be off until process_block or finish_wait.
+void prepare_to_wait(wait_queue_t* wq, wait_entry_t* entry) {
+    pcb_t* proc = this_cpu()->current;
+    spin_lock(&wq->lock);
+    if (!entry->next) {
+        entry->proc = proc;
+        entry->next = &wq->list;
+        entry->prev = wq->list.prev;
+        wq->list.prev->next = entry;
+        wq->list.prev = entry;
+    }
+    proc->state = PROCESS_BLOCKED;
+    spin_unlock(&wq->lock);
+
+    // Being queued must be visible before the caller checks its condition
+    // (see wait_queue_active)
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+// Leave 'wq' without blocking, now the condition holds (interrupts off)
+void finish_wait(wait_queue_t* wq, wait_entry_t* entry) {
+    spin_lock(&wq->lock);
+    if (entry->next) {
+        entry_unlink(entry);
+    }
+    process_unblock();
+    spin_unlock(&wq->lock);
+}
+
+// Wake the longest waiting process
+void wake_up(wait_queue_t* wq) {
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+    wait_entry_t* entry = wq->list.next;
+    if (entry != &wq->list) {
+        entry_unlink(entry);
+        process_wake(entry->proc);
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+void wake_up_all(wait_queue_t* wq) {
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+    while (wq->list.next != &wq->list) {
+        wait_entry_t* entry = wq->list.next;
+        entry_unlink(entry);
+        process_wake(entry->proc);
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+// Mutexes
+
+void mutex_init(mutex_t* mutex) {
+    mutex->locked = 0;
+    mutex->owner = NULL;
+    wait_queue_init(&mutex->waiters);
+}
+
+int mutex_trylock(mutex_t* mutex) {
+    if (__atomic_exchange_n(&mutex->locked, 1, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    mutex->owner = process_current();
+    return 1;
+}
+
+void mutex_lock(mutex_t* mutex) {
+    while (!mutex_trylock(mutex)) {
+        wait_event(&mutex->waiters, !mutex->locked);
+    }
+}
+
+void mutex_unlock(mutex_t* mutex) {
+    mutex->owner = NULL;
+    __atomic_store_n(&mutex->locked, 0, __ATOMIC_RELEASE);
+    wake_up(&mutex->waiters);
+}
+
+// Semaphores
+
+void sem_init(semaphore_t* sem, int32_t count) {
+    sem->count = count;
+    wait_queue_init(&sem->waiters);
+}
+
+int sem_trydown(semaphore_t* sem) {
+    int32_t count = __atomic_load_n(&sem->count, __ATOMIC_RELAXED);
+    while (count > 0) {
+        if (__atomic_compare_exchange_n(&sem->count, &count, count - 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void sem_down(semaphore_t* sem) {
+    while (!sem_trydown(sem)) {
+        wait_event(&sem->waiters, sem->count > 0);
+    }
+}
+
+void sem_up(semaphore_t* sem) {
+    __atomic_fetch_add(&sem->count, 1, __ATOMIC_RELEASE);
+    wake_up(&sem->waiters);
+}
@@ -0,0 +1,83 @@
+#ifndef _SYNC_H
+#define _SYNC_H
+
+#include <stdint.h>
+#include "cpu.h"
+#include "spinlock.h"
+#include "process.h"
+
+// Sleeping synchronization for processes. Spinlocks (spinlock.h) are for
+// short sections and interrupt handlers; everything here may block, so
+// only wake_up, wake_up_all and sem_up are allowed in interrupt handlers.
+
+// Wait queue: processes blocked until some condition holds. Entries live
+// on the waiters' stacks.
+typedef struct wait_entry {
+    struct wait_entry* next;
+    struct wait_entry* prev;
+    pcb_t* proc;
+} wait_entry_t;
+
+typedef struct {
+    spinlock_t lock;
+    wait_entry_t list;  // Circular; the list head itself holds no process
+} wait_queue_t;
+
+// Sleeping mutex: contenders block instead of spinning. Not recursive.
+typedef struct {
+    volatile uint32_t locked;
+    pcb_t* owner;
+    wait_queue_t waiters;
+} mutex_t;
+
+// Counting semaphore
+typedef struct {
+    volatile int32_t count;
+    wait_queue_t waiters;
+} semaphore_t;
+
+// Function declarations
+void wait_queue_init(wait_queue_t* wq);
+void prepare_to_wait(wait_queue_t* wq, wait_entry_t* entry);
+void finish_wait(wait_queue_t* wq, wait_entry_t* entry);
+void wake_up(wait_queue_t* wq);
+void wake_up_all(wait_queue_t* wq);
+
+void mutex_init(mutex_t* mutex);
+void mutex_lock(mutex_t* mutex);
+int mutex_trylock(mutex_t* mutex);
+void mutex_unlock(mutex_t* mutex);
+
+void sem_init(semaphore_t* sem, int32_t count);
+void sem_down(semaphore_t* sem);
+int sem_trydown(semaphore_t* sem);
+void sem_up(semaphore_t* sem);
+
+// Whether anyone is waiting on 'wq': lets a waker skip the queue lock.
+// The waker must publish its change and then issue a full fence before
+// asking (prepare_to_wait ends with the matching one).
+static inline int wait_queue_active(wait_queue_t* wq) {
+    return __atomic_load_n(&wq->list.next, __ATOMIC_RELAXED) != &wq->list;
+}
+
+// Block the calling process on 'wq' until 'condition' is true. The
+// condition is checked after queueing, so a wake_up between the check and
+// blocking is never lost. It is evaluated with interrupts off and may be
+// evaluated any number of times.
+#define wait_event(wq, condition)                       \
+    do {                                                \
+        wait_entry_t _entry = { 0 };                    \
+        for (;;) {                                      \
+            uint64_t _flags = irq_save();               \
+            prepare_to_wait((wq), &_entry);             \
+            if (condition) {                            \
+                finish_wait((wq), &_entry);             \
+                irq_restore(_flags);                    \
+                break;                                  \
+            }                                           \
+            process_block();                            \
+            irq_restore(_flags);                        \
+        }                                               \
+    } while (0)
+
+#endif // _SYNC_H
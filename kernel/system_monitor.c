@@ -3,7 +3,11 @@
 #include "text.h"
 #include "framebuffer.h"
 #include "mm/mm.h"
+#include "mm/arena.h"
+#include "mm/pmm.h"
 #include "process.h"
+#include "smp.h"
+#include "timer.h"
 #include "libc/string.h"
 #include "libc/stdio.h"
 
@@ -12,6 +16,10 @@ static cpu_stats_t cpu_stats;
 static system_info_t system_info;
 static uint32_t update_counter = 0;
 
+// Processes as of the last update
+static process_snapshot_t snapshot[PROCESS_MAX];
+static int snapshot_count = 0;
+
 void system_monitor_init(void) {
     memset(&memory_stats, 0, sizeof(memory_stats));
     memset(&cpu_stats, 0, sizeof(cpu_stats));
@@ -23,26 +31,46 @@ void system_monitor_init(void) {
     system_info.boot_time = 0; // Would be set during boot
     
     update_counter = 0;
+    snapshot_count = 0;
 }
 
 void system_monitor_update(void) {
     update_counter++;
     
-    // Update memory stats (get from memory manager)
-    // This would interface with the actual memory manager
-    memory_stats.total_memory = 64 * 1024 * 1024; // 64MB example
-    memory_stats.used_memory = 16 * 1024 * 1024;  // 16MB example
-    memory_stats.free_memory = memory_stats.total_memory - memory_stats.used_memory;
-    memory_stats.cached_memory = 4 * 1024 * 1024; // 4MB example
-    
-    // Update CPU stats (simulated for now)
-    cpu_stats.cpu_usage_percent = (update_counter * 7) % 100; // Simulated varying load
-    cpu_stats.processes_running = 3; // Example
-    cpu_stats.processes_total = 5;   // Example
-    cpu_stats.context_switches = update_counter * 10;
+    // Physical memory comes from the page frame allocator. Cached memory
+    // is held for reuse: pre-zeroed frames and heap space not handed out.
+    pmm_stats_t pmm;
+    mm_heap_stats_t heap;
+    pmm_get_stats(&pmm);
+    mm_get_heap_stats(&heap);
+    memory_stats.total_memory = pmm.total_frames * PAGE_SIZE;
+    memory_stats.free_memory = pmm.free_frames * PAGE_SIZE;
+    memory_stats.used_memory = memory_stats.total_memory - memory_stats.free_memory;
+    memory_stats.cached_memory = pmm.zero_pool * PAGE_SIZE + (heap.heap_size - heap.used);
+    
+    // CPU load is measured by the scheduler over its usage windows
+    uint32_t cpus = smp_cpu_count();
+    uint32_t busy = 0;
+    for (uint32_t i = 0; i < cpus; i++) {
+        busy += process_cpu_usage(i);
+    }
+    cpu_stats.cpu_usage_percent = cpus ? busy / cpus : 0;
+
+    snapshot_count = process_snapshot(snapshot, PROCESS_MAX);
+    cpu_stats.processes_total = snapshot_count;
+    cpu_stats.processes_running = 0;
+    for (int i = 0; i < snapshot_count; i++) {
+        if (snapshot[i].state == PROCESS_RUNNING) {
+            cpu_stats.processes_running++;
+        }
+    }
+
+    sched_stats_t sched;
+    process_get_sched_stats(&sched);
+    cpu_stats.context_switches = sched.switches;
     
     // Update system uptime
-    system_info.uptime_seconds = update_counter; // Simplified
+    system_info.uptime_seconds = (uint32_t)(timer_uptime_ms() / 1000);
 }
 
 memory_stats_t system_monitor_get_memory_stats(void) {
@@ -57,35 +85,41 @@ system_info_t system_monitor_get_system_info(void) {
     return system_info;
 }
 
+static const char* state_name(uint32_t state) {
+    switch (state) {
+    case PROCESS_RUNNING: return "running";
+    case PROCESS_READY:   return "ready";
+    case PROCESS_BLOCKED: return "blocked";
+    default:              return "zombie";
+    }
+}
+
+// Processes as of the last system_monitor_update, busiest first
 int system_monitor_get_processes(process_info_t* processes, int max_processes) {
-    // This would interface with the actual process manager
-    // For now, return some example processes
-    if (max_processes < 1) return 0;
-    
-    // Example processes
-    strcpy(processes[0].name, "kernel");
-    processes[0].pid = 0;
-    processes[0].memory_usage = 8 * 1024 * 1024; // 8MB
-    processes[0].cpu_usage = 5;
-    strcpy(processes[0].state, "running");
-    
-    if (max_processes < 2) return 1;
-    
-    strcpy(processes[1].name, "desktop");
-    processes[1].pid = 1;
-    processes[1].memory_usage = 4 * 1024 * 1024; // 4MB
-    processes[1].cpu_usage = 15;
-    strcpy(processes[1].state, "running");
-    
-    if (max_processes < 3) return 2;
-    
-    strcpy(processes[2].name, "calculator");
-    processes[2].pid = 2;
-    processes[2].memory_usage = 1 * 1024 * 1024; // 1MB
-    processes[2].cpu_usage = 2;
-    strcpy(processes[2].state, "sleeping");
-    
-    return 3; // Return number of processes
+    int count = 0;
+    for (int i = 0; i < snapshot_count && count < max_processes; i++) {
+        process_snapshot_t* proc = &snapshot[i];
+        process_info_t info;
+        info.pid = proc->pid;
+        strcpy(info.name, proc->name);
+        info.memory_usage = proc->heap_bytes;
+        info.cpu_usage = proc->usage;
+        strcpy(info.state, state_name(proc->state));
+        info.cpu = proc->cpu;
+        info.runtime_ms = (uint32_t)(timer_cycles_to_us(proc->runtime) / 1000);
+        info.switches = proc->switches;
+
+        // Insertion sort by CPU usage, then by CPU time
+        int j = count++;
+        while (j > 0 && (processes[j - 1].cpu_usage < info.cpu_usage ||
+                         (processes[j - 1].cpu_usage == info.cpu_usage &&
+                          processes[j - 1].runtime_ms < info.runtime_ms))) {
+            processes[j] = processes[j - 1];
+            j--;
+        }
+        processes[j] = info;
+    }
+    return count;
 }
 
 void system_monitor_draw_window(int x, int y, int width, int height) {
@@ -100,31 +134,29 @@ void system_monitor_draw_window(int x, int y, int width, int height) {
     draw_string("Memory Usage:", x + 10, current_y, current_theme.text_primary);
     current_y += 20;
     
-    char mem_text[128];
-    snprintf(mem_text, sizeof(mem_text), "Total: %u MB", memory_stats.total_memory / (1024 * 1024));
-    draw_string(mem_text, x + 20, current_y, current_theme.text_secondary);
+    draw_string(arena_printf(frame_arena, "Total: %u MB", memory_stats.total_memory / (1024 * 1024)),
+                x + 20, current_y, current_theme.text_secondary);
     current_y += 16;
     
-    snprintf(mem_text, sizeof(mem_text), "Used: %u MB", memory_stats.used_memory / (1024 * 1024));
-    draw_string(mem_text, x + 20, current_y, current_theme.text_secondary);
+    draw_string(arena_printf(frame_arena, "Used: %u MB", memory_stats.used_memory / (1024 * 1024)),
+                x + 20, current_y, current_theme.text_secondary);
     current_y += 16;
     
-    snprintf(mem_text, sizeof(mem_text), "Free: %u MB", memory_stats.free_memory / (1024 * 1024));
-    draw_string(mem_text, x + 20, current_y, current_theme.text_secondary);
+    draw_string(arena_printf(frame_arena, "Free: %u MB", memory_stats.free_memory / (1024 * 1024)),
+                x + 20, current_y, current_theme.text_secondary);
     current_y += 30;
     
     // CPU section
     draw_string("CPU Information:", x + 10, current_y, current_theme.text_primary);
     current_y += 20;
     
-    char cpu_text[128];
-    snprintf(cpu_text, sizeof(cpu_text), "Usage: %u%%", cpu_stats.cpu_usage_percent);
-    draw_string(cpu_text, x + 20, current_y, current_theme.text_secondary);
+    draw_string(arena_printf(frame_arena, "Usage: %u%%", cpu_stats.cpu_usage_percent),
+                x + 20, current_y, current_theme.text_secondary);
     current_y += 16;
     
-    snprintf(cpu_text, sizeof(cpu_text), "Processes: %u running, %u total", 
-             cpu_stats.processes_running, cpu_stats.processes_total);
-    draw_string(cpu_text, x + 20, current_y, current_theme.text_secondary);
+    draw_string(arena_printf(frame_arena, "Processes: %u running, %u total", 
+                             cpu_stats.processes_running, cpu_stats.processes_total),
+                x + 20, current_y, current_theme.text_secondary);
     current_y += 30;
     
     // System info section
@@ -134,9 +166,23 @@ void system_monitor_draw_window(int x, int y, int width, int height) {
     draw_string(system_info.kernel_version, x + 20, current_y, current_theme.text_secondary);
     current_y += 16;
     
-    char uptime_text[64];
-    snprintf(uptime_text, sizeof(uptime_text), "Uptime: %u seconds", system_info.uptime_seconds);
-    draw_string(uptime_text, x + 20, current_y, current_theme.text_secondary);
+    draw_string(arena_printf(frame_arena, "Uptime: %u seconds", system_info.uptime_seconds),
+                x + 20, current_y, current_theme.text_secondary);
+    current_y += 30;
+    
+    // Busiest processes
+    draw_string("Top Processes:", x + 10, current_y, current_theme.text_primary);
+    current_y += 20;
+    
+    process_info_t top[SYSTEM_MONITOR_TOP];
+    int count = system_monitor_get_processes(top, SYSTEM_MONITOR_TOP);
+    for (int i = 0; i < count && current_y + 16 <= y + height; i++) {
+        draw_string(arena_printf(frame_arena, "%u %s: %u%% CPU, %u KB",
+                                 top[i].pid, top[i].name, top[i].cpu_usage,
+                                 top[i].memory_usage / 1024),
+                    x + 20, current_y, current_theme.text_secondary);
+        current_y += 16;
+    }
     
     // Draw CPU usage bar
     int bar_x = x + width - 150;
@@ -3,6 +3,8 @@
 
 #include <stdint.h>
 
+#define SYSTEM_MONITOR_TOP 5  // Hottest processes listed in the window
+
 typedef struct {
     uint32_t total_memory;
     uint32_t used_memory;
@@ -11,7 +13,7 @@ typedef struct {
 } memory_stats_t;
 
 typedef struct {
-    uint32_t cpu_usage_percent;
+    uint32_t cpu_usage_percent;   // Average over all CPUs, last usage window
     uint32_t processes_running;
     uint32_t processes_total;
     uint32_t context_switches;
@@ -27,9 +29,12 @@ typedef struct {
 typedef struct {
     uint32_t pid;
     char name[32];
-    uint32_t memory_usage;
-    uint32_t cpu_usage;
+    uint32_t memory_usage;  // Heap bytes the process allocated and has not freed
+    uint32_t cpu_usage;     // Percent of one CPU over the last usage window
     char state[16];
+    uint32_t cpu;           // CPU it last ran on
+    uint32_t runtime_ms;    // CPU time since it was created
+    uint32_t switches;      // Times switched in
 } process_info_t;
 
 // System monitoring functions
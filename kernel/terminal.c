@@ -3,6 +3,16 @@
 #include "font.h"
 #include "framebuffer.h"
 #include "system_monitor.h"
+#include "mm/mm.h"
+#include "mm/slab.h"
+#include "mm/stack.h"
+#include "mm/pmm.h"
+#include "process.h"
+#include "smp.h"
+#include "timer.h"
+#include "bench.h"
+#include "softirq.h"
+#include "cpu.h"
 #include "libc/string.h"
 #include "libc/stdio.h"
 #include <stdarg.h>
@@ -114,6 +124,27 @@ void terminal_printf(terminal_t* term, const char* format, ...) {
     terminal_puts(term, buffer);
 }
 
+// Print 'text' in a column 'width' characters wide, right-aligned unless
+// 'left' is set. The kernel's vsnprintf has no field widths.
+static void terminal_put_column(terminal_t* term, const char* text, uint32_t width, int left) {
+    uint32_t len = strlen(text);
+    if (left) {
+        terminal_puts(term, text);
+    }
+    for (; len < width; len++) {
+        terminal_puts(term, " ");
+    }
+    if (!left) {
+        terminal_puts(term, text);
+    }
+}
+
+static void terminal_put_number(terminal_t* term, uint32_t value, uint32_t width) {
+    char text[12];
+    snprintf(text, sizeof(text), "%u", value);
+    terminal_put_column(term, text, width, 0);
+}
+
 void terminal_handle_key(terminal_t* term, char key) {
     if (key == '\n' || key == '\r') {
         // Execute command
@@ -254,6 +285,14 @@ void terminal_execute_command(terminal_t* term, const char* command) {
         terminal_cmd_ps(term);
     } else if (strcmp(cmd, "mem") == 0) {
         terminal_cmd_mem(term);
+    } else if (strcmp(cmd, "heaptop") == 0) {
+        terminal_cmd_heaptop(term, args);
+    } else if (strcmp(cmd, "sched") == 0) {
+        terminal_cmd_sched(term);
+    } else if (strcmp(cmd, "irq") == 0) {
+        terminal_cmd_irq(term);
+    } else if (strcmp(cmd, "bench") == 0) {
+        terminal_cmd_bench(term);
     } else if (strcmp(cmd, "uptime") == 0) {
         terminal_cmd_uptime(term);
     } else if (strcmp(cmd, "version") == 0) {
@@ -273,6 +312,10 @@ void terminal_cmd_help(terminal_t* term) {
     terminal_puts(term, "  echo     - Display a line of text\n");
     terminal_puts(term, "  ps       - Show running processes\n");
     terminal_puts(term, "  mem      - Show memory usage\n");
+    terminal_puts(term, "  heaptop  - Show top heap callsites ('heaptop dump' for serial)\n");
+    terminal_puts(term, "  sched    - Show scheduler statistics\n");
+    terminal_puts(term, "  irq      - Show interrupt and bottom half latency\n");
+    terminal_puts(term, "  bench    - Measure context switch cost\n");
     terminal_puts(term, "  uptime   - Show system uptime\n");
     terminal_puts(term, "  version  - Show system version\n");
 }
@@ -287,22 +330,40 @@ void terminal_cmd_echo(terminal_t* term, const char* args) {
 }
 
 void terminal_cmd_ps(terminal_t* term) {
-    terminal_puts(term, "PID  NAME         STATE    MEM\n");
-    terminal_puts(term, "---  -----------  -------  -------\n");
+    system_monitor_update();
+    cpu_stats_t cpu = system_monitor_get_cpu_stats();
+    terminal_printf(term, "CPU: %u%% busy over %u CPUs, %u processes, %u switches\n",
+                   cpu.cpu_usage_percent, smp_cpu_count(), cpu.processes_total,
+                   cpu.context_switches);
+    
+    terminal_puts(term, "PID  NAME         STATE    CPU  %CPU  TIME(ms)  SWITCHES  HEAP\n");
+    terminal_puts(term, "---  -----------  -------  ---  ----  --------  --------  -------\n");
     
-    process_info_t processes[10];
-    int count = system_monitor_get_processes(processes, 10);
+    process_info_t processes[TERMINAL_MAX_PROCESSES];
+    int count = system_monitor_get_processes(processes, TERMINAL_MAX_PROCESSES);
     
     for (int i = 0; i < count; i++) {
-        terminal_printf(term, "%3u  %-11s  %-7s  %4uMB\n",
-                       processes[i].pid,
-                       processes[i].name,
-                       processes[i].state,
-                       processes[i].memory_usage / (1024 * 1024));
+        terminal_put_number(term, processes[i].pid, 3);
+        terminal_puts(term, "  ");
+        terminal_put_column(term, processes[i].name, 11, 1);
+        terminal_puts(term, "  ");
+        terminal_put_column(term, processes[i].state, 7, 1);
+        terminal_puts(term, "  ");
+        terminal_put_number(term, processes[i].cpu, 3);
+        terminal_puts(term, "  ");
+        terminal_put_number(term, processes[i].cpu_usage, 3);
+        terminal_puts(term, "%  ");
+        terminal_put_number(term, processes[i].runtime_ms, 8);
+        terminal_puts(term, "  ");
+        terminal_put_number(term, processes[i].switches, 8);
+        terminal_puts(term, "  ");
+        terminal_put_number(term, processes[i].memory_usage / 1024, 4);
+        terminal_puts(term, "KB\n");
     }
 }
 
 void terminal_cmd_mem(terminal_t* term) {
+    system_monitor_update();
     memory_stats_t stats = system_monitor_get_memory_stats();
     
     terminal_printf(term, "Memory Usage:\n");
@@ -310,9 +371,164 @@ void terminal_cmd_mem(terminal_t* term) {
     terminal_printf(term, "  Used:  %u MB\n", stats.used_memory / (1024 * 1024));
     terminal_printf(term, "  Free:  %u MB\n", stats.free_memory / (1024 * 1024));
     terminal_printf(term, "  Cache: %u MB\n", stats.cached_memory / (1024 * 1024));
+    
+    mm_heap_stats_t heap;
+    mm_get_heap_stats(&heap);
+    terminal_printf(term, "Heap: %u KB used of %u KB, %u KB owned by the kernel\n",
+                   heap.used / 1024, heap.heap_size / 1024,
+                   mm_owner_bytes(MM_OWNER_KERNEL) / 1024);
+    
+    stack_stats_t stacks;
+    stack_get_stats(&stacks);
+    terminal_printf(term, "Stacks: %u in use, %u cached, %u pages, %u lazy faults\n",
+                   stacks.in_use, stacks.cached, stacks.pages, stacks.lazy_faults);
+    
+    pmm_stats_t pmm;
+    pmm_get_stats(&pmm);
+    uint32_t zero_requests = pmm.zero_hits + pmm.zero_misses;
+    terminal_printf(term, "Zeroed pages: %u pooled, %u hits, %u misses (%u%% hit rate)\n",
+                   pmm.zero_pool, pmm.zero_hits, pmm.zero_misses,
+                   zero_requests ? pmm.zero_hits * 100 / zero_requests : 0);
+    
+    kmem_cache_stats_t caches[TERMINAL_MAX_CACHES];
+    int count = kmem_cache_get_stats(caches, TERMINAL_MAX_CACHES);
+    
+    terminal_puts(term, "Slab caches:\n");
+    for (int i = 0; i < count; i++) {
+        terminal_printf(term, "  %s: %u/%u objs x %u B, %u allocs, %u frees\n",
+                       caches[i].name,
+                       caches[i].objects_in_use,
+                       caches[i].objects_total,
+                       caches[i].object_size,
+                       caches[i].allocations,
+                       caches[i].frees);
+    }
+}
+
+void terminal_cmd_heaptop(terminal_t* term, const char* args) {
+    mm_profile_site_t sites[TERMINAL_HEAPTOP_SITES];
+    int count = mm_profile_top(sites, TERMINAL_HEAPTOP_SITES);
+
+    if (count < 0) {
+        terminal_puts(term, "Heap profiler not built in (make MM_PROFILE=1)\n");
+        return;
+    }
+
+    if (strcmp(args, "dump") == 0) {
+        mm_profile_dump();
+        terminal_puts(term, "Heap profile written to COM1\n");
+        return;
+    }
+
+    terminal_printf(term, "Heap in use: %u KB\n", mm_get_used_memory() / 1024);
+    terminal_puts(term, "CALLER      LIVE B    BLOCKS  ALLOCS\n");
+    for (int i = 0; i < count; i++) {
+        terminal_printf(term, "0x%x  %u  %u  %u\n",
+                       (uint32_t)sites[i].caller,
+                       sites[i].live_bytes,
+                       sites[i].live_count,
+                       sites[i].allocations);
+    }
+}
+
+void terminal_cmd_sched(terminal_t* term) {
+    sched_stats_t stats;
+    process_get_sched_stats(&stats);
+    
+    terminal_printf(term, "Scheduler: %u Hz, %u ticks, %u preemptions, %u yields, %u switches\n",
+                   timer_hz(), (uint32_t)stats.ticks, stats.preemptions, stats.yields, stats.switches);
+    terminal_printf(term, "Tick overhead: %u cycles average, %u max\n",
+                   stats.ticks ? (uint32_t)(stats.tick_cycles / stats.ticks) : 0,
+                   (uint32_t)stats.tick_cycles_max);
+    terminal_printf(term, "MLFQ: %u demotions, %u boosts, %u resets\n",
+                   stats.demotions, stats.boosts, stats.resets);
+    terminal_printf(term, "Balancer: %u steals in %u attempts\n",
+                   stats.steals, stats.steal_attempts);
+    terminal_printf(term, "Idle: %u halts, %u tickless, %u wakeup IPIs\n",
+                   stats.halts, stats.tickless, stats.kicks);
+    for (uint32_t i = 0; i < smp_cpu_count(); i++) {
+        cpu_t* cpu = smp_cpu(i);
+        terminal_printf(term, "CPU %u: %u ready, %u ticks, %u switches, running PID %u, halted %u ms\n",
+                       cpu->id, cpu->run_queue.count, (uint32_t)cpu->stats.ticks,
+                       cpu->stats.switches, cpu->current ? cpu->current->pid : 0,
+                       (uint32_t)(timer_cycles_to_us(cpu->stats.idle_cycles) / 1000));
+    }
+    
+    terminal_puts(term, "PID  CPU  PRIO  TICKS  PREEMPTIONS  SWITCHES  RUNTIME (Mcycles)\n");
+    uint64_t now = rdtsc();
+    for (pcb_t* proc = process_first(); proc; proc = proc->all_next) {
+        uint64_t runtime = proc->runtime;
+        if (proc->state == PROCESS_RUNNING) {
+            // TSC deltas across CPUs are close enough for a listing
+            runtime += now - proc->last_run;
+        }
+        terminal_printf(term, "%u  %u  %u/%u  %u  %u  %u  %u\n",
+                       proc->pid, proc->cpu, proc->priority, proc->base_priority, proc->ticks, proc->preemptions, proc->switches,
+                       (uint32_t)(runtime / 1000000));
+    }
+}
+
+void terminal_cmd_irq(terminal_t* term) {
+    irq_stats_t stats;
+    softirq_get_stats(&stats);
+    
+    // What bottom halves take now ran with interrupts off before they existed
+    terminal_printf(term, "Interrupts: %u, %u cycles average, %u max with interrupts off\n",
+                   stats.irqs,
+                   stats.irqs ? (uint32_t)(stats.irq_cycles / stats.irqs) : 0,
+                   (uint32_t)stats.irq_cycles_max);
+    terminal_printf(term, "Bottom halves: %u runs, %u cycles average, %u max with interrupts on\n",
+                   stats.softirq_runs,
+                   stats.softirq_runs ? (uint32_t)(stats.softirq_cycles / stats.softirq_runs) : 0,
+                   (uint32_t)stats.softirq_cycles_max);
+    terminal_printf(term, "Deferred to ksoftirqd: %u times\n", stats.ksoftirqd_wakeups);
+}
+
+void terminal_cmd_bench(terminal_t* term) {
+    uint32_t full = 0;
+    uint32_t slim = bench_context_switch(BENCH_RAW_SWITCH_ROUNDS, &full);
+    terminal_printf(term, "Raw context switch: %u cycles (%u saving every register)\n",
+                   slim, full);
+    uint32_t syscall = bench_syscall(BENCH_SYSCALL_CALLS);
+    uint64_t khz = timer_tsc_khz();
+    terminal_printf(term, "Null system call from ring 3: %u cycles, %u ns\n", syscall,
+                   khz ? (uint32_t)((uint64_t)syscall * 1000000 / khz) : 0);
+    uint32_t clock_syscall;
+    uint32_t clock_vdso = bench_clock(BENCH_CLOCK_READS, &clock_syscall);
+    terminal_printf(term, "Clock read from ring 3: %u cycles from the data page, %u by system call\n",
+                   clock_vdso, clock_syscall);
+    uint32_t ring_syscall;
+    uint32_t ring = bench_ring(BENCH_RING_PAIRS, &ring_syscall);
+    terminal_printf(term, "Send/receive to self from ring 3: %u ops/s by system call, %u batched in rings\n",
+                   ring_syscall, ring);
+
+    terminal_puts(term, "Context switch cost by runnable processes:\n");
+    for (uint32_t procs = 2; procs <= BENCH_SWITCH_MAX_PROCS; procs *= 2) {
+        uint32_t cycles = bench_switch(procs, BENCH_SWITCH_ROUNDS);
+        terminal_printf(term, "  %u processes: %u cycles per switch\n", procs, cycles);
+    }
+
+    uint32_t cpus = smp_cpu_count();
+    terminal_printf(term, "Throughput of CPU-bound processes (%u CPUs):\n", cpus);
+    for (uint32_t procs = 1; procs <= 2 * cpus; procs *= 2) {
+        uint32_t units = bench_throughput(procs, BENCH_THROUGHPUT_MS);
+        terminal_printf(term, "  %u processes: %u units/s\n", procs, units);
+    }
+
+    uint32_t steals = 0;
+    uint32_t ms = bench_batch(BENCH_BATCH_PROCS, &steals);
+    terminal_printf(term, "Batch of %u CPU-bound processes: done in %u ms, %u steals\n",
+                   BENCH_BATCH_PROCS, ms, steals);
+
+    terminal_puts(term, "IPC to one batch-receiving consumer:\n");
+    for (uint32_t procs = 1; procs <= cpus; procs *= 2) {
+        uint32_t rate = bench_ipc(procs, BENCH_IPC_MS);
+        terminal_printf(term, "  %u producers: %u messages/s\n", procs, rate);
+    }
 }
 
 void terminal_cmd_uptime(terminal_t* term) {
+    system_monitor_update();
     system_info_t info = system_monitor_get_system_info();
     
     uint32_t hours = info.uptime_seconds / 3600;
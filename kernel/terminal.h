@@ -7,6 +7,9 @@
 #define TERMINAL_HEIGHT 25
 #define TERMINAL_BUFFER_SIZE (TERMINAL_WIDTH * TERMINAL_HEIGHT)
 #define TERMINAL_HISTORY_SIZE 1000
+#define TERMINAL_MAX_CACHES 16  // Slab caches listed by 'mem'
+#define TERMINAL_MAX_PROCESSES 32  // Processes listed by 'ps'
+#define TERMINAL_HEAPTOP_SITES 10  // Callsites listed by 'heaptop'
 
 typedef struct {
     char character;
@@ -50,6 +53,10 @@ void terminal_cmd_clear(terminal_t* term);
 void terminal_cmd_echo(terminal_t* term, const char* args);
 void terminal_cmd_ps(terminal_t* term);
 void terminal_cmd_mem(terminal_t* term);
+void terminal_cmd_heaptop(terminal_t* term, const char* args);
+void terminal_cmd_sched(terminal_t* term);
+void terminal_cmd_irq(terminal_t* term);
+void terminal_cmd_bench(terminal_t* term);
 void terminal_cmd_uptime(terminal_t* term);
 void terminal_cmd_version(terminal_t* term);
 
@@ -0,0 +1,328 @@
+#include "timer.h"
+#include "idt.h"
+#include "io.h"
+#include "cpu.h"
+#include "process.h"
+#include "spinlock.h"
+#include "softirq.h"
+#include "smp.h"
+#include "libc/stdio.h"
+
+static volatile uint64_t ticks = 0;
+static uint32_t hz = 0;
+static uint64_t tsc_khz = 0;  // TSC cycles per millisecond
+
+// Tickless idle (boot CPU). While nohz is set the PIT is in one-shot mode
+// and 'ticks' is stale: the tick count is worked out from the TSC, counting
+// from last_tick_tsc, the time of the last tick 'ticks' includes.
+static volatile uint64_t last_tick_tsc = 0;
+static volatile uint32_t nohz = 0;
+static uint64_t nohz_deadline = 0;  // Earliest timer when the tick stopped
+
+// Timer wheel. wheel_next is the next tick whose level 0 slot runs, and
+// expired holds timers due whose callbacks have not run yet. timer_lock
+// guards all three.
+static timer_t* wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+static uint64_t wheel_next = 0;
+static timer_t* expired = NULL;
+static spinlock_t timer_lock = SPINLOCK_INIT;
+
+static void timer_run(void);
+
+// PIT channel 0 as a rate generator at 'hz' interrupts a second
+static void pit_periodic(void) {
+    uint32_t divisor = PIT_FREQUENCY / hz;
+    outb(PIT_COMMAND, 0x34);  // Channel 0, lobyte/hibyte, mode 2
+    outb(PIT_CHANNEL0, divisor & 0xFF);
+    outb(PIT_CHANNEL0, (divisor >> 8) & 0xFF);
+}
+
+// TSC cycles per tick
+static inline uint64_t tick_cycles(void) {
+    return tsc_khz * 1000 / hz;
+}
+
+// Program PIT channel 0 as a rate generator at 'rate' interrupts a second
+void timer_init(uint32_t rate) {
+    uint32_t divisor = PIT_FREQUENCY / rate;
+    if (divisor == 0 || divisor > 0xFFFF) {
+        printf("timer_init: %u Hz is out of the PIT's range\n", rate);
+        return;
+    }
+
+    hz = PIT_FREQUENCY / divisor;
+    pit_periodic();
+    softirq_register(SOFTIRQ_TIMER, timer_run);
+    irq_unmask(0);
+
+    // Measure the TSC against PIT channel 2, to turn cycle counts into time
+    uint64_t start = rdtsc();
+    timer_udelay(TIMER_TSC_CALIBRATE_MS * 1000);
+    tsc_khz = (rdtsc() - start) / TIMER_TSC_CALIBRATE_MS;
+
+    printf("Timer initialized at %u Hz, TSC at %u MHz\n", hz, (uint32_t)(tsc_khz / 1000));
+}
+
+static void list_push(timer_t** head, timer_t* timer) {
+    timer->next = *head;
+    if (*head) {
+        (*head)->pprev = &timer->next;
+    }
+    *head = timer;
+    timer->pprev = head;
+}
+
+// Put a timer in the slot its deadline falls in, relative to wheel_next:
+// the lowest level whose turn still reaches it. Deadlines already passed
+// go in the slot that runs next.
+static void wheel_insert(timer_t* timer) {
+    uint64_t deadline = timer->deadline;
+    if ((int64_t)(deadline - wheel_next) < 0) {
+        deadline = wheel_next;
+    }
+    uint64_t delta = deadline - wheel_next;
+
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 &&
+           delta >= (1ULL << (TIMER_WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+    uint64_t reach = 1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS);
+    if (delta >= reach) {
+        deadline = wheel_next + reach - 1;
+    }
+
+    list_push(&wheel[level][(deadline >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1)], timer);
+}
+
+static void wheel_remove(timer_t* timer) {
+    *timer->pprev = timer->next;
+    if (timer->next) {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+// Earliest deadline of any pending timer, no earlier than wheel_next; ~0
+// with none (timer_lock held)
+static uint64_t wheel_earliest(void) {
+    if (expired) {
+        return wheel_next;
+    }
+    uint64_t earliest = ~0ULL;
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        for (int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+            for (timer_t* timer = wheel[level][slot]; timer; timer = timer->next) {
+                if (timer->deadline < earliest) {
+                    earliest = timer->deadline;
+                }
+            }
+        }
+    }
+    return earliest < wheel_next ? wheel_next : earliest;
+}
+
+// Move one slot of 'level' down the wheel; returns the slot's index, so
+// the caller cascades the next level up when it is 0
+static int wheel_cascade(int level) {
+    int index = (wheel_next >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+    timer_t* timer = wheel[level][index];
+    wheel[level][index] = NULL;
+    while (timer) {
+        timer_t* next = timer->next;
+        wheel_insert(timer);
+        timer = next;
+    }
+    return index;
+}
+
+// Convert a delay to ticks, rounding up so a timer never fires early
+uint64_t timer_ms_to_ticks(uint32_t ms) {
+    return ((uint64_t)ms * hz + 999) / 1000;
+}
+
+// Arm 'timer' to call 'callback(arg)' from the tick interrupt once
+// timer_ticks() reaches 'deadline'. Re-arming a pending timer moves it.
+void timer_add(timer_t* timer, uint64_t deadline, void (*callback)(void* arg), void* arg) {
+    uint64_t flags = spin_lock_irqsave(&timer_lock);
+    if (timer->pprev) {
+        wheel_remove(timer);
+    }
+    timer->deadline = deadline;
+    timer->callback = callback;
+    timer->arg = arg;
+    wheel_insert(timer);
+
+    // The boot CPU halted with its tick stopped until a later deadline
+    int kick = nohz && deadline < nohz_deadline && this_cpu()->id != 0;
+    spin_unlock_irqrestore(&timer_lock, flags);
+    if (kick) {
+        smp_resched(smp_cpu(0));
+    }
+}
+
+// Disarm a timer. Returns 1 if it was pending, 0 if its callback has
+// already been called (it may still be running on the boot CPU).
+int timer_cancel(timer_t* timer) {
+    uint64_t flags = spin_lock_irqsave(&timer_lock);
+    int pending = timer->pprev != NULL;
+    if (pending) {
+        wheel_remove(timer);
+    }
+    spin_unlock_irqrestore(&timer_lock, flags);
+    return pending;
+}
+
+int timer_pending(timer_t* timer) {
+    return timer->pprev != NULL;
+}
+
+// SOFTIRQ_TIMER: catch the wheel up with the tick count and run what
+// expired, with interrupts on. Callbacks run without the lock, so they may
+// add timers (their own included), and a timer cancelled before its
+// callback starts stays cancelled.
+static void timer_run(void) {
+    uint64_t flags = spin_lock_irqsave(&timer_lock);
+    while ((int64_t)(ticks - wheel_next) >= 0) {
+        int index = wheel_next & (TIMER_WHEEL_SLOTS - 1);
+        for (int level = 1; index == 0 && level < TIMER_WHEEL_LEVELS; level++) {
+            index = wheel_cascade(level);
+        }
+        index = wheel_next & (TIMER_WHEEL_SLOTS - 1);
+        wheel_next++;
+
+        // Everything left in a level 0 slot is due
+        while (wheel[0][index]) {
+            timer_t* timer = wheel[0][index];
+            wheel_remove(timer);
+            list_push(&expired, timer);
+        }
+    }
+
+    while (expired) {
+        timer_t* timer = expired;
+        void (*callback)(void* arg) = timer->callback;
+        void* arg = timer->arg;
+        wheel_remove(timer);
+        spin_unlock_irqrestore(&timer_lock, flags);
+        callback(arg);
+        flags = spin_lock_irqsave(&timer_lock);
+    }
+    spin_unlock_irqrestore(&timer_lock, flags);
+}
+
+// IRQ0: replaces the weak default in idt.c. The PIC is acknowledged and
+// the timer wheel run (as a bottom half) before the scheduler runs, since
+// a preempted process does not return here until it is next scheduled.
+void irq0_handler(void) {
+    uint64_t start = rdtsc();
+    if (nohz) {
+        timer_nohz_exit();  // The one-shot: catch up on the ticks it stood in for
+    } else {
+        ticks++;
+        last_tick_tsc = start;
+    }
+    pic_send_eoi(0);
+    softirq_raise(SOFTIRQ_TIMER);
+    irq_exit(start);
+    process_tick(start);
+}
+
+uint64_t timer_ticks(void) {
+    if (nohz) {
+        return ticks + (rdtsc() - last_tick_tsc) / tick_cycles();
+    }
+    return ticks;
+}
+
+// Stop the periodic tick while the boot CPU idles (interrupts off, the
+// caller about to halt): the PIT is set to interrupt once, at the next
+// timer deadline or TIMER_NOHZ_MAX_US from now if that comes first.
+// Returns 0, leaving the tick alone, when a deadline is due within a tick.
+int timer_nohz_enter(void) {
+    if (nohz || !tsc_khz || !hz) {
+        return 0;
+    }
+    // Held until the deadline is published, so a timer_add on another CPU
+    // either lands before wheel_earliest or sees nohz and kicks us
+    spin_lock(&timer_lock);
+    uint64_t next = wheel_earliest();
+    if (next <= ticks + 1) {
+        spin_unlock(&timer_lock);
+        return 0;
+    }
+
+    uint64_t cycles_per_tick = tick_cycles();
+    uint64_t max_ticks = (uint64_t)TIMER_NOHZ_MAX_US * hz / 1000000;
+    if (next - ticks > max_ticks) {
+        next = ticks + max_ticks;
+    }
+    uint64_t target = last_tick_tsc + (next - ticks) * cycles_per_tick;
+    uint64_t now = rdtsc();
+    if (target <= now + cycles_per_tick) {
+        spin_unlock(&timer_lock);
+        return 0;
+    }
+    uint32_t count = (target - now) * PIT_FREQUENCY / (tsc_khz * 1000);
+
+    nohz_deadline = next;
+    nohz = 1;
+    spin_unlock(&timer_lock);
+    outb(PIT_COMMAND, 0x30);  // Channel 0, lobyte/hibyte, mode 0 (one-shot)
+    outb(PIT_CHANNEL0, count & 0xFF);
+    outb(PIT_CHANNEL0, (count >> 8) & 0xFF);
+    return 1;
+}
+
+// Restart the periodic tick (interrupts off), counting the ticks missed.
+// Rounded to the nearest tick, since the one-shot's own interrupt may land
+// a hair before the tick it replaces.
+void timer_nohz_exit(void) {
+    if (!nohz) {
+        return;
+    }
+    uint64_t cycles_per_tick = tick_cycles();
+    uint64_t missed = (rdtsc() - last_tick_tsc + cycles_per_tick / 2) / cycles_per_tick;
+    ticks += missed;
+    last_tick_tsc += missed * cycles_per_tick;
+    nohz = 0;
+    pit_periodic();
+}
+
+uint32_t timer_hz(void) {
+    return hz;
+}
+
+uint64_t timer_uptime_ms(void) {
+    return hz ? timer_ticks() * 1000 / hz : 0;
+}
+
+uint64_t timer_tsc_khz(void) {
+    return tsc_khz;
+}
+
+// Convert TSC cycles to microseconds; 0 before calibration
+uint64_t timer_cycles_to_us(uint64_t cycles) {
+    return tsc_khz ? cycles * 1000 / tsc_khz : 0;
+}
+
+// Busy-wait on PIT channel 2, which needs neither interrupts nor the tick,
+// so it works during boot (AP start-up, APIC timer calibration). One shot
+// of the 16-bit counter lasts at most ~54ms; longer waits take several.
+void timer_udelay(uint32_t us) {
+    while (us > 0) {
+        uint32_t chunk = us > 50000 ? 50000 : us;
+        uint32_t count = (uint32_t)((uint64_t)PIT_FREQUENCY * chunk / 1000000);
+        if (count == 0) count = 1;
+
+        outb(PIT_GATE, (inb(PIT_GATE) & ~0x02) | 0x01);  // Gate on, speaker off
+        outb(PIT_COMMAND, 0xB0);  // Channel 2, lobyte/hibyte, mode 0
+        outb(PIT_CHANNEL2, count & 0xFF);
+        outb(PIT_CHANNEL2, (count >> 8) & 0xFF);
+        while (!(inb(PIT_GATE) & 0x20)) {
+            cpu_pause();
+        }
+        us -= chunk;
+    }
+}
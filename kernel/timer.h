@@ -0,0 +1,58 @@
+#ifndef _TIMER_H
+#define _TIMER_H
+
+#include <stdint.h>
+
+// Tick rate of the system timer: 'make HZ=1000' to override
+#ifndef TIMER_HZ
+#define TIMER_HZ 100
+#endif
+
+// 8253/8254 programmable interval timer
+#define PIT_FREQUENCY 1193182  // Input clock in Hz
+#define PIT_CHANNEL0  0x40
+#define PIT_CHANNEL2  0x42
+#define PIT_COMMAND   0x43
+#define PIT_GATE      0x61  // Channel 2 gate (bit 0) and output (bit 5)
+
+// Length of the TSC calibration in timer_init
+#define TIMER_TSC_CALIBRATE_MS 10
+
+// Longest the boot CPU's tick stays stopped while idle: the PIT's one-shot
+// counter runs out after about 54ms
+#define TIMER_NOHZ_MAX_US 50000
+
+// Timer wheel: TIMER_WHEEL_LEVELS levels of 2^TIMER_WHEEL_BITS slots each.
+// Level 0 slots are one tick wide, and each level's slots span a whole
+// turn of the level below. Deadlines further out than the top level
+// reaches wait in its last slot and are re-sorted when it comes round.
+#define TIMER_WHEEL_BITS   6
+#define TIMER_WHEEL_SLOTS  (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+// A pending callback. The owner provides the storage and must leave it
+// alone until the callback has run or timer_cancel succeeded.
+typedef struct timer {
+    uint64_t deadline;              // Tick at which the callback runs
+    void (*callback)(void* arg);    // Runs in the tick interrupt: must not block
+    void* arg;
+    struct timer* next;             // Wheel slot list
+    struct timer** pprev;           // Link pointing at us; NULL when not pending
+} timer_t;
+
+// Function declarations
+void timer_init(uint32_t hz);
+uint64_t timer_ticks(void);
+uint32_t timer_hz(void);
+uint64_t timer_uptime_ms(void);
+uint64_t timer_tsc_khz(void);
+uint64_t timer_cycles_to_us(uint64_t cycles);
+void timer_udelay(uint32_t us);
+uint64_t timer_ms_to_ticks(uint32_t ms);
+void timer_add(timer_t* timer, uint64_t deadline, void (*callback)(void* arg), void* arg);
+int timer_cancel(timer_t* timer);
+int timer_pending(timer_t* timer);
+int timer_nohz_enter(void);
+void timer_nohz_exit(void);
+
+#endif // _TIMER_H
@@ -10,6 +10,8 @@
 #include "keyboard.h"
 #include "desktop.h"
 #include "mm/mm.h"
+#include "mm/slab.h"
+#include "mm/arena.h"
 #include "process.h"
 
 // Screen dimensions and framebuffer are now in framebuffer.h
@@ -22,8 +24,11 @@ static void draw_string(const char *str, int x, int y, uint32_t color);
 // Global UI state
 ui_state_t ui_state;
 
-// Window management
-static ui_window_t windows[MAX_WINDOWS];
+// Window management: windows come from a slab cache and are kept in
+// z-order (back to front) in a growable pointer array
+static kmem_cache_t *ui_window_cache = NULL;
+static ui_window_t **windows = NULL;
+static int window_capacity = 0;
 static int window_count = 0;
 static int active_window = -1;
 static int dragging_window = -1;
@@ -45,11 +50,30 @@ static int point_in_rect(int x, int y, int rect_x, int rect_y, int width, int he
             y >= rect_y && y < rect_y + height);
 }
 
+static void ui_window_ctor(void *obj) {
+    memset(obj, 0, sizeof(ui_window_t));
+}
+
+// Allocate a window object and give it a slot at the top of the z-order
+static ui_window_t *ui_window_alloc(void) {
+    if (window_count >= window_capacity) {
+        int new_capacity = window_capacity ? window_capacity * 2 : UI_WINDOW_INITIAL_CAPACITY;
+        ui_window_t **grown = krealloc(windows, new_capacity * sizeof(ui_window_t *));
+        if (!grown) return NULL;
+        windows = grown;
+        window_capacity = new_capacity;
+    }
+    
+    ui_window_t *win = kmem_cache_alloc(ui_window_cache);
+    if (!win) return NULL;
+    windows[window_count] = win;
+    return win;
+}
+
 // Create a new window
 int ui_create_window(int x, int y, int width, int height, const char *title, uint32_t color) {
-    if (window_count >= MAX_WINDOWS) return -1;
-    
-    ui_window_t *win = &windows[window_count];
+    ui_window_t *win = ui_window_alloc();
+    if (!win) return -1;
     win->x = x;
     win->y = y;
     win->width = width;
@@ -80,7 +104,12 @@ void ui_init(uint32_t *fb, uint32_t width, uint32_t height) {
     ui_state.taskbar_height = TASKBAR_HEIGHT;
     
     // Initialize windows array
-    memset(windows, 0, sizeof(windows));
+    if (!ui_window_cache) {
+        ui_window_cache = kmem_cache_create("ui_window", sizeof(ui_window_t), 0, ui_window_ctor);
+    }
+    for (int i = 0; i < window_count; i++) {
+        kmem_cache_free(ui_window_cache, windows[i]);
+    }
     window_count = 0;
     active_window = -1;
     dragging_window = -1;
@@ -141,8 +170,7 @@ void taskbar_draw(void) {
     }
     
     // Draw system tray with current time (placeholder)
-    char time_str[16];
-    snprintf(time_str, sizeof(time_str), "%02d:%02d", 12, 34);
+    char* time_str = arena_printf(frame_arena, "%d:%d", 12, 34);
     uint32_t time_width = strlen(time_str) * 8;
     ui_draw_string(time_str, ui_state.width - time_width - 20, 
                   ui_state.height - TASKBAR_HEIGHT + 12, TASKBAR_TEXT_COLOR);
@@ -172,10 +200,11 @@ void taskbar_handle_click(int x, int y) {
 
 // Window management
 void wm_add_window(ui_window_t *window) {
-    if (window_count >= MAX_WINDOWS) return;
+    ui_window_t *win = ui_window_alloc();
+    if (!win) return;
     
     // Add window to the windows array
-    windows[window_count] = *window;
+    *win = *window;
     window_count++;
     
     // Set as active window
@@ -187,7 +216,7 @@ void wm_add_window(ui_window_t *window) {
 void wm_draw_all(void) {
     // Draw all windows in reverse order (back to front)
     for (int i = window_count - 1; i >= 0; i--) {
-        ui_window_t *win = &windows[i];
+        ui_window_t *win = windows[i];
         if (!win->visible || win->minimized) continue;
         
         // Draw window background
@@ -274,7 +303,7 @@ static void draw_taskbar(void) {
     // Draw taskbar items (open windows)
     int item_x = 90;
     for (int i = 0; i < window_count; i++) {
-        if (!windows[i].visible) continue;
+        if (!windows[i]->visible) continue;
         
         int is_active = (i == window_count - 1); // Top window is active
         uint32_t bg_color = is_active ? 0x4CAF50 : 0x3F51B5;
@@ -285,9 +314,9 @@ static void draw_taskbar(void) {
         
         // Truncate title if too long
         char title[20];
-        strncpy(title, windows[i].title, sizeof(title) - 1);
+        strncpy(title, windows[i]->title, sizeof(title) - 1);
         title[sizeof(title) - 1] = '\0';
-        if (strlen(windows[i].title) > 15) {
+        if (strlen(windows[i]->title) > 15) {
             strcpy(title + 12, "...");
         }
         
@@ -322,22 +351,22 @@ static void handle_taskbar_click(int x, int y) {
     // Handle window taskbar items
     int item_x = 90;
     for (int i = 0; i < window_count; i++) {
-        if (!windows[i].visible) continue;
+        if (!windows[i]->visible) continue;
         
         if (x >= item_x && x < item_x + TASKBAR_ITEM_WIDTH &&
             y >= taskbar_y + 5 && y < taskbar_y + ui_state.taskbar_height - 5) {
             
             // Bring window to front
             if (i != window_count - 1) {
-                ui_window_t win = windows[i];
+                ui_window_t *win = windows[i];
                 memmove(&windows[i], &windows[i + 1], 
-                       (window_count - i - 1) * sizeof(ui_window_t));
+                       (window_count - i - 1) * sizeof(ui_window_t *));
                 windows[window_count - 1] = win;
             }
             
             // Toggle window visibility if already active
             if (i == window_count - 1) {
-                windows[i].visible = !windows[i].visible;
+                windows[i]->visible = !windows[i]->visible;
             }
             
             break;
@@ -394,14 +423,14 @@ void ui_handle_click(int x, int y, int buttons) {
     
     // Check if click was on a window
     for (int i = window_count - 1; i >= 0; i--) {
-        ui_window_t *win = &windows[i];
+        ui_window_t *win = windows[i];
         if (win->visible && !win->minimized &&
             x >= win->x && x < win->x + (int)win->width &&
             y >= win->y && y < win->y + (int)win->height) {
             
             // Bring window to front
             if (i != window_count - 1) {
-                ui_window_t temp = windows[i];
+                ui_window_t *temp = windows[i];
                 for (int j = i; j < window_count - 1; j++) {
                     windows[j] = windows[j + 1];
                 }
@@ -420,7 +449,7 @@ void ui_handle_click(int x, int y, int buttons) {
 void ui_handle_mouse_move(int x, int y, int buttons) {
     // Handle window dragging
     if (dragging_window != -1 && (buttons & 0x1)) {
-        ui_window_t *win = &windows[dragging_window];
+        ui_window_t *win = windows[dragging_window];
         win->x = x - win->drag_start_x;
         win->y = y - win->drag_start_y;
         
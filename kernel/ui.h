@@ -5,7 +5,7 @@
 #include <stddef.h>
 
 // UI Constants
-#define MAX_WINDOWS 32
+#define UI_WINDOW_INITIAL_CAPACITY 32
 #define TASKBAR_HEIGHT 30
 #define TASKBAR_ITEM_WIDTH 120
 
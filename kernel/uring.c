@@ -0,0 +1,292 @@
+#include "uring.h"
+#include "process.h"
+#include "ipc.h"
+#include "fs.h"
+#include "mm/mm.h"
+#include "mm/pmm.h"
+#include "libc/string.h"
+#include "libc/stdio.h"
+
+// Whether the running process may touch [addr, addr + size). Kernel
+// processes pass kernel pointers and are trusted.
+static int ring_access(uint64_t addr, uint64_t size, int write) {
+    vmm_space_t* space = process_current()->space;
+    return !space || vmm_user_access(space, addr, size, write);
+}
+
+// Completions the process has not reaped. A garbage cq_head counts as a
+// full queue, so the kernel stops taking requests rather than overrun it.
+static uint32_t cq_used(uring_t* ring) {
+    uint32_t used = ring->shared->cq_tail - __atomic_load_n(&ring->shared->cq_head, __ATOMIC_ACQUIRE);
+    return used > URING_ENTRIES ? URING_ENTRIES : used;
+}
+
+// Publish a completion (ring lock held). Room for it was reserved when
+// its request was taken.
+static void cq_post(uring_t* ring, uint64_t user_data, int32_t res) {
+    uring_shared_t* shared = ring->shared;
+    uint32_t tail = shared->cq_tail;
+    uring_cqe_t* cqe = &shared->cq[tail & (URING_ENTRIES - 1)];
+    cqe->user_data = user_data;
+    cqe->res = res;
+    cqe->flags = 0;
+    __atomic_store_n(&shared->cq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static void complete(uring_t* ring, uint64_t user_data, int32_t res) {
+    uint64_t flags = spin_lock_irqsave(&ring->lock);
+    cq_post(ring, user_data, res);
+    ring->inflight--;
+    spin_unlock_irqrestore(&ring->lock, flags);
+}
+
+// Timer callback: a timeout ran out. Once the slot is free again the ring
+// may be destroyed, so nothing touches it after the unlock.
+static void timeout_expired(void* arg) {
+    uring_timeout_t* timeout = arg;
+    uring_t* ring = timeout->ring;
+    uint64_t flags = spin_lock_irqsave(&ring->lock);
+    cq_post(ring, timeout->user_data, 0);
+    ring->inflight--;
+    wake_up(&ring->wait);
+    timeout->ring = NULL;
+    spin_unlock_irqrestore(&ring->lock, flags);
+}
+
+static int32_t op_rw(uring_sqe_t* sqe) {
+    int write = sqe->opcode == URING_OP_WRITE;
+    if (sqe->len > INT32_MAX) {
+        return URING_EINVAL;
+    }
+    if (!ring_access(sqe->addr, sqe->len, !write)) {
+        return URING_EFAULT;
+    }
+    fs_node_t* node = fs_find_inode(sqe->fd);
+    if (!node) {
+        return URING_ENOENT;
+    }
+    uint8_t* buffer = (uint8_t*)(uintptr_t)sqe->addr;
+    return (int32_t)(write ? write_fs(node, sqe->arg, sqe->len, buffer)
+                           : read_fs(node, sqe->arg, sqe->len, buffer));
+}
+
+// 1 if the timeout is in flight, else a result to complete with now
+static int32_t op_timeout(uring_t* ring, uring_sqe_t* sqe) {
+    uint64_t flags = spin_lock_irqsave(&ring->lock);
+    for (uint32_t i = 0; i < URING_TIMEOUTS; i++) {
+        uring_timeout_t* timeout = &ring->timeouts[i];
+        if (!timeout->ring) {
+            timeout->ring = ring;
+            timeout->user_data = sqe->user_data;
+            timer_add(&timeout->timer, timer_ticks() + timer_ms_to_ticks(sqe->len) + 1,
+                      timeout_expired, timeout);
+            spin_unlock_irqrestore(&ring->lock, flags);
+            return 1;
+        }
+    }
+    spin_unlock_irqrestore(&ring->lock, flags);
+    return URING_EAGAIN;
+}
+
+static int32_t op_send(uring_sqe_t* sqe) {
+    if (sqe->len > IPC_DATA_SIZE) {
+        return URING_EINVAL;
+    }
+    if (sqe->len && !ring_access(sqe->addr, sqe->len, 0)) {
+        return URING_EFAULT;
+    }
+    return ipc_send(sqe->fd, sqe->arg, (const void*)(uintptr_t)sqe->addr, sqe->len) ? 0 : URING_EAGAIN;
+}
+
+// Take a message into 'addr' if one is waiting
+static int receive_now(uint64_t addr) {
+    message_t message;
+    if (!ipc_poll(&message)) {
+        return 0;
+    }
+    memcpy((void*)(uintptr_t)addr, &message, sizeof(message_t));
+    return 1;
+}
+
+// 1 if the receive is in flight, else a result to complete with now.
+// Receives finish in order, so one never overtakes another in flight.
+static int32_t op_receive(uring_t* ring, uring_sqe_t* sqe) {
+    if (!ring_access(sqe->addr, sizeof(message_t), 1)) {
+        return URING_EFAULT;
+    }
+    if (!ring->receives && receive_now(sqe->addr)) {
+        return 0;
+    }
+    if (ring->receives == URING_RECEIVES) {
+        return URING_EAGAIN;
+    }
+    ring->receive[ring->receives].addr = sqe->addr;
+    ring->receive[ring->receives].user_data = sqe->user_data;
+    ring->receives++;
+    return 1;
+}
+
+// Finish the receives in flight that have a message now
+static void receives_reap(uring_t* ring) {
+    uint32_t done = 0;
+    while (done < ring->receives && receive_now(ring->receive[done].addr)) {
+        complete(ring, ring->receive[done].user_data, 0);
+        done++;
+    }
+    if (done) {
+        ring->receives -= done;
+        memmove(ring->receive, ring->receive + done, ring->receives * sizeof(uring_receive_t));
+    }
+}
+
+// Carry out one request; it has room reserved in the completion queue
+static void submit(uring_t* ring, uring_sqe_t* sqe) {
+    int32_t res;
+    if (sqe->flags || sqe->opcode >= URING_OP_COUNT) {
+        res = URING_EINVAL;
+    } else {
+        switch (sqe->opcode) {
+        case URING_OP_READ:
+        case URING_OP_WRITE:   res = op_rw(sqe); break;
+        case URING_OP_TIMEOUT: res = op_timeout(ring, sqe); break;
+        case URING_OP_SEND:    res = op_send(sqe); break;
+        case URING_OP_RECEIVE: res = op_receive(ring, sqe); break;
+        default:               res = 0; break;
+        }
+        if (res == 1 && (sqe->opcode == URING_OP_TIMEOUT || sqe->opcode == URING_OP_RECEIVE)) {
+            return;  // In flight
+        }
+    }
+    complete(ring, sqe->user_data, res);
+}
+
+// Completions ready or on their way
+static uint32_t cq_pending(uring_t* ring) {
+    return cq_used(ring) + ring->inflight;
+}
+
+// Block until 'min' completions are ready. Timeouts wake the ring's queue
+// and messages the mailbox's, so with receives in flight it waits on both.
+static void ring_wait(uring_t* ring, uint32_t min) {
+    wait_queue_t* mail = ipc_wait_queue();
+    wait_entry_t ring_entry = { 0 };
+    wait_entry_t mail_entry = { 0 };
+    for (;;) {
+        receives_reap(ring);
+        if (cq_used(ring) >= min) {
+            return;
+        }
+        uint64_t flags = irq_save();
+        prepare_to_wait(&ring->wait, &ring_entry);
+        if (ring->receives && mail) {
+            prepare_to_wait(mail, &mail_entry);
+        }
+        if (cq_used(ring) < min && !(ring->receives && ipc_pending())) {
+            process_block();
+        }
+        finish_wait(&ring->wait, &ring_entry);
+        if (mail) {
+            finish_wait(mail, &mail_entry);
+        }
+        irq_restore(flags);
+    }
+}
+
+// Set up a ring for the running process; returns where the shared page is
+// in its address space (the same each time), or 0
+uint64_t uring_setup(void) {
+    pcb_t* proc = process_current();
+    uint64_t base = proc->space ? URING_USER_BASE : 0;
+    if (proc->ring) {
+        return base ? base : (uintptr_t)proc->ring->shared;
+    }
+
+    uring_t* ring = kmalloc(sizeof(uring_t));
+    uring_shared_t* shared = pmm_alloc_zeroed_pages(0);
+    if (!ring || !shared) {
+        printf("uring_setup: Out of memory\n");
+        goto fail;
+    }
+    memset(ring, 0, sizeof(uring_t));
+    spin_init(&ring->lock);
+    wait_queue_init(&ring->wait);
+    ring->shared = shared;
+    shared->entries = URING_ENTRIES;
+    if (proc->space && !vmm_map_in(proc->space, URING_USER_BASE, (uintptr_t)shared,
+                                   VMM_USER | VMM_WRITE | VMM_NO_EXEC)) {
+        printf("uring_setup: Failed to map the ring\n");
+        goto fail;
+    }
+    proc->ring = ring;
+    return base ? base : (uintptr_t)shared;
+
+fail:
+    if (shared) pmm_free_pages(shared, 0);
+    if (ring) kfree(ring);
+    return 0;
+}
+
+// The doorbell: take up to 'to_submit' new requests, as many as the
+// completion queue has room for, then wait until at least 'min_complete'
+// completions are ready (fewer if fewer are on their way). Returns the
+// number of requests taken, or -1 without a ring.
+int uring_enter(uint32_t to_submit, uint32_t min_complete) {
+    uring_t* ring = process_current()->ring;
+    if (!ring) {
+        return -1;
+    }
+    uring_shared_t* shared = ring->shared;
+    ring->enters++;
+    receives_reap(ring);
+
+    uint32_t head = shared->sq_head;
+    uint32_t tail = __atomic_load_n(&shared->sq_tail, __ATOMIC_ACQUIRE);
+    uint32_t taken = 0;
+    while (taken < to_submit && head != tail && cq_pending(ring) < URING_ENTRIES) {
+        // A copy, so the process cannot change it while it is carried out
+        uring_sqe_t sqe = shared->sq[head & (URING_ENTRIES - 1)];
+        head++;
+        __atomic_store_n(&shared->sq_head, head, __ATOMIC_RELEASE);
+
+        uint64_t flags = spin_lock_irqsave(&ring->lock);
+        ring->inflight++;
+        spin_unlock_irqrestore(&ring->lock, flags);
+        submit(ring, &sqe);
+        taken++;
+    }
+    ring->submitted += taken;
+
+    uint32_t pending = cq_pending(ring);
+    if (min_complete > pending) {
+        min_complete = pending;
+    }
+    if (min_complete) {
+        ring_wait(ring, min_complete);
+    }
+    return taken;
+}
+
+// Free a dead process's ring (the reaper, before its address space goes).
+// Timeouts that cannot be cancelled are running: wait for them to finish.
+void uring_destroy(uring_t* ring) {
+    for (uint32_t i = 0; i < URING_TIMEOUTS; i++) {
+        uring_timeout_t* timeout = &ring->timeouts[i];
+        if (timeout->ring && timer_cancel(&timeout->timer)) {
+            timeout->ring = NULL;
+        }
+    }
+    for (;;) {
+        int busy = 0;
+        uint64_t flags = spin_lock_irqsave(&ring->lock);
+        for (uint32_t i = 0; i < URING_TIMEOUTS; i++) {
+            busy |= ring->timeouts[i].ring != NULL;
+        }
+        spin_unlock_irqrestore(&ring->lock, flags);
+        if (!busy) {
+            break;
+        }
+        process_yield();
+    }
+    pmm_free_pages(ring->shared, 0);
+    kfree(ring);
+}
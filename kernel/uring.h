@@ -0,0 +1,111 @@
+#ifndef _URING_H
+#define _URING_H
+
+#include <stdint.h>
+#include "spinlock.h"
+#include "sync.h"
+#include "timer.h"
+#include "mm/vmm.h"
+
+// Submission/completion rings. A process gets one page shared with the
+// kernel (uring_setup), holding a submission queue it fills with requests
+// and a completion queue the kernel fills with their results. One
+// uring_enter hands the kernel a whole batch and can wait for results, so
+// a busy process pays for one system call per batch rather than per
+// request. The ring indexes only ever grow; an entry's slot is its index
+// masked by URING_ENTRIES - 1.
+//
+// The kernel takes a request only while the completion queue has room for
+// its result, so completions are never dropped. Requests that cannot
+// finish at once (timeouts, receives with an empty mailbox) stay in
+// flight; receives finish inside a later uring_enter.
+#define URING_ENTRIES     64   // Per queue; power of two
+#define URING_TIMEOUTS    16   // Timeouts in flight per ring
+#define URING_RECEIVES    16   // Receives in flight per ring
+#define URING_USER_BASE   (VMM_USER_BASE + 0x200000ULL)  // Past the kernel data page
+
+// Opcodes
+#define URING_OP_NOP      0
+#define URING_OP_READ     1  // read_fs(inode 'fd', offset 'arg', 'len' bytes into 'addr')
+#define URING_OP_WRITE    2  // write_fs(inode 'fd', offset 'arg', 'len' bytes from 'addr')
+#define URING_OP_TIMEOUT  3  // Completes after 'len' milliseconds
+#define URING_OP_SEND     4  // ipc_send(pid 'fd', type 'arg', 'len' bytes at 'addr')
+#define URING_OP_RECEIVE  5  // ipc_receive into the message_t at 'addr'
+#define URING_OP_COUNT    6
+
+// Completion results below zero
+#define URING_EINVAL  -1  // Unknown opcode or bad arguments
+#define URING_EFAULT  -2  // Buffer not accessible to the process
+#define URING_ENOENT  -3  // No such file
+#define URING_EAGAIN  -4  // Refused for now: mailbox full, no slot for the request
+
+// A request. Field offsets are mirrored in arch/x86_64/user.s.
+typedef struct {
+    uint8_t opcode;       // URING_OP_*
+    uint8_t flags;        // None yet: must be 0
+    uint16_t reserved;
+    uint32_t fd;          // File inode, or destination PID
+    uint64_t addr;        // Buffer
+    uint32_t len;         // Buffer size, or milliseconds
+    uint32_t arg;         // File offset, or message type
+    uint64_t user_data;   // Handed back unchanged in the completion
+} uring_sqe_t;
+
+typedef struct {
+    uint64_t user_data;   // From the request
+    int32_t res;          // Bytes transferred or 0; a URING_E* code on failure
+    uint32_t flags;
+} uring_cqe_t;
+
+// The shared page. The process writes sq_tail and cq_head, the kernel
+// sq_head and cq_tail.
+typedef struct {
+    volatile uint32_t sq_head;  // Next request the kernel takes
+    volatile uint32_t sq_tail;  // Next free submission slot
+    volatile uint32_t cq_head;  // Next completion the process reaps
+    volatile uint32_t cq_tail;  // Next free completion slot
+    uint32_t entries;           // URING_ENTRIES
+    uint32_t reserved[3];
+    uring_sqe_t sq[URING_ENTRIES];
+    uring_cqe_t cq[URING_ENTRIES];
+} uring_shared_t;
+
+_Static_assert(sizeof(uring_sqe_t) == 32, "user.s builds requests of this size");
+_Static_assert(offsetof(uring_shared_t, sq) == 32, "user.s finds the queues here");
+_Static_assert(sizeof(uring_shared_t) <= VMM_PAGE_SIZE, "the ring is one page");
+
+typedef struct uring uring_t;
+
+// A timeout in flight
+typedef struct {
+    timer_t timer;
+    uring_t* ring;        // NULL while the slot is free
+    uint64_t user_data;
+} uring_timeout_t;
+
+// A receive waiting for a message
+typedef struct {
+    uint64_t addr;
+    uint64_t user_data;
+} uring_receive_t;
+
+// Kernel side of a ring. Only the owner submits; timer callbacks complete
+// timeouts, under 'lock'.
+struct uring {
+    spinlock_t lock;           // Guards cq_tail, 'inflight' and the timeout slots
+    wait_queue_t wait;         // The owner, waiting in uring_enter
+    uring_shared_t* shared;    // The page, through the identity map
+    uint32_t inflight;         // Taken requests without a completion yet
+    uint32_t receives;         // Entries in 'receive', oldest first
+    uring_receive_t receive[URING_RECEIVES];
+    uring_timeout_t timeouts[URING_TIMEOUTS];
+    uint32_t submitted;        // Requests taken
+    uint32_t enters;           // uring_enter calls
+};
+
+// Function declarations
+uint64_t uring_setup(void);
+int uring_enter(uint32_t to_submit, uint32_t min_complete);
+void uring_destroy(uring_t* ring);
+
+#endif // _URING_H
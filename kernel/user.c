@@ -0,0 +1,230 @@
+#include "user.h"
+#include "process.h"
+#include "vdso.h"
+#include "timer.h"
+#include "uring.h"
+#include "gdt.h"
+#include "ipc.h"
+#include "cpu.h"
+#include "serial.h"
+#include "mm/pmm.h"
+#include "libc/string.h"
+#include "libc/stdio.h"
+
+#define MSR_EFER           0xC0000080
+#define MSR_STAR           0xC0000081
+#define MSR_LSTAR          0xC0000082
+#define MSR_SFMASK         0xC0000084
+#define MSR_KERNEL_GS_BASE 0xC0000102
+#define EFER_SCE           (1ULL << 0)
+
+// RFLAGS bits SYSCALL clears on entry: TF, IF, DF and AC
+#define SYSCALL_RFLAGS_MASK 0x40700
+
+// arch/x86_64/user.s
+extern void syscall_entry(void);
+
+// Address spaces
+
+// Free the frames mapped in [virt, virt + size) of a user space
+static void free_user_range(vmm_space_t* space, uint64_t virt, uint64_t size) {
+    for (uint64_t page = virt; page < virt + size; page += VMM_PAGE_SIZE) {
+        uint64_t phys = vmm_translate(space, page);
+        if (phys) {
+            pmm_free_pages((void*)(uintptr_t)phys, 0);
+        }
+    }
+}
+
+// Map a fresh zeroed frame at 'virt'; returns it, or NULL
+static void* map_user_page(vmm_space_t* space, uint64_t virt, uint64_t flags) {
+    void* frame = pmm_alloc_zeroed_pages(0);
+    if (frame && !vmm_map_in(space, virt, (uintptr_t)frame, flags | VMM_USER)) {
+        pmm_free_pages(frame, 0);
+        return NULL;
+    }
+    return frame;
+}
+
+// A new address space holding a copy of 'code' (read-only) at
+// USER_CODE_BASE, an empty stack below USER_STACK_TOP and the kernel
+// data page
+vmm_space_t* user_space_create(const void* code, uint32_t size) {
+    if (size == 0 || size > USER_CODE_MAX) {
+        printf("user_space_create: %u bytes of code is out of range\n", size);
+        return NULL;
+    }
+    vmm_space_t* space = vmm_create_space();
+    if (!space) {
+        printf("user_space_create: Failed to create an address space\n");
+        return NULL;
+    }
+
+    for (uint32_t offset = 0; offset < size; offset += VMM_PAGE_SIZE) {
+        void* frame = map_user_page(space, USER_CODE_BASE + offset, 0);
+        if (!frame) {
+            goto fail;
+        }
+        uint32_t chunk = size - offset < VMM_PAGE_SIZE ? size - offset : VMM_PAGE_SIZE;
+        memcpy(frame, (const uint8_t*)code + offset, chunk);
+    }
+    for (uint64_t page = USER_STACK_TOP - USER_STACK_SIZE; page < USER_STACK_TOP; page += VMM_PAGE_SIZE) {
+        if (!map_user_page(space, page, VMM_WRITE | VMM_NO_EXEC)) {
+            goto fail;
+        }
+    }
+    if (!vdso_map(space)) {
+        goto fail;
+    }
+    return space;
+
+fail:
+    printf("user_space_create: Out of memory\n");
+    user_space_destroy(space);
+    return NULL;
+}
+
+// Free a user address space along with its code and stack frames (the
+// kernel data page is shared and stays). No CPU may have it loaded.
+void user_space_destroy(vmm_space_t* space) {
+    free_user_range(space, USER_CODE_BASE, USER_CODE_MAX);
+    free_user_range(space, USER_STACK_TOP - USER_STACK_SIZE, USER_STACK_SIZE);
+    vmm_destroy_space(space);
+}
+
+// System calls. They run with interrupts on, in the calling process, so
+// they may block or be preempted like any kernel code. User pointers are
+// checked against the caller's page tables before they are touched.
+
+static int user_access(uint64_t addr, uint64_t size, int write) {
+    vmm_space_t* space = process_current()->space;
+    return space && vmm_user_access(space, addr, size, write);
+}
+
+static uint64_t sys_exit(syscall_frame_t* frame) {
+    process_exit((int)frame->rdi);
+    return 0;
+}
+
+static uint64_t sys_yield(syscall_frame_t* frame) {
+    (void)frame;
+    process_yield();
+    return 0;
+}
+
+static uint64_t sys_getpid(syscall_frame_t* frame) {
+    (void)frame;
+    return process_current()->pid;
+}
+
+static uint64_t sys_sleep(syscall_frame_t* frame) {
+    process_sleep((uint32_t)frame->rdi);
+    return 0;
+}
+
+// Print up to USER_WRITE_MAX bytes; returns how many
+static uint64_t sys_write(syscall_frame_t* frame) {
+    uint64_t len = frame->rsi < USER_WRITE_MAX ? frame->rsi : USER_WRITE_MAX;
+    if (!user_access(frame->rdi, len, 0)) {
+        return SYSCALL_ERROR;
+    }
+    char text[USER_WRITE_MAX + 1];
+    memcpy(text, (const void*)(uintptr_t)frame->rdi, len);
+    text[len] = '\0';
+    printf("%s", text);
+    return len;
+}
+
+// 1 once queued, 0 if ipc_send refused it
+static uint64_t sys_send(syscall_frame_t* frame) {
+    uint64_t size = frame->r10;
+    if (size > IPC_DATA_SIZE || (size && !user_access(frame->rdx, size, 0))) {
+        return SYSCALL_ERROR;
+    }
+    return ipc_send((uint32_t)frame->rdi, (uint32_t)frame->rsi,
+                    (const void*)(uintptr_t)frame->rdx, (uint32_t)size);
+}
+
+static uint64_t sys_receive(syscall_frame_t* frame) {
+    if (!user_access(frame->rdi, sizeof(message_t), 1)) {
+        return SYSCALL_ERROR;
+    }
+    message_t message;
+    if (!ipc_receive(&message)) {
+        return SYSCALL_ERROR;
+    }
+    memcpy((void*)(uintptr_t)frame->rdi, &message, sizeof(message_t));
+    return 0;
+}
+
+// The slow path to the clock, for comparison with reading the data page
+static uint64_t sys_clock(syscall_frame_t* frame) {
+    (void)frame;
+    const vdso_data_t* vd = vdso_data();
+    if (!vd) {
+        // vdso_init failed; tick time is all there is
+        return timer_uptime_ms() * 1000000;
+    }
+    return vdso_clock_ns(vd);
+}
+
+static uint64_t sys_ring_setup(syscall_frame_t* frame) {
+    (void)frame;
+    uint64_t base = uring_setup();
+    return base ? base : SYSCALL_ERROR;
+}
+
+static uint64_t sys_ring_enter(syscall_frame_t* frame) {
+    int taken = uring_enter((uint32_t)frame->rdi, (uint32_t)frame->rsi);
+    return taken < 0 ? SYSCALL_ERROR : (uint64_t)taken;
+}
+
+static uint64_t (*const syscall_table[SYSCALL_COUNT])(syscall_frame_t* frame) = {
+    [SYS_EXIT]       = sys_exit,
+    [SYS_YIELD]      = sys_yield,
+    [SYS_GETPID]     = sys_getpid,
+    [SYS_SLEEP]      = sys_sleep,
+    [SYS_WRITE]      = sys_write,
+    [SYS_SEND]       = sys_send,
+    [SYS_RECEIVE]    = sys_receive,
+    [SYS_CLOCK]      = sys_clock,
+    [SYS_RING_SETUP] = sys_ring_setup,
+    [SYS_RING_ENTER] = sys_ring_enter,
+};
+
+// Called by syscall_entry; the result goes back to ring 3 in RAX
+uint64_t syscall_dispatch(syscall_frame_t* frame) {
+    if (frame->rax >= SYSCALL_COUNT) {
+        return SYSCALL_ERROR;
+    }
+    return syscall_table[frame->rax](frame);
+}
+
+// A user process raised an exception: report it and end the process.
+// 'info' is the faulting address for page faults, else the error code.
+void user_fault(const char* what, uint64_t rip, uint64_t info) {
+    serial_printf("%s in user process %u at ", what, process_current()->pid);
+    serial_write_hex(rip);
+    serial_write(" (");
+    serial_write_hex(info);
+    serial_write(")\n");
+    printf("Process %u killed: %s at 0x%x\n", process_current()->pid, what, (uint32_t)rip);
+    process_exit(-1);
+    for (;;) __asm__ volatile("hlt");
+}
+
+// Set up SYSCALL on this CPU. SYSRET returns to GDT_USER_CODE and
+// GDT_USER_DATA (gdt.h); the user's GS base starts out as 0.
+void user_init_ap(void) {
+    wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_SCE);
+    wrmsr(MSR_STAR, ((uint64_t)GDT_USER_BASE << 48) | ((uint64_t)GDT_KERNEL_CODE << 32));
+    wrmsr(MSR_LSTAR, (uint64_t)(uintptr_t)syscall_entry);
+    wrmsr(MSR_SFMASK, SYSCALL_RFLAGS_MASK);
+    wrmsr(MSR_KERNEL_GS_BASE, 0);
+}
+
+// Boot CPU, before smp_init: the APs copy its EFER and call user_init_ap
+void user_init(void) {
+    user_init_ap();
+    printf("User mode: ring 3 with SYSCALL/SYSRET\n");
+}
@@ -0,0 +1,61 @@
+#ifndef _USER_H
+#define _USER_H
+
+#include <stdint.h>
+#include "mm/vmm.h"
+
+// User mode. A user process runs in ring 3 in an address space of its
+// own, with its code at USER_CODE_BASE and a stack ending at
+// USER_STACK_TOP, both in the user window (vmm.h), and the kernel data
+// page (vdso.h) mapped read-only at VDSO_USER_BASE. It calls the kernel
+// with SYSCALL: the number in RAX, arguments in RDI, RSI, RDX, R10, R8 and
+// R9, the result back in RAX. RCX and R11 are clobbered, the rest kept.
+#define USER_CODE_BASE  VMM_USER_BASE
+#define USER_CODE_MAX   (64 * 1024)
+#define USER_STACK_SIZE (16 * 1024)  // Mapped up front
+#define USER_STACK_TOP  (VMM_USER_BASE + VMM_USER_SIZE)
+
+// System calls (the numbers are mirrored in arch/x86_64/user.s)
+#define SYS_EXIT       0   // (status)
+#define SYS_YIELD      1
+#define SYS_GETPID     2   // Does nothing else: the null call of the benchmark
+#define SYS_SLEEP      3   // (ms)
+#define SYS_WRITE      4   // (buf, len): text to the console
+#define SYS_SEND       5   // (pid, type, data, size): ipc_send
+#define SYS_RECEIVE    6   // (message): ipc_receive into a message_t
+#define SYS_CLOCK      7   // Nanoseconds since boot, as vdso_clock_ns reads them
+#define SYS_RING_SETUP 8   // Address of the process's submission/completion rings (uring.h)
+#define SYS_RING_ENTER 9   // (to_submit, min_complete): uring_enter
+#define SYSCALL_COUNT  10
+
+#define SYSCALL_ERROR  ((uint64_t)-1)
+#define USER_WRITE_MAX 256  // Bytes SYS_WRITE takes per call
+
+// What syscall_entry saves on the kernel stack
+typedef struct {
+    uint64_t rdi, rsi, rdx, r10, r8, r9;  // Arguments
+    uint64_t rax;     // System call number
+    uint64_t rip;     // Return address (RCX at entry)
+    uint64_t rflags;  // User RFLAGS (R11 at entry)
+    uint64_t rsp;     // User stack
+} syscall_frame_t;
+
+// Ring 3 programs in arch/x86_64/user.s: position-independent code that
+// process_create_user copies into a new address space
+extern uint8_t user_syscall_bench_start[];
+extern uint8_t user_syscall_bench_end[];
+extern uint8_t user_clock_bench_start[];
+extern uint8_t user_clock_bench_end[];
+extern uint8_t user_ring_bench_start[];
+extern uint8_t user_ring_bench_end[];
+
+// Function declarations
+void user_init(void);
+void user_init_ap(void);
+vmm_space_t* user_space_create(const void* code, uint32_t size);
+void user_space_destroy(vmm_space_t* space);
+void user_enter(uint64_t rip, uint64_t rsp) __attribute__((noreturn));
+uint64_t syscall_dispatch(syscall_frame_t* frame);
+void user_fault(const char* what, uint64_t rip, uint64_t info) __attribute__((noreturn));
+
+#endif // _USER_H
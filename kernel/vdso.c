@@ -0,0 +1,101 @@
+#include "vdso.h"
+#include "timer.h"
+#include "process.h"
+#include "smp.h"
+#include "cpu.h"
+#include "mm/mm.h"
+#include "mm/pmm.h"
+#include "libc/stdio.h"
+
+static vdso_data_t* vdso = NULL;  // The page, through the identity map
+static timer_t vdso_timer;
+
+// Rebase the clock at 'now' and copy the counters in. Only the timer
+// callback writes, so the writer side needs no lock, just interrupts off
+// to keep the odd stretch short for readers spinning on it.
+static void vdso_refresh(void) {
+    pmm_stats_t pmm;
+    mm_heap_stats_t heap;
+    sched_stats_t sched;
+    pmm_get_stats(&pmm);
+    mm_get_heap_stats(&heap);
+    process_get_sched_stats(&sched);
+
+    uint32_t cpus = smp_cpu_count();
+    if (cpus > VDSO_MAX_CPUS) {
+        cpus = VDSO_MAX_CPUS;
+    }
+    uint32_t usage[VDSO_MAX_CPUS];
+    uint32_t busy = 0;
+    for (uint32_t i = 0; i < cpus; i++) {
+        usage[i] = process_cpu_usage(i);
+        busy += usage[i];
+    }
+
+    uint64_t flags = irq_save();
+    vdso->seq++;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    uint64_t now = rdtsc();
+    vdso->base_ns += (uint64_t)(((unsigned __int128)(now - vdso->base_tsc) * vdso->mult) >> VDSO_CLOCK_SHIFT);
+    vdso->base_tsc = now;
+    vdso->ticks = timer_ticks();
+    vdso->cpu_count = cpus;
+    vdso->memory_total = (uint64_t)pmm.total_frames * PAGE_SIZE;
+    vdso->memory_free = (uint64_t)pmm.free_frames * PAGE_SIZE;
+    vdso->heap_used = heap.used;
+    vdso->cpu_usage = cpus ? busy / cpus : 0;
+    for (uint32_t i = 0; i < cpus; i++) {
+        vdso->cpu_usage_per[i] = usage[i];
+    }
+    vdso->processes = process_total();
+    vdso->context_switches = sched.switches;
+    vdso->updates++;
+
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    vdso->seq++;
+    irq_restore(flags);
+}
+
+static void vdso_update(void* arg) {
+    (void)arg;
+    vdso_refresh();
+    timer_add(&vdso_timer, vdso_timer.deadline + timer_ms_to_ticks(VDSO_UPDATE_MS),
+              vdso_update, NULL);
+}
+
+// Set up the page and start refreshing it (after timer_init). The clock
+// picks up from the tick-based uptime.
+void vdso_init(void) {
+    vdso = pmm_alloc_zeroed_pages(0);
+    if (!vdso) {
+        printf("vdso_init: Out of memory\n");
+        return;
+    }
+    uint64_t khz = timer_tsc_khz();
+    vdso->version = VDSO_VERSION;
+    vdso->tsc_khz = khz;
+    vdso->mult = khz ? (1000000ULL << VDSO_CLOCK_SHIFT) / khz : 0;
+    vdso->hz = timer_hz();
+    vdso->base_tsc = rdtsc();
+    vdso->base_ns = timer_uptime_ms() * 1000000;
+    vdso_refresh();
+
+    timer_add(&vdso_timer, timer_ticks() + timer_ms_to_ticks(VDSO_UPDATE_MS),
+              vdso_update, NULL);
+    printf("Kernel data page: clock and counters every %u ms\n", VDSO_UPDATE_MS);
+}
+
+// Map the page read-only at VDSO_USER_BASE in a user address space. It is
+// shared, so user_space_destroy leaves the frame alone.
+int vdso_map(vmm_space_t* space) {
+    if (!vdso) {
+        return 0;
+    }
+    return vmm_map_in(space, VDSO_USER_BASE, (uintptr_t)vdso, VMM_USER | VMM_NO_EXEC);
+}
+
+// The kernel's view of the page, for the same lockless readers
+const vdso_data_t* vdso_data(void) {
+    return vdso;
+}
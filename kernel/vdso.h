@@ -0,0 +1,117 @@
+#ifndef _VDSO_H
+#define _VDSO_H
+
+#include <stdint.h>
+#include "mm/vmm.h"
+
+// Kernel data page. One page the kernel keeps up to date and maps
+// read-only at VDSO_USER_BASE in every user address space, so ring 3 can
+// read the clock, the tick and the system counters without a system call.
+// The kernel is the only writer; readers use the seqlock below and retry
+// when 'seq' is odd or changed under them.
+#define VDSO_USER_BASE (VMM_USER_BASE + 0x100000ULL)  // Past USER_CODE_MAX
+#define VDSO_VERSION   1
+#define VDSO_MAX_CPUS  16    // SMP_MAX_CPUS
+#define VDSO_UPDATE_MS 100   // Counter refresh period; the clock runs between refreshes
+
+// Monotonic clock: ns = base_ns + ((tsc - base_tsc) * mult >> VDSO_CLOCK_SHIFT),
+// with the product taken to 128 bits. It starts at 0 at boot, like the uptime.
+#define VDSO_CLOCK_SHIFT 32
+
+// The page. Field offsets are mirrored in arch/x86_64/user.s.
+typedef struct {
+    volatile uint32_t seq;    // Odd while the kernel is writing
+    uint32_t version;         // VDSO_VERSION
+    uint64_t base_tsc;        // TSC at the last refresh
+    uint64_t base_ns;         // Clock at base_tsc
+    uint64_t mult;            // Nanoseconds per TSC cycle, 32.32 fixed point
+    uint64_t tsc_khz;         // TSC cycles per millisecond
+    uint64_t ticks;           // Timer tick at the last refresh
+    uint32_t hz;              // Timer ticks per second
+    uint32_t cpu_count;
+    uint64_t memory_total;    // Bytes of physical memory
+    uint64_t memory_free;
+    uint64_t heap_used;       // Bytes of kernel heap handed out
+    uint32_t cpu_usage;       // Percent busy over all CPUs, last usage window
+    uint32_t processes;       // Live processes
+    uint32_t context_switches;
+    uint32_t updates;         // Refreshes so far
+    uint32_t cpu_usage_per[VDSO_MAX_CPUS];
+} vdso_data_t;
+
+_Static_assert(offsetof(vdso_data_t, base_tsc) == 8, "user.s reads base_tsc here");
+_Static_assert(offsetof(vdso_data_t, base_ns) == 16, "user.s reads base_ns here");
+_Static_assert(offsetof(vdso_data_t, mult) == 24, "user.s reads mult here");
+_Static_assert(sizeof(vdso_data_t) <= VMM_PAGE_SIZE, "the data page is one page");
+
+// Lockless readers, for the kernel and for C code in ring 3 (reading the
+// page at VDSO_USER_BASE). Everything between vdso_read_begin and a
+// vdso_read_retry that returns 0 is a consistent snapshot. x86 keeps loads
+// in order, so only the compiler needs fencing.
+
+static inline uint32_t vdso_read_begin(const vdso_data_t* vd) {
+    uint32_t seq;
+    while ((seq = vd->seq) & 1) {
+        __asm__ volatile("pause");
+    }
+    __asm__ volatile("" ::: "memory");
+    return seq;
+}
+
+static inline int vdso_read_retry(const vdso_data_t* vd, uint32_t seq) {
+    __asm__ volatile("" ::: "memory");
+    return vd->seq != seq;
+}
+
+static inline uint64_t vdso_rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// Nanoseconds since boot
+static inline uint64_t vdso_clock_ns(const vdso_data_t* vd) {
+    uint32_t seq;
+    uint64_t ns;
+    do {
+        seq = vdso_read_begin(vd);
+        uint64_t delta = vdso_rdtsc() - vd->base_tsc;
+        ns = vd->base_ns + (uint64_t)(((unsigned __int128)delta * vd->mult) >> VDSO_CLOCK_SHIFT);
+    } while (vdso_read_retry(vd, seq));
+    return ns;
+}
+
+static inline uint64_t vdso_uptime_ms(const vdso_data_t* vd) {
+    return vdso_clock_ns(vd) / 1000000;
+}
+
+// The current timer tick, extrapolated from the last refresh
+static inline uint64_t vdso_ticks(const vdso_data_t* vd) {
+    uint32_t seq;
+    uint64_t ticks;
+    do {
+        seq = vdso_read_begin(vd);
+        uint64_t cycles_per_tick = vd->hz ? vd->tsc_khz * 1000 / vd->hz : 0;
+        ticks = vd->ticks;
+        if (cycles_per_tick) {
+            ticks += (vdso_rdtsc() - vd->base_tsc) / cycles_per_tick;
+        }
+    } while (vdso_read_retry(vd, seq));
+    return ticks;
+}
+
+// The counters as of the last refresh, copied out in one piece
+static inline void vdso_snapshot(const vdso_data_t* vd, vdso_data_t* out) {
+    uint32_t seq;
+    do {
+        seq = vdso_read_begin(vd);
+        *out = *(const vdso_data_t*)vd;
+    } while (vdso_read_retry(vd, seq));
+}
+
+// Function declarations
+void vdso_init(void);
+int vdso_map(vmm_space_t* space);
+const vdso_data_t* vdso_data(void);
+
+#endif // _VDSO_H
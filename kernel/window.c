@@ -3,54 +3,85 @@
 #include "window.h"
 #include "text.h"
 #include "framebuffer.h"  // For VGA color definitions
+#include "mm/mm.h"
+#include "mm/slab.h"
 
-// Window state
-window_t windows[MAX_WINDOWS];
+// Window state: window objects come from a slab cache, and 'windows'
+// holds them in z-order (back to front), growing as needed
+window_t **windows = NULL;
 int window_count = 0;
 int active_window = -1;
 int dragging_window = -1;
 
+static kmem_cache_t *window_cache = NULL;
+static int window_capacity = 0;
+
 void window_init(void) {
+    if (!window_cache) {
+        window_cache = kmem_cache_create("window", sizeof(window_t), 0, NULL);
+    }
+    
+    // Release any windows from a previous session
+    for (int i = 0; i < window_count; i++) {
+        kmem_cache_free(window_cache, windows[i]);
+    }
+    
     window_count = 0;
     active_window = -1;
     dragging_window = -1;
-    
-    for (int i = 0; i < MAX_WINDOWS; i++) {
-        windows[i].active = 0;
-        windows[i].dragging = 0;
+}
+
+// Make room for one more window in the z-order array
+static int window_reserve_slot(void) {
+    if (window_count < window_capacity) {
+        return 1;
     }
+    int new_capacity = window_capacity ? window_capacity * 2 : WINDOW_INITIAL_CAPACITY;
+    window_t **grown = krealloc(windows, new_capacity * sizeof(window_t *));
+    if (!grown) {
+        return 0;
+    }
+    windows = grown;
+    window_capacity = new_capacity;
+    return 1;
 }
 
 int window_create(int16_t x, int16_t y, uint16_t width, uint16_t height, const char *title, uint8_t color) {
-    if (window_count >= MAX_WINDOWS) {
+    if (!window_reserve_slot()) {
         return -1; // No more window slots
     }
+    window_t *win = kmem_cache_alloc(window_cache);
+    if (!win) {
+        return -1;
+    }
     int id = window_count++;
-    windows[id].x = x;
-    windows[id].y = y;
-    windows[id].width = width;
-    windows[id].height = height;
-    windows[id].color = color;
-    windows[id].active = 1;
-    windows[id].dragging = 0;
-    windows[id].minimized = 0;
-    windows[id].maximized = 0;
+    windows[id] = win;
+    win->x = x;
+    win->y = y;
+    win->width = width;
+    win->height = height;
+    win->color = color;
+    win->active = 1;
+    win->dragging = 0;
+    win->minimized = 0;
+    win->maximized = 0;
     int i = 0;
-    while (title[i] && i < 63) {
-        windows[id].title[i] = title[i];
+    while (title[i] && i < (int)sizeof(win->title) - 1) {
+        win->title[i] = title[i];
         i++;
     }
-    windows[id].title[i] = '\0';
+    win->title[i] = '\0';
     window_bring_to_front(id);
     return id;
 }
 
 void window_destroy(int id) {
-    if (id < 0 || id >= window_count || !windows[id].active) {
+    if (id < 0 || id >= window_count || !windows[id]->active) {
         return;
     }
     
     // Remove window by shifting others
+    kmem_cache_free(window_cache, windows[id]);
     for (int i = id; i < window_count - 1; i++) {
         windows[i] = windows[i + 1];
     }
@@ -65,11 +96,11 @@ void window_destroy(int id) {
 }
 
 void window_draw(uint32_t *fb, int width, int height, int id) {
-    if (id < 0 || id >= window_count || !windows[id].active || windows[id].minimized) {
+    if (id < 0 || id >= window_count || !windows[id]->active || windows[id]->minimized) {
         return;
     }
     
-    window_t *win = &windows[id];
+    window_t *win = windows[id];
     int wx = win->x, wy = win->y, wwidth = win->width, wheight = win->height;
     
     // For maximized windows, adjust dimensions but leave space for taskbar
@@ -208,9 +239,9 @@ void window_draw_all(uint32_t *fb, int width, int height) {
 int window_at_position(int16_t x, int16_t y) {
     // Check windows in reverse order (front to back)
     for (int i = window_count - 1; i >= 0; i--) {
-        if (windows[i].active) {
-            if (x >= windows[i].x && x < windows[i].x + windows[i].width &&
-                y >= windows[i].y && y < windows[i].y + windows[i].height) {
+        if (windows[i]->active) {
+            if (x >= windows[i]->x && x < windows[i]->x + windows[i]->width &&
+                y >= windows[i]->y && y < windows[i]->y + windows[i]->height) {
                 return i;
             }
         }
@@ -219,12 +250,12 @@ int window_at_position(int16_t x, int16_t y) {
 }
 
 void window_bring_to_front(int id) {
-    if (id < 0 || id >= window_count || !windows[id].active) {
+    if (id < 0 || id >= window_count || !windows[id]->active) {
         return;
     }
     
     // Move window to end of list (front)
-    window_t temp = windows[id];
+    window_t *temp = windows[id];
     for (int i = id; i < window_count - 1; i++) {
         windows[i] = windows[i + 1];
     }
@@ -234,35 +265,35 @@ void window_bring_to_front(int id) {
 }
 
 void window_start_drag(int id, int16_t x, int16_t y) {
-    if (id < 0 || id >= window_count || !windows[id].active) {
+    if (id < 0 || id >= window_count || !windows[id]->active) {
         return;
     }
     
     // Only allow dragging from title bar
-    if (y < windows[id].y + WINDOW_TITLE_HEIGHT) {
-        windows[id].dragging = 1;
-        windows[id].drag_start_x = x - windows[id].x;
-        windows[id].drag_start_y = y - windows[id].y;
-        windows[id].original_x = windows[id].x;
-        windows[id].original_y = windows[id].y;
+    if (y < windows[id]->y + WINDOW_TITLE_HEIGHT) {
+        windows[id]->dragging = 1;
+        windows[id]->drag_start_x = x - windows[id]->x;
+        windows[id]->drag_start_y = y - windows[id]->y;
+        windows[id]->original_x = windows[id]->x;
+        windows[id]->original_y = windows[id]->y;
         dragging_window = id;
     }
 }
 
 void window_stop_drag(void) {
     if (dragging_window >= 0 && dragging_window < window_count) {
-        windows[dragging_window].dragging = 0;
+        windows[dragging_window]->dragging = 0;
         dragging_window = -1;
     }
 }
 
 void window_update_drag(int16_t x, int16_t y) {
-    if (dragging_window >= 0 && dragging_window < window_count && windows[dragging_window].dragging) {
-        windows[dragging_window].x = x - windows[dragging_window].drag_start_x;
-        windows[dragging_window].y = y - windows[dragging_window].drag_start_y;
+    if (dragging_window >= 0 && dragging_window < window_count && windows[dragging_window]->dragging) {
+        windows[dragging_window]->x = x - windows[dragging_window]->drag_start_x;
+        windows[dragging_window]->y = y - windows[dragging_window]->drag_start_y;
         
         // Clamp to screen boundaries
-        if (windows[dragging_window].x < 0) windows[dragging_window].x = 0;
-        if (windows[dragging_window].y < 0) windows[dragging_window].y = 0;
+        if (windows[dragging_window]->x < 0) windows[dragging_window]->x = 0;
+        if (windows[dragging_window]->y < 0) windows[dragging_window]->y = 0;
     }
 }
@@ -4,7 +4,7 @@
 #include <stdint.h>
 #include "framebuffer.h"  // For VGA_WIDTH, VGA_HEIGHT
 
-#define MAX_WINDOWS 8           // Reduced for VGA memory constraints
+#define WINDOW_INITIAL_CAPACITY 8  // Initial size of the z-order array
 #define WINDOW_TITLE_HEIGHT 12  // Smaller title bar for VGA
 
 // Window structure
@@ -22,7 +22,7 @@ typedef struct {
 } window_t;
 
 // Global window management
-extern window_t windows[MAX_WINDOWS];
+extern window_t **windows;  // Z-ordered, back to front
 extern int window_count;
 extern int active_window;
 
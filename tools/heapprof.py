@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+"""Symbolize a heap profile dumped over COM1 by 'heaptop dump'.
+
+Capture the serial port (e.g. qemu -serial file:serial.log), then run:
+
+    tools/heapprof.py serial.log [kernel.elf]
+
+Callsites are resolved with addr2line against the unstripped kernel.elf.
+"""
+import subprocess
+import sys
+
+
+def parse(path):
+    sites = []
+    allocs = []
+    header = None
+    with open(path, errors="replace") as log:
+        for line in log:
+            fields = line.split()
+            if not fields:
+                continue
+            if fields[0] == "mmprof" and fields[1] == "begin":
+                # Keep only the most recent dump in the log
+                header = dict(f.split("=") for f in fields[2:])
+                sites, allocs = [], []
+            elif fields[0] == "site" and len(fields) == 6:
+                caller = int(fields[1], 16)
+                live_bytes, live_count, allocations, total_bytes = map(int, fields[2:])
+                sites.append((caller, live_bytes, live_count, allocations, total_bytes))
+            elif fields[0] in ("alloc", "calloc", "realloc", "free") and len(fields) == 6:
+                # op tsc caller size ptr old_ptr (frees are only needed for replay)
+                if fields[0] != "free":
+                    allocs.append((int(fields[1], 16), int(fields[2], 16), int(fields[3]), fields[0]))
+    return header, sites, allocs
+
+
+def symbolize(elf, addresses):
+    if not addresses:
+        return {}
+    # Return addresses point after the call; look up the call itself
+    query = ["%x" % (addr - 1) for addr in addresses]
+    out = subprocess.run(["addr2line", "-f", "-s", "-e", elf] + query,
+                         capture_output=True, text=True, check=True).stdout.splitlines()
+    names = {}
+    for i, addr in enumerate(addresses):
+        names[addr] = "%s (%s)" % (out[2 * i], out[2 * i + 1])
+    return names
+
+
+def main():
+    if len(sys.argv) < 2:
+        print(__doc__.strip())
+        return 1
+    elf = sys.argv[2] if len(sys.argv) > 2 else "kernel.elf"
+
+    header, sites, allocs = parse(sys.argv[1])
+    if header is None:
+        print("no 'mmprof begin' record found")
+        return 1
+
+    names = symbolize(elf, sorted({s[0] for s in sites} | {a[1] for a in allocs}))
+    print("heap used %s bytes, heap size %s bytes, untracked allocations %s"
+          % (header.get("used"), header.get("heap"), header.get("untracked")))
+    print("%10s %8s %8s %12s  %s" % ("LIVE B", "BLOCKS", "ALLOCS", "TOTAL B", "CALLSITE"))
+    for caller, live_bytes, live_count, allocations, total_bytes in sorted(sites, key=lambda s: -s[1]):
+        print("%10d %8d %8d %12d  %s" % (live_bytes, live_count, allocations, total_bytes, names[caller]))
+
+    if allocs:
+        start = allocs[0][0]
+        print("\nlast %d allocations (cycles since the first):" % len(allocs))
+        for tsc, caller, size, op in allocs:
+            print("%14d %-7s %8d  %s" % (tsc - start, op, size, names[caller]))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,67 @@
+// Host stand-ins for the kernel services kernel/mm/mm.c calls, so the heap
+// can run as an ordinary Linux program. The VMM heap window becomes one
+// large anonymous mapping that Linux backs on first touch, just like the
+// kernel's demand-paged heap.
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include "vmm.h"
+#include "host.h"
+
+int host_verbose = 0;
+
+static uint8_t* heap_window = NULL;
+static size_t heap_end = 0;
+
+// Start over with an empty heap window whose pages read as zero
+void host_heap_reset(void) {
+    if (!heap_window) {
+        heap_window = mmap(NULL, VMM_HEAP_SIZE, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (heap_window == MAP_FAILED) {
+            perror("mmbench: mmap heap window");
+            exit(1);
+        }
+    } else if (heap_end) {
+        madvise(heap_window, heap_end, MADV_DONTNEED);
+    }
+    heap_end = 0;
+}
+
+size_t host_heap_reserved(void) {
+    return heap_end;
+}
+
+void* vmm_heap_grow(size_t size) {
+    size = (size + VMM_PAGE_SIZE - 1) & ~(VMM_PAGE_SIZE - 1);
+    if (heap_end + size > VMM_HEAP_SIZE) {
+        return NULL;
+    }
+    void* base = heap_window + heap_end;
+    heap_end += size;
+    return base;
+}
+
+// Dropping the pages is the host's equivalent of swapping in pre-zeroed
+// frames: they come back zero-filled on the next touch
+void vmm_heap_clear(void* addr, size_t size) {
+    uintptr_t start = ((uintptr_t)addr + VMM_PAGE_SIZE - 1) & ~(uintptr_t)(VMM_PAGE_SIZE - 1);
+    uintptr_t end = ((uintptr_t)addr + size) & ~(uintptr_t)(VMM_PAGE_SIZE - 1);
+    if (start < end) {
+        madvise((void*)start, end - start, MADV_DONTNEED);
+    }
+}
+
+// The kernel's printf draws nothing; keep the CSV on stdout clean the same way
+int printf(const char* format, ...) {
+    if (!host_verbose) {
+        return 0;
+    }
+    va_list args;
+    va_start(args, format);
+    int written = vfprintf(stderr, format, args);
+    va_end(args);
+    return written;
+}
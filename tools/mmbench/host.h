@@ -0,0 +1,13 @@
+#ifndef _MMBENCH_HOST_H
+#define _MMBENCH_HOST_H
+
+#include <stddef.h>
+
+// Set to route the allocator's printf output to stderr
+extern int host_verbose;
+
+// Function declarations
+void host_heap_reset(void);
+size_t host_heap_reserved(void);
+
+#endif // _MMBENCH_HOST_H
@@ -0,0 +1,438 @@
+// Hosted benchmarks and trace replay for the kernel heap (kernel/mm/mm.c
+// and the kernel/libc string routines, built as a Linux program).
+//
+//   make mmbench
+//   tools/mmbench/mmbench [-n ops] [-s seed] [-v] [benchmark...]
+//   tools/mmbench/mmbench -r serial.log
+//
+// Every benchmark starts from an empty heap. Results go to stdout as CSV,
+// one row per benchmark, with the heap's fragmentation measured after the
+// last operation while everything the benchmark allocated is still live.
+// '-r' replays the heap calls recorded in the last 'heaptop dump' of a
+// serial log captured from a kernel built with MM_PROFILE=1.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "mm.h"
+#include "host.h"
+
+#define BENCH_DEFAULT_OPS 1000000
+#define BENCH_MAX_LIVE    4096     // Live objects a benchmark may hold
+#define BENCH_BATCH       1024     // Objects per round in the batch benchmark
+#define BENCH_REALLOC_MAX (256 * 1024)  // Buffers start over past this size
+#define REPLAY_MAP_SIZE   (1 << 16)  // Kernel-to-host pointer map slots (power of two)
+
+static void* live[BENCH_MAX_LIVE];
+static size_t live_size[BENCH_MAX_LIVE];
+static uint64_t rng_state;
+
+static uint64_t rng_next(void) {
+    // xorshift64*
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+static uint32_t rng_range(uint32_t lo, uint32_t hi) {
+    return lo + (uint32_t)(rng_next() % (hi - lo + 1));
+}
+
+// Mostly small objects with a tail of page-sized and larger buffers
+static size_t mixed_size(void) {
+    uint32_t pick = rng_range(0, 99);
+    if (pick < 80) return rng_range(16, 512);
+    if (pick < 95) return rng_range(512, 16 * 1024);
+    return rng_range(16 * 1024, 256 * 1024);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Allocate into an empty live slot, touching the block like a real user
+static void live_alloc(int slot, size_t size) {
+    live[slot] = kmalloc(size);
+    live_size[slot] = size;
+    if (live[slot]) {
+        ((uint8_t*)live[slot])[0] = 1;
+        ((uint8_t*)live[slot])[size - 1] = 1;
+    }
+}
+
+static void live_free(int slot) {
+    kfree(live[slot]);
+    live[slot] = NULL;
+    live_size[slot] = 0;
+}
+
+// Each benchmark returns the number of heap calls it made
+
+static uint64_t bench_pairs_small(uint64_t ops) {
+    for (uint64_t i = 0; i < ops / 2; i++) {
+        void* p = kmalloc(MM_MIN_BIN_SIZE << (i % MM_NUM_BINS));
+        ((uint8_t*)p)[0] = 1;
+        kfree(p);
+    }
+    return ops / 2 * 2;
+}
+
+static uint64_t bench_pairs_large(uint64_t ops) {
+    for (uint64_t i = 0; i < ops / 2; i++) {
+        void* p = kmalloc(rng_range(4096, 256 * 1024));
+        ((uint8_t*)p)[0] = 1;
+        kfree(p);
+    }
+    return ops / 2 * 2;
+}
+
+// Fill BENCH_BATCH small objects, then free them oldest first
+static uint64_t bench_batch_small(uint64_t ops) {
+    uint64_t done = 0;
+    while (done + 2 * BENCH_BATCH <= ops) {
+        for (int i = 0; i < BENCH_BATCH; i++) {
+            live_alloc(i, rng_range(16, MM_MAX_BIN_SIZE));
+        }
+        for (int i = 0; i < BENCH_BATCH; i++) {
+            live_free(i);
+        }
+        done += 2 * BENCH_BATCH;
+    }
+    return done;
+}
+
+// Random frees and allocations of mixed sizes over a fixed set of slots
+static uint64_t bench_churn(uint64_t ops) {
+    for (uint64_t i = 0; i < ops; i++) {
+        int slot = (int)(rng_next() % BENCH_MAX_LIVE);
+        if (live[slot]) {
+            live_free(slot);
+        } else {
+            live_alloc(slot, mixed_size());
+        }
+    }
+    return ops;
+}
+
+// Buffers grown by half again at every step, as a string builder would
+static uint64_t bench_realloc(uint64_t ops) {
+    const int buffers = 256;
+    for (uint64_t i = 0; i < ops; i++) {
+        int slot = (int)(rng_next() % buffers);
+        size_t size = live_size[slot] + live_size[slot] / 2 + 16;
+        if (size > BENCH_REALLOC_MAX) {
+            live_free(slot);
+            continue;
+        }
+        void* grown = krealloc(live[slot], size);
+        if (grown) {
+            ((uint8_t*)grown)[size - 1] = 1;
+            live[slot] = grown;
+            live_size[slot] = size;
+        }
+    }
+    return ops;
+}
+
+// Churn, then free every other live object to leave holes behind
+static uint64_t bench_fragment(uint64_t ops) {
+    uint64_t done = bench_churn(ops);
+    for (int slot = 0; slot < BENCH_MAX_LIVE; slot += 2) {
+        if (live[slot]) {
+            live_free(slot);
+            done++;
+        }
+    }
+    return done;
+}
+
+// kcalloc of mixed sizes, including the page-clearing large path
+static uint64_t bench_calloc(uint64_t ops) {
+    for (uint64_t i = 0; i < ops; i++) {
+        int slot = (int)(rng_next() % BENCH_MAX_LIVE);
+        if (live[slot]) {
+            live_free(slot);
+        } else {
+            live_size[slot] = mixed_size();
+            live[slot] = kcalloc(1, live_size[slot]);
+        }
+    }
+    return ops;
+}
+
+typedef struct {
+    const char* name;
+    uint64_t (*run)(uint64_t ops);
+} benchmark_t;
+
+static const benchmark_t benchmarks[] = {
+    { "pairs_small", bench_pairs_small },
+    { "pairs_large", bench_pairs_large },
+    { "batch_small", bench_batch_small },
+    { "churn",       bench_churn },
+    { "realloc",     bench_realloc },
+    { "fragment",    bench_fragment },
+    { "calloc",      bench_calloc },
+};
+
+#define NUM_BENCHMARKS (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+static void heap_start(void) {
+    host_heap_reset();
+    mm_init(0);
+    memset(live, 0, sizeof(live));
+    memset(live_size, 0, sizeof(live_size));
+}
+
+static void csv_header(void) {
+    fprintf(stdout, "benchmark,ops,ns_per_op,heap_kb,used_kb,free_kb,free_chunks,"
+                    "largest_free_kb,frag_pct,bin_idle_kb,realloc_in_place,realloc_moved\n");
+}
+
+// One CSV row; fragmentation is the share of free chunk bytes outside the
+// largest free chunk
+static void csv_row(const char* name, uint64_t ops, uint64_t ns) {
+    mm_heap_stats_t stats;
+    mm_get_heap_stats(&stats);
+    double frag = stats.free_bytes ?
+        100.0 * (stats.free_bytes - stats.largest_free) / stats.free_bytes : 0.0;
+    fprintf(stdout, "%s,%llu,%.2f,%u,%u,%u,%u,%u,%.1f,%u,%u,%u\n",
+            name, (unsigned long long)ops, ops ? (double)ns / ops : 0.0,
+            stats.heap_size / 1024, stats.used / 1024, stats.free_bytes / 1024,
+            stats.free_chunks, stats.largest_free / 1024, frag,
+            stats.bin_free_bytes / 1024, stats.realloc_in_place, stats.realloc_moved);
+}
+
+static int run_benchmark(const benchmark_t* bench, uint64_t ops) {
+    heap_start();
+    uint64_t start = now_ns();
+    uint64_t done = bench->run(ops);
+    uint64_t elapsed = now_ns() - start;
+    csv_row(bench->name, done, elapsed);
+
+    for (int slot = 0; slot < BENCH_MAX_LIVE; slot++) {
+        kfree(live[slot]);
+    }
+    return 0;
+}
+
+// Trace replay
+
+typedef struct {
+    char op[8];
+    uint32_t size;
+    uint64_t ptr;
+    uint64_t old_ptr;
+} trace_op_t;
+
+typedef struct {
+    uint64_t kernel;   // 0 = empty, 1 = deleted
+    void* host;
+} ptr_map_entry_t;
+
+static ptr_map_entry_t ptr_map[REPLAY_MAP_SIZE];
+
+static ptr_map_entry_t* ptr_map_find(uint64_t kernel, int insert) {
+    uint32_t i = (uint32_t)((kernel >> 4) * 2654435761U) & (REPLAY_MAP_SIZE - 1);
+    ptr_map_entry_t* reuse = NULL;
+    for (uint32_t probe = 0; probe < REPLAY_MAP_SIZE; probe++) {
+        ptr_map_entry_t* entry = &ptr_map[(i + probe) & (REPLAY_MAP_SIZE - 1)];
+        if (entry->kernel == kernel) {
+            return entry;
+        }
+        if (entry->kernel == 1 && !reuse) {
+            reuse = entry;
+        }
+        if (entry->kernel == 0) {
+            if (!insert) {
+                return NULL;
+            }
+            return reuse ? reuse : entry;
+        }
+    }
+    return insert ? reuse : NULL;
+}
+
+static void ptr_map_set(uint64_t kernel, void* host) {
+    ptr_map_entry_t* entry = ptr_map_find(kernel, 1);
+    if (entry) {
+        entry->kernel = kernel;
+        entry->host = host;
+    }
+}
+
+static void* ptr_map_take(uint64_t kernel) {
+    ptr_map_entry_t* entry = ptr_map_find(kernel, 0);
+    if (!entry) {
+        return NULL;
+    }
+    entry->kernel = 1;
+    return entry->host;
+}
+
+// Read the heap calls of the last dump in a serial log
+static trace_op_t* trace_load(const char* path, size_t* count) {
+    FILE* log = fopen(path, "r");
+    if (!log) {
+        perror(path);
+        return NULL;
+    }
+
+    size_t capacity = 4096;
+    trace_op_t* ops = malloc(capacity * sizeof(trace_op_t));
+    char line[256];
+    *count = 0;
+    while (ops && fgets(line, sizeof(line), log)) {
+        if (strncmp(line, "mmprof begin", 12) == 0) {
+            *count = 0;
+            continue;
+        }
+        trace_op_t op;
+        unsigned long long tsc, caller, ptr, old_ptr;
+        if (sscanf(line, "%7s %llx %llx %u %llx %llx", op.op, &tsc, &caller,
+                   &op.size, &ptr, &old_ptr) != 6) {
+            continue;
+        }
+        if (strcmp(op.op, "alloc") && strcmp(op.op, "calloc") &&
+            strcmp(op.op, "realloc") && strcmp(op.op, "free")) {
+            continue;
+        }
+        op.ptr = ptr;
+        op.old_ptr = old_ptr;
+        if (*count == capacity) {
+            capacity *= 2;
+            ops = realloc(ops, capacity * sizeof(trace_op_t));
+            if (!ops) {
+                break;
+            }
+        }
+        ops[(*count)++] = op;
+    }
+    fclose(log);
+    return ops;
+}
+
+// Frees and reallocs of blocks allocated before the trace window are
+// skipped (a realloc of one becomes a plain allocation)
+static int run_replay(const char* path) {
+    size_t count;
+    trace_op_t* ops = trace_load(path, &count);
+    if (!ops) {
+        return 1;
+    }
+    if (count == 0) {
+        fprintf(stderr, "mmbench: no heap trace in %s\n", path);
+        free(ops);
+        return 1;
+    }
+
+    heap_start();
+    memset(ptr_map, 0, sizeof(ptr_map));
+    uint64_t skipped = 0;
+
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < count; i++) {
+        trace_op_t* op = &ops[i];
+        void* block;
+        switch (op->op[0]) {
+        case 'a':
+            ptr_map_set(op->ptr, kmalloc(op->size));
+            break;
+        case 'c':
+            ptr_map_set(op->ptr, kcalloc(1, op->size));
+            break;
+        case 'r':
+            block = op->old_ptr ? ptr_map_take(op->old_ptr) : NULL;
+            if (op->old_ptr && !block) {
+                skipped++;
+                if (op->size == 0) {
+                    break;
+                }
+            }
+            block = krealloc(block, op->size);
+            if (op->ptr) {
+                ptr_map_set(op->ptr, block);
+            }
+            break;
+        default:
+            block = ptr_map_take(op->ptr);
+            if (block) {
+                kfree(block);
+            } else {
+                skipped++;
+            }
+            break;
+        }
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    csv_row("replay", count, elapsed);
+    if (skipped) {
+        fprintf(stderr, "mmbench: %llu calls referred to blocks from before the trace\n",
+                (unsigned long long)skipped);
+    }
+    free(ops);
+    return 0;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: mmbench [-n ops] [-s seed] [-v] [benchmark...]\n"
+                    "       mmbench [-v] -r serial.log\n"
+                    "benchmarks:");
+    for (size_t i = 0; i < NUM_BENCHMARKS; i++) {
+        fprintf(stderr, " %s", benchmarks[i].name);
+    }
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char** argv) {
+    uint64_t ops = BENCH_DEFAULT_OPS;
+    uint64_t seed = 1;
+    const char* trace = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:r:vh")) != -1) {
+        switch (opt) {
+        case 'n': ops = strtoull(optarg, NULL, 0); break;
+        case 's': seed = strtoull(optarg, NULL, 0); break;
+        case 'r': trace = optarg; break;
+        case 'v': host_verbose = 1; break;
+        default: usage(); return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    for (int arg = optind; arg < argc; arg++) {
+        size_t i = 0;
+        while (i < NUM_BENCHMARKS && strcmp(argv[arg], benchmarks[i].name) != 0) {
+            i++;
+        }
+        if (i == NUM_BENCHMARKS) {
+            fprintf(stderr, "mmbench: unknown benchmark '%s'\n", argv[arg]);
+            usage();
+            return 1;
+        }
+    }
+
+    csv_header();
+    if (trace) {
+        return run_replay(trace);
+    }
+
+    int status = 0;
+    for (size_t i = 0; i < NUM_BENCHMARKS; i++) {
+        int selected = optind == argc;
+        for (int arg = optind; arg < argc; arg++) {
+            selected |= strcmp(argv[arg], benchmarks[i].name) == 0;
+        }
+        if (selected) {
+            rng_state = seed * 0x9E3779B97F4A7C15ULL | 1;
+            status |= run_benchmark(&benchmarks[i], ops);
+        }
+    }
+    return status;
+}